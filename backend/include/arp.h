@@ -71,6 +71,7 @@ typedef struct _arp_packet_t
 int ARPResolve(gpacket_t *in_pkt);
 void ARPProcess(gpacket_t *pkt);
 
+void ARPInit();
 void ARPInitTable();
 void ARPReInitTable();
 
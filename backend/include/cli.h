@@ -74,6 +74,11 @@ void classCmd();
 void filterCmd();
 void openflowCmd();
 void gncCmd();
+void replayCmd();
+void pktgenCmd();
+void statsCmd();
+void showCmd();
+void traceCmd();
 void gncTerminate();
 
 #endif
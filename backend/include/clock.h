@@ -0,0 +1,91 @@
+/*
+ * clock.h (the router clock)
+ *
+ * Two views of time for the data path:
+ *
+ * clockNow() and clockSeconds() return a monotonic nanosecond count and
+ * the wall clock in seconds as last cached by the clock thread, which
+ * refreshes them every resolution_us (100 us by default, "set
+ * clock-resolution"). Reading them is a load, for code that only needs
+ * to know roughly how much time went by (RED idle time, rate averages,
+ * flow timeouts, protocol timers).
+ *
+ * clockPrecise() reads the time stamp counter, calibrated against
+ * CLOCK_MONOTONIC when the clock is started, on x86-64 machines with an
+ * invariant TSC and clock_gettime() elsewhere. It is used where single
+ * packets are timed (latency stamps, queue sojourn times).
+ *
+ * Both count from the same origin as CLOCK_MONOTONIC, and the views work
+ * (by calling clock_gettime) before clockInit() or without it.
+ */
+
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#define CLOCK_DEFAULT_RESOLUTION_US     100
+#define CLOCK_CALIBRATION_US            20000
+
+
+typedef struct _router_clock_t
+{
+	volatile uint64_t now_ns;           // cached CLOCK_MONOTONIC
+	volatile time_t now_sec;            // cached wall clock
+	volatile int running;               // the cached values are being refreshed
+	volatile int resolution_us;
+	int tsc;                            // clockPrecise() uses the TSC
+	uint64_t tsc_base;
+	uint64_t ns_base;
+	uint64_t tsc_mult;                  // ns per TSC cycle, 32.32 fixed point
+} router_clock_t;
+
+extern router_clock_t router_clock;
+
+
+static inline uint64_t clockRead(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static inline uint64_t clockNow()
+{
+	if (__builtin_expect(router_clock.running, 1))
+		return router_clock.now_ns;
+	return clockRead(CLOCK_MONOTONIC);
+}
+
+
+static inline time_t clockSeconds()
+{
+	if (__builtin_expect(router_clock.running, 1))
+		return router_clock.now_sec;
+	return time(NULL);
+}
+
+
+static inline uint64_t clockPrecise()
+{
+#if defined(__x86_64__)
+	if (__builtin_expect(router_clock.tsc, 1))
+		return router_clock.ns_base + (uint64_t)(((unsigned __int128)(__rdtsc() - router_clock.tsc_base) *
+							  router_clock.tsc_mult) >> 32);
+#endif
+	return clockRead(CLOCK_MONOTONIC);
+}
+
+
+int clockInit(int resolution_us);
+int clockSetResolution(int resolution_us);
+void clockWaitTick();
+void clockShow();
+
+#endif
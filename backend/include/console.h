@@ -0,0 +1,37 @@
+/*
+ * console.h (header file for the console/.port packet capture)
+ *
+ * Frames are captured into lock-free per-thread rings and written out
+ * in pcap-ng format by the console thread. When no capture is running
+ * the cost at a capture point is the single branch in CONSOLE_CAPTURE.
+ */
+
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+
+#include <stdint.h>
+
+#define CAPTURE_RING_SLOTS      128                // per producing thread, power of 2
+#define CAPTURE_MAX_SNAPLEN     2048
+#define CAPTURE_WRITE_BATCH     65536              // bytes per FIFO write
+#define CAPTURE_IDLE_US         1000               // console thread nap when rings are empty
+
+extern volatile int console_capture;               // non-zero while frames are wanted
+
+
+#define CONSOLE_CAPTURE(buf, len)                                       \
+	do {                                                                \
+		if (__builtin_expect(console_capture, 0))                       \
+			consoleCapture(buf, len);                                   \
+	} while (0)
+
+
+void consoleInit(char *rpath, char *rname);
+void consoleRestart(char *rpath, char *rname);
+void consoleGetState();
+void consoleCapture(void *buf, int len);
+void consoleSetEnabled(int enabled);
+int consoleSetSnaplen(int snaplen);
+int consoleSetFilter(char *expr);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * drop.h (header file for the packet drop accounting)
+ *
+ * Every place in the data path that discards a packet calls dropPacket()
+ * with one of the reasons below, or countDrop() when the buffer lives on
+ * (for example when it is turned into an ICMP error). Counts are kept per
+ * interface and per reason. When sampling is on, one in every N drops of
+ * each reason is copied into a small ring that "show drops save" writes
+ * out as a pcap-ng file with the reason in the packet comment.
+ */
+
+#ifndef __DROP_H__
+#define __DROP_H__
+
+#include <stdint.h>
+#include "message.h"
+
+typedef enum _drop_reason_t
+{
+	DROP_NOT_FOR_ME = 0,                // destination MAC is not ours or broadcast
+	DROP_FILTERED,                      // denied by a filter rule
+	DROP_NO_QUEUE,                      // no queue for the class of the packet
+	DROP_QUEUE_FULL,                    // class queue full (taildrop)
+	DROP_RED,                           // random early discard
+	DROP_UNKNOWN_PROTO,                 // unknown ethertype or IP protocol
+	DROP_BAD_IP_HEADER,                 // bad IP version or header checksum
+	DROP_IP_BCAST,                      // IP broadcast, not forwarded
+	DROP_NO_ROUTE,                      // no route to the destination
+	DROP_TTL_EXPIRED,                   // TTL reached zero (an ICMP error is sent)
+	DROP_FRAG_NEEDED,                   // larger than the MTU with DF set (ICMP sent)
+	DROP_BAD_IFACE,                     // output interface does not exist
+	DROP_IFACE_DOWN,                    // output interface is down
+	DROP_ARP_EVICTED,                   // pushed out of the ARP buffer before resolution
+	DROP_TX_FULL,                       // device transmit queue full
+	DROP_OPENFLOW_FRAG,                 // IP fragment, switch is set to drop them
+	DROP_OPENFLOW_NO_ACTION,            // matching flow had no action that could be done
+	DROP_OPENFLOW_TABLE_MISS,           // no matching flow in a table set to drop misses
+	DROP_REASONS
+} drop_reason_t;
+
+#define DROP_SAMPLE_SLOTS               256
+#define DROP_SAMPLE_SNAPLEN             256
+
+
+void dropPacket(gpacket_t *pkt, int ifid, drop_reason_t reason);
+void countDrop(gpacket_t *pkt, int ifid, drop_reason_t reason);
+uint64_t getDropCount(int ifid, drop_reason_t reason);
+char *dropReasonName(drop_reason_t reason);
+void printDrops();
+void resetDrops();
+int setDropSampling(int rate);
+int saveDropSamples(char *path);
+
+#endif
@@ -12,6 +12,7 @@
 #include "vpl.h"
 #include "device.h"
 #include "message.h"
+#include "simplequeue.h"
 #include <pthread.h>
 
 
@@ -50,6 +51,10 @@ typedef struct _interface_t
 	pthread_t sdwthread;
 	device_t *devdriver;				// the device driver that include toXDev and fromXDev functions
 	void *iarray;                       // pointer to interface array type
+	// receive counters are only written by the receiving thread of the
+	// interface and transmit counters by the GNET handler
+	uint64_t rx_pkts, rx_bytes;
+	uint64_t tx_pkts, tx_bytes;
 } interface_t;
 
 
@@ -75,12 +80,14 @@ interface_t *GNETMakeEthInterface(char *vsock_name, char *device,
 			   uchar *mac_addr, uchar *nw_addr, int iface_mtu, int cforce);
 interface_t *GNETMakeTapInterface(char *device, uchar *mac_addr, uchar *nw_addr);
 interface_t *GNETMakeTunInterface(char *device, uchar *mac_addr, uchar *nw_addr,
-                                  uchar* dst_ip, short int dst_port);
+                                  uchar* dst_ip, short int dst_port, int batch);
 interface_t *GNETMakeRawInterface(char *device, uchar *nw_addr, char *bridge);
 
 device_t *findDeviceDriver(char *dev_type);
 interface_t *findInterface(int indx);
+void GNETCountRx(interface_t *iface, gpacket_t *in_pkt);
 void *delayedServerCall(void *arg);
+int GNETInit(pthread_t *ghandler, char *config_dir, char *rname, simplequeue_t *sq);
 void *GNETHandler(void *outq);
 void GNETHalt(int gnethandler);
 int destroyInterfaceByIndex(int indx);
@@ -92,4 +99,8 @@ void printInterfaces(int mode);
 int upInterface(int index);
 int downInterface(int index);
 
+void GNETInitARPCache(void);
+int lookupARPCache(uchar *ip_addr, uchar *mac_addr);
+void putARPCache(uchar *ip_addr, uchar *mac_addr);
+
 #endif //__GNET_H__
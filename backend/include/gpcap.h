@@ -21,3 +21,51 @@ typedef struct pcaprec_hdr_s {
         uint32_t incl_len;       /* number of octets of packet saved in file */
         uint32_t orig_len;       /* actual length of packet */
 } pcaprec_hdr_t;
+
+
+// pcap-ng blocks used by the console capture. Timestamps are in
+// nanoseconds (if_tsresol = 9) and blocks are padded to 32 bits.
+
+#define PCAPNG_SHB_TYPE         0x0A0D0D0A
+#define PCAPNG_IDB_TYPE         0x00000001
+#define PCAPNG_EPB_TYPE         0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETHERNET 1
+#define PCAPNG_OPT_ENDOFOPT     0
+#define PCAPNG_OPT_COMMENT      1
+#define PCAPNG_OPT_IF_TSRESOL   9
+
+typedef struct pcapng_shb_s {
+        uint32_t block_type;     /* PCAPNG_SHB_TYPE */
+        uint32_t block_len;
+        uint32_t byte_order;     /* PCAPNG_BYTE_ORDER_MAGIC */
+        uint16_t version_major;  /* 1 */
+        uint16_t version_minor;  /* 0 */
+        int64_t  section_len;    /* -1: not specified */
+        uint32_t block_len2;
+} __attribute__((packed)) pcapng_shb_t;
+
+typedef struct pcapng_idb_s {
+        uint32_t block_type;     /* PCAPNG_IDB_TYPE */
+        uint32_t block_len;
+        uint16_t linktype;
+        uint16_t reserved;
+        uint32_t snaplen;
+        uint16_t opt_tsresol_code; /* PCAPNG_OPT_IF_TSRESOL */
+        uint16_t opt_tsresol_len;  /* 1 */
+        uint8_t  opt_tsresol;      /* 9: nanoseconds */
+        uint8_t  opt_pad[3];
+        uint16_t opt_end_code;     /* PCAPNG_OPT_ENDOFOPT */
+        uint16_t opt_end_len;
+        uint32_t block_len2;
+} __attribute__((packed)) pcapng_idb_t;
+
+typedef struct pcapng_epb_s {
+        uint32_t block_type;     /* PCAPNG_EPB_TYPE */
+        uint32_t block_len;      /* header + padded data + trailing length */
+        uint32_t interface_id;
+        uint32_t ts_high;        /* upper 32 bits of the timestamp */
+        uint32_t ts_low;
+        uint32_t cap_len;
+        uint32_t orig_len;
+} __attribute__((packed)) pcapng_epb_t;
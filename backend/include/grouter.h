@@ -42,6 +42,7 @@
 
 #define MAX_QUEUE_SIZE              256
 #define MAX_QUEUE_NUM				32
+#define MAX_OPENFLOW_WORKERS        16
 
 #define MAX_PORT_TRIES              20
 
@@ -65,6 +66,8 @@
 #define COPY_IP(DST, SRC)           ( memcpy(DST, SRC, 4) )
 #define COMPARE_MAC(X, Y)           ( memcmp(X, Y, 6) )
 #define COMPARE_IP(X, Y)            ( memcmp(X, Y, 4) )
+#define PACK_IP(X)                  ( ((uint32_t)(X)[3] << 24) | ((uint32_t)(X)[2] << 16) | \
+				      ((uint32_t)(X)[1] << 8) | (uint32_t)(X)[0] )
 #define MAC_BCAST_ADDR              {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}
 #define IP_BCAST_ADDR               {0xFF, 0xFF, 0xFF, 0xFF}
 
@@ -90,6 +93,7 @@ typedef struct _router_config
 	char *config_file;
 	char *config_dir;
 	int openflow;
+	int openflow_workers;
 	pthread_t ghandler;
 	pthread_t clihandler;
 	pthread_t scheduler;
@@ -12,7 +12,7 @@
 #define USAGE_ROUTE         "route action [action specific options]"
 #define USAGE_ARP           "arp action [action specific options]"
 #define USAGE_PING          "ping [options] target"
-#define USAGE_CONSOLE    	"port (type) [restart]"
+#define USAGE_CONSOLE    	"console [show | start | stop | restart | snaplen N | filter expr | filter none]"
 #define USAGE_HALT          "halt"
 #define USAGE_EXIT          "exit"
 #define USAGE_QUEUE   	    "queue action [action specific options]"
@@ -22,6 +22,11 @@
 #define USAGE_FILTER     	"filter action [action specific options]"
 #define USAGE_OPENFLOW      "openflow action [action specific options]"
 #define USAGE_GNC           "gnc [-u] [-l <port>] <destination> <port>"
+#define USAGE_PKTGEN        "pktgen (start -dev ethX -dst IP[-IP] [options] | stop | show)"
+#define USAGE_REPLAY        "replay (start -file capture -dev ethX [-mode original|fast] [-pps N] [-loop N] | stop | show)"
+#define USAGE_STATS         "stats (latency [show | on | off | reset] | page [interval ms])"
+#define USAGE_SHOW          "show drops [reset | sample rate | save file]"
+#define USAGE_TRACE         "trace (on | off | clear | show [count])"
 
 
 #define SHELP_HELP          "display help information on given command"
@@ -43,6 +48,11 @@
 #define SHELP_FILTER		"create add, del, and view filtering rules; this uses class rules to group packets"
 #define SHELP_OPENFLOW      "view OpenFlow switch information or force the OpenFlow switch to reconnect to the controller"
 #define SHELP_GNC           "use gRouter netcat (gnc) to create udp and tcp connections"
+#define SHELP_PKTGEN        "generate synthetic UDP or TCP traffic out of an interface"
+#define SHELP_REPLAY        "inject the frames of a pcap or pcap-ng capture into an interface"
+#define SHELP_STATS         "show latency histograms and control the shared statistics page"
+#define SHELP_SHOW          "show dropped packets by interface and reason"
+#define SHELP_TRACE         "record data path events in the binary trace ring"
 
 
 /*
@@ -82,5 +92,10 @@ absolute path (e.g., /sbin/ifconfig). \n"
 #define LHELP_FILTER		"filter.hlp"
 #define LHELP_OPENFLOW      "openflow.hlp"
 #define LHELP_GNC           "gnc.hlp"
+#define LHELP_REPLAY        "replay.hlp"
+#define LHELP_PKTGEN        "pktgen.hlp"
+#define LHELP_STATS         "stats.hlp"
+#define LHELP_SHOW          "show.hlp"
+#define LHELP_TRACE         "trace.hlp"
 
 #endif
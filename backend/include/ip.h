@@ -12,6 +12,7 @@
 
 #include <stdint.h>
 #include <endian.h>
+#include <pthread.h>
 #include "mtu.h"
 #include "routetable.h"
 #include "grouter.h"
@@ -115,6 +116,14 @@ typedef struct _ip_packet_t
 
 #define IPH_HL(hdr) ((hdr)->ip_hdr_len & 0x0f)
 
+/*
+ * lwIP is not thread safe: the packet path (TCPProcess, UDPProcess), the
+ * TCP timer and the CLI hold the core lock around every call into it.
+ */
+extern pthread_mutex_t lwip_core_mutex;
+#define LOCK_TCPIP_CORE()               pthread_mutex_lock(&lwip_core_mutex)
+#define UNLOCK_TCPIP_CORE()             pthread_mutex_unlock(&lwip_core_mutex)
+
 // function prototypes...
 
 void IPInit();
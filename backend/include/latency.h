@@ -0,0 +1,67 @@
+/*
+ * latency.h (header file for the per-stage packet latency histograms)
+ *
+ * When enabled, each packet is time stamped as it crosses the stages of
+ * the forwarding path and the differences are recorded in log-linear (HDR)
+ * histograms when it is handed to the device. When disabled the cost at a
+ * stamping point is the single branch in LATENCY_STAMP.
+ */
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdint.h>
+#include <time.h>
+#include "clock.h"
+
+// time stamps kept in pkt_frame_t.tstamp[]
+#define LAT_RX                  0               // received from the device
+#define LAT_ENQ                 1               // classified and enqueued
+#define LAT_SCHED               2               // dequeued by the scheduler
+#define LAT_WORK                3               // picked up by the worker
+#define LAT_OUTQ                4               // written to the output queue
+#define LAT_TODEV               5               // handed to the device driver
+#define LAT_STAMPS              6
+
+// histograms: one per pair of consecutive stamps and one end to end
+#define LAT_HIST_TOTAL          (LAT_STAMPS - 1)
+#define LAT_HISTS               LAT_STAMPS
+
+// log-linear buckets: exact below 64 ns, then 32 buckets per power of 2 (~3%)
+#define LAT_SUB_BITS            5
+#define LAT_LINEAR_MAX          (2 << LAT_SUB_BITS)
+#define LAT_BUCKETS             ((64 - LAT_SUB_BITS - 1) * (1 << LAT_SUB_BITS) + LAT_LINEAR_MAX)
+
+typedef struct _lat_hist_t
+{
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[LAT_BUCKETS];
+} lat_hist_t;
+
+extern volatile int latency_enabled;
+
+
+#define LATENCY_STAMP(pkt, stage)                                       \
+	do {                                                                \
+		if (__builtin_expect(latency_enabled, 0))                       \
+			(pkt)->frame.tstamp[stage] = clockPrecise();                \
+	} while (0)
+
+// stamps LAT_TODEV and records the packet in the histograms
+#define LATENCY_RECORD(pkt)                                             \
+	do {                                                                \
+		if (__builtin_expect(latency_enabled, 0))                       \
+			latencyRecord((pkt)->frame.tstamp);                         \
+	} while (0)
+
+
+void latencyRecord(uint64_t *tstamp);
+void latencySetEnabled(int enabled);
+void latencyReset();
+void latencyShow();
+uint64_t latencyPercentile(lat_hist_t *hist, double pct);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * logging.h (cheap debug logging and the binary trace ring)
+ *
+ * Including this header turns every verbose() call of the file into a
+ * macro that tests the level before any argument is evaluated, so the
+ * IP2Dot() and MAC2Colon() calls in the arguments cost nothing unless the
+ * message is printed. Levels above LOG_MAX_LEVEL are removed at compile
+ * time; build with LOG_MAX_LEVEL=1 (scons LOG_LEVEL=1) for a router that
+ * only keeps the warnings.
+ *
+ * The trace ring is for looking at the data path at full rate, where
+ * printing is out of the question: TRACE() stores an event number and up to
+ * three raw values in a per-thread ring, and the values are only formatted
+ * when the ring is dumped with "trace show".
+ */
+
+#ifndef __LOGGING_H__
+#define __LOGGING_H__
+
+#include <stdint.h>
+#include <slack/err.h>
+
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL                   6
+#endif
+
+// mirror of the libslack verbosity level, kept in sync by setLogLevel()
+extern int log_level;
+
+#define LOG_ENABLED(level)              (((level) <= LOG_MAX_LEVEL) && ((level) <= log_level))
+
+// the verbose() inside the expansion is the libslack function
+#define verbose(level, ...)                                             \
+	(LOG_ENABLED(level) ? (void)verbose(level, __VA_ARGS__) : (void)0)
+
+
+typedef enum _trace_event_t
+{
+	TRACE_RX = 0,                       // interface, bytes
+	TRACE_TX,                           // interface, bytes
+	TRACE_ROUTE,                        // destination, next hop, interface
+	TRACE_NO_ROUTE,                     // destination
+	TRACE_ARP_MISS,                     // next hop, interface
+	TRACE_DROP,                         // interface, drop reason
+	TRACE_EVENTS
+} trace_event_t;
+
+#define TRACE_RING_SLOTS                4096            // per thread, power of 2
+#define TRACE_MAX_THREADS               64
+#define TRACE_SHOW_DEFAULT              50
+
+typedef struct _trace_rec_t
+{
+	uint64_t ts;                        // CLOCK_MONOTONIC in nanoseconds
+	uint32_t event;
+	uint32_t thread;
+	uint64_t arg[3];
+} trace_rec_t;
+
+extern volatile int trace_enabled;
+
+#define TRACE(event, a0, a1, a2)                                        \
+	do {                                                                \
+		if (__builtin_expect(trace_enabled, 0))                         \
+			traceRecord(event, (uint64_t)(a0), (uint64_t)(a1),          \
+				    (uint64_t)(a2));                                \
+	} while (0)
+
+// packs an IP address kept in host order (first octet last) for TRACE()
+#define TRACE_IP(ip)                    (((uint32_t)(ip)[3] << 24) | ((uint32_t)(ip)[2] << 16) | \
+					 ((uint32_t)(ip)[1] << 8) | (uint32_t)(ip)[0])
+
+
+void setLogLevel(int level);
+void traceRecord(int event, uint64_t a0, uint64_t a1, uint64_t a2);
+void traceSetEnabled(int on);
+void traceShow(int count);
+void traceClear();
+
+#endif
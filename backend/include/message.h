@@ -11,6 +11,7 @@
 
 #include <sys/types.h>
 #include "grouter.h"
+#include "latency.h"
 #include <stdint.h>
 
 
@@ -52,6 +53,43 @@ typedef struct
 	uint8_t data[DEFAULT_MTU];
 } pkt_data_vlan_t;
 
+// flags of the parsed headers
+#define PKT_META_VLAN                   0x01     // 802.1Q tagged
+#define PKT_META_IP                     0x02     // nw_* fields are from an IPv4 header
+#define PKT_META_ARP                    0x04     // nw_* fields are from an ARP packet
+#define PKT_META_FRAG                   0x08     // IP fragment (offset or more fragments set)
+#define PKT_META_L4                     0x10     // tp_* fields are from a TCP/UDP/ICMP header
+
+#define PKT_META_VLAN_NONE              0xffff   // as OFP_VLAN_NONE
+#define PKT_META_DL_NOT_ETH_TYPE        0x05ff   // 802.3 frame without a SNAP ethertype
+
+/*
+ * Headers of the packet, parsed once by parsePacket() when it is received
+ * so the filter, the classifier, the IP module and the OpenFlow matcher do
+ * not decode the same headers again for every rule they test. All fields
+ * are in host order; addresses are packed like PACK_IP(). Anything that
+ * rewrites the headers must clear valid (packetMeta() parses again).
+ */
+typedef struct _pkt_meta_t
+{
+	uint8_t valid;
+	uint8_t flags;
+	uint8_t vlan_pcp;
+	uint8_t nw_tos;
+	uint16_t vlan;                   // PKT_META_VLAN_NONE when untagged
+	uint16_t dl_type;                // after the VLAN tag or SNAP header
+	uint16_t l3_offset;              // from the start of pkt_data_t
+	uint16_t l4_offset;              // 0 when there is no L4 header
+	uint32_t nw_src;                 // IP or ARP sender address
+	uint32_t nw_dst;                 // IP or ARP target address
+	uint8_t nw_proto;                // IP protocol or low byte of the ARP opcode
+	uint8_t pad;
+	uint16_t tp_src;                 // TCP/UDP port or ICMP type
+	uint16_t tp_dst;                 // TCP/UDP port or ICMP code
+	uint32_t hash;                   // of the 5-tuple, or of the MACs and type
+} pkt_meta_t;
+
+
 // frame wrapping every packet... GINI specific (GINI metadata)
 typedef struct _pkt_frame_t
 {
@@ -63,6 +101,8 @@ typedef struct _pkt_frame_t
 	int arp_valid;
 	int arp_bcast;
 	int openflow;
+	uint64_t tstamp[LAT_STAMPS];     // per-stage time stamps when latency stamping is on
+	pkt_meta_t meta;                 // parsed headers, see parsePacket()
 } pkt_frame_t;
 
 
@@ -73,6 +113,7 @@ typedef struct _gpacket_t
 } gpacket_t;
 
 
+void parsePacket(gpacket_t *pkt);
 gpacket_t *duplicatePacket(gpacket_t *inpkt);
 void printSepLine(char *start, char *end, int count, char sep);
 void printGPktFrame(gpacket_t *msg, char *routine);
@@ -86,4 +127,13 @@ void printICMPPacket(gpacket_t *msg);
 void printUDPPacket(gpacket_t *msg);
 void printTCPPacket(gpacket_t *msg);
 
+
+// the parsed headers of a packet, parsing them if that was not done at rx
+static inline pkt_meta_t *packetMeta(gpacket_t *pkt)
+{
+	if (__builtin_expect(!pkt->frame.meta.valid, 0))
+		parsePacket(pkt);
+	return &(pkt->frame.meta);
+}
+
 #endif
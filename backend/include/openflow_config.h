@@ -64,6 +64,18 @@ ofp_phy_port *openflow_config_get_phy_port(uint16_t openflow_port_num);
 void openflow_config_set_phy_port(uint16_t openflow_port_num,
         ofp_phy_port *port);
 
+/**
+ * Checks whether a packet may be sent out of the specified OpenFlow physical
+ * port without taking the port mutex.
+ *
+ * @param openflow_port_num The specified OpenFlow port number.
+ * @param flood             1 if the packet is being flooded, otherwise 0.
+ *
+ * @return 1 if the packet may be sent, 0 if not.
+ */
+uint8_t openflow_config_port_can_send(uint16_t openflow_port_num,
+        uint8_t flood);
+
 /**
  * Prints information associated with the specified OpenFlow physical port.
  *
@@ -77,27 +89,33 @@ void openflow_config_print_port(uint32_t index);
 void openflow_config_print_ports();
 
 /**
- * Gets the OpenFlow physical port statistics corresponding to the specified
- * OpenFlow port number.
- *
- * This function uses dynamically allocated memory that must be manually
- * freed afterwards.
+ * Counts a packet received on the specified OpenFlow port. The counters
+ * are per thread, so this takes no lock.
  *
  * @param openflow_port_num The specified OpenFlow port number.
+ * @param bytes             The length of the packet.
+ */
+void openflow_config_count_rx(uint16_t openflow_port_num, uint32_t bytes);
+
+/**
+ * Counts a packet sent on the specified OpenFlow port. The counters are
+ * per thread, so this takes no lock.
  *
- * @return The OpenFlow physical port statistics corresponding to the
- *         specified port number.
+ * @param openflow_port_num The specified OpenFlow port number.
+ * @param bytes             The length of the packet.
  */
-ofp_port_stats *openflow_config_get_port_stats(uint16_t openflow_port_num);
+void openflow_config_count_tx(uint16_t openflow_port_num, uint32_t bytes);
 
 /**
- * Sets the OpenFlow ofp_port_stats struct corresponding to the specified
- * OpenFlow port number.
+ * Gets the OpenFlow physical port statistics corresponding to the specified
+ * OpenFlow port number, with the counts of all threads added up.
  *
  * @param openflow_port_num The specified OpenFlow port number.
- * @param stats             The new ofp_port_stats struct.
+ * @param stats             The struct to fill in.
+ *
+ * @return 0 if the port exists, -1 otherwise.
  */
-void openflow_config_set_port_stats(uint16_t openflow_port_num,
+int32_t openflow_config_get_port_stats(uint16_t openflow_port_num,
         ofp_port_stats *stats);
 
 /**
@@ -126,6 +144,22 @@ uint16_t openflow_config_get_switch_config_flags();
  */
 void openflow_config_set_switch_config_flags(uint16_t flags);
 
+/**
+ * Gets the number of bytes of a packet that a table miss sends to the
+ * controller.
+ *
+ * @return The miss send length in host byte order.
+ */
+uint16_t openflow_config_get_miss_send_len();
+
+/**
+ * Sets the number of bytes of a packet that a table miss sends to the
+ * controller.
+ *
+ * @param len The miss send length in host byte order.
+ */
+void openflow_config_set_miss_send_len(uint16_t len);
+
 /**
  * Gets the OpenFlow switch features.
  *
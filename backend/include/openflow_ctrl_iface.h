@@ -16,28 +16,46 @@
  */
 void openflow_ctrl_iface_reconnect();
 
+/**
+ * Sets the interval without messages from the controller after which an
+ * echo request is sent. The connection is closed after
+ * OPENFLOW_CTRL_IFACE_ECHO_MISSES intervals without messages.
+ *
+ * @param interval_ms The interval in milliseconds.
+ */
+void openflow_ctrl_iface_set_echo_interval(uint32_t interval_ms);
+
+/**
+ * Prints the state of the controller connection to the console.
+ */
+void openflow_ctrl_iface_print_status();
+
 /**
  * Sends a packet in message to the OpenFlow controller containing the
- * specified packet.
+ * specified packet. A packet longer than max_len is buffered and only its
+ * first max_len bytes are sent. Packet in messages over the rate limit of
+ * the input port are not sent.
  *
- * @param packet A pointer to the packet to send to the OpenFlow controller.
- * @param reason The reason the packet is being sent to the controller.
+ * @param packet  A pointer to the packet to send to the OpenFlow controller.
+ * @param reason  The reason the packet is being sent to the controller.
+ * @param max_len The number of bytes of the packet to send.
  *
  * @return The number of bytes sent, or a negative value if an error occurred.
  */
-int32_t openflow_ctrl_iface_send_packet_in(gpacket_t *packet, uint8_t reason);
+int32_t openflow_ctrl_iface_send_packet_in(gpacket_t *packet, uint8_t reason,
+        uint16_t max_len);
 
 /**
- * Sends a flow removed message to the OpenFlow controller.
+ * Sends flow removed messages to the OpenFlow controller, all of them in
+ * one write.
  *
- * @param entry  A pointer to the flowtable entry that is being removed from
- *               the flowtable.
- * @param reason The reason the flow is being removed.
+ * @param msgs  The flow removed messages, filled in except for the header.
+ * @param count The number of messages.
  *
  * @return The number of bytes sent, or a negative value if an error occurred.
  */
-int32_t openflow_ctrl_iface_send_flow_removed(
-        openflow_flowtable_entry_type *entry, uint8_t reason);
+int32_t openflow_ctrl_iface_send_flow_removed(ofp_flow_removed *msgs,
+        uint32_t count);
 
 /**
  * Sends a port status message to the OpenFlow controller.
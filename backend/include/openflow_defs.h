@@ -5,10 +5,12 @@
 #ifndef __OPENFLOW_DEFS_H_
 #define __OPENFLOW_DEFS_H_
 
+#include <pthread.h>
 #include <stdint.h>
 #include <time.h>
 
 #include "gnet.h"
+#include "message.h"
 #include "openflow.h"
 
 // OpenFlow struct typedefs
@@ -47,10 +49,12 @@ typedef struct ofp_port_stats ofp_port_stats;
 // OpenFlow error codes
 #define OPENFLOW_CTRL_IFACE_ERR_UNKNOWN          ((int32_t) -1)
 #define OPENFLOW_CTRL_IFACE_ERR_CONN_CLOSED      ((int32_t) -2)
-#define OPENFLOW_CTRL_IFACE_ERR_SEND_TIMEOUT     ((int32_t) -3)
+#define OPENFLOW_CTRL_IFACE_ERR_QUEUE_FULL       ((int32_t) -3)
 #define OPENFLOW_CTRL_IFACE_ERR_OPENFLOW         ((int32_t) -4)
 #define OPENFLOW_PKT_PROC_ERR_ACTION_INVALID     ((int32_t) -5)
 #define OPENFLOW_PKT_PROC_ERR_QUEUE              ((int32_t) -6)
+#define OPENFLOW_PKT_BUFFER_ERR_UNKNOWN          ((int32_t) -7)
+#define OPENFLOW_PKT_BUFFER_ERR_EMPTY            ((int32_t) -8)
 
 // OpenFlow constants
 #define OPENFLOW_MFR_DESC                        "McGill University Advanced Networking Research Laboratory (ANRL)"
@@ -59,12 +63,83 @@ typedef struct ofp_port_stats ofp_port_stats;
 
 #define OPENFLOW_TABLE_NAME                      "Standard"
 
-#define OPENFLOW_NUM_TABLES                      ((uint32_t) 1)
+#define OPENFLOW_NUM_TABLES                      ((uint32_t) 4)
+// Table ID of all tables in flow stats requests and deletions
+#define OPENFLOW_TABLE_ALL                       ((uint8_t) 0xff)
 #define OPENFLOW_ERROR_MSG_MIN_DATA_SIZE         64
-#define OPENFLOW_CTRL_IFACE_SEND_TIMEOUT         10
+
+// Controller connection: reconnect attempts back off from the minimum to the
+// maximum delay; an echo request goes out after an interval without a
+// message from the controller, and the connection is given up after
+// OPENFLOW_CTRL_IFACE_ECHO_MISSES intervals
+#define OPENFLOW_CTRL_IFACE_BACKOFF_MIN_MS       ((uint32_t) 100)
+#define OPENFLOW_CTRL_IFACE_BACKOFF_MAX_MS       ((uint32_t) 15000)
+#define OPENFLOW_CTRL_IFACE_ECHO_INTERVAL_MS     ((uint32_t) 5000)
+#define OPENFLOW_CTRL_IFACE_ECHO_MISSES          ((uint32_t) 3)
+// Room for two messages of the maximum size, so a whole message always fits
+// behind a partial one
+#define OPENFLOW_CTRL_IFACE_RECV_BUFFER          ((uint32_t) 131072)
+#define OPENFLOW_CTRL_IFACE_SEND_QUEUE_MSGS      ((uint32_t) 4096)
+#define OPENFLOW_CTRL_IFACE_SEND_QUEUE_BYTES     ((uint32_t) 4194304)
+#define OPENFLOW_CTRL_IFACE_SEND_BATCH           ((uint32_t) 64)
+// Multipart stats replies go out a message of at most the maximum OpenFlow
+// message size at a time, and only while less than
+// OPENFLOW_CTRL_IFACE_STATS_QUEUE_BYTES wait in the send queue
+#define OPENFLOW_CTRL_IFACE_STATS_REPLY_BYTES    ((uint32_t) 65535)
+#define OPENFLOW_CTRL_IFACE_STATS_QUEUE_BYTES    ((uint32_t) 1048576)
+
+// Controller connection states
+#define OPENFLOW_CTRL_IFACE_DISCONNECTED         0
+#define OPENFLOW_CTRL_IFACE_CONNECTING           1
+#define OPENFLOW_CTRL_IFACE_HELLO                2
+#define OPENFLOW_CTRL_IFACE_FEATURES             3
+#define OPENFLOW_CTRL_IFACE_CONNECTED            4
+
+// Packet in messages: a truncated packet is kept in a buffer until the
+// controller releases it or for OPENFLOW_PKT_BUFFER_TIMEOUT_MS, and each
+// port may send OPENFLOW_PACKET_IN_RATE messages per second with bursts of
+// up to OPENFLOW_PACKET_IN_BURST (a rate of 0 turns the limit off)
+#define OPENFLOW_PKT_BUFFER_BITS                 8
+#define OPENFLOW_PKT_BUFFERS                     ((uint32_t) 1 << OPENFLOW_PKT_BUFFER_BITS)
+#define OPENFLOW_PKT_BUFFER_TIMEOUT_MS           ((uint32_t) 5000)
+#define OPENFLOW_PACKET_IN_RATE                  ((uint32_t) 1000)
+#define OPENFLOW_PACKET_IN_BURST                 ((uint32_t) 100)
+
+// What a table does with a packet that matches none of its entries: send
+// it to the controller, go on to the next table (dropping it after the last
+// one) or drop it
+#define OPENFLOW_TABLE_MISS_CONTROLLER           0
+#define OPENFLOW_TABLE_MISS_CONTINUE             1
+#define OPENFLOW_TABLE_MISS_DROP                 2
+
+// Nicira vendor extensions for the tables after the first one, which
+// OpenFlow 1.0 has no messages for: the resubmit action with a table
+// continues the pipeline in a later table (goto table), and a flow mod
+// carries its table ID in the upper byte of the command once the controller
+// has turned that on
+#define OPENFLOW_NX_VENDOR_ID                    ((uint32_t) 0x00002320)
+#define OPENFLOW_NXAST_RESUBMIT_TABLE            ((uint16_t) 14)
+#define OPENFLOW_NXT_FLOW_MOD_TABLE_ID           ((uint32_t) 15)
 
 #define OPENFLOW_MAX_PHYSICAL_PORTS              MAX_INTERFACES
-#define OPENFLOW_MAX_FLOWTABLE_ENTRIES           ((uint32_t) 100)
+// Port flags the packet path checks before sending
+#define OPENFLOW_PORT_NO_SEND                    ((uint32_t) 0x1)
+#define OPENFLOW_PORT_NO_FLOOD                   ((uint32_t) 0x2)
+#define OPENFLOW_DEFAULT_FLOWTABLE_ENTRIES       ((uint32_t) 1024)
+#define OPENFLOW_MAX_FLOWTABLE_ENTRIES           ((uint32_t) 1048576)
+#define OPENFLOW_FLOWTABLE_NIL                   ((uint32_t) 0xffffffff)
+#define OPENFLOW_PKT_BUFFER_NONE                 ((uint32_t) 0xffffffff)
+#define OPENFLOW_FLOWTABLE_MIN_BUCKETS           ((uint32_t) 16)
+#define OPENFLOW_PRIORITY_BUCKETS                ((uint32_t) 256)
+#define OPENFLOW_MICROFLOW_SLOTS                 ((uint32_t) 4096)
+#define OPENFLOW_MEGAFLOW_SLOTS                  ((uint32_t) 4096)
+#define OPENFLOW_MEGAFLOW_MAX_MASKS              ((uint32_t) 16)
+#define OPENFLOW_MAX_THREADS                     ((uint32_t) 64)
+#define OPENFLOW_TIMER_WHEEL_BITS                8
+#define OPENFLOW_TIMER_WHEEL_SLOTS               ((uint32_t) 1 << OPENFLOW_TIMER_WHEEL_BITS)
+#define OPENFLOW_TIMER_WHEEL_LEVELS              2
+#define OPENFLOW_FLOW_REMOVED_BATCH              ((uint32_t) 64)
+#define OPENFLOW_FLOWTABLE_STATS_BATCH           ((uint32_t) 4096)
 #define OPENFLOW_MAX_ACTIONS                     ((uint32_t) 25)
 #define OPENFLOW_MAX_ACTION_SIZE                 ((uint32_t) 16)
 #define OPENFLOW_MAX_MSG_TYPE                    OFPT_QUEUE_GET_CONFIG_REPLY
@@ -82,6 +157,43 @@ typedef struct
 	uint8_t pad[OPENFLOW_MAX_ACTION_SIZE - sizeof(ofp_action_header)];
 } openflow_flowtable_action_type;
 
+/**
+ * Represents the Nicira resubmit action with a table, which the pipeline
+ * uses as its goto table action.
+ */
+typedef struct
+{
+	// OFPAT_VENDOR
+	uint16_t type;
+	// Length of the action (16)
+	uint16_t len;
+	// OPENFLOW_NX_VENDOR_ID
+	uint32_t vendor;
+	// OPENFLOW_NXAST_RESUBMIT_TABLE
+	uint16_t subtype;
+	// Input port the packet is looked up with; only OFPP_IN_PORT (the port
+	// it came in on) is supported
+	uint16_t in_port;
+	// Table to continue in
+	uint8_t table;
+	uint8_t pad[3];
+} openflow_nx_action_resubmit_type;
+
+/**
+ * Represents the Nicira message that turns table IDs in flow mods on or off.
+ */
+typedef struct
+{
+	ofp_header header;
+	// OPENFLOW_NX_VENDOR_ID
+	uint32_t vendor;
+	// OPENFLOW_NXT_FLOW_MOD_TABLE_ID
+	uint32_t subtype;
+	// 1 to turn table IDs on, 0 to turn them off
+	uint8_t set;
+	uint8_t pad[7];
+} openflow_nx_flow_mod_table_id_type;
+
 /**
  * Represents an entry in an OpenFlow flowtable.
  */
@@ -89,11 +201,14 @@ typedef struct
 {
 	// 1 if this entry is active (i.e. not empty), 0 otherwise
 	uint8_t active;
+	// Table the entry is in
+	uint8_t table_id;
 	// Match headers
 	ofp_match match;
 	// Cookie (opaque data) from controller
 	uint64_t cookie;
-	// The last time this entry was matched against a packet
+	// The last time this entry was matched against a packet, as of the last
+	// time its counters were added up
 	time_t last_matched;
 	// The last time this entry was modified by the controller
 	time_t last_modified;
@@ -112,19 +227,254 @@ typedef struct
 	uint16_t flags;
 	// Entry actions
 	openflow_flowtable_action_type actions[OPENFLOW_MAX_ACTIONS];
-	// Entry stats
+	// Entry stats; the packet and byte counts are kept per thread and
+	// added up here when the stats are needed
 	ofp_flow_stats stats;
+	// The match with the fields that are not compared cleared (see
+	// openflow_flowtable_mask), which is what the lookup hashes
+	ofp_match key;
+	// Hash of key
+	uint32_t hash;
+	// Wildcard tuple the entry is in, or OPENFLOW_FLOWTABLE_NIL for
+	// exact-match entries
+	uint32_t tuple;
+	// Next entry in the same hash chain, or OPENFLOW_FLOWTABLE_NIL
+	uint32_t next;
+	// Neighbours in the priority chain of the table
+	uint32_t priority_next;
+	uint32_t priority_prev;
+	// When the entry is next checked for expiry, or 0 if it has no timeout
+	time_t expires;
+	// Timer wheel slot of the entry and its neighbours in the slot
+	uint32_t timer_slot;
+	uint32_t timer_next;
+	uint32_t timer_prev;
 } openflow_flowtable_entry_type;
 
 /**
- * Represents an OpenFlow flowtable.
+ * Represents the wildcard entries that compare the same fields (a tuple in
+ * tuple space search). They are kept in a hash table of their masked keys,
+ * so a lookup costs one probe per tuple rather than one test per entry.
  */
 typedef struct
 {
-	// Table entries
-	openflow_flowtable_entry_type entries[OPENFLOW_MAX_FLOWTABLE_ENTRIES];
+	// All ones in the fields compared by the entries of the tuple
+	ofp_match mask;
+	// Number of entries in the tuple (0 if the slot is unused)
+	uint32_t count;
+	// Highest priority of the entries in the tuple, in host byte order
+	uint16_t max_priority;
+	// Heads of the hash chains (entry indexes)
+	uint32_t *buckets;
+	// Number of buckets (a power of 2)
+	uint32_t num_buckets;
+} openflow_flowtable_tuple_type;
+
+/**
+ * Represents one table of the pipeline: the lookup structures of its
+ * entries, which live in the entries of the flowtable, and its stats.
+ */
+typedef struct
+{
+	// Size limit of the table, and the number of entries it has
+	uint32_t max_entries;
+	uint32_t num_entries;
+	// What happens to packets that match no entry (OPENFLOW_TABLE_MISS_*)
+	uint8_t miss;
+	// Hash table of the exact-match entries
+	uint32_t *exact_buckets;
+	uint32_t num_exact_buckets;
+	uint32_t num_exact;
+	// Wildcard tuples, and the indexes of the ones in use sorted by
+	// decreasing maximum priority
+	openflow_flowtable_tuple_type *tuples;
+	uint32_t *tuple_order;
+	uint32_t num_tuples;
+	uint32_t max_tuples;
+	// Heads of the chains of the entries by priority (hashed), which the
+	// overlap check walks for the tuples it cannot probe
+	uint32_t priority_buckets[OPENFLOW_PRIORITY_BUCKETS];
 	// Table stats
 	ofp_table_stats stats;
+} openflow_flowtable_table_type;
+
+/**
+ * Represents an OpenFlow flowtable: the entries of all tables, which share
+ * one array so that an entry is known by its index wherever it is.
+ */
+typedef struct
+{
+	// Table entries
+	openflow_flowtable_entry_type *entries;
+	// Number of entries allocated (the size limits of the tables added up)
+	uint32_t max_entries;
+	// Indexes of the inactive entries
+	uint32_t *free_entries;
+	uint32_t num_free;
+	// Tables of the pipeline
+	openflow_flowtable_table_type tables[OPENFLOW_NUM_TABLES];
+	// Timer wheel of the entries with a timeout: the first level has a slot
+	// for each second, the second a slot for each OPENFLOW_TIMER_WHEEL_SLOTS
+	// seconds, which together cover any 16-bit timeout
+	uint32_t timer_slots[OPENFLOW_TIMER_WHEEL_LEVELS
+	        * OPENFLOW_TIMER_WHEEL_SLOTS];
+	// The second the wheel has been run up to
+	time_t timer_now;
 } openflow_flowtable_type;
 
+/**
+ * Represents a slot of a flow cache: a packet key, masked for the megaflow
+ * cache, and the index of the entry it matched in a table
+ * (OPENFLOW_FLOWTABLE_NIL for no entry).
+ */
+typedef struct
+{
+	ofp_match key;
+	uint32_t hash;
+	uint32_t entry;
+	// The slot is valid if this is the current generation of its cache
+	uint32_t generation;
+	// Megaflow mask of the slot
+	uint32_t mask;
+	// Table the key was looked up in
+	uint8_t table_id;
+} openflow_flowcache_slot_type;
+
+/**
+ * Represents the flow caches of one thread: an exact-match microflow cache
+ * keyed on the whole packet key and, below it, a megaflow cache keyed on
+ * the packet fields that the flowtable lookup actually looked at.
+ */
+typedef struct
+{
+	// Flowtable version the cached results belong to
+	uint32_t version;
+	uint32_t microflow_generation;
+	uint32_t megaflow_generation;
+	// Masks of the megaflow cache
+	ofp_match masks[OPENFLOW_MEGAFLOW_MAX_MASKS];
+	uint32_t num_masks;
+	openflow_flowcache_slot_type microflow[OPENFLOW_MICROFLOW_SLOTS];
+	openflow_flowcache_slot_type megaflow[OPENFLOW_MEGAFLOW_SLOTS];
+	// Counters
+	uint64_t microflow_hits;
+	uint64_t megaflow_hits;
+	uint64_t misses;
+	uint64_t microflow_evictions;
+	uint64_t megaflow_evictions;
+	uint64_t invalidations;
+} openflow_flowcache_type;
+
+/**
+ * Represents the packet and byte counters of one thread for a flowtable
+ * entry, and when the thread last matched it.
+ */
+typedef struct
+{
+	uint64_t packet_count;
+	uint64_t byte_count;
+	uint64_t last_matched;
+} openflow_flowtable_counters_type;
+
+/**
+ * Represents the lookup state of one thread: whether it is inside a lookup,
+ * its flow caches and its share of the flow and table counters. Only the
+ * thread itself writes the counters; readers add them up.
+ */
+typedef struct
+{
+	// Nonzero while the thread uses the flowtable without its mutex
+	volatile uint32_t reading;
+	// Lookups nest when an action sends a packet back to the table
+	uint32_t depth;
+	// One for each flowtable entry, by index
+	openflow_flowtable_counters_type *counters;
+	uint32_t num_counters;
+	// One for each table
+	uint64_t lookup_count[OPENFLOW_NUM_TABLES];
+	uint64_t matched_count[OPENFLOW_NUM_TABLES];
+	openflow_flowcache_type cache;
+} openflow_flowtable_thread_type;
+
+/**
+ * Represents the counters of one thread for a physical port.
+ */
+typedef struct
+{
+	uint64_t rx_packets;
+	uint64_t tx_packets;
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+} openflow_port_counters_type;
+
+/**
+ * Adds to a per-thread counter. Only the owning thread writes it, so this is
+ * a plain add; the atomic store keeps readers on other threads from seeing a
+ * torn value.
+ */
+static inline void openflow_count(uint64_t *counter, uint64_t n)
+{
+	__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * Represents a packet kept for the controller.
+ */
+typedef struct
+{
+	// The buffer ID sent with the packet in message, or
+	// OPENFLOW_PKT_BUFFER_NONE if the buffer is free
+	uint32_t buffer_id;
+	// When the buffer may be reused for another packet
+	uint64_t expires;
+	gpacket_t packet;
+} openflow_pkt_buffer_type;
+
+/**
+ * Represents the packet in token bucket of a port. Tokens are counted in
+ * billionths of a packet, so that a nanosecond at the configured rate adds
+ * the rate in tokens.
+ */
+typedef struct
+{
+	pthread_mutex_t mutex;
+	uint64_t tokens;
+	uint64_t last_refill;
+	uint64_t sent;
+	uint64_t suppressed;
+} openflow_packet_in_limiter_type;
+
+/**
+ * Represents a message waiting to be sent to the controller.
+ */
+typedef struct
+{
+	uint8_t *data;
+	uint32_t length;
+} openflow_ctrl_iface_msg_type;
+
+// OpenFlow stats reply that is sent a message at a time
+typedef struct
+{
+	uint8_t active;
+	uint16_t type;
+	// Transaction ID of the request, in network byte order
+	uint32_t xid;
+	union
+	{
+		ofp_flow_stats_request flow;
+		ofp_aggregate_stats_request aggregate;
+		ofp_port_stats_request port;
+	} request;
+	// Where the next message continues, or OPENFLOW_FLOWTABLE_NIL after the
+	// last one
+	uint32_t cursor;
+	// Totals of an aggregate stats reply, in host byte order
+	ofp_aggregate_stats_reply aggregate;
+	// The message being sent, and its length if the send queue had no room
+	// for it yet
+	ofp_stats_reply *msg;
+	uint32_t pending;
+} openflow_ctrl_iface_stats_stream_type;
+
 #endif // ifndef __OPENFLOW_DEFS_H_
@@ -18,6 +18,15 @@
  */
 pthread_t openflow_flowtable_timeout_init();
 
+/**
+ * Removes the entries whose timeouts have gone off by the specified time
+ * and sends the flow removed messages for them. The timeout thread calls
+ * this every second.
+ *
+ * @param now The current time in seconds (see clockSeconds).
+ */
+void openflow_flowtable_expire(time_t now);
+
 /**
  * Initializes the flowtable.
  */
@@ -29,19 +38,69 @@ void openflow_flowtable_init(void);
 void openflow_flowtable_release(void);
 
 /**
- * Retrieves the matching flowtable entry for the specified packet.
+ * Retrieves the matching entry of the specified table for the specified
+ * packet and counts the packet against it. Flow mods wait until the entry
+ * is given back with openflow_flowtable_release_entry().
  *
  * @param packet    The specified packet.
+ * @param length    The length of the packet in bytes.
+ * @param table_id  The table to look the packet up in.
+ *
+ * @return The matching flowtable entry, or NULL if there is none.
+ */
+const openflow_flowtable_entry_type *openflow_flowtable_get_entry_for_packet(
+        gpacket_t *packet, uint32_t length, uint8_t table_id);
+
+/**
+ * Gives back an entry returned by openflow_flowtable_get_entry_for_packet.
+ *
+ * @param entry The entry (may be NULL).
+ */
+void openflow_flowtable_release_entry(const openflow_flowtable_entry_type *entry);
+
+/**
+ * Changes the maximum number of entries of the specified table, up to
+ * OPENFLOW_MAX_FLOWTABLE_ENTRIES. The flowtable, which holds the entries of
+ * all tables, can shrink only down to its highest active entry.
+ *
+ * @param table_id    The table.
+ * @param max_entries The new maximum.
+ *
+ * @return 0 if no error occurred, -1 otherwise.
+ */
+int32_t openflow_flowtable_set_max_entries(uint8_t table_id,
+        uint32_t max_entries);
+
+/**
+ * Returns the maximum number of entries of the specified table, or of all
+ * tables together for OPENFLOW_TABLE_ALL.
+ */
+uint32_t openflow_flowtable_get_max_entries(uint8_t table_id);
+
+/**
+ * Sets what the specified table does with packets that match none of its
+ * entries.
  *
- * @return The matching flowtable entry.
+ * @param table_id The table.
+ * @param miss     OPENFLOW_TABLE_MISS_CONTROLLER, OPENFLOW_TABLE_MISS_CONTINUE
+ *                 or OPENFLOW_TABLE_MISS_DROP.
+ *
+ * @return 0 if no error occurred, -1 otherwise.
+ */
+int32_t openflow_flowtable_set_table_miss(uint8_t table_id, uint8_t miss);
+
+/**
+ * Returns what the specified table does with packets that match none of its
+ * entries (OPENFLOW_TABLE_MISS_DROP for a table that does not exist).
  */
-openflow_flowtable_entry_type *openflow_flowtable_get_entry_for_packet(
-        gpacket_t *packet);
+uint8_t openflow_flowtable_get_table_miss(uint8_t table_id);
 
 /**
  * Applies the specified modification to the flowtable.
  *
  * @param modify_info The modification to apply to the flowtable.
+ * @param table_id    The table to apply it to. OPENFLOW_TABLE_ALL deletes
+ *                    from every table and adds to the first one.
  * @param error_type  A pointer to an error type variable that will be
  *                    populated (in network byte order) if an error occurs.
  * @param error_code  A pointer to an error code variable that will be
@@ -49,47 +108,70 @@ openflow_flowtable_entry_type *openflow_flowtable_get_entry_for_packet(
  *
  * @return 0 if no error occurred, -1 otherwise.
  */
-int32_t openflow_flowtable_modify(ofp_flow_mod *flow_mod, uint16_t *error_type,
-        uint16_t *error_code);
+int32_t openflow_flowtable_modify(ofp_flow_mod *flow_mod, uint8_t table_id,
+        uint16_t *error_type, uint16_t *error_code);
 
 /**
- * Gets the table statistics for the OpenFlow flowtable.
+ * Gets the table statistics for the specified table.
+ *
+ * @param table_id The table, below OPENFLOW_NUM_TABLES.
  *
- * @return The table statistics for the OpenFlow flowtable.
+ * @return The table statistics for the table.
  */
-ofp_table_stats openflow_flowtable_get_table_stats();
+ofp_table_stats openflow_flowtable_get_table_stats(uint8_t table_id);
 
 /**
- * Retrieves the flow statistics for the first matching flow.
+ * Holds off flow expiry while a stats reply is read from the flowtable a
+ * part at a time, so that entries do not disappear between the parts.
+ */
+void openflow_flowtable_stats_begin(void);
+
+/**
+ * Ends what openflow_flowtable_stats_begin started.
+ */
+void openflow_flowtable_stats_end(void);
+
+/**
+ * Writes the flow statistics of the entries that match the specified match,
+ * each followed by its actions, as the body of a flow stats reply. Reading
+ * starts at the entry the cursor points to and stops when the next entry
+ * does not fit in the buffer or OPENFLOW_FLOWTABLE_STATS_BATCH entries have
+ * been looked at.
  *
- * This function returns dynamically allocated memory referenced by
- * ptr_to_flow_stats and ptr_to_actions which must be manually free.
+ * @param match    A pointer to the match to match entries against.
+ * @param out_port The output port which entries are required to have an
+ *                 action for to be matched, in network byte order.
+ * @param table_id The table to read from, or OPENFLOW_TABLE_ALL.
+ * @param cursor   A pointer to the index to start reading at, 0 for the first
+ *                 part. It is advanced past the entries read, and set to
+ *                 OPENFLOW_FLOWTABLE_NIL once every entry has been read.
+ * @param buf      The buffer to write to.
+ * @param len      The length of the buffer in bytes.
  *
- * @param match             A pointer to the match to match entries against.
- *                          The flow statistics for the first matching entry
- *                          will be returned.
- * @param out_port          The output port which entries are required to have
- *                          an action for to be matched, in network byte order.
- * @param index             The index at which to begin searching the
- *                          flowtable.
- * @param match_index       A pointer to a variable used to store the index of
- *                          the matching entry, if any.
- * @param table_index       The index of the table to read from.
- * @param ptr_to_flow_stats A pointer to an ofp_flow_stats struct pointer. The
- *                          inner pointer will be replaced by a pointer to the
- *                          matching ofp_flow_stats struct if one is found.
- * @param ptr_to_actions    A pointer to an openflow_flowtable_action_type
- *                          struct pointer. The inner pointer will be replaced
- *                          by a pointer to the matching
- *                          openflow_flowtable_action_type struct if one is
- *                          found.
+ * @return The number of bytes written, which may be 0 even if the cursor
+ *         did not reach the end.
+ */
+uint32_t openflow_flowtable_get_flow_stats(ofp_match *match,
+        uint16_t out_port, uint8_t table_id, uint32_t *cursor, uint8_t *buf,
+        uint32_t len);
+
+/**
+ * Adds the statistics of the entries that match the specified match to an
+ * aggregate stats reply, reading at most OPENFLOW_FLOWTABLE_STATS_BATCH
+ * entries starting at the entry the cursor points to.
  *
- * @return 1 if a match is found, 0 otherwise.
+ * @param match    A pointer to the match to match entries against.
+ * @param out_port The output port which entries are required to have an
+ *                 action for to be matched, in network byte order.
+ * @param table_id The table to read from, or OPENFLOW_TABLE_ALL.
+ * @param cursor   A pointer to the index to start reading at, 0 for the first
+ *                 part. It is advanced past the entries read, and set to
+ *                 OPENFLOW_FLOWTABLE_NIL once every entry has been read.
+ * @param body     The aggregate stats to add to, in host byte order.
  */
-int32_t openflow_flowtable_get_entry_stats(ofp_match *match, uint16_t out_port,
-        uint32_t index, uint32_t *match_index, uint8_t table_index,
-        ofp_flow_stats **ptr_to_flow_stats,
-        openflow_flowtable_action_type **ptr_to_actions);
+void openflow_flowtable_get_aggregate_stats(ofp_match *match,
+        uint16_t out_port, uint8_t table_id, uint32_t *cursor,
+        ofp_aggregate_stats_reply *body);
 
 /**
  * Prints the specified OpenFlow flowtable entry to the console.
@@ -106,18 +188,29 @@ void openflow_flowtable_print_entry(uint32_t index);
 void openflow_flowtable_print_entry_stat(uint32_t index);
 
 /**
- * Prints all OpenFlow flowtable entries to the console.
+ * Prints the active OpenFlow flowtable entries to the console.
  */
 void openflow_flowtable_print_entries();
 
 /**
- * Prints the statistics for all entries in the flowtable.
+ * Prints the statistics for all active entries in the flowtable.
  */
 void openflow_flowtable_print_entry_stats();
 
 /**
- * Prints the statistics for the flowtable.
+ * Prints the statistics for every table of the flowtable.
  */
 void openflow_flowtable_print_table_stats();
 
+/**
+ * Prints how the flowtable entries are organized for lookups.
+ */
+void openflow_flowtable_print_lookup_info(void);
+
+/**
+ * Prints the hit, miss and eviction counters of the microflow and megaflow
+ * caches in front of the flowtable.
+ */
+void openflow_flowtable_print_cache_stats(void);
+
 #endif // ifndef __OPENFLOW_FLOWTABLE_H_
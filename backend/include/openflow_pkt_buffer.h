@@ -0,0 +1,65 @@
+/**
+ * openflow_pkt_buffer.h - OpenFlow packet in buffers and rate limiting
+ */
+
+#ifndef __OPENFLOW_PKT_BUFFER_H_
+#define __OPENFLOW_PKT_BUFFER_H_
+
+#include <stdint.h>
+
+#include "message.h"
+#include "openflow_defs.h"
+
+/**
+ * Initializes the packet buffers and the packet in rate limiters.
+ */
+void openflow_pkt_buffer_init();
+
+/**
+ * Keeps a copy of the specified packet for the controller.
+ *
+ * @param packet The packet to keep.
+ * @param length The length of the packet data in bytes.
+ *
+ * @return The buffer ID of the copy, or OPENFLOW_PKT_BUFFER_NONE if all
+ *         buffers are in use.
+ */
+uint32_t openflow_pkt_buffer_store(gpacket_t *packet, uint32_t length);
+
+/**
+ * Takes a packet out of its buffer, which becomes free.
+ *
+ * @param buffer_id The buffer ID in host byte order.
+ * @param packet    A pointer to the packet to fill in.
+ *
+ * @return 0, OPENFLOW_PKT_BUFFER_ERR_EMPTY if the packet was already taken or
+ *         OPENFLOW_PKT_BUFFER_ERR_UNKNOWN if the buffer ID is not valid (any
+ *         more).
+ */
+int32_t openflow_pkt_buffer_retrieve(uint32_t buffer_id, gpacket_t *packet);
+
+/**
+ * Takes a packet in token for the specified port, counting the packet in as
+ * suppressed if there is none.
+ *
+ * @param gnet_port_num The GNET port number the packet came in on.
+ *
+ * @return 1 if the packet in may be sent, 0 if not.
+ */
+uint8_t openflow_pkt_buffer_admit(uint16_t gnet_port_num);
+
+/**
+ * Sets the packet in rate limit of every port.
+ *
+ * @param rate  The number of packet in messages per second, or 0 for no
+ *              limit.
+ * @param burst The number of packet in messages that may be sent at once.
+ */
+void openflow_pkt_buffer_set_rate(uint32_t rate, uint32_t burst);
+
+/**
+ * Prints the packet buffer and packet in counters to the console.
+ */
+void openflow_pkt_buffer_print_stats();
+
+#endif // ifndef __OPENFLOW_PKT_BUFFER_H_
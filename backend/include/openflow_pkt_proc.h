@@ -33,7 +33,7 @@ int32_t openflow_pkt_proc_handle_packet(gpacket_t *packet);
  *
  * @return 0, or a negative value if an error occurred.
  */
-int32_t openflow_pkt_proc_perform_action(ofp_action_header *header,
+int32_t openflow_pkt_proc_perform_action(const ofp_action_header *header,
         gpacket_t *packet);
 
 #endif // ifndef __OPENFLOW_PKT_PROC_H_
@@ -36,7 +36,9 @@ typedef struct _pktcore_t
 	pthread_mutex_t wqlock;               // lock for work queue
 	simplequeue_t *outputQ;
 	simplequeue_t *workQ;
-	simplequeue_t *openflowWorkQ;
+	simplequeue_t *openflowWorkQ[MAX_OPENFLOW_WORKERS];   // one for each OpenFlow worker
+	pthread_t openflowworker[MAX_OPENFLOW_WORKERS];
+	int openflowworkers;
 	Map *queues;
 	int lastqid;
 	int packetcnt;
@@ -61,11 +63,12 @@ int delPktCoreQueue(pktcore_t *pcore, char *qname);
 
 pthread_t PktCoreSchedulerInit(pktcore_t *pcore);
 int PktCoreWorkerInit(pktcore_t *pcore);
-int PktCoreOpenflowWorkerInit(pktcore_t *pcore);
-void *openflowPacketProcessor(void *pc);
+int PktCoreOpenflowWorkerInit(pktcore_t *pcore, int nworkers);
+void *openflowPacketProcessor(void *wq);
 void *packetProcessor(void *pc);
 
 int enqueuePacket(pktcore_t *pcore, gpacket_t *in_pkt, int pktsize, uint8_t openflow);
+char *tagPacket(pktcore_t *pcore, gpacket_t *in_pkt);
 
 // Function prototypes from roundrobin.c and wfq.c??
 void *weightedFairScheduler(void *pc);
@@ -0,0 +1,45 @@
+/*
+ * pktgen.h (header file for the synthetic packet generator)
+ *
+ * Builds Ethernet/IPv4/UDP or TCP frames from a template and sends them
+ * straight out of an interface with its todev routine.
+ */
+
+#ifndef __PKTGEN_H__
+#define __PKTGEN_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "grouter.h"
+
+#define PKTGEN_SIZE_FIXED         1
+#define PKTGEN_SIZE_UNIFORM       2        // uniform between min and max
+#define PKTGEN_SIZE_IMIX          3        // 7:4:1 mix of 64, 576 and 1514 byte frames
+
+#define PKTGEN_MIN_FRAME          60       // Ethernet minimum without FCS
+
+
+typedef struct _pktgen_config_t
+{
+	int iface;
+	int proto;                             // UDP_PROTOCOL or TCP_PROTOCOL
+	uchar dst_mac[6];
+	uint32_t src_ip;                       // host order
+	uint32_t dst_first, dst_last;          // destination range, host order
+	uint16_t sport, dport;
+	int size_mode;
+	int size_min, size_max;                // frame sizes including the Ethernet header
+	double rate;                           // packets per second, 0: as fast as possible
+	unsigned long count;                   // 0: until stopped
+	int running;
+	pthread_t threadid;
+	unsigned long sent, bytes;
+	double elapsed;
+} pktgen_config_t;
+
+
+int pktgenStart(pktgen_config_t *cfg);
+void pktgenStop();
+void pktgenShow();
+
+#endif
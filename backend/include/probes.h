@@ -0,0 +1,52 @@
+/*
+ * probes.h (USDT probes for bpftrace and perf)
+ *
+ * When the gRouter is built with <sys/sdt.h> (systemtap-sdt-dev) each probe
+ * is a single nop plus a note in the ELF file, so they stay in production
+ * builds and cost nothing until a tracer attaches. Without the header they
+ * compile to nothing. List them with
+ *
+ *      bpftrace -l 'usdt:/path/to/grouter:grouter:*'
+ *
+ * provider grouter:
+ *      rx(pkt, ifid, bytes)            a device driver received a packet
+ *      tx(pkt, ifid, bytes)            a packet is handed to a device driver
+ *      enqueue(qname, data, bytes)     an element is written to a simplequeue
+ *      dequeue(qname, data, bytes)     an element is read from a simplequeue
+ *      classify(pkt, qname)            the class queue picked for a packet
+ *      route_hit(dst, nexthop, ifid)   route lookup, addresses packed
+ *      route_miss(dst)                 as in TRACE_IP()
+ *      arp_miss(pkt, nexthop, ifid)    the packet waits for an ARP reply
+ *      drop(pkt, ifid, reason)         see drop.h for the reasons
+ *      flow_match(pkt, priority)       OpenFlow flowtable hit, priority as stored
+ *      flow_miss(pkt)                  OpenFlow flowtable miss
+ *      packet_in(pkt, reason)          packet sent to the OpenFlow controller
+ *      tcp_input(pkt, bytes)           a segment enters the lwIP TCP stack
+ *      tcp_output(pcb, local_port, remote_port)
+ *
+ * pkt is the gpacket_t, which keeps its address from rx to tx, so scripts
+ * can key per-packet state on it (see scripts/bpftrace).
+ */
+
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define PROBE0(name)                    DTRACE_PROBE(grouter, name)
+#define PROBE1(name, a)                 DTRACE_PROBE1(grouter, name, a)
+#define PROBE2(name, a, b)              DTRACE_PROBE2(grouter, name, a, b)
+#define PROBE3(name, a, b, c)           DTRACE_PROBE3(grouter, name, a, b, c)
+
+#else
+
+#define PROBE0(name)                    do { } while (0)
+#define PROBE1(name, a)                 do { } while (0)
+#define PROBE2(name, a, b)              do { } while (0)
+#define PROBE3(name, a, b, c)           do { } while (0)
+
+#endif
+
+#endif
@@ -23,5 +23,6 @@
 #define IEEE_802_2_DSAP_SNAP    0xAA
 #define IEEE_802_2_CTRL_8_BITS  0x03
 #define ETHERTYPE_IEEE_802_1Q   0x8100
+#define ETHERTYPE_MIN           0x0600          // smaller values are 802.3 lengths
 
 #endif
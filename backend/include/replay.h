@@ -0,0 +1,66 @@
+/*
+ * replay.h (header file for the pcap replay traffic engine)
+ *
+ * Frames from a pcap or pcap-ng capture are injected into the receive
+ * path of an interface (enqueuePacket) as if they had arrived on it.
+ */
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "grouter.h"
+
+#define REPLAY_MODE_ORIGINAL      1        // keep the inter-frame gaps of the capture
+#define REPLAY_MODE_PPS           2        // fixed packets per second
+#define REPLAY_MODE_FAST          3        // as fast as possible
+
+#define REPLAY_MAX_IFACES         16       // pcap-ng interface descriptions tracked
+
+
+typedef struct _replay_file_t
+{
+	uchar *base;                           // mmap'ed capture
+	size_t size;
+	int ng;                                // 1: pcap-ng, 0: pcap
+	int swapped;                           // capture written on the other endianness
+	int nsec;                              // pcap timestamps are in nanoseconds
+	size_t off;                            // iterator position
+	uint64_t tsdiv[REPLAY_MAX_IFACES];     // pcap-ng ticks per second, per interface
+	int linktype[REPLAY_MAX_IFACES];
+	int nifaces;
+	uint64_t lastts;
+} replay_file_t;
+
+typedef struct _replay_run_t
+{
+	unsigned long packets, bytes, drops, truncated, skipped;
+	double elapsed;                        // seconds
+} replay_run_t;
+
+typedef struct _replay_config_t
+{
+	char path[MAX_NAME_LEN];
+	int iface;                             // interface the frames arrive on
+	int mode;
+	double pps;
+	int loops;                             // 0: until stopped
+	int running;
+	int loop;                              // current loop
+	pthread_t threadid;
+	replay_file_t file;
+	replay_run_t run;                      // current or last run
+	replay_run_t total;
+} replay_config_t;
+
+
+int replayOpen(replay_file_t *rf, char *path);
+int replayNext(replay_file_t *rf, uchar **data, uint32_t *caplen, uint32_t *origlen, uint64_t *ts);
+void replayRewind(replay_file_t *rf);
+void replayClose(replay_file_t *rf);
+int replayStart(char *path, int iface, int mode, double pps, int loops);
+void replayStop();
+void replayShow();
+
+#endif
@@ -12,13 +12,49 @@
 #include <slack/std.h>
 #include <slack/map.h>
 #include <slack/list.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "grouter.h"
+#include "clock.h"
+
+
+/*
+ * Queue statistics are kept in per-thread slots so that threads writing
+ * and reading the same queue do not share counter cache lines. Every
+ * counter is only changed with the queue lock (or the packet core lock
+ * for the drop counters) held, so threads that end up sharing a slot when
+ * there are more than QSTATS_SLOTS of them still count correctly.
+ */
+#define QSTATS_SLOTS                    32
+
+#define QSTATS_TAILDROP                 1
+#define QSTATS_REDDROP                  2
+
+typedef struct _qstats_slot_t
+{
+	uint64_t enq_pkts, enq_bytes;
+	uint64_t deq_pkts, deq_bytes;
+	uint64_t taildrops, reddrops;
+	uint64_t sojourn_sum, sojourn_min, sojourn_max;     // nanoseconds
+} __attribute__((aligned(64))) qstats_slot_t;
+
+
+// totals over all the slots, as returned by getQueueStats()
+typedef struct _qstats_t
+{
+	uint64_t enq_pkts, enq_bytes;
+	uint64_t deq_pkts, deq_bytes;
+	uint64_t taildrops, reddrops;
+	int maxdepth;
+	uint64_t sojourn_min, sojourn_avg, sojourn_max;     // nanoseconds
+} qstats_t;
 
 
 typedef struct _simplewrapper_t
 {
 	int size;
+	uint64_t enqtime;
 	void *data;
 } simplewrapper_t;
 
@@ -36,6 +72,10 @@ typedef struct _simplequeue_t
 	// following parameters are useful for statistics keeping
 	double prevaccesstime;
 	double avgbyterate;
+	uint64_t ratebytes;
+	uint64_t lastdeqtime;
+	int maxdepth;
+	qstats_slot_t stats[QSTATS_SLOTS];
 	// following parameters are useful for queueing discipline
 	char qdisc[MAX_NAME_LEN];
 	double delay_us;
@@ -57,6 +97,9 @@ int writeQueue(simplequeue_t *msgqueue, void *data, int size);
 int copy2Queue(simplequeue_t *msgqueue, void *data, int size);
 void computeAvgByteRate(simplequeue_t *sq, int size);
 double getAvgByteRate(simplequeue_t *sq);
+void countQueueDrop(simplequeue_t *sq, int reason);
+void getQueueStats(simplequeue_t *sq, qstats_t *st);
+void printSimpleQueueStats(simplequeue_t *sq);
 
 int readQueue(simplequeue_t *msgqueue, void **data, int *size);
 int peekQueue(simplequeue_t *msgqueue, void **data, int *size);
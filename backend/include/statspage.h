@@ -0,0 +1,149 @@
+/*
+ * statspage.h (layout of the shared memory statistics page)
+ *
+ * The gRouter publishes its counters in <config dir>/<router name>.stats,
+ * a file that external collectors map read-only and poll as often as they
+ * like without a system call into the router. A single thread in the router
+ * refreshes the page every interval_ms under a sequence lock: seq is odd
+ * while the page is being written, so a reader copies the page and retries
+ * if seq was odd or changed under it (see statsPageSnapshot below).
+ *
+ * This header is shared with the reader tool and must not depend on the
+ * rest of the gRouter headers. Fields are only ever appended; a reader
+ * should check magic and that version is at least the one it knows.
+ */
+
+#ifndef __STATS_PAGE_H__
+#define __STATS_PAGE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+
+#define STATS_PAGE_MAGIC                0x53545247      // "GRTS"
+#define STATS_PAGE_VERSION              2
+
+#define STATS_NAME_LEN                  32
+#define STATS_MAX_IFACES                64
+#define STATS_MAX_QUEUES                40
+#define STATS_DROP_REASONS              24
+
+#define STATS_DEFAULT_INTERVAL_MS       100
+
+
+typedef struct _stats_iface_t
+{
+	char name[STATS_NAME_LEN];
+	int32_t interface_id;
+	int32_t state;                      // 'U' or 'D'
+	int32_t mtu;
+	uint8_t mac_addr[6];
+	uint8_t ip_addr[4];                 // in the order the CLI prints it
+	uint8_t pad[6];
+	uint64_t rx_pkts, rx_bytes;
+	uint64_t tx_pkts, tx_bytes;
+} stats_iface_t;
+
+
+typedef struct _stats_queue_t
+{
+	char name[STATS_NAME_LEN];
+	int32_t depth, maxsize, maxdepth;
+	int32_t pad;
+	uint64_t enq_pkts, enq_bytes;
+	uint64_t deq_pkts, deq_bytes;
+	uint64_t taildrops, reddrops;
+	uint64_t sojourn_min_ns, sojourn_avg_ns, sojourn_max_ns;
+} stats_queue_t;
+
+
+typedef struct _stats_tables_t
+{
+	uint32_t routes, max_routes;
+	uint32_t arp_entries, max_arp_entries;
+	uint32_t arp_cache_entries, arp_cache_size;
+	uint32_t classes;
+	uint32_t filter_rules, max_filter_rules;
+	uint32_t pad;
+} stats_tables_t;
+
+
+typedef struct _stats_openflow_t
+{
+	uint32_t enabled;
+	uint32_t active_flows, max_flows;
+	uint32_t pad;
+	uint64_t lookups, matched;
+} stats_openflow_t;
+
+
+// drop counters by interface and reason (version 2); the reasons are named
+// in the page so readers need not know the router's list
+typedef struct _stats_drops_t
+{
+	uint32_t num_reasons;
+	uint32_t pad;
+	char reasons[STATS_DROP_REASONS][STATS_NAME_LEN];
+	uint64_t ifaces[STATS_MAX_IFACES][STATS_DROP_REASONS];  // rows as in ifaces[] of the page
+	uint64_t local[STATS_DROP_REASONS];                     // no interface (generated here)
+} stats_drops_t;
+
+
+typedef struct _stats_page_t
+{
+	// fixed at creation
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;                      // sizeof(stats_page_t) of the writer
+	volatile uint32_t seq;              // odd while an update is in progress
+
+	// everything from here on is rewritten by each update
+	uint64_t update_ns;                 // CLOCK_MONOTONIC of the last update
+	uint64_t update_realtime_ns;        // CLOCK_REALTIME of the last update
+	uint64_t updates;
+	uint32_t interval_ms;
+	int32_t pid;
+	char router_name[STATS_NAME_LEN];
+
+	uint32_t num_ifaces;
+	uint32_t num_queues;
+	stats_tables_t tables;
+	stats_openflow_t openflow;
+	stats_iface_t ifaces[STATS_MAX_IFACES];
+	stats_queue_t queues[STATS_MAX_QUEUES];
+	stats_drops_t drops;
+} stats_page_t;
+
+#define STATS_PAGE_BODY                 offsetof(stats_page_t, update_ns)
+
+
+/*
+ * Copies a consistent snapshot of the page into snap. Returns 0 on success
+ * and -1 if the writer kept the page busy for all of the given tries.
+ */
+static inline int statsPageSnapshot(const stats_page_t *page, stats_page_t *snap, int tries)
+{
+	uint32_t s1, s2;
+
+	while (tries-- > 0)
+	{
+		s1 = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+		if (s1 & 1)
+			continue;
+		memcpy(snap, (const void *)page, sizeof(stats_page_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		s2 = __atomic_load_n(&page->seq, __ATOMIC_RELAXED);
+		if (s1 == s2)
+			return 0;
+	}
+	return -1;
+}
+
+
+// page management in the router (statspage.c)
+int statsPageInit(char *config_dir, char *rname);
+void statsPageSetInterval(int interval_ms);
+void statsPageShow();
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ * timer.h (the router timer service)
+ *
+ * One thread calls the handlers of every armed timer when they are due,
+ * sleeping until the earliest deadline in between, so modules that need
+ * timeouts (the lwIP TCP timers, for one) do not each run a thread that
+ * polls the clock.
+ *
+ * A timer is a router_timer_t owned by the caller, zeroed before it is
+ * first started. timerStart() arms it to fire after delay_ms and then
+ * every period_ms, or once if period_ms is 0; starting an armed timer
+ * rearms it. Handlers run on the timer thread without any timer lock held
+ * and may start or stop timers, their own included, but they hold up every
+ * other timer while they run.
+ *
+ * timerStop() disarms a timer and waits for its handler if it is running
+ * on the timer thread, so the timer and its argument may be freed when it
+ * returns. It must not be called while holding a lock the handler takes.
+ */
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <stdint.h>
+
+typedef void (*timer_handler_t)(void *arg);
+
+typedef struct _router_timer_t
+{
+	struct _router_timer_t *next;       // next armed timer, by deadline
+	uint64_t expires;                   // CLOCK_MONOTONIC deadline in ns
+	uint64_t period_ns;                 // 0 for a one shot timer
+	timer_handler_t handler;
+	void *arg;
+	int armed;
+} router_timer_t;
+
+
+int timerInit();
+void timerStart(router_timer_t *timer, int delay_ms, int period_ms, timer_handler_t handler, void *arg);
+void timerStop(router_timer_t *timer);
+
+#endif
@@ -9,13 +9,59 @@
 #ifndef TUN_H
 #define	TUN_H
 
+#include <stdint.h>
 #include "vpl.h"
 #include "grouter.h"
+#include "gnet.h"
+#include "message.h"
+#include "simplequeue.h"
+
+/*
+ * Batched tunnel mode. Frames are packed into fixed size segments, each
+ * frame preceded by a tun_frame_hdr_t. A batch of segments leaves in one
+ * sendmsg() using UDP_SEGMENT; the receiver reads with recvmmsg() and
+ * UDP_GRO and splits the (possibly coalesced) payload back into segments
+ * and frames. A zero length header marks the padding at the end of a segment.
+ *
+ * The kernel only segments datagrams that fit the path MTU, so the segment
+ * size follows the MTU of the route to the peer. A frame too big for a
+ * segment goes out in a datagram of its own, which IP fragments as it does
+ * in per packet mode.
+ */
+#define TUN_FRAME_VERSION       1
+#define TUN_SEG_MAX             (sizeof(tun_frame_hdr_t) + sizeof(pkt_data_t))
+#define TUN_SEG_MIN             512
+#define TUN_UDP_OVERHEAD        28                 // IPv4 and UDP headers
+#define TUN_DEFAULT_PATH_MTU    1500
+#define TUN_BATCH_MAX_SEGS      32                 // UDP_SEGMENT allows 64, keep under 64KB
+#define TUN_BATCH_MAX_FRAMES    64
+#define TUN_BATCH_QSIZE         1024
+#define TUN_RX_VLEN             8
+#define TUN_RX_BUF_SIZE         65536
+
+typedef struct _tun_frame_hdr_t
+{
+	uint8_t version;
+	uint8_t flags;
+	uint16_t len;                                   // frame length (network order)
+} tun_frame_hdr_t;
+
+typedef struct _tun_batch_t
+{
+	int gso;                                        // UDP_SEGMENT usable on this socket
+	int gro;                                        // UDP_GRO enabled on this socket
+	int seg_size;                                   // bytes per segment
+	simplequeue_t *txq;
+	pthread_t txthread;
+	unsigned long tx_frames, tx_calls, rx_frames, rx_calls, rx_errors;
+} tun_batch_t;
 
 void *toTunDev(void *arg);
 void* fromTunDev(void *arg);
 vpl_data_t *tun_connect(short int src_port, uchar* src_IP,
                         short int dst_port, uchar* dst_IP);
+int tun_enable_batch(interface_t *iface);
+void tun_disable_batch(interface_t *iface);
 
 
 #endif	/* TUN_H */
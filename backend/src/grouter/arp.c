@@ -18,6 +18,9 @@
 #include "moduledefs.h"
 #include "grouter.h"
 #include "packetcore.h"
+#include "drop.h"
+#include "logging.h"
+#include "probes.h"
 
 
 int tbl_replace_indx;            // overwrite this element if no free space in ARP table
@@ -52,18 +55,16 @@ void ARPInit()
 
 int ARPSend2Output(gpacket_t *pkt)
 {
-  int vlevel;
-
   if (pkt == NULL)
   {
     verbose(1, "[ARPSend2Output]:: NULL pointer error... nothing sent");
     return EXIT_FAILURE;
   }
 
-  vlevel = prog_verbosity_level();
-  if (vlevel >= 3)
-    printGPacket(pkt, vlevel, "ARP_ROUTINE");
+  if (LOG_ENABLED(3))
+    printGPacket(pkt, log_level, "ARP_ROUTINE");
 
+  LATENCY_STAMP(pkt, LAT_OUTQ);
   return writeQueue(pcore->outputQ, (void *)pkt, sizeof(gpacket_t));
 }
 
@@ -86,6 +87,8 @@ int ARPResolve(gpacket_t *in_pkt)
   {
     // no ARP match, buffer and send ARP request for next
     verbose(2, "[ARPResolve]:: buffering packet, sending ARP request");
+    TRACE(TRACE_ARP_MISS, TRACE_IP(in_pkt->frame.nxth_ip_addr), in_pkt->frame.dst_interface, 0);
+    PROBE3(arp_miss, in_pkt, TRACE_IP(in_pkt->frame.nxth_ip_addr), in_pkt->frame.dst_interface);
     ARPAddBuffer(in_pkt);
     in_pkt->frame.arp_bcast = TRUE;                        // tell gnet this is bcast to prevent recursive ARP lookup!
     // create a new message for ARP request
@@ -120,6 +123,7 @@ void ARPProcess(gpacket_t *pkt)
   if ((ntohs(apkt->hw_addr_type) != ETHERNET_PROTOCOL) || (ntohs(apkt->arp_prot) != IP_PROTOCOL))
   {
     verbose(2, "[ARPProcess]:: unknown hwtype or protocol, dropping ARP packet");
+    dropPacket(pkt, pkt->frame.src_interface, DROP_UNKNOWN_PROTO);
     return;
   }
 
@@ -135,6 +139,7 @@ void ARPProcess(gpacket_t *pkt)
 
     verbose(2, "[APRProcess]:: packet destined for %s, dropping",
         IP2Dot(tmpbuf, gNtohl((uchar *)tmpbuf, apkt->dst_ip_addr)));
+    dropPacket(pkt, pkt->frame.src_interface, DROP_NOT_FOR_ME);
     return;
   }
 
@@ -416,8 +421,9 @@ void ARPAddBuffer(gpacket_t *in_pkt)
   }
 
   // No empty spot? Replace a packet, we need to deallocate the old packet
-  free(ARPbuffer[i].wait_msg);
-  ARPbuffer[i].wait_msg = cppkt;
+  dropPacket(ARPbuffer[buf_replace_indx].wait_msg,
+             ARPbuffer[buf_replace_indx].wait_msg->frame.src_interface, DROP_ARP_EVICTED);
+  ARPbuffer[buf_replace_indx].wait_msg = cppkt;
   verbose(2, "[addARPBuffer]:: buffer full, packet buffered to replaced entry %d",
       buf_replace_indx);
   buf_replace_indx = (buf_replace_indx + 1) % MAX_ARP_BUFFERS; // adjust for FIFO
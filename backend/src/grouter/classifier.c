@@ -15,6 +15,7 @@
 #include "classspec.h"
 #include "classifier.h"
 #include "ip.h"
+#include "protocols.h"
 
 #include <slack/std.h>
 #include <slack/err.h>
@@ -245,39 +246,19 @@ int insertTOSSpec(classlist_t *clas, char *cname, int tos)
 }
 
 
-int compareIP2Spec(uchar ip[], ip_spec_t *ips)
+/*
+ * The spec address is kept in host order (first octet last) like all the
+ * addresses of the router; ip is packed the same way (see parsePacket).
+ */
+int compareIP2Spec(uint32_t ip, ip_spec_t *ips)
 {
-	int preflen;
-	uchar spec[4];
-	char tmpbuf[MAX_TMPBUF_LEN];
-	uchar temp[4] = {0,0,0,0}, mask, tbyte = 0;
-	int prefbytes;
-	int i, j, rembits;
+	uint32_t mask;
 
 	if (ips == NULL) return 1;
+	if (ips->preflen <= 0) return 1;
 
-	preflen = ips->preflen;
-	prefbytes = preflen/8;
-
-	bcopy(gHtonl(tmpbuf, ips->ip_addr), spec, 4);
-
-	for (i = 0; i < prefbytes; i++)
-		temp[i] = ip[i];
-
-	if (prefbytes < 4)
-	{
-		rembits = preflen - (prefbytes * 8);
-		mask = 0x80;
-
-		for (j = 0; j < rembits; j++)
-		{
-			tbyte = tbyte | mask;
-			mask = mask >> 1;
-		}
-
-		temp[prefbytes] = ip[prefbytes] & tbyte;
-	}
-	return COMPARE_IP(temp, spec) == 0;
+	mask = (ips->preflen >= 32) ? 0xFFFFFFFF : ~(0xFFFFFFFF >> ips->preflen);
+	return (ip & mask) == PACK_IP(ips->ip_addr);
 }
 
 
@@ -298,18 +279,33 @@ int compareTos2Spec(int tos, int tspec)
 
 
 /*
- * TODO: What happened to the port range check? Not implemented?
- * Returns 1 if the rule given by cdef matches the packet and 0 otherwise.
+ * A port range only matches TCP and UDP packets that are not fragments;
+ * 0 -- 0 is any port.
  */
-int isRuleMatching(classdef_t *cdef, gpacket_t *in_pkt)
+int comparePort2Spec(pkt_meta_t *meta, int port, port_range_t *prs)
 {
-
-	ip_packet_t *ip_pkt = (ip_packet_t *)&in_pkt->data.data;
-
-	return compareIP2Spec(ip_pkt->ip_src, cdef->srcspec) *
-		compareIP2Spec(ip_pkt->ip_dst, cdef->dstspec) *
-		compareProt2Spec(ip_pkt->ip_prot, cdef->prot) *
-		compareTos2Spec(ip_pkt->ip_tos, cdef->tos);
+	if ((prs == NULL) || ((prs->minport == 0) && (prs->maxport == 0))) return 1;
+	if (!(meta->flags & PKT_META_L4) ||
+	    ((meta->nw_proto != TCP_PROTOCOL) && (meta->nw_proto != UDP_PROTOCOL)))
+		return 0;
+	return (port >= prs->minport) && (port <= prs->maxport);
 }
 
 
+/*
+ * Returns 1 if the rule given by cdef matches the packet and 0 otherwise.
+ * Only the parsed headers are looked at, so testing a rule is a handful of
+ * compares however many rules the filter or the queues have.
+ */
+int isRuleMatching(classdef_t *cdef, gpacket_t *in_pkt)
+{
+	pkt_meta_t *meta = packetMeta(in_pkt);
+	int ip = meta->flags & PKT_META_IP;
+
+	return compareIP2Spec(meta->nw_src, cdef->srcspec) &&
+		compareIP2Spec(meta->nw_dst, cdef->dstspec) &&
+		compareProt2Spec(ip ? meta->nw_proto : 0, cdef->prot) &&
+		compareTos2Spec(ip ? meta->nw_tos : 0, cdef->tos) &&
+		comparePort2Spec(meta, meta->tp_src, cdef->srcports) &&
+		comparePort2Spec(meta, meta->tp_dst, cdef->dstports);
+}
@@ -32,6 +32,15 @@
 #include "filter.h"
 #include "classspec.h"
 #include "packetcore.h"
+#include "console.h"
+#include "replay.h"
+#include "pktgen.h"
+#include "latency.h"
+#include "statspage.h"
+#include "drop.h"
+#include "logging.h"
+#include "clock.h"
+#include "protocols.h"
 #include <slack/err.h>
 #include <slack/std.h>
 #include <slack/prog.h>
@@ -40,7 +49,10 @@
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "openflow_flowtable.h"
+#include "openflow_pkt_buffer.h"
+#include "openflow_ctrl_iface.h"
 #include <limits.h>
+#include <arpa/inet.h>
 #include <unistd.h>
 #include <stdbool.h>
 
@@ -103,6 +115,11 @@ int CLIInit(router_config *rarg)
     registerCLI("filter", filterCmd, SHELP_FILTER, USAGE_FILTER, LHELP_FILTER);
     registerCLI("openflow", openflowCmd, SHELP_OPENFLOW, USAGE_OPENFLOW, LHELP_OPENFLOW);
     registerCLI("gnc", gncCmd, SHELP_GNC, USAGE_GNC, LHELP_GNC);
+    registerCLI("replay", replayCmd, SHELP_REPLAY, USAGE_REPLAY, LHELP_REPLAY);
+    registerCLI("pktgen", pktgenCmd, SHELP_PKTGEN, USAGE_PKTGEN, LHELP_PKTGEN);
+    registerCLI("stats", statsCmd, SHELP_STATS, USAGE_STATS, LHELP_STATS);
+    registerCLI("show", showCmd, SHELP_SHOW, USAGE_SHOW, LHELP_SHOW);
+    registerCLI("trace", traceCmd, SHELP_TRACE, USAGE_TRACE, LHELP_TRACE);
 
     if (rarg->config_dir != NULL)
         chdir(rarg->config_dir);                  // change to the configuration directory
@@ -361,7 +378,7 @@ int getDevType(char *str)
  * ifconfig add eth1 -socket socketfile -addr IP_addr  -hwaddr MAC [-gateway GW] [-mtu N]
  * ifconfig add raw1 -bridge bridgeid -addr IP_addr
  * ifconfig add tap0 -device dev_location -addr IP_addr -hwaddr MAC
- * ifconfig add tun0 -dstip dst_ip -dstport portnum -addr IP_addr -hwaddr MAC
+ * ifconfig add tun0 -dstip dst_ip -dstport portnum -addr IP_addr -hwaddr MAC [-batch]
  * ifconfig del eth0|tap0
  * ifconfig show [brief|verbose]
  * ifconfig up eth0|tap0
@@ -374,12 +391,13 @@ void ifconfigCmd()
     interface_t *iface;
     char dev_name[MAX_DNAME_LEN], con_sock[MAX_NAME_LEN], dev_type[MAX_NAME_LEN], raw_bridge[MAX_NAME_LEN];
     uchar mac_addr[6], ip_addr[4], gw_addr[4], dst_ip[4];
-    int mtu, interface, mode;
+    int mtu, interface, mode, batch;
     short int dst_port;
 
     // set default values for optional parameters
     bzero(gw_addr, 4);
     mtu = DEFAULT_MTU;
+    batch = 0;
     mode = NORMAL_LISTING;
 
     // we have already matched ifconfig... now parsing rest of the parameters.
@@ -445,14 +463,15 @@ void ifconfigCmd()
             {
                 next_tok = strtok(NULL, " \n");
                 mtu = atoi(next_tok);
-            }
+            } else if (!strcmp("-batch", next_tok))
+                batch = 1;
 
         if (strcmp(dev_type, "eth") == 0)
             iface = GNETMakeEthInterface(con_sock, dev_name, mac_addr, ip_addr, mtu, 0);
         else if (strcmp(dev_type, "tap") == 0)
             iface = GNETMakeTapInterface(dev_name, mac_addr, ip_addr);
         else if (strcmp(dev_type, "tun") == 0)
-            iface = GNETMakeTunInterface(dev_name, mac_addr, ip_addr, dst_ip, dst_port);
+            iface = GNETMakeTunInterface(dev_name, mac_addr, ip_addr, dst_ip, dst_port, batch);
         else if (strcmp(dev_type, "raw") == 0) 
             iface = GNETMakeRawInterface(dev_name, ip_addr, raw_bridge);
         else {
@@ -643,11 +662,18 @@ void gncTerminate() {
  */
 void gncCmd() {
 
-    // initialize LWIP code
-    memp_init();
-    pbuf_init();
-    udp_init();
-    tcp_init();
+    // initialize LWIP code, once: resetting the pools under PCBs that are
+    // still registered would corrupt them
+    static bool lwip_ready = false;
+    LOCK_TCPIP_CORE();
+    if (!lwip_ready) {
+        memp_init();
+        pbuf_init();
+        udp_init();
+        tcp_init();
+        lwip_ready = true;
+    }
+    UNLOCK_TCPIP_CORE();
 
     char *next_tok = next_arg(" \n");
     if (next_tok == NULL)
@@ -666,11 +692,13 @@ void gncCmd() {
             uint16_t port = atoi(next_tok);
 
             // create and initialize pcb to listen to TCP connections at the specified port
+            LOCK_TCPIP_CORE();
             struct tcp_pcb * pcb = tcp_new();
             uchar any[4] = {0,0,0,0};
             err_t err = tcp_bind(pcb, any, port);
             pcb = tcp_listen(pcb);
             tcp_accept(pcb, tcp_accept_callback);
+            UNLOCK_TCPIP_CORE();
 
             // keep sending user input with the TCP connection
             char payload[DEFAULT_MTU];
@@ -678,10 +706,12 @@ void gncCmd() {
             gncTerm = false;
             while (!gncTerm) {
                 fgets(payload, sizeof(payload), stdin);
+                LOCK_TCPIP_CORE();
                 err_t e1 = tcp_write (pcb_established, payload, strlen(payload), TCP_WRITE_FLAG_MORE | TCP_WRITE_FLAG_COPY);
                 if (e1 != ERR_OK)
                     printf("tcp write error: %d\n", e1);
                 err_t e2 = tcp_output(pcb_established);
+                UNLOCK_TCPIP_CORE();
                 if (e1 != ERR_OK)
                     printf("tcp output error: %d\n", e2);
             }
@@ -690,7 +720,9 @@ void gncCmd() {
             redefineSignalHandler(SIGINT, dummyFunctionCopy);
 
             // remove and free pcb
+            LOCK_TCPIP_CORE();
             tcp_shutdown(pcb, 1, 1);
+            UNLOCK_TCPIP_CORE();
         }
         // gnc <host> <port>
         else {
@@ -706,11 +738,13 @@ void gncCmd() {
             u16_t port = atoi(next_tok);
 
             // create and initialize pcb to make a TCP connection at the specified host and port
+            LOCK_TCPIP_CORE();
             struct tcp_pcb * pcb = tcp_new();
             err_t e0 = tcp_connect(pcb, ipaddr, port, NULL);
             if (e0 != ERR_OK)
                 printf("tcp connect error: %d\n", e0);
             tcp_recv(pcb, tcp_recv_callback);
+            UNLOCK_TCPIP_CORE();
 
             // keep sending user input with the TCP connection
             char payload[DEFAULT_MTU];
@@ -718,10 +752,12 @@ void gncCmd() {
             gncTerm = false;
             while (!gncTerm) {
                 fgets(payload, sizeof(payload), stdin);
+                LOCK_TCPIP_CORE();
                 err_t e1 = tcp_write (pcb, payload, strlen(payload), TCP_WRITE_FLAG_MORE | TCP_WRITE_FLAG_COPY);
                 if (e1 != ERR_OK)
                     printf("tcp write error: %d\n", e1);
                 err_t e2 = tcp_output(pcb);
+                UNLOCK_TCPIP_CORE();
                 if (e2 != ERR_OK)
                     printf("tcp output error: %d\n", e2);
             }
@@ -730,7 +766,9 @@ void gncCmd() {
             redefineSignalHandler(SIGINT, dummyFunctionCopy);
 
             // remove and free pcb
+            LOCK_TCPIP_CORE();
             err_t e3 = tcp_shutdown(pcb, 1, 1);
+            UNLOCK_TCPIP_CORE();
             if (e3 != ERR_OK)
                 printf("shutdown err: %d\n", e3);
         }
@@ -791,10 +829,12 @@ void gncCmd() {
             uint16_t port = atoi(next_tok);
 
             // create and initialze pcb to listen to UDP connections at the specified port
+            LOCK_TCPIP_CORE();
             struct udp_pcb * pcb = udp_new();
             udp_recv(pcb, recv_callback, pcb);
             uchar any[4] = {0,0,0,0};
             udp_bind(pcb, any, port);
+            UNLOCK_TCPIP_CORE();
 
             // keep sending user input with the TCP connection
             char payload[DEFAULT_MTU];
@@ -804,9 +844,11 @@ void gncCmd() {
                 fgets(payload, sizeof(payload), stdin);
 
                 // create pbuf and call udp_send()
+                LOCK_TCPIP_CORE();
                 struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, strlen(payload), PBUF_RAM);
                 p->payload = payload;
                 err_t e1 = send_fn(pcb, p);
+                UNLOCK_TCPIP_CORE();
                 if (e1 != ERR_OK)
                     printf("udp send error: %d\n", e1);
             }
@@ -815,7 +857,9 @@ void gncCmd() {
             redefineSignalHandler(SIGINT, dummyFunctionCopy);
 
             // remove and free pcb
+            LOCK_TCPIP_CORE();
             udp_remove(pcb);
+            UNLOCK_TCPIP_CORE();
         }
 
         // gnc -u <host> <port>
@@ -831,9 +875,11 @@ void gncCmd() {
             uint16_t port = atoi(next_tok);
 
             // create pcb and set its remote ip and remote port
+            LOCK_TCPIP_CORE();
             struct udp_pcb * pcb = udp_new();
             udp_connect(pcb, ipaddr, port);
             udp_recv(pcb, recv_callback, pcb);
+            UNLOCK_TCPIP_CORE();
 
             // keep sending user input with the TCP connection
             redefineSignalHandler(SIGINT, gncTerminate);
@@ -843,9 +889,11 @@ void gncCmd() {
                 fgets(payload, sizeof(payload), stdin);
 
                 // create pbuf and call udp_send()
+                LOCK_TCPIP_CORE();
                 struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, strlen(payload), PBUF_RAM);
                 p->payload = payload;
                 err_t e1 = send_fn(pcb, p);
+                UNLOCK_TCPIP_CORE();
                 if (e1 != ERR_OK)
                     printf("udp send error: %d\n", e1);
             }
@@ -854,7 +902,9 @@ void gncCmd() {
             redefineSignalHandler(SIGINT, dummyFunctionCopy);
 
             // remove and free pcb
+            LOCK_TCPIP_CORE();
             udp_remove(pcb);
+            UNLOCK_TCPIP_CORE();
 
         }
         if(rdp_mode) {
@@ -1183,6 +1233,7 @@ void pingCmd()
  * set raw-time [true | false ]
  * set update-delay value
  * set sched-cycle value
+ * set clock-resolution value
  */
 void setCmd()
 {
@@ -1202,17 +1253,23 @@ void setCmd()
                 verbose(1, "ERROR!! schedule cycle length should be positive \n");
         } else
             printf("\nSchedule cycle length: %d (microseconds) \n", rconfig.schedcycle);
+    } else if (!strcmp(next_tok, "clock-resolution"))
+    {
+        if ((next_tok = strtok(NULL, " \n")) != NULL)
+            clockSetResolution(atoi(next_tok));
+        else
+            clockShow();
     } else if (!strcmp(next_tok, "verbose"))
     {
         if ((next_tok = strtok(NULL, " \n")) != NULL)
         {
             level = atoi(next_tok);
             if ((level >= 0) && (level <= 6))
-                prog_set_verbosity_level(level);
+                setLogLevel(level);
             else
                 verbose(1, "[setCmd]:: ERROR!! level should be in [0..6] \n");
         } else
-            printf("\nVerbose level: %ld \n", prog_verbosity_level());
+            printf("\nVerbose level: %d (compiled up to %d) \n", log_level, LOG_MAX_LEVEL);
     } else if (!strcmp(next_tok, "raw-times"))
     {
         if ((next_tok = strtok(NULL, " \n")) != NULL)
@@ -1268,10 +1325,29 @@ void consoleCmd()
 {
     char *next_tok = strtok(NULL, " \n");
 
-    if (next_tok == NULL)
+    if ((next_tok == NULL) || !strcmp(next_tok, "show"))
         consoleGetState();
     else if (!strcmp(next_tok, "restart"))
         consoleRestart(rconfig.config_dir, rconfig.router_name);
+    else if (!strcmp(next_tok, "start"))
+        consoleSetEnabled(1);
+    else if (!strcmp(next_tok, "stop"))
+        consoleSetEnabled(0);
+    else if (!strcmp(next_tok, "snaplen"))
+    {
+        if ((next_tok = strtok(NULL, " \n")) == NULL)
+        {
+            printf("console:: missing snaplen value ..\n");
+            return;
+        }
+        consoleSetSnaplen(atoi(next_tok));
+    }
+    else if (!strcmp(next_tok, "filter"))
+    {
+        // the rest of the line is the filter expression
+        next_tok = strtok(NULL, "\n");
+        consoleSetFilter(next_tok);
+    }
     else
     {
         verbose(2, "[consoleCmd]:: Unknown port action requested \n");
@@ -1280,6 +1356,276 @@ void consoleCmd()
 }
 
 
+/*
+ * replay start -file capture -dev eth1 [-mode original|fast] [-pps N] [-loop N]
+ * replay stop
+ * replay show
+ * Injects the frames of a pcap/pcap-ng capture as if they arrived on the
+ * given interface. -loop 0 repeats until stopped.
+ */
+void replayCmd()
+{
+    char *next_tok = strtok(NULL, " \n");
+    char path[MAX_NAME_LEN];
+    int iface = -1, mode = REPLAY_MODE_ORIGINAL, loops = 1;
+    double pps = 0;
+
+    if ((next_tok == NULL) || !strcmp(next_tok, "show"))
+        replayShow();
+    else if (!strcmp(next_tok, "stop"))
+        replayStop();
+    else if (!strcmp(next_tok, "start"))
+    {
+        GET_NEXT_PARAMETER("-file", "replay:: missing -file spec ..");
+        strncpy(path, next_tok, MAX_NAME_LEN - 1);
+        path[MAX_NAME_LEN - 1] = '\0';
+        GET_NEXT_PARAMETER("-dev", "replay:: missing -dev spec ..");
+        iface = gAtoi(next_tok);
+
+        while ((next_tok = strtok(NULL, " \n")) != NULL)
+            if (!strcmp("-mode", next_tok))
+            {
+                if ((next_tok = strtok(NULL, " \n")) == NULL)
+                    break;
+                if (!strcmp(next_tok, "fast"))
+                    mode = REPLAY_MODE_FAST;
+                else if (!strcmp(next_tok, "original"))
+                    mode = REPLAY_MODE_ORIGINAL;
+                else
+                {
+                    printf("replay:: unknown mode %s ..\n", next_tok);
+                    return;
+                }
+            } else if (!strcmp("-pps", next_tok))
+            {
+                if ((next_tok = strtok(NULL, " \n")) == NULL)
+                    break;
+                mode = REPLAY_MODE_PPS;
+                pps = atof(next_tok);
+            } else if (!strcmp("-loop", next_tok))
+            {
+                if ((next_tok = strtok(NULL, " \n")) == NULL)
+                    break;
+                loops = atoi(next_tok);
+            }
+
+        replayStart(path, iface, mode, pps, loops);
+    }
+    else
+        printf("replay:: unknown action %s .. type help replay for usage.\n", next_tok);
+}
+
+
+/*
+ * pktgen start -dev eth1 -dst IP[-IP] [-src IP] [-proto udp|tcp] [-size N|MIN-MAX|imix]
+ *              [-rate PPS] [-count N] [-dstmac MAC] [-sport N] [-dport N]
+ * pktgen stop
+ * pktgen show
+ */
+void pktgenCmd()
+{
+    char *next_tok = strtok(NULL, " \n");
+    char *dash;
+    pktgen_config_t cfg;
+    interface_t *iface;
+    struct in_addr addr;
+    uchar ipbuf[4];
+
+    if ((next_tok == NULL) || !strcmp(next_tok, "show"))
+    {
+        pktgenShow();
+        return;
+    }
+    else if (!strcmp(next_tok, "stop"))
+    {
+        pktgenStop();
+        return;
+    }
+    else if (strcmp(next_tok, "start"))
+    {
+        printf("pktgen:: unknown action %s .. type help pktgen for usage.\n", next_tok);
+        return;
+    }
+
+    bzero(&cfg, sizeof(cfg));
+    cfg.proto = UDP_PROTOCOL;
+    cfg.size_mode = PKTGEN_SIZE_FIXED;
+    cfg.size_min = cfg.size_max = PKTGEN_MIN_FRAME;
+    cfg.sport = cfg.dport = 9;                                  // discard
+    memset(cfg.dst_mac, 0xFF, 6);
+
+    GET_NEXT_PARAMETER("-dev", "pktgen:: missing -dev spec ..");
+    cfg.iface = gAtoi(next_tok);
+    if ((iface = findInterface(cfg.iface)) == NULL)
+    {
+        printf("pktgen:: interface %s does not exist ..\n", next_tok);
+        return;
+    }
+    cfg.src_ip = ntohl(*((uint32_t *)gHtonl(ipbuf, iface->ip_addr)));
+
+    GET_NEXT_PARAMETER("-dst", "pktgen:: missing -dst spec ..");
+    if ((dash = strchr(next_tok, '-')) != NULL)
+        *dash++ = '\0';
+    if (inet_aton(next_tok, &addr) == 0)
+    {
+        printf("pktgen:: invalid destination %s ..\n", next_tok);
+        return;
+    }
+    cfg.dst_first = cfg.dst_last = ntohl(addr.s_addr);
+    if (dash != NULL)
+    {
+        if (inet_aton(dash, &addr) == 0)
+        {
+            printf("pktgen:: invalid destination %s ..\n", dash);
+            return;
+        }
+        cfg.dst_last = ntohl(addr.s_addr);
+    }
+
+    while ((next_tok = strtok(NULL, " \n")) != NULL)
+    {
+        char *opt = next_tok;
+        if ((next_tok = strtok(NULL, " \n")) == NULL)
+        {
+            printf("pktgen:: missing value for %s ..\n", opt);
+            return;
+        }
+        if (!strcmp(opt, "-src"))
+        {
+            if (inet_aton(next_tok, &addr) == 0)
+            {
+                printf("pktgen:: invalid source %s ..\n", next_tok);
+                return;
+            }
+            cfg.src_ip = ntohl(addr.s_addr);
+        } else if (!strcmp(opt, "-proto"))
+            cfg.proto = strcmp(next_tok, "tcp") ? UDP_PROTOCOL : TCP_PROTOCOL;
+        else if (!strcmp(opt, "-size"))
+        {
+            if (!strcmp(next_tok, "imix"))
+                cfg.size_mode = PKTGEN_SIZE_IMIX;
+            else if (sscanf(next_tok, "%d-%d", &cfg.size_min, &cfg.size_max) == 2)
+                cfg.size_mode = PKTGEN_SIZE_UNIFORM;
+            else
+            {
+                cfg.size_mode = PKTGEN_SIZE_FIXED;
+                cfg.size_min = cfg.size_max = atoi(next_tok);
+            }
+        } else if (!strcmp(opt, "-rate"))
+            cfg.rate = atof(next_tok);
+        else if (!strcmp(opt, "-count"))
+            cfg.count = strtoul(next_tok, NULL, 10);
+        else if (!strcmp(opt, "-dstmac"))
+            Colon2MAC(next_tok, cfg.dst_mac);
+        else if (!strcmp(opt, "-sport"))
+            cfg.sport = atoi(next_tok);
+        else if (!strcmp(opt, "-dport"))
+            cfg.dport = atoi(next_tok);
+        else
+        {
+            printf("pktgen:: unknown option %s ..\n", opt);
+            return;
+        }
+    }
+
+    pktgenStart(&cfg);
+}
+
+
+/*
+ * stats latency [show]
+ * stats latency (on | off | reset)
+ * stats page [interval ms]
+ */
+void statsCmd()
+{
+    char *next_tok = strtok(NULL, " \n");
+
+    if ((next_tok != NULL) && !strcmp(next_tok, "page"))
+    {
+        if ((next_tok = strtok(NULL, " \n")) == NULL)
+            statsPageShow();
+        else if (!strcmp(next_tok, "interval") && ((next_tok = strtok(NULL, " \n")) != NULL))
+            statsPageSetInterval(atoi(next_tok));
+        else
+            printf("stats:: unknown page option .. type help stats for usage.\n");
+        return;
+    }
+    if ((next_tok == NULL) || strcmp(next_tok, "latency"))
+    {
+        printf("stats:: unknown statistics %s .. type help stats for usage.\n",
+               (next_tok == NULL) ? "" : next_tok);
+        return;
+    }
+
+    next_tok = strtok(NULL, " \n");
+    if ((next_tok == NULL) || !strcmp(next_tok, "show"))
+        latencyShow();
+    else if (!strcmp(next_tok, "on"))
+        latencySetEnabled(1);
+    else if (!strcmp(next_tok, "off"))
+        latencySetEnabled(0);
+    else if (!strcmp(next_tok, "reset"))
+        latencyReset();
+    else
+        printf("stats:: unknown action %s .. type help stats for usage.\n", next_tok);
+}
+
+
+/*
+ * show drops
+ * show drops reset
+ * show drops sample rate
+ * show drops save file
+ */
+void showCmd()
+{
+    char *next_tok = strtok(NULL, " \n");
+
+    if ((next_tok == NULL) || strcmp(next_tok, "drops"))
+    {
+        printf("show:: unknown item %s .. type help show for usage.\n",
+               (next_tok == NULL) ? "" : next_tok);
+        return;
+    }
+
+    next_tok = strtok(NULL, " \n");
+    if (next_tok == NULL)
+        printDrops();
+    else if (!strcmp(next_tok, "reset"))
+        resetDrops();
+    else if (!strcmp(next_tok, "sample") && ((next_tok = strtok(NULL, " \n")) != NULL))
+        setDropSampling(atoi(next_tok));
+    else if (!strcmp(next_tok, "save") && ((next_tok = strtok(NULL, " \n")) != NULL))
+        saveDropSamples(next_tok);
+    else
+        printf("show:: unknown drops option .. type help show for usage.\n");
+}
+
+
+/*
+ * trace (on | off | clear)
+ * trace show [count]
+ */
+void traceCmd()
+{
+    char *next_tok = strtok(NULL, " \n");
+
+    if ((next_tok == NULL) || !strcmp(next_tok, "show"))
+    {
+        next_tok = (next_tok == NULL) ? NULL : strtok(NULL, " \n");
+        traceShow((next_tok == NULL) ? TRACE_SHOW_DEFAULT : atoi(next_tok));
+    } else if (!strcmp(next_tok, "on"))
+        traceSetEnabled(1);
+    else if (!strcmp(next_tok, "off"))
+        traceSetEnabled(0);
+    else if (!strcmp(next_tok, "clear"))
+        traceClear();
+    else
+        printf("trace:: unknown action %s .. type help trace for usage.\n", next_tok);
+}
+
+
 /*
  * helpCmd - this implements the following command line.
  * help - prints a general help usage message
@@ -1327,8 +1673,10 @@ void getCmd()
         error("[getCmd]:: ERROR!! missing get-parameter");
     else if (!strcmp(next_tok, "sched-cycle"))
         printf("\nSchedule cycle length: %d (microseconds) \n", rconfig.schedcycle);
+    else if (!strcmp(next_tok, "clock-resolution"))
+        clockShow();
     else if (!strcmp(next_tok, "verbose"))
-        printf("\nVerbose level: %ld \n", prog_verbosity_level());
+        printf("\nVerbose level: %d (compiled up to %d) \n", log_level, LOG_MAX_LEVEL);
     else if (!strcmp(next_tok, "raw-times"))
         printf("\nRaw time mode: %d  \n", getTimeMode());
     else if (!strcmp(next_tok, "update-delay"))
@@ -1483,6 +1831,9 @@ void spolicyCmd()
         printf("Scheduling policy: rr (round robin)\n");
 }
 
+// indexed by OPENFLOW_TABLE_MISS_*
+static const char *cli_table_miss_names[] = { "controller", "continue", "drop" };
+
 void openflowCmd()
 {
     if (!rconfig.openflow)
@@ -1561,6 +1912,88 @@ void openflowCmd()
             }
         }
     }
+    else if (next_tok != NULL && !strcmp(next_tok, "flowtable"))
+    {
+        next_tok = strtok(NULL, " \n");
+        if (next_tok == NULL)
+        {
+            openflow_flowtable_print_lookup_info();
+            return;
+        }
+        else if (!strcmp(next_tok, "stats"))
+        {
+            openflow_flowtable_print_cache_stats();
+            return;
+        }
+        else
+        {
+            // "size" alone works on the first table
+            long table_id = 0;
+            if (!strcmp(next_tok, "table"))
+            {
+                next_tok = strtok(NULL, " \n");
+                if (next_tok == NULL)
+                {
+                    printf("[openflowCmd]:: missing table number\n");
+                    return;
+                }
+                char *endptr;
+                table_id = strtol(next_tok, &endptr, 10);
+                if (endptr == next_tok || *endptr != '\0' || table_id < 0
+                        || table_id >= OPENFLOW_NUM_TABLES)
+                {
+                    printf("Table number must be between 0 and %d\n",
+                           OPENFLOW_NUM_TABLES - 1);
+                    return;
+                }
+                next_tok = strtok(NULL, " \n");
+                if (next_tok == NULL)
+                {
+                    printf("Maximum number of entries: %u\n",
+                           openflow_flowtable_get_max_entries(table_id));
+                    printf("Table miss: %s\n",
+                           cli_table_miss_names[openflow_flowtable_get_table_miss(table_id)]);
+                    return;
+                }
+            }
+
+            if (!strcmp(next_tok, "size"))
+            {
+                next_tok = strtok(NULL, " \n");
+                if (next_tok == NULL)
+                {
+                    printf("Maximum number of entries: %u\n",
+                           openflow_flowtable_get_max_entries(table_id));
+                    return;
+                }
+                char *endptr;
+                long num = strtol(next_tok, &endptr, 10);
+                if (endptr != next_tok)
+                {
+                    if (num < 1 || num > OPENFLOW_MAX_FLOWTABLE_ENTRIES)
+                        printf("Flowtable size must be between 1 and %d\n",
+                               OPENFLOW_MAX_FLOWTABLE_ENTRIES);
+                    else if (openflow_flowtable_set_max_entries(table_id, num) < 0)
+                        printf("Could not resize table %ld (entries in use above %ld?)\n",
+                               table_id, num);
+                    return;
+                }
+            }
+            else if (!strcmp(next_tok, "miss"))
+            {
+                next_tok = strtok(NULL, " \n");
+                int miss;
+                for (miss = 0; next_tok != NULL && miss < 3; miss++)
+                {
+                    if (!strcmp(next_tok, cli_table_miss_names[miss]))
+                    {
+                        openflow_flowtable_set_table_miss(table_id, miss);
+                        return;
+                    }
+                }
+            }
+        }
+    }
     else if (next_tok != NULL && !strcmp(next_tok, "port"))
     {
         next_tok = strtok(NULL, " \n");
@@ -1579,6 +2012,63 @@ void openflowCmd()
             }
         }
     }
+    else if (next_tok != NULL && !strcmp(next_tok, "controller"))
+    {
+        next_tok = strtok(NULL, " \n");
+        if (next_tok == NULL)
+        {
+            openflow_ctrl_iface_print_status();
+            return;
+        }
+        else if (!strcmp(next_tok, "echo"))
+        {
+            next_tok = strtok(NULL, " \n");
+            if (next_tok != NULL)
+            {
+                char *endptr;
+                long num = strtol(next_tok, &endptr, 10);
+                if (endptr != next_tok)
+                {
+                    if (num < 10 || num > 3600000)
+                        printf("Echo interval must be between 10 and 3600000 ms\n");
+                    else
+                        openflow_ctrl_iface_set_echo_interval(num);
+                    return;
+                }
+            }
+        }
+    }
+    else if (next_tok != NULL && !strcmp(next_tok, "packet-in"))
+    {
+        next_tok = strtok(NULL, " \n");
+        if (next_tok == NULL)
+        {
+            openflow_pkt_buffer_print_stats();
+            return;
+        }
+        else if (!strcmp(next_tok, "rate"))
+        {
+            char *endptr;
+            long rate = -1, burst = OPENFLOW_PACKET_IN_BURST;
+            if ((next_tok = strtok(NULL, " \n")) != NULL)
+            {
+                rate = strtol(next_tok, &endptr, 10);
+                if (endptr == next_tok)
+                    rate = -1;
+            }
+            if ((rate >= 0) && ((next_tok = strtok(NULL, " \n")) != NULL))
+            {
+                burst = -1;
+                if (!strcmp(next_tok, "burst") && ((next_tok = strtok(NULL, " \n")) != NULL))
+                    burst = strtol(next_tok, &endptr, 10);
+            }
+            if (rate < 0 || rate > 1000000 || burst < 1 || burst > 1000000)
+                printf("Rate must be between 0 and 1000000, burst between 1 and 1000000\n");
+            else
+                openflow_pkt_buffer_set_rate(rate, burst);
+            return;
+        }
+    }
     else if (next_tok != NULL && !strcmp(next_tok, "reconnect"))
     {
         openflow_ctrl_iface_reconnect();
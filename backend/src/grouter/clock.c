@@ -0,0 +1,120 @@
+/*
+ * clock.c (calibration and the thread that refreshes the cached clock)
+ */
+
+#include "clock.h"
+#include <stdio.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+#include <slack/std.h>
+#include <slack/err.h>
+
+
+router_clock_t router_clock;
+
+static pthread_t clock_threadid;
+
+
+static void clockRefresh()
+{
+	router_clock.now_ns = clockRead(CLOCK_MONOTONIC);
+	router_clock.now_sec = time(NULL);
+}
+
+
+void clockWaitTick()
+{
+	struct timespec delay;
+
+	delay.tv_sec = router_clock.resolution_us / 1000000;
+	delay.tv_nsec = (router_clock.resolution_us % 1000000) * 1000L;
+	nanosleep(&delay, NULL);
+}
+
+
+void *clockHandler(void *arg)
+{
+	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+	while (1)
+	{
+		clockWaitTick();
+		clockRefresh();
+	}
+	return NULL;
+}
+
+
+/*
+ * Only an invariant TSC ticks at a constant rate through frequency changes
+ * and sleep states and agrees between cores; without it the precise clock
+ * stays on clock_gettime().
+ */
+static void clockCalibrateTSC()
+{
+#if defined(__x86_64__)
+	unsigned int eax, ebx, ecx, edx;
+	uint64_t t0, c0, t1, c1;
+	struct timespec delay = {0, CLOCK_CALIBRATION_US * 1000L};
+
+	if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || (eax < 0x80000007))
+		return;
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	if (!(edx & (1 << 8)))
+		return;
+
+	t0 = clockRead(CLOCK_MONOTONIC);
+	c0 = __rdtsc();
+	nanosleep(&delay, NULL);
+	t1 = clockRead(CLOCK_MONOTONIC);
+	c1 = __rdtsc();
+	if ((c1 <= c0) || (t1 <= t0))
+		return;
+
+	router_clock.tsc_mult = (uint64_t)(((unsigned __int128)(t1 - t0) << 32) / (c1 - c0));
+	router_clock.tsc_base = c1;
+	router_clock.ns_base = t1;
+	router_clock.tsc = 1;
+#endif
+}
+
+
+int clockInit(int resolution_us)
+{
+	router_clock.resolution_us = (resolution_us > 0) ? resolution_us : CLOCK_DEFAULT_RESOLUTION_US;
+	clockCalibrateTSC();
+	clockRefresh();
+
+	if (pthread_create(&clock_threadid, NULL, clockHandler, NULL) != 0)
+	{
+		error("[clockInit]:: unable to create the clock thread ");
+		return EXIT_FAILURE;
+	}
+	router_clock.running = 1;
+	verbose(2, "[clockInit]:: clock started, resolution %d us, %s ", router_clock.resolution_us,
+		router_clock.tsc ? "TSC" : "clock_gettime");
+	return EXIT_SUCCESS;
+}
+
+
+int clockSetResolution(int resolution_us)
+{
+	if (resolution_us < 1)
+	{
+		printf("clock:: the resolution must be at least 1 us \n");
+		return EXIT_FAILURE;
+	}
+	router_clock.resolution_us = resolution_us;
+	return EXIT_SUCCESS;
+}
+
+
+void clockShow()
+{
+	printf("\nClock resolution: %d (microseconds), precise clock: %s", router_clock.resolution_us,
+	       router_clock.tsc ? "TSC" : "clock_gettime");
+	if (router_clock.tsc)
+		printf(" (%.3f GHz)", 4294967296.0 / router_clock.tsc_mult);
+	printf(" \n");
+}
@@ -1,111 +1,403 @@
-/*                                                                                                               * This is the console (it creates a .port) interface for the gRouter.
+/*
+ * This is the console (it creates a .port) interface for the gRouter.
  * At this time, the console gives a copy of all the packets that are
- * flowing through the router in the libpcap format.
+ * flowing through the router in the pcap-ng format.
+ *
+ * Capture points (vpl_recvfrom/vpl_sendto) use CONSOLE_CAPTURE: a single
+ * branch on console_capture. The flag is only raised while a reader has
+ * the FIFO open and the console is enabled. Each producing thread owns a
+ * single-producer/single-consumer ring; the console thread drains all the
+ * rings and writes the records to the FIFO in large batches.
  */
 
 #include "grouter.h"
-#include "simplequeue.h"
+#include "console.h"
 #include "gpcap.h"
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
 #include <slack/std.h>
 #include <slack/err.h>
 #include <slack/fio.h>
 #include <sys/stat.h>
+#ifdef HAVE_LIBPCAP
+#include <pcap.h>
+#endif
+
+
+typedef struct _capture_slot_t
+{
+	uint64_t ts;                          // nanoseconds since the epoch
+	uint32_t caplen;
+	uint32_t origlen;
+	uchar data[CAPTURE_MAX_SNAPLEN];
+} capture_slot_t;
+
+typedef struct _capture_ring_t
+{
+	uint32_t head;                        // written by the producer only
+	char pad1[60];
+	uint32_t tail;                        // written by the console thread only
+	char pad2[60];
+	unsigned long drops;                  // ring full
+	struct _capture_ring_t *next;
+	capture_slot_t slots[CAPTURE_RING_SLOTS];
+} capture_ring_t;
+
 
 /*
  * Some global variables!
  */
-int consoleid;                        // FIFO id 
-simplequeue_t *consoleq;
+int consoleid = -1;                   // FIFO id (write end, -1 when no reader)
 char consolepath[MAX_NAME_LEN];
 pthread_t console_threadid;
+volatile int console_capture;
 
+static int console_enabled = 1;       // console stop/start
+static int capture_snaplen = CAPTURE_MAX_SNAPLEN;
+static char capture_filter_expr[MAX_TMPBUF_LEN];
+#ifdef HAVE_LIBPCAP
+static struct bpf_program *volatile capture_filter;
+#endif
+static capture_ring_t *capture_rings;   // list of all rings, only ever grows
+static pthread_mutex_t capture_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread capture_ring_t *my_ring;
+static unsigned long capture_written;
 
-void consoleRestart(char *rpath, char *rname)
+
+/*
+ * Raise or lower the capture flag according to the console state.
+ */
+static void consoleUpdateCapture()
 {
-	int fd, status;
+	console_capture = (console_enabled && (consoleid >= 0));
+}
+
 
+/*
+ * (Re)create the FIFO. The write end is opened by the console thread
+ * once a reader shows up.
+ */
+static int consoleMakeFIFO(char *rpath, char *rname)
+{
 	sprintf(consolepath, "%s/%s.%s", rpath, rname, "port");
 
- 	if (fifo_exists(consolepath, 1)) 
-		verbose(2, "[consoleRestart]:: Existing FIFO %s removed .. creating a new one ", consolepath); 
+	if (fifo_exists(consolepath, 1))
+	{
+		verbose(2, "[consoleMakeFIFO]:: WARNING! existing FIFO %s removed .. creating a new one ", consolepath);
+		remove(consolepath);
+	}
+	if ((mkfifo(consolepath, S_IRUSR | S_IWUSR | S_IWGRP | S_IWOTH) == -1) && (errno != EEXIST))
+	{
+		error("[consoleMakeFIFO]:: unable to create FIFO .. %s", consolepath);
+		return -1;
+	}
+	return 0;
+}
+
 
+static void consoleDisconnect()
+{
+	int fd = consoleid;
 
- 	if ((fd = fifo_open(consolepath, S_IRUSR | S_IWUSR | S_IWGRP | S_IWOTH, 1, &consoleid)) == -1) 
- 	{ 
- 		error("[consoleRestart]:: unable to create socket .. %s", consolepath); 
- 		return; 
- 	} 
-	write_pcapheader(consoleid);
+	consoleid = -1;
+	consoleUpdateCapture();
+	if (fd >= 0)
+		close(fd);
+}
+
+
+void consoleRestart(char *rpath, char *rname)
+{
+	consoleDisconnect();
+	consoleMakeFIFO(rpath, rname);
 	return;
 }
 
 
 void consoleGetState()
 {
-	printf("Port (console) is always enabled \n");
+	capture_ring_t *r;
+	unsigned long drops = 0;
+	int nrings = 0;
+
+	for (r = capture_rings; r != NULL; r = r->next, nrings++)
+		drops += r->drops;
+
+	printf("Port (console) %s: %s, reader %s \n", consolepath,
+	       console_enabled ? "enabled" : "stopped",
+	       (consoleid >= 0) ? "connected" : "not connected");
+	printf("Snaplen %d, filter %s \n", capture_snaplen,
+	       capture_filter_expr[0] ? capture_filter_expr : "none");
+	printf("Captured %lu, dropped (ring full) %lu, rings %d \n", capture_written, drops, nrings);
+}
+
+
+void consoleSetEnabled(int enabled)
+{
+	console_enabled = enabled;
+	consoleUpdateCapture();
+}
+
+
+int consoleSetSnaplen(int snaplen)
+{
+	if ((snaplen <= 0) || (snaplen > CAPTURE_MAX_SNAPLEN))
+	{
+		error("[consoleSetSnaplen]:: snaplen must be between 1 and %d ", CAPTURE_MAX_SNAPLEN);
+		return EXIT_FAILURE;
+	}
+	capture_snaplen = snaplen;
+	return EXIT_SUCCESS;
 }
 
 
 /*
- * Write out the Gpcap header into the FIFO.
+ * Compile a BPF filter for the capture. A NULL or "none" expression
+ * removes the filter. The previous program is not freed: a producer may
+ * still be running it, and filters are few and changed by hand.
  */
-int write_pcapheader(int fid)
+int consoleSetFilter(char *expr)
 {
-	pcap_hdr_t phdr = {0xa1b2c3d4, 2, 4, 0, 0, 65535, 1};
-	int bytes;
+#ifdef HAVE_LIBPCAP
+	struct bpf_program *prog;
+	pcap_t *p;
 
- 	if (bytes = write(fid, &phdr, sizeof(pcap_hdr_t)) == -1)
- 	{
-		error("[write_pcapheader]:: error writing the pcap header ");
- 		return -1; 
- 	} 
-	return 0;
+	if ((expr == NULL) || !strcmp(expr, "none"))
+	{
+		capture_filter = NULL;
+		capture_filter_expr[0] = '\0';
+		return EXIT_SUCCESS;
+	}
+
+	prog = (struct bpf_program *)malloc(sizeof(struct bpf_program));
+	p = pcap_open_dead(DLT_EN10MB, CAPTURE_MAX_SNAPLEN);
+	if ((p == NULL) || (pcap_compile(p, prog, expr, 1, PCAP_NETMASK_UNKNOWN) == -1))
+	{
+		error("[consoleSetFilter]:: unable to compile filter %s: %s ", expr,
+		      (p != NULL) ? pcap_geterr(p) : "pcap_open_dead failed");
+		if (p != NULL)
+			pcap_close(p);
+		free(prog);
+		return EXIT_FAILURE;
+	}
+	pcap_close(p);
+	strncpy(capture_filter_expr, expr, MAX_TMPBUF_LEN - 1);
+	capture_filter = prog;
+	return EXIT_SUCCESS;
+#else
+	if ((expr == NULL) || !strcmp(expr, "none"))
+		return EXIT_SUCCESS;
+	error("[consoleSetFilter]:: capture filters need libpcap, not available in this build ");
+	return EXIT_FAILURE;
+#endif
+}
+
+
+static capture_ring_t *consoleNewRing()
+{
+	capture_ring_t *r;
+
+	if ((r = (capture_ring_t *)calloc(1, sizeof(capture_ring_t))) == NULL)
+		return NULL;
+	pthread_mutex_lock(&capture_rings_lock);
+	r->next = capture_rings;
+	capture_rings = r;
+	pthread_mutex_unlock(&capture_rings_lock);
+	return r;
 }
 
 
-int write_pcappacket(int fid, void *buf, int len)
+/*
+ * Producer side: copy (up to snaplen of) the frame into the calling
+ * thread's ring. Never blocks; a full ring counts a drop.
+ */
+void consoleCapture(void *buf, int len)
 {
-	pcaprec_hdr_t pchdr = {.ts_sec = 0, .ts_usec = 0};
-	int bytes;
-	void *lbuf;
+	capture_ring_t *r = my_ring;
+	capture_slot_t *slot;
+	struct timespec ts;
+	uint32_t head;
 
-	pchdr.incl_len = pchdr.orig_len = len;
-	lbuf = malloc(sizeof(pcaprec_hdr_t) + len);
-	bcopy(&pchdr, lbuf, sizeof(pcaprec_hdr_t));
-	bcopy(buf, (lbuf + sizeof(pcaprec_hdr_t)), len);
+#ifdef HAVE_LIBPCAP
+	struct bpf_program *prog = capture_filter;
+	if ((prog != NULL) && !bpf_filter(prog->bf_insns, (uchar *)buf, len, len))
+		return;
+#endif
+	if (r == NULL)
+	{
+		if ((r = consoleNewRing()) == NULL)
+			return;
+		my_ring = r;
+	}
 
-	if (bytes = write(fid, lbuf, len + sizeof(pcaprec_hdr_t)) == -1)
+	head = r->head;
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= CAPTURE_RING_SLOTS)
 	{
-		error("[write_pcapheader]:: error writing the pcap header ");
- 		return -1; 
+		r->drops++;
+		return;
+	}
+
+	slot = &r->slots[head & (CAPTURE_RING_SLOTS - 1)];
+	clock_gettime(CLOCK_REALTIME, &ts);
+	slot->ts = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	slot->origlen = len;
+	slot->caplen = (len < capture_snaplen) ? len : capture_snaplen;
+	memcpy(slot->data, buf, slot->caplen);
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Write the whole buffer to the FIFO. Returns -1 when the reader went away.
+ */
+static int consoleWrite(void *buf, int len)
+{
+	int n, off = 0;
+
+	while (off < len)
+	{
+		if ((n = write(consoleid, (char *)buf + off, len - off)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			verbose(2, "[consoleWrite]:: reader closed the port (%s) ", strerror(errno));
+			return -1;
+		}
+		off += n;
 	}
-	free(lbuf);
 	return 0;
 }
 
 
+static int consoleWriteHeaders()
+{
+	pcapng_shb_t shb = {PCAPNG_SHB_TYPE, sizeof(pcapng_shb_t), PCAPNG_BYTE_ORDER_MAGIC,
+			    1, 0, -1, sizeof(pcapng_shb_t)};
+	pcapng_idb_t idb = {PCAPNG_IDB_TYPE, sizeof(pcapng_idb_t), PCAPNG_LINKTYPE_ETHERNET, 0,
+			    CAPTURE_MAX_SNAPLEN, PCAPNG_OPT_IF_TSRESOL, 1, 9, {0, 0, 0},
+			    PCAPNG_OPT_ENDOFOPT, 0, sizeof(pcapng_idb_t)};
+
+	if ((consoleWrite(&shb, sizeof(shb)) == -1) || (consoleWrite(&idb, sizeof(idb)) == -1))
+	{
+		error("[consoleWriteHeaders]:: error writing the pcap-ng header ");
+		return -1;
+	}
+	return 0;
+}
+
+
+/*
+ * Move records from all rings into buf as enhanced packet blocks.
+ * Returns the number of bytes placed in buf.
+ */
+static int consoleDrainRings(uchar *buf, int size)
+{
+	capture_ring_t *r;
+	capture_slot_t *slot;
+	pcapng_epb_t epb;
+	uint32_t tail, head, padded, trailer;
+	int len = 0;
+
+	for (r = capture_rings; r != NULL; r = r->next)
+	{
+		tail = r->tail;
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		while (tail != head)
+		{
+			slot = &r->slots[tail & (CAPTURE_RING_SLOTS - 1)];
+			padded = (slot->caplen + 3) & ~3;
+			if (len + sizeof(epb) + padded + sizeof(trailer) > size)
+				break;
+			epb.block_type = PCAPNG_EPB_TYPE;
+			epb.block_len = trailer = sizeof(epb) + padded + sizeof(trailer);
+			epb.interface_id = 0;
+			epb.ts_high = (uint32_t)(slot->ts >> 32);
+			epb.ts_low = (uint32_t)slot->ts;
+			epb.cap_len = slot->caplen;
+			epb.orig_len = slot->origlen;
+			memcpy(buf + len, &epb, sizeof(epb));
+			memcpy(buf + len + sizeof(epb), slot->data, slot->caplen);
+			bzero(buf + len + sizeof(epb) + slot->caplen, padded - slot->caplen);
+			memcpy(buf + len + sizeof(epb) + padded, &trailer, sizeof(trailer));
+			len += epb.block_len;
+			tail++;
+			capture_written++;
+		}
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	}
+	return len;
+}
+
+
+/*
+ * Discard whatever the rings hold (reader gone or console stopped).
+ */
+static void consoleFlushRings()
+{
+	capture_ring_t *r;
+
+	for (r = capture_rings; r != NULL; r = r->next)
+		__atomic_store_n(&r->tail, __atomic_load_n(&r->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
 
 
 void consoleHandler(void *ptr)
 {
-	unsigned char *data;
-	int len;
+	uchar *buf;
+	sigset_t sigs;
+	int len, fd;
 
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	write_pcapheader(consoleid);
+	// a reader closing the FIFO must give EPIPE here, not kill the router
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	if ((buf = (uchar *)malloc(CAPTURE_WRITE_BATCH)) == NULL)
+	{
+		fatal("[consoleHandler]:: unable to allocate the write buffer ");
+		return;
+	}
+
 	while(1)
 	{
 		pthread_testcancel();
-		// read a packet from the queue, wait if no packet
-		readQueue(consoleq, (void **)&data, &len);
-		pthread_testcancel();
+		if (consoleid < 0)
+		{
+			// wait for a reader: opening the write end fails with ENXIO until then
+			if ((fd = open(consolepath, O_WRONLY | O_NONBLOCK)) == -1)
+			{
+				sleep(1);
+				continue;
+			}
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+			consoleid = fd;
+			verbose(2, "[consoleHandler]:: reader attached to %s ", consolepath);
+			if (consoleWriteHeaders() == -1)
+			{
+				consoleDisconnect();
+				continue;
+			}
+			consoleFlushRings();
+			consoleUpdateCapture();
+		}
+
+		if ((len = consoleDrainRings(buf, CAPTURE_WRITE_BATCH)) == 0)
+		{
+			usleep(CAPTURE_IDLE_US);
+			continue;
+		}
 		// write the fifo, block if FIFO not read (i.e., full)
-		write_pcappacket(consoleid, data, len);
-		free(data);
+		if (consoleWrite(buf, len) == -1)
+		{
+			consoleDisconnect();
+			consoleFlushRings();
+		}
 	}
 }
 
@@ -116,32 +408,19 @@ void consoleHandler(void *ptr)
  */
 void consoleInit(char *rpath, char *rname)
 {
-	int fd, status;
+	int status;
 
+	if (console_threadid != 0)
+	{
+		pthread_cancel(console_threadid);
+		consoleDisconnect();
+	}
 
-	sprintf(consolepath, "%s/%s.%s", rpath, rname, "port");
+	if (consoleMakeFIFO(rpath, rname) == -1)
+		return;
 
- 	if (fifo_exists(consolepath, 1)) 
- 	{ 
- 		verbose(2, "[consoleInit]:: WARNING! existing FIFO %s removed .. creating a new one ", consolepath); 
- 		remove(consolepath); 
-		// remove existing console message queue - the message queue connecting to wireshark
-		if (consoleq != NULL)
-			destroySimpleQueue(consoleq);
-		if (console_threadid != 0)
-			pthread_cancel(console_threadid);
- 	} 
-
-	consoleq = createSimpleQueue("console queue", 256, 0, 1);
- 	if ((fd = fifo_open(consolepath, S_IRUSR | S_IWUSR | S_IWGRP | S_IWOTH, 1, &consoleid)) == -1) 
- 	{ 
- 		error("[consoleInit]:: unable to create socket .. %s", consolepath); 
- 		return; 
- 	} 
-
-	status = pthread_create(&(console_threadid), NULL, (void *)consoleHandler, (void *)consoleq);
-	if (status != 0) 
+	status = pthread_create(&(console_threadid), NULL, (void *)consoleHandler, NULL);
+	if (status != 0)
 		error("[consoleInit]:: Unable to create the console handler thread... ");
 	return;
 }
-
@@ -0,0 +1,271 @@
+/*
+ * drop.c (per-interface, per-reason packet drop accounting)
+ *
+ * The counters are updated with relaxed atomic adds: the same counter can
+ * be hit by the receive thread of an interface and by the worker, and drop
+ * paths are not the ones that have to be fast. Sampling decisions reuse the
+ * value returned by the add, so they cost nothing extra.
+ */
+
+#include "drop.h"
+#include "gnet.h"
+#include "ethernet.h"
+#include "gpcap.h"
+#include "logging.h"
+#include "probes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <slack/std.h>
+#include <slack/err.h>
+
+
+typedef struct _drop_sample_t
+{
+	uint64_t ts;                        // nanoseconds since the epoch
+	int ifid;
+	drop_reason_t reason;
+	uint32_t caplen;
+	uint32_t origlen;
+	uchar data[DROP_SAMPLE_SNAPLEN];
+} drop_sample_t;
+
+
+// the last row collects drops on packets without a valid interface
+static uint64_t drop_counts[MAX_INTERFACES + 1][DROP_REASONS];
+
+static volatile int drop_sample_rate = 0;
+static drop_sample_t *drop_samples = NULL;
+static unsigned long drop_sample_next = 0;
+static pthread_mutex_t drop_sample_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char *drop_names[DROP_REASONS] = {
+	"not for me",
+	"filtered",
+	"no queue",
+	"queue full",
+	"red",
+	"unknown protocol",
+	"bad ip header",
+	"ip broadcast",
+	"no route",
+	"ttl expired",
+	"fragmentation needed",
+	"bad interface",
+	"interface down",
+	"arp evicted",
+	"tx queue full",
+	"openflow fragment",
+	"openflow no action",
+	"openflow table miss"
+};
+
+
+static int dropRow(int ifid)
+{
+	return ((ifid >= 0) && (ifid < MAX_INTERFACES)) ? ifid : MAX_INTERFACES;
+}
+
+
+static void dropSample(gpacket_t *pkt, int ifid, drop_reason_t reason)
+{
+	drop_sample_t *s;
+	struct timespec ts;
+	int len;
+
+	pthread_mutex_lock(&drop_sample_lock);
+	if (drop_samples != NULL)
+	{
+		s = &drop_samples[drop_sample_next++ % DROP_SAMPLE_SLOTS];
+		clock_gettime(CLOCK_REALTIME, &ts);
+		len = findPacketSize(&(pkt->data));
+		s->ts = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		s->ifid = ifid;
+		s->reason = reason;
+		s->origlen = len;
+		s->caplen = (len < DROP_SAMPLE_SNAPLEN) ? len : DROP_SAMPLE_SNAPLEN;
+		memcpy(s->data, &(pkt->data), s->caplen);
+	}
+	pthread_mutex_unlock(&drop_sample_lock);
+}
+
+
+/*
+ * Count a drop of pkt (which may be NULL) against interface ifid without
+ * releasing the packet.
+ */
+void countDrop(gpacket_t *pkt, int ifid, drop_reason_t reason)
+{
+	uint64_t seen;
+	int rate = drop_sample_rate;
+
+	seen = __atomic_fetch_add(&drop_counts[dropRow(ifid)][reason], 1, __ATOMIC_RELAXED);
+	TRACE(TRACE_DROP, ifid, reason, 0);
+	PROBE3(drop, pkt, ifid, reason);
+	if (__builtin_expect(rate > 0, 0) && (pkt != NULL) && ((seen % rate) == 0))
+		dropSample(pkt, ifid, reason);
+}
+
+
+// count the drop and release the packet
+void dropPacket(gpacket_t *pkt, int ifid, drop_reason_t reason)
+{
+	countDrop(pkt, ifid, reason);
+	free(pkt);
+}
+
+
+uint64_t getDropCount(int ifid, drop_reason_t reason)
+{
+	return drop_counts[dropRow(ifid)][reason];
+}
+
+
+char *dropReasonName(drop_reason_t reason)
+{
+	if ((reason < 0) || (reason >= DROP_REASONS))
+		return "unknown";
+	return drop_names[reason];
+}
+
+
+static char *dropRowName(char *buf, int row)
+{
+	interface_t *iface;
+
+	if (row == MAX_INTERFACES)
+		return "-";
+	if ((iface = findInterface(row)) != NULL)
+		return iface->device_name;
+	sprintf(buf, "if%d", row);
+	return buf;
+}
+
+
+void printDrops()
+{
+	char namebuf[MAX_DNAME_LEN];
+	uint64_t totals[DROP_REASONS];
+	int row, r, any = 0;
+
+	memset(totals, 0, sizeof(totals));
+	printf("%-10s %-20s %12s\n", "interface", "reason", "packets");
+	for (row = 0; row <= MAX_INTERFACES; row++)
+		for (r = 0; r < DROP_REASONS; r++)
+		{
+			if (drop_counts[row][r] == 0)
+				continue;
+			printf("%-10s %-20s %12llu\n", dropRowName(namebuf, row), drop_names[r],
+			       (unsigned long long)drop_counts[row][r]);
+			totals[r] += drop_counts[row][r];
+			any = 1;
+		}
+	if (!any)
+	{
+		printf("No packets dropped \n");
+		return;
+	}
+	printf("\n");
+	for (r = 0; r < DROP_REASONS; r++)
+		if (totals[r] != 0)
+			printf("%-10s %-20s %12llu\n", "total", drop_names[r], (unsigned long long)totals[r]);
+	if (drop_sample_rate > 0)
+		printf("\nSampling 1 in %d drops, %lu sampled \n", drop_sample_rate, drop_sample_next);
+}
+
+
+void resetDrops()
+{
+	memset(drop_counts, 0, sizeof(drop_counts));
+	pthread_mutex_lock(&drop_sample_lock);
+	drop_sample_next = 0;
+	pthread_mutex_unlock(&drop_sample_lock);
+}
+
+
+// keep one in every rate drops of each reason; 0 turns sampling off
+int setDropSampling(int rate)
+{
+	if (rate < 0)
+	{
+		error("[setDropSampling]:: invalid sampling rate %d ", rate);
+		return EXIT_FAILURE;
+	}
+	pthread_mutex_lock(&drop_sample_lock);
+	if ((rate > 0) && (drop_samples == NULL) &&
+	    ((drop_samples = (drop_sample_t *)calloc(DROP_SAMPLE_SLOTS, sizeof(drop_sample_t))) == NULL))
+	{
+		pthread_mutex_unlock(&drop_sample_lock);
+		error("[setDropSampling]:: unable to allocate the sample buffer ");
+		return EXIT_FAILURE;
+	}
+	drop_sample_rate = rate;
+	pthread_mutex_unlock(&drop_sample_lock);
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * Write the sampled packets, oldest first, to a pcap-ng file. The comment
+ * of each packet gives the interface and the drop reason.
+ */
+int saveDropSamples(char *path)
+{
+	pcapng_shb_t shb = {PCAPNG_SHB_TYPE, sizeof(pcapng_shb_t), PCAPNG_BYTE_ORDER_MAGIC,
+			    1, 0, -1, sizeof(pcapng_shb_t)};
+	pcapng_idb_t idb = {PCAPNG_IDB_TYPE, sizeof(pcapng_idb_t), PCAPNG_LINKTYPE_ETHERNET, 0,
+			    DROP_SAMPLE_SNAPLEN, PCAPNG_OPT_IF_TSRESOL, 1, 9, {0, 0, 0},
+			    PCAPNG_OPT_ENDOFOPT, 0, sizeof(pcapng_idb_t)};
+	char comment[MAX_TMPBUF_LEN], namebuf[MAX_DNAME_LEN];
+	uint16_t opt[2];
+	uint32_t padded, cpadded, trailer, zero = 0;
+	unsigned long i, first;
+	pcapng_epb_t epb;
+	drop_sample_t *s;
+	FILE *fp;
+	int n = 0;
+
+	if ((fp = fopen(path, "wb")) == NULL)
+	{
+		error("[saveDropSamples]:: unable to open %s ", path);
+		return EXIT_FAILURE;
+	}
+	fwrite(&shb, sizeof(shb), 1, fp);
+	fwrite(&idb, sizeof(idb), 1, fp);
+
+	pthread_mutex_lock(&drop_sample_lock);
+	first = (drop_sample_next > DROP_SAMPLE_SLOTS) ? drop_sample_next - DROP_SAMPLE_SLOTS : 0;
+	for (i = first; (drop_samples != NULL) && (i < drop_sample_next); i++, n++)
+	{
+		s = &drop_samples[i % DROP_SAMPLE_SLOTS];
+		sprintf(comment, "%s dropped: %s", dropRowName(namebuf, dropRow(s->ifid)),
+			drop_names[s->reason]);
+		padded = (s->caplen + 3) & ~3;
+		cpadded = (strlen(comment) + 3) & ~3;
+		epb.block_type = PCAPNG_EPB_TYPE;
+		epb.block_len = trailer = sizeof(epb) + padded + 4 + cpadded + 4 + sizeof(trailer);
+		epb.interface_id = 0;
+		epb.ts_high = (uint32_t)(s->ts >> 32);
+		epb.ts_low = (uint32_t)s->ts;
+		epb.cap_len = s->caplen;
+		epb.orig_len = s->origlen;
+		fwrite(&epb, sizeof(epb), 1, fp);
+		fwrite(s->data, 1, s->caplen, fp);
+		fwrite(&zero, 1, padded - s->caplen, fp);
+		opt[0] = PCAPNG_OPT_COMMENT;
+		opt[1] = strlen(comment);
+		fwrite(opt, sizeof(opt), 1, fp);
+		fwrite(comment, 1, opt[1], fp);
+		fwrite(&zero, 1, cpadded - opt[1], fp);
+		opt[0] = PCAPNG_OPT_ENDOFOPT;
+		opt[1] = 0;
+		fwrite(opt, sizeof(opt), 1, fp);
+		fwrite(&trailer, sizeof(trailer), 1, fp);
+	}
+	pthread_mutex_unlock(&drop_sample_lock);
+
+	fclose(fp);
+	printf("%d dropped packets written to %s \n", n, path);
+	return EXIT_SUCCESS;
+}
@@ -14,6 +14,8 @@
 #include "gnet.h"
 #include "arp.h"
 #include "ip.h"
+#include "drop.h"
+#include "logging.h"
 #include <netinet/in.h>
 #include <stdlib.h>
 
@@ -106,7 +108,7 @@ void* fromEthernetDev(void *arg)
 			(COMPARE_MAC(in_pkt->data.header.dst, bcast_mac) != 0))
 		{
 			verbose(1, "[fromEthernetDev]:: Packet dropped .. not for this router!? ");
-			free(in_pkt);
+			dropPacket(in_pkt, iface->interface_id, DROP_NOT_FOR_ME);
 			continue;
 		}
 
@@ -114,6 +116,9 @@ void* fromEthernetDev(void *arg)
 		in_pkt->frame.src_interface = iface->interface_id;
 		COPY_MAC(in_pkt->frame.src_hw_addr, iface->mac_addr);
 		COPY_IP(in_pkt->frame.src_ip_addr, iface->ip_addr);
+		LATENCY_STAMP(in_pkt, LAT_RX);
+		GNETCountRx(iface, in_pkt);
+		parsePacket(in_pkt);
 
 		verbose(2, "[fromEthernetDev]:: Packet is sent for enqueuing..");
 		enqueuePacket(pcore, in_pkt, sizeof(gpacket_t), rconfig.openflow);
@@ -21,6 +21,7 @@
 #include "classifier.h"
 #include "filter.h"
 #include "ip.h"
+#include "logging.h"
 
 
 filtertab_t *createFilter(classlist_t *cl, int state)
@@ -15,6 +15,7 @@
 #include "protocols.h"
 #include "ip.h"
 #include "fragment.h"
+#include "logging.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
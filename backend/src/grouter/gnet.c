@@ -25,6 +25,9 @@
 #include <netinet/in.h>
 #include "routetable.h"
 #include "openflow_config.h"
+#include "drop.h"
+#include "logging.h"
+#include "probes.h"
 
 #define MAX_MTU 1500
 #define BASEPORTNUM 60000
@@ -213,6 +216,21 @@ interface_t *findInterface(int indx)
 }
 
 
+/*
+ * count a packet received on the interface; called from the thread that
+ * reads the device, so the counters need no locking
+ */
+void GNETCountRx(interface_t *iface, gpacket_t *in_pkt)
+{
+	int len = findPacketSize(&(in_pkt->data));
+
+	iface->rx_pkts++;
+	iface->rx_bytes += len;
+	TRACE(TRACE_RX, iface->interface_id, len, 0);
+	PROBE3(rx, in_pkt, iface->interface_id, len);
+}
+
+
 void printHorLine(int mode)
 {
 	int i, imax;
@@ -478,10 +496,11 @@ interface_t *GNETMakeTapInterface(char *device, uchar *mac_addr, uchar *nw_addr)
  * 			  nw_addr: network address of the interface (IPv4 by default)
  * 			  dst_ip: physical IP address of destination mesh station on the MBSS
  *				  dst_port: interface number of the destination interface on the destination yRouter
+ *			  batch: use the batched (UDP_SEGMENT/UDP_GRO) tunnel framing; the peer must match
  * RETURNS: a pointer to the interface on success and NULL on failure
  */
 interface_t *GNETMakeTunInterface(char *device, uchar *mac_addr, uchar *nw_addr,
-                                  uchar* dst_ip, short int dst_port)
+                                  uchar* dst_ip, short int dst_port, int batch)
 {
     vpl_data_t *vcon;
     interface_t *iface;
@@ -516,6 +535,12 @@ interface_t *GNETMakeTunInterface(char *device, uchar *mac_addr, uchar *nw_addr,
     iface->iface_fd = vcon->data;
     iface->vpl_data = vcon;
 
+    if (batch && (tun_enable_batch(iface) == EXIT_FAILURE))
+    {
+        verbose(1, "[GNETMakeTunInterface]:: unable to enable batching on %s", device);
+        return NULL;
+    }
+
     upThisInterface(iface);
     return iface;
 }
@@ -621,11 +646,11 @@ int destroyInterface(interface_t *iface)
 
 	verbose(2, "[destroyInterface]:: cancelling the fromdev handler.. ");
 	if (iface->state == INTERFACE_UP)
-	{
 		pthread_cancel(iface->threadid);        // cancel the running thread
-		// close socket
-		close(iface->iface_fd);
-	}
+	// a batched tun interface stops sending before its socket closes
+	tun_disable_batch(iface);
+	if (iface->state == INTERFACE_UP)
+		close(iface->iface_fd);                 // close socket
 
 	verbose(2, "[destroyInterface]:: cancelling the shadow thread.. ");
 	if (iface->mode == IFACE_SERVER_MODE)
@@ -888,10 +913,12 @@ void *GNETHandler(void *outq)
 		if ((iface = findInterface(in_pkt->frame.dst_interface)) == NULL)
 		{
 			error("[gnetHandler]:: Packet dropped, interface [%d] is invalid ", in_pkt->frame.dst_interface);
+			dropPacket(in_pkt, in_pkt->frame.dst_interface, DROP_BAD_IFACE);
 			continue;
 		} else if (iface->state == INTERFACE_DOWN)
 		{
 			error("[gnetHandler]:: Packet dropped! Interface not up");
+			dropPacket(in_pkt, iface->interface_id, DROP_IFACE_DOWN);
 			continue;
 		}
 
@@ -915,6 +942,12 @@ void *GNETHandler(void *outq)
 			}
 		}
 
+		inbytes = findPacketSize(&(in_pkt->data));
+		iface->tx_pkts++;
+		iface->tx_bytes += inbytes;
+		TRACE(TRACE_TX, iface->interface_id, inbytes, 0);
+		PROBE3(tx, in_pkt, iface->interface_id, inbytes);
+		LATENCY_RECORD(in_pkt);
 		iface->devdriver->todev((void *)in_pkt);
 
 	}
@@ -23,8 +23,12 @@
 #include "filter.h"
 #include "openflow_ctrl_iface.h"
 #include "openflow_pkt_proc.h"
+#include "statspage.h"
+#include "logging.h"
+#include "clock.h"
+#include "timer.h"
 
-router_config rconfig = {.router_name=NULL, .gini_home=NULL, .cli_flag=0, .config_file=NULL, .config_dir=NULL, .openflow=0, .ghandler=0, .clihandler= 0, .scheduler=0, .worker=0, .openflow_worker=0, .openflow_controller_iface=0, .openflow_flowtable_timeout=0, .schedcycle=0};
+router_config rconfig = {.router_name=NULL, .gini_home=NULL, .cli_flag=0, .config_file=NULL, .config_dir=NULL, .openflow=0, .openflow_workers=1, .ghandler=0, .clihandler= 0, .scheduler=0, .worker=0, .openflow_worker=0, .openflow_controller_iface=0, .openflow_flowtable_timeout=0, .schedcycle=0};
 pktcore_t *pcore;
 classlist_t *classifier;
 filtertab_t *filter;
@@ -49,6 +53,11 @@ Option grouter_optab[] =
 		" when specified, grouter functions as an OpenFlow 1.0 switch",
 		optional_argument, OPT_INTEGER, OPT_VARIABLE, &(rconfig.openflow)
 	},
+	{
+		"openflow-workers", '\0', "count", "The number of threads that process"
+		" OpenFlow packets; packets of the same flow go to the same thread",
+		required_argument, OPT_INTEGER, OPT_VARIABLE, &(rconfig.openflow_workers)
+	},
 	{
 		NULL, '\0', NULL, NULL, 0, 0, 0, NULL
 	}
@@ -66,11 +75,14 @@ int isPIDAlive(int pid);
 int main(int ac, char *av[])
 {
 	char rpath[MAX_NAME_LEN];
-	int status, *jstatus;
+	int status, *jstatus, i;
 	simplequeue_t *outputQ, *workQ, *openflowWorkQ, *qtoa;
 
 	// setup the program properties
 	setupProgram(ac, av);
+	// start the clock before any thread that reads it
+	clockInit(CLOCK_DEFAULT_RESOLUTION_US);
+	timerInit();
 	// creates a PID file under router_name.pid in the current directory
 	status = makePIDFile(rconfig.router_name, rpath);
 	// shutdown the router on receiving SIGUSR1 or SIGUSR2
@@ -102,7 +114,9 @@ int main(int ac, char *av[])
 
 	// Initialize OpenFlow packet processor
 	if (rconfig.openflow) {
-		rconfig.openflow_worker = PktCoreOpenflowWorkerInit(pcore);
+		if ((rconfig.openflow_workers = PktCoreOpenflowWorkerInit(pcore, rconfig.openflow_workers)) < 0)
+			fatal("[main]:: unable to start the OpenFlow workers ");
+		rconfig.openflow_worker = pcore->openflowworker[0];
 	}
 
 	infoInit(rconfig.config_dir, rconfig.router_name);
@@ -112,6 +126,7 @@ int main(int ac, char *av[])
 		addTarget("Default Queue", qtoa);
 	else
 		printf("Error .. found null queue for default\n");
+	statsPageInit(rconfig.config_dir, rconfig.router_name);
 
 	// Initialize OpenFlow controller interface
 	if (rconfig.openflow) {
@@ -129,7 +144,8 @@ int main(int ac, char *av[])
 	if (rconfig.openflow) {
 		wait4thread(rconfig.openflow_flowtable_timeout);
 		wait4thread(rconfig.openflow_controller_iface);
-		wait4thread(rconfig.openflow_worker);
+		for (i = 0; i < pcore->openflowworkers; i++)
+			wait4thread(pcore->openflowworker[i]);
 	}
 	wait4thread(rconfig.ghandler);
 }
@@ -145,13 +161,16 @@ void wait4thread(pthread_t threadid)
 
 void shutdownRouter()
 {
+	int i;
+
 	verbose(1, "[main]:: shutting down the GNET handler...");
 	GNETHalt(rconfig.ghandler);
 	verbose(1, "[main]:: shutting down the packet core... "); fflush(stdout);
 	pthread_cancel(rconfig.scheduler);
 	pthread_cancel(rconfig.worker);
 	if (rconfig.openflow) {
-		pthread_cancel(rconfig.openflow_worker);
+		for (i = 0; i < pcore->openflowworkers; i++)
+			pthread_cancel(pcore->openflowworker[i]);
 	}
 	verbose(1, "[main]:: shutting down the CLI handler.. ");
 	pthread_cancel(rconfig.clihandler);
@@ -179,6 +198,7 @@ void setupProgram(int ac, char *av[])
 	prog_set_verbosity_level(2);
 
 	indx = prog_opt_process(ac, av);
+	setLogLevel(prog_verbosity_level());
 
 	if (indx < ac)
 		rconfig.router_name = strdup(av[indx]);
@@ -12,6 +12,7 @@
 #include "ip.h"
 #include "message.h"
 #include "grouter.h"
+#include "logging.h"
 #include <slack/err.h>
 #include <netinet/in.h>
 #include <sys/time.h>
@@ -52,6 +52,7 @@ void infoHandler()
 {
 	queue_target_t *tptr;
 	simplequeue_t *qptr;
+	qstats_t st;
 	char linebuf[MAX_LINE_LEN], timestr[MAX_TMPBUF_LEN];
 	int len;
 	time_t tval;
@@ -77,9 +78,14 @@ void infoHandler()
 		{
 			tptr = (queue_target_t *)lister_next(lster);
 			qptr = tptr->queue;
-			sprintf(linebuf, "//Time stamp\t Queue name\t Queue size\t Queue rate\n");
+			getQueueStats(qptr, &st);
+			sprintf(linebuf, "//Time stamp\t Queue name\t Queue size\t Queue rate\t Enqueued\t Dequeued\t"
+				" Tail drops\t RED drops\t Max size\t Avg sojourn (us)\n");
 			len = strlen(linebuf);
-			sprintf(linebuf+len, "%s\t%s\t%d\t%f\n", timestr, qptr->name, qptr->cursize, getAvgByteRate(qptr));
+			sprintf(linebuf+len, "%s\t%s\t%d\t%f\t%llu\t%llu\t%llu\t%llu\t%d\t%.3f\n", timestr,
+				qptr->name, qptr->cursize, getAvgByteRate(qptr), (unsigned long long)st.enq_pkts,
+				(unsigned long long)st.deq_pkts, (unsigned long long)st.taildrops,
+				(unsigned long long)st.reddrops, st.maxdepth, st.sojourn_avg / 1e3);
 			write_to_fifo(iconf.id, linebuf, strlen(linebuf));
 		}
 		lister_release(lster);
@@ -17,6 +17,8 @@
 #include "icmp.h"
 #include "fragment.h"
 #include "packetcore.h"
+#include "drop.h"
+#include "logging.h"
 #include <stdlib.h>
 #include <slack/err.h>
 #include <netinet/in.h>
@@ -27,6 +29,8 @@
 
 extern pktcore_t *pcore;
 
+pthread_mutex_t lwip_core_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 void IPInit()
 {
 	RouteTableInit(route_tbl);
@@ -54,12 +58,13 @@ void IPIncomingPacket(gpacket_t *in_pkt)
 	{
 		verbose(2, "[IPIncomingPacket]:: got IP packet destined to this router");
 		IPProcessMyPacket(in_pkt);
-	} else if (COMPARE_IP(gNtohl(tmpbuf, ip_pkt->ip_dst), bcast_ip) == 0)
+	} else if (packetMeta(in_pkt)->nw_dst == PACK_IP(bcast_ip))
 	{
 		// TODO: rudimentary 'broadcast IP address' check
 		verbose(2, "[IPIncomingPacket]:: not repeat broadcast (final destination %s), packet thrown",
 		       IP2Dot(tmpbuf, gNtohl((tmpbuf+20), ip_pkt->ip_dst)));
 		IPProcessBcastPacket(in_pkt);
+		dropPacket(in_pkt, in_pkt->frame.src_interface, DROP_IP_BCAST);
 	} else
 	{
 		// Destinated to someone else
@@ -81,17 +86,16 @@ int IPCheckPacket4Me(gpacket_t *in_pkt)
 	char tmpbuf[MAX_TMPBUF_LEN];
 	int count, i;
 	uchar iface_ip[MAX_MTU][4];
-	uchar pkt_ip[4];
+	uint32_t pkt_ip = packetMeta(in_pkt)->nw_dst;
 
-	COPY_IP(pkt_ip, gNtohl(tmpbuf, ip_pkt->ip_dst));
-	verbose(2, "[IPCheckPacket4Me]:: looking for IP %s ", IP2Dot(tmpbuf, pkt_ip));
+	verbose(2, "[IPCheckPacket4Me]:: looking for IP %s ", IP2Dot(tmpbuf, gNtohl((tmpbuf+20), ip_pkt->ip_dst)));
 	if ((count = findAllInterfaceIPs(MTU_tbl, iface_ip)) > 0)
 	{
 		for (i = 0; i < count; i++)
 		{
-			if (COMPARE_IP(iface_ip[i], pkt_ip) == 0)
+			if (PACK_IP(iface_ip[i]) == pkt_ip)
 			{
-				verbose(2, "[IPCheckPacket4Me]:: found a matching IP.. for %s ", IP2Dot(tmpbuf, pkt_ip));
+				verbose(2, "[IPCheckPacket4Me]:: found a matching IP.. for %s ", IP2Dot(tmpbuf, iface_ip[i]));
 				return TRUE;
 			}
 		}
@@ -105,6 +109,8 @@ int IPCheckPacket4Me(gpacket_t *in_pkt)
 /*
  * TODO: broadcast not yet implemented.. should be simple to implement.
  * read RFC 1812 and 922 ...
+ * NOTE: udp_input also calls this on packets it keeps using, so it must
+ * not free the packet; IPIncomingPacket drops broadcasts itself.
  */
 int IPProcessBcastPacket(gpacket_t *in_pkt)
 {
@@ -144,7 +150,10 @@ int IPProcessForwardingPacket(gpacket_t *in_pkt)
 	if (findRouteEntry(route_tbl, gNtohl(tmpbuf, ip_pkt->ip_dst),
 			   in_pkt->frame.nxth_ip_addr,
 			   &(in_pkt->frame.dst_interface)) == EXIT_FAILURE)
+	{
+		dropPacket(in_pkt, in_pkt->frame.src_interface, DROP_NO_ROUTE);
 		return EXIT_FAILURE;
+	}
 
 	// check for redirection?? -- the output interface is already found
 	// by the previous command.. if needed the following routine sends the
@@ -174,6 +183,7 @@ int IPProcessForwardingPacket(gpacket_t *in_pkt)
 		verbose(2, "[IPProcessForwardingPacket]:: unreachable on packet from %s",
 			IP2Dot(tmpbuf, gNtohl((tmpbuf+20), ip_pkt->ip_src)));
 		int int_mtu = findMTU(MTU_tbl, in_pkt->frame.dst_interface);
+		countDrop(in_pkt, in_pkt->frame.src_interface, DROP_FRAG_NEEDED);
 		ICMPProcessFragNeeded(in_pkt, int_mtu);
 		break;
 
@@ -194,6 +204,8 @@ int IPProcessForwardingPacket(gpacket_t *in_pkt)
 		deallocateFragments(pkt_frags, num_frags);
 		break;
 	default:
+		// no MTU for the output interface
+		dropPacket(in_pkt, in_pkt->frame.src_interface, DROP_BAD_IFACE);
 		return EXIT_FAILURE;
 	}
 	return EXIT_SUCCESS;
@@ -207,7 +219,10 @@ int IPCheck4Errors(gpacket_t *in_pkt)
 
 	// check for valid version and checksum.. silently drop the packet if not.
 	if (IPVerifyPacket(ip_pkt) == EXIT_FAILURE)
+	{
+		dropPacket(in_pkt, in_pkt->frame.src_interface, DROP_BAD_IP_HEADER);
 		return EXIT_FAILURE;
+	}
 
 	// Decrement TTL, if TTL <= 0, send to ICMP module with TTL-expired command
 	// return EXIT_FAILURE
@@ -216,6 +231,7 @@ int IPCheck4Errors(gpacket_t *in_pkt)
 		verbose(2, "[processIPErrors]:: TTL expired on packet from %s",
 		       IP2Dot(tmpbuf, gNtohl((tmpbuf+20), ip_pkt->ip_src)));
 
+		countDrop(in_pkt, in_pkt->frame.src_interface, DROP_TTL_EXPIRED);
 		ICMPProcessTTLExpired(in_pkt);
 		return EXIT_FAILURE;
 	}
@@ -306,29 +322,33 @@ int IPCheck4Redirection(gpacket_t *in_pkt)
 int IPProcessMyPacket(gpacket_t *in_pkt)
 {
 	ip_packet_t *ip_pkt = (ip_packet_t *)in_pkt->data.data;
+	pkt_meta_t *meta = packetMeta(in_pkt);
 
 	if (IPVerifyPacket(ip_pkt) == EXIT_SUCCESS)
 	{
 		// Is packet ICMP? send it to the ICMP module
 		// further processing with appropriate type code
 
-		if (ip_pkt->ip_prot == ICMP_PROTOCOL) {
+		if (meta->nw_proto == ICMP_PROTOCOL) {
 			ICMPProcessPacket(in_pkt);
 		  return EXIT_SUCCESS;
         }
 
 		// Is packet UDP/TCP
 		// May be we can deal with other connectionless protocols as well.
-		if (ip_pkt->ip_prot == UDP_PROTOCOL){
+		if (meta->nw_proto == UDP_PROTOCOL){
 			UDPProcess(in_pkt);
 		  return EXIT_SUCCESS;
         }
-		if (ip_pkt->ip_prot == TCP_PROTOCOL){
+		if (meta->nw_proto == TCP_PROTOCOL){
 			TCPProcess(in_pkt);
 		  return EXIT_SUCCESS;
         }
 
+		dropPacket(in_pkt, in_pkt->frame.src_interface, DROP_UNKNOWN_PROTO);
+		return EXIT_FAILURE;
 	}
+	dropPacket(in_pkt, in_pkt->frame.src_interface, DROP_BAD_IP_HEADER);
 	return EXIT_FAILURE;
 }
 
@@ -346,7 +366,9 @@ int UDPProcess(gpacket_t *in_pkt)
     p->tot_len = p->len;
     p->type = PBUF_REF;
 
+    LOCK_TCPIP_CORE();
     udp_input(p, in_pkt, route_tbl[in_pkt->frame.src_interface].netmask,route_tbl[in_pkt->frame.src_interface].network);
+    UNLOCK_TCPIP_CORE();
 	return EXIT_SUCCESS;
 }
 
@@ -363,7 +385,9 @@ int TCPProcess(gpacket_t *in_pkt)
     p->tot_len = p->len;
     p->type = PBUF_REF;
 
+    LOCK_TCPIP_CORE();
     tcp_input(p, in_pkt);
+    UNLOCK_TCPIP_CORE();
 	return EXIT_SUCCESS;
 }
 
@@ -388,6 +412,7 @@ int IPOutgoingPacket(gpacket_t *pkt, uchar *dst_ip, int size, int newflag, int s
 	ip_pkt->ip_ttl = 64;                        // set TTL to default value
 	ip_pkt->ip_cksum = 0;                       // reset the checksum field
 	ip_pkt->ip_prot = src_prot;  // set the protocol field
+	pkt->frame.meta.valid = 0;                  // the headers are rewritten here
 
 	if (newflag == 0)
 	{
@@ -398,7 +423,10 @@ int IPOutgoingPacket(gpacket_t *pkt, uchar *dst_ip, int size, int newflag, int s
 		// NOTE: the packet itself is not modified by this lookup!
 		if (findRouteEntry(route_tbl, gNtohl(tmpbuf, ip_pkt->ip_dst),
 				   pkt->frame.nxth_ip_addr, &(pkt->frame.dst_interface)) == EXIT_FAILURE)
-				   return EXIT_FAILURE;
+		{
+			dropPacket(pkt, pkt->frame.src_interface, DROP_NO_ROUTE);
+			return EXIT_FAILURE;
+		}
 
 	} else if (newflag == 1)
 	{
@@ -417,7 +445,10 @@ int IPOutgoingPacket(gpacket_t *pkt, uchar *dst_ip, int size, int newflag, int s
 		verbose(2, "[IPOutgoingPacket]:: lookup next hop ");
 		// find the nexthop and interface and fill them in the "meta" frame
 		// NOTE: the packet itself is not modified by this lookup!
+		// a new packet is generated here (frame.src_interface is not set), so
+		// its drops go to the "-" row rather than an incoming interface
 		if (findRouteEntry(route_tbl, gNtohl(tmpbuf, ip_pkt->ip_dst), pkt->frame.nxth_ip_addr, &(pkt->frame.dst_interface)) == EXIT_FAILURE) {
+            dropPacket(pkt, -1, DROP_NO_ROUTE);
             return EXIT_FAILURE;
         }
 
@@ -425,13 +456,17 @@ int IPOutgoingPacket(gpacket_t *pkt, uchar *dst_ip, int size, int newflag, int s
 		// lookup the IP address of the destination interface..
 		if ((status = findInterfaceIP(MTU_tbl, pkt->frame.dst_interface,
 					      iface_ip_addr)) == EXIT_FAILURE)
-					      return EXIT_FAILURE;
+		{
+			dropPacket(pkt, -1, DROP_BAD_IFACE);
+			return EXIT_FAILURE;
+		}
 		// the outgoing packet should have the interface IP as source
 		COPY_IP(ip_pkt->ip_src, gHtonl(tmpbuf, iface_ip_addr));
 		verbose(2, "[IPOutgoingPacket]:: almost one processing the IP header.");
 	} else
 	{
 		error("[IPOutgoingPacket]:: unknown outgoing packet action.. packet discarded ");
+		free(pkt);
 		return EXIT_FAILURE;
 	}
 
@@ -452,18 +487,16 @@ int IPOutgoingPacket(gpacket_t *pkt, uchar *dst_ip, int size, int newflag, int s
  */
 int IPSend2Output(gpacket_t *pkt)
 {
-	int vlevel;
-
 	if (pkt == NULL)
 	{
 		verbose(1, "[IPSend2Output]:: NULL pointer error... nothing sent");
 		return EXIT_FAILURE;
 	}
 
-	vlevel = prog_verbosity_level();
-	if (vlevel >= 3)
-		printGPacket(pkt, vlevel, "IP_ROUTINE");
+	if (LOG_ENABLED(3))
+		printGPacket(pkt, log_level, "IP_ROUTINE");
 
+	LATENCY_STAMP(pkt, LAT_OUTQ);
 	return writeQueue(pcore->outputQ, (void *)pkt, sizeof(gpacket_t));
 }
 
@@ -0,0 +1,141 @@
+/*
+ * latency.c (per-stage packet latency histograms)
+ *
+ * Packets are recorded by the GNET handler as they are handed to the
+ * device driver, so there is a single writer; show and reset from the CLI
+ * may see a histogram that is being updated, which only skews a sample.
+ */
+
+#include "latency.h"
+#include <stdio.h>
+#include <string.h>
+#include <slack/std.h>
+#include <slack/err.h>
+
+volatile int latency_enabled = 0;
+
+static lat_hist_t lat_hist[LAT_HISTS];
+
+static char *lat_names[LAT_HISTS] = {
+	"rx -> enqueue",
+	"class queue",
+	"work queue",
+	"processing",
+	"output queue",
+	"total"
+};
+
+
+static int latencyBucket(uint64_t v)
+{
+	int e;
+
+	if (v < LAT_LINEAR_MAX)
+		return v;
+	e = 63 - __builtin_clzll(v);
+	return (e - LAT_SUB_BITS) * (1 << LAT_SUB_BITS) + (v >> (e - LAT_SUB_BITS));
+}
+
+
+// lowest value that falls in the bucket
+static uint64_t latencyBucketValue(int idx)
+{
+	int e;
+
+	if (idx < LAT_LINEAR_MAX)
+		return idx;
+	e = idx / (1 << LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+	return (uint64_t)(idx % (1 << LAT_SUB_BITS) + (1 << LAT_SUB_BITS)) << (e - LAT_SUB_BITS);
+}
+
+
+static void latencyAdd(lat_hist_t *hist, uint64_t v)
+{
+	if ((hist->count == 0) || (v < hist->min))
+		hist->min = v;
+	if (v > hist->max)
+		hist->max = v;
+	hist->count++;
+	hist->sum += v;
+	hist->buckets[latencyBucket(v)]++;
+}
+
+
+/*
+ * Stages the packet did not go through (for example, locally generated
+ * packets have no receive stamp) have a zero stamp and are skipped; the
+ * interval then runs from the previous stamp that is set.
+ */
+void latencyRecord(uint64_t *tstamp)
+{
+	int i, prev = -1;
+
+	tstamp[LAT_TODEV] = clockPrecise();
+	for (i = 0; i < LAT_STAMPS; i++)
+	{
+		if (tstamp[i] == 0)
+			continue;
+		if ((prev >= 0) && (tstamp[i] >= tstamp[prev]))
+			latencyAdd(&lat_hist[i - 1], tstamp[i] - tstamp[prev]);
+		prev = i;
+	}
+	for (i = 0; i < LAT_TODEV; i++)
+		if (tstamp[i] != 0)
+		{
+			latencyAdd(&lat_hist[LAT_HIST_TOTAL], tstamp[LAT_TODEV] - tstamp[i]);
+			break;
+		}
+}
+
+
+void latencySetEnabled(int enabled)
+{
+	latency_enabled = enabled;
+	verbose(2, "[latencySetEnabled]:: latency stamping %s ", enabled ? "enabled" : "disabled");
+}
+
+
+void latencyReset()
+{
+	memset(lat_hist, 0, sizeof(lat_hist));
+}
+
+
+// pct in [0, 100]; returns the lower bound of the bucket holding that rank
+uint64_t latencyPercentile(lat_hist_t *hist, double pct)
+{
+	uint64_t rank, seen = 0;
+	int i;
+
+	if (hist->count == 0)
+		return 0;
+	rank = (uint64_t)(pct / 100.0 * hist->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < LAT_BUCKETS; i++)
+	{
+		seen += hist->buckets[i];
+		if (seen >= rank)
+			return latencyBucketValue(i);
+	}
+	return hist->max;
+}
+
+
+void latencyShow()
+{
+	lat_hist_t *h;
+	int i;
+
+	printf("Latency stamping is %s (times in microseconds) \n", latency_enabled ? "on" : "off");
+	printf("%-14s %10s %9s %9s %9s %9s %9s %9s %9s\n", "stage", "packets", "min", "avg",
+	       "p50", "p90", "p99", "p99.9", "max");
+	for (i = 0; i < LAT_HISTS; i++)
+	{
+		h = &lat_hist[i];
+		printf("%-14s %10llu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n", lat_names[i],
+		       (unsigned long long)h->count, h->min / 1e3, h->count ? h->sum / 1e3 / h->count : 0.0,
+		       latencyPercentile(h, 50.0) / 1e3, latencyPercentile(h, 90.0) / 1e3,
+		       latencyPercentile(h, 99.0) / 1e3, latencyPercentile(h, 99.9) / 1e3, h->max / 1e3);
+	}
+}
@@ -0,0 +1,196 @@
+/*
+ * logging.c (log level and the binary trace ring)
+ *
+ * Each thread that records a trace event gets its own ring the first time,
+ * so recording is a few stores with no lock and no shared cache line. The
+ * dump merges the rings by time stamp. It reads the rings while they may
+ * still be written; turn tracing off first for an exact picture.
+ */
+
+#include "logging.h"
+#include "grouter.h"
+#include "clock.h"
+#include "drop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <slack/std.h>
+#include <slack/prog.h>
+
+
+typedef struct _trace_ring_t
+{
+	uint64_t next;                      // total records written
+	uint32_t thread;
+	trace_rec_t recs[TRACE_RING_SLOTS];
+} trace_ring_t;
+
+
+int log_level = 0;                      // libslack starts at 0 as well
+volatile int trace_enabled = 0;
+
+static __thread trace_ring_t *trace_ring = NULL;
+static trace_ring_t *trace_rings[TRACE_MAX_THREADS];
+static int trace_nrings = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Formats of the events: %u and %x print a value in decimal and hex, %I
+ * prints a value packed with TRACE_IP() and %D the name of a drop reason.
+ */
+static char *trace_formats[TRACE_EVENTS] = {
+	"rx on interface %u, %u bytes",
+	"tx on interface %u, %u bytes",
+	"route to %I via %I on interface %u",
+	"no route to %I",
+	"arp miss for %I on interface %u, packet buffered",
+	"drop on interface %u: %D"
+};
+
+
+void setLogLevel(int level)
+{
+	prog_set_verbosity_level(level);
+	log_level = level;
+	if (level > LOG_MAX_LEVEL)
+		printf("Messages above level %d are compiled out of this gRouter \n", LOG_MAX_LEVEL);
+}
+
+
+static trace_ring_t *traceRingCreate()
+{
+	trace_ring_t *r;
+
+	pthread_mutex_lock(&trace_lock);
+	if ((trace_nrings < TRACE_MAX_THREADS) &&
+	    ((r = (trace_ring_t *)calloc(1, sizeof(trace_ring_t))) != NULL))
+	{
+		r->thread = trace_nrings;
+		trace_rings[trace_nrings++] = r;
+		trace_ring = r;
+	}
+	pthread_mutex_unlock(&trace_lock);
+	return trace_ring;
+}
+
+
+void traceRecord(int event, uint64_t a0, uint64_t a1, uint64_t a2)
+{
+	trace_ring_t *r = trace_ring;
+	trace_rec_t *rec;
+
+	if ((r == NULL) && ((r = traceRingCreate()) == NULL))
+		return;
+
+	rec = &(r->recs[r->next & (TRACE_RING_SLOTS - 1)]);
+	rec->ts = clockPrecise();
+	rec->event = event;
+	rec->thread = r->thread;
+	rec->arg[0] = a0;
+	rec->arg[1] = a1;
+	rec->arg[2] = a2;
+	__atomic_store_n(&(r->next), r->next + 1, __ATOMIC_RELEASE);
+}
+
+
+void traceSetEnabled(int on)
+{
+	trace_enabled = on;
+}
+
+
+void traceClear()
+{
+	int i;
+
+	pthread_mutex_lock(&trace_lock);
+	for (i = 0; i < trace_nrings; i++)
+		__atomic_store_n(&(trace_rings[i]->next), 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+
+static void traceFormat(char *buf, trace_rec_t *rec)
+{
+	char *fmt = trace_formats[rec->event];
+	int n = 0;
+
+	for (; *fmt != '\0'; fmt++)
+	{
+		if ((*fmt != '%') || (fmt[1] == '\0'))
+		{
+			*buf++ = *fmt;
+			continue;
+		}
+		switch (*++fmt)
+		{
+		case 'u':
+			buf += sprintf(buf, "%llu", (unsigned long long)rec->arg[n++]);
+			break;
+		case 'x':
+			buf += sprintf(buf, "%llx", (unsigned long long)rec->arg[n++]);
+			break;
+		case 'I':
+			buf += sprintf(buf, "%u.%u.%u.%u", (uint32_t)(rec->arg[n] >> 24) & 0xFF,
+				       (uint32_t)(rec->arg[n] >> 16) & 0xFF, (uint32_t)(rec->arg[n] >> 8) & 0xFF,
+				       (uint32_t)rec->arg[n] & 0xFF);
+			n++;
+			break;
+		case 'D':
+			buf += sprintf(buf, "%s", dropReasonName(rec->arg[n++]));
+			break;
+		default:
+			*buf++ = *fmt;
+		}
+	}
+	*buf = '\0';
+}
+
+
+static int traceCompare(const void *a, const void *b)
+{
+	const trace_rec_t *ra = a, *rb = b;
+
+	return (ra->ts > rb->ts) - (ra->ts < rb->ts);
+}
+
+
+// prints the last count events of all threads, oldest first
+void traceShow(int count)
+{
+	char line[MAX_TMPBUF_LEN];
+	trace_rec_t *all;
+	uint64_t next, i, first;
+	int r, n = 0;
+
+	pthread_mutex_lock(&trace_lock);
+	if ((all = (trace_rec_t *)malloc(sizeof(trace_rec_t) * TRACE_RING_SLOTS * (trace_nrings + 1))) == NULL)
+	{
+		pthread_mutex_unlock(&trace_lock);
+		error("[traceShow]:: unable to allocate memory for the dump ");
+		return;
+	}
+	for (r = 0; r < trace_nrings; r++)
+	{
+		next = __atomic_load_n(&(trace_rings[r]->next), __ATOMIC_ACQUIRE);
+		first = (next > TRACE_RING_SLOTS) ? next - TRACE_RING_SLOTS : 0;
+		for (i = first; i < next; i++)
+			all[n++] = trace_rings[r]->recs[i & (TRACE_RING_SLOTS - 1)];
+	}
+	pthread_mutex_unlock(&trace_lock);
+
+	qsort(all, n, sizeof(trace_rec_t), traceCompare);
+	if ((count <= 0) || (count > n))
+		count = n;
+	printf("Trace is %s, %d events recorded in %d threads \n", trace_enabled ? "on" : "off",
+	       n, trace_nrings);
+	for (r = n - count; r < n; r++)
+	{
+		if (all[r].event >= TRACE_EVENTS)
+			continue;
+		traceFormat(line, &all[r]);
+		printf("%14.6f [%u] %s\n", (all[r].ts - all[n - count].ts) / 1e9, all[r].thread, line);
+	}
+	free(all);
+}
@@ -13,6 +13,140 @@
 #include <slack/err.h>
 
 
+// four bytes in network order as a host order value
+static inline uint32_t getLong(uchar *b)
+{
+	return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+
+static inline uint32_t hashMix(uint32_t h, uint32_t k)
+{
+	k *= 0xcc9e2d51;
+	k = (k << 15) | (k >> 17);
+	k *= 0x1b873593;
+	h ^= k;
+	h = (h << 13) | (h >> 19);
+	return h * 5 + 0xe6546b64;
+}
+
+
+static inline uint32_t hashFinish(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+
+/*
+ * Parses the L2-L4 headers of the packet into pkt->frame.meta. The drivers
+ * call it once on every packet they receive; other code gets the result
+ * through packetMeta(). Nothing here trusts the header lengths beyond the
+ * packet buffer.
+ */
+void parsePacket(gpacket_t *pkt)
+{
+	pkt_meta_t *meta = &(pkt->frame.meta);
+	uchar *base = (uchar *)&(pkt->data);
+	uint16_t prot = ntohs(pkt->data.header.prot);
+	int off = sizeof(pkt->data.header);
+	uint32_t h;
+
+	memset(meta, 0, sizeof(pkt_meta_t));
+	meta->vlan = PKT_META_VLAN_NONE;
+
+	if (prot == ETHERTYPE_IEEE_802_1Q)
+	{
+		pkt_data_vlan_t *vlan_data = (pkt_data_vlan_t *)&(pkt->data);
+
+		meta->flags |= PKT_META_VLAN;
+		meta->vlan = ntohs(vlan_data->header.tci) & 0xFFF;
+		meta->vlan_pcp = ntohs(vlan_data->header.tci) >> 13;
+		prot = ntohs(vlan_data->header.prot);
+		off = sizeof(vlan_data->header);
+	}
+
+	// IEEE 802.3 frame: the type is in the SNAP header, if there is one
+	if (prot < ETHERTYPE_MIN)
+	{
+		uchar *llc = base + off;
+		int ctrl_len = (llc[2] & IEEE_802_2_CTRL_8_BITS) == IEEE_802_2_CTRL_8_BITS ? 1 : 2;
+		uchar *snap = llc + 2 + ctrl_len;
+
+		if ((llc[0] == IEEE_802_2_DSAP_SNAP) && (snap[0] == 0) && (snap[1] == 0) && (snap[2] == 0))
+		{
+			prot = (snap[3] << 8) | snap[4];
+			off += 2 + ctrl_len + 5;
+		} else
+			prot = PKT_META_DL_NOT_ETH_TYPE;
+	}
+	meta->dl_type = prot;
+	meta->l3_offset = off;
+
+	if (prot == IP_PROTOCOL)
+	{
+		ip_packet_t *ip_pkt = (ip_packet_t *)(base + off);
+		int hlen = ip_pkt->ip_hdr_len * 4;
+
+		meta->flags |= PKT_META_IP;
+		meta->nw_src = getLong(ip_pkt->ip_src);
+		meta->nw_dst = getLong(ip_pkt->ip_dst);
+		meta->nw_proto = ip_pkt->ip_prot;
+		meta->nw_tos = ip_pkt->ip_tos;
+
+		if (ntohs(ip_pkt->ip_frag_off) & 0x3fff)
+			meta->flags |= PKT_META_FRAG;
+		else if ((hlen >= 20) && (off + hlen + 4 <= sizeof(pkt_data_t)))
+		{
+			uchar *l4 = base + off + hlen;
+
+			switch (ip_pkt->ip_prot)
+			{
+			case TCP_PROTOCOL:
+			case UDP_PROTOCOL:
+				meta->tp_src = (l4[0] << 8) | l4[1];
+				meta->tp_dst = (l4[2] << 8) | l4[3];
+				meta->flags |= PKT_META_L4;
+				break;
+			case ICMP_PROTOCOL:
+				meta->tp_src = l4[0];
+				meta->tp_dst = l4[1];
+				meta->flags |= PKT_META_L4;
+				break;
+			}
+			if (meta->flags & PKT_META_L4)
+				meta->l4_offset = off + hlen;
+		}
+
+		h = hashMix(0, meta->nw_src);
+		h = hashMix(h, meta->nw_dst);
+		h = hashMix(h, meta->nw_proto);
+		h = hashMix(h, ((uint32_t)meta->tp_src << 16) | meta->tp_dst);
+	} else
+	{
+		if (prot == ARP_PROTOCOL)
+		{
+			arp_packet_t *apkt = (arp_packet_t *)(base + off);
+
+			meta->flags |= PKT_META_ARP;
+			meta->nw_src = getLong(apkt->src_ip_addr);
+			meta->nw_dst = getLong(apkt->dst_ip_addr);
+			meta->nw_proto = ntohs(apkt->arp_opcode);
+		}
+		h = hashMix(0, getLong(base));
+		h = hashMix(h, getLong(base + 4));
+		h = hashMix(h, getLong(base + 8));
+		h = hashMix(h, prot);
+	}
+	meta->hash = hashFinish(h);
+	meta->valid = 1;
+}
+
+
 gpacket_t *duplicatePacket(gpacket_t *inpkt)
 {
 	gpacket_t *cpptr = (gpacket_t *) malloc(sizeof(gpacket_t));
@@ -7,7 +7,9 @@
 #include <arpa/inet.h>
 #include <inttypes.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <slack/err.h>
 
 #include "gnet.h"
 #include "grouter.h"
@@ -19,12 +21,24 @@
 static ofp_phy_port phy_ports[OPENFLOW_MAX_PHYSICAL_PORTS];
 static pthread_mutex_t phy_ports_mutex;
 
-// OpenFlow physical port statistics
+// Whether packets may go out of each port, kept next to the port structs
+// under the mutex so the OpenFlow workers can check it without the mutex
+// (see openflow_config_port_can_send)
+static uint32_t phy_port_flags[OPENFLOW_MAX_PHYSICAL_PORTS];
+
+// OpenFlow physical port statistics, without the packet and byte counts
 static ofp_port_stats phy_port_stats[OPENFLOW_MAX_PHYSICAL_PORTS];
 static pthread_mutex_t phy_port_stats_mutex;
 
+// Packet and byte counts of the physical ports, kept per thread so the data
+// path counts without a lock; they are added up when the stats are read
+static __thread openflow_port_counters_type *port_counters = NULL;
+static openflow_port_counters_type *port_counters_threads[OPENFLOW_MAX_THREADS];
+static uint32_t num_port_counters_threads = 0;
+
 // OpenFlow switch configuration
 static uint16_t switch_config_flags;
+static uint16_t miss_send_len = OFP_DEFAULT_MISS_SEND_LEN;
 static pthread_mutex_t switch_config_flags_mutex;
 
 extern router_config rconfig;
@@ -76,11 +90,38 @@ static void openflow_config_set_phy_port_stats_defaults()
 		phy_port_stats[i].rx_over_err = htonll(-1);
 		phy_port_stats[i].rx_crc_err = htonll(-1);
 		phy_port_stats[i].collisions = htonll(-1);
+
+		uint32_t j;
+		for (j = 0; j < num_port_counters_threads; j++)
+		{
+			memset(&port_counters_threads[j][i], 0,
+			        sizeof(openflow_port_counters_type));
+		}
 	}
 
 	pthread_mutex_unlock(&phy_port_stats_mutex);
 }
 
+/**
+ * Updates the flags the packet path checks from the config and state of the
+ * specified port. The port mutex must be held.
+ *
+ * @param gnet_port_num The GNET port number of the port.
+ */
+static void openflow_config_update_port_flags(uint16_t gnet_port_num)
+{
+	uint32_t config = ntohl(phy_ports[gnet_port_num].config);
+	uint32_t state = ntohl(phy_ports[gnet_port_num].state);
+	uint32_t flags = 0;
+
+	if ((config & OFPPC_PORT_DOWN) || (state & OFPPS_LINK_DOWN))
+	{
+		flags |= OPENFLOW_PORT_NO_SEND;
+	}
+	if (config & OFPPC_NO_FLOOD) flags |= OPENFLOW_PORT_NO_FLOOD;
+	__atomic_store_n(&phy_port_flags[gnet_port_num], flags, __ATOMIC_RELEASE);
+}
+
 /**
  * Sets the OpenFlow physical port structs to their default values. These
  * values change depending on the current state of the GNET interfaces.
@@ -114,6 +155,7 @@ static void openflow_config_set_phy_port_defaults()
 		{
 			COPY_MAC(phy_ports[i].hw_addr, iface->mac_addr);
 		}
+		openflow_config_update_port_flags(i);
 	}
 
 	pthread_mutex_unlock(&phy_ports_mutex);
@@ -151,6 +193,7 @@ void openflow_config_update_phy_port(int32_t openflow_port_num)
 	{
 		COPY_MAC(phy_ports[gnet_port_num].hw_addr, iface->mac_addr);
 	}
+	openflow_config_update_port_flags(gnet_port_num);
 
 	openflow_ctrl_iface_send_port_status(&phy_ports[gnet_port_num],
 	        OFPPR_MODIFY);
@@ -204,12 +247,43 @@ void openflow_config_set_phy_port(uint16_t openflow_port_num,
 	if (openflow_port_num > 0
 	        && openflow_port_num < OPENFLOW_MAX_PHYSICAL_PORTS + 1)
 	{
+		uint16_t gnet_port_num = openflow_config_get_gnet_port_num(
+		        openflow_port_num);
 		pthread_mutex_lock(&phy_ports_mutex);
-		phy_ports[openflow_config_get_gnet_port_num(openflow_port_num)] = *port;
+		phy_ports[gnet_port_num] = *port;
+		openflow_config_update_port_flags(gnet_port_num);
 		pthread_mutex_unlock(&phy_ports_mutex);
 	}
 }
 
+/**
+ * Checks whether a packet may be sent out of the specified OpenFlow physical
+ * port: the port has to exist and be up, administratively and physically,
+ * and a flooded packet also needs flooding to be enabled on the port. Takes
+ * no lock, so the OpenFlow workers do not wait for each other.
+ *
+ * @param openflow_port_num The specified OpenFlow port number.
+ * @param flood             1 if the packet is being flooded, otherwise 0.
+ *
+ * @return 1 if the packet may be sent, 0 if not.
+ */
+uint8_t openflow_config_port_can_send(uint16_t openflow_port_num,
+        uint8_t flood)
+{
+	if (openflow_port_num == 0
+	        || openflow_port_num > OPENFLOW_MAX_PHYSICAL_PORTS)
+	{
+		return 0;
+	}
+
+	uint32_t flags = __atomic_load_n(&phy_port_flags[
+	        openflow_config_get_gnet_port_num(openflow_port_num)],
+	        __ATOMIC_ACQUIRE);
+	if (flags & OPENFLOW_PORT_NO_SEND) return 0;
+	if (flood && (flags & OPENFLOW_PORT_NO_FLOOD)) return 0;
+	return 1;
+}
+
 /**
  * Prints information associated with the specified OpenFlow physical port.
  *
@@ -286,55 +360,120 @@ void openflow_config_print_ports()
 }
 
 /**
- * Gets the OpenFlow ofp_port_stats struct corresponding to the specified
- * OpenFlow port number.
- *
- * This function uses dynamically allocated memory that must be manually
- * freed afterwards.
+ * Returns the port counters of the calling thread, registering the thread
+ * the first time.
+ */
+static openflow_port_counters_type *openflow_config_port_counters()
+{
+	openflow_port_counters_type *counters = port_counters;
+	if (counters != NULL) return counters;
+
+	pthread_mutex_lock(&phy_port_stats_mutex);
+	if (num_port_counters_threads == OPENFLOW_MAX_THREADS
+	        || (counters = calloc(OPENFLOW_MAX_PHYSICAL_PORTS,
+	                sizeof(openflow_port_counters_type))) == NULL)
+	{
+		fatal("[openflow_config_port_counters]:: Could not set up port"
+				" counters for another thread.");
+	}
+	port_counters_threads[num_port_counters_threads++] = counters;
+	port_counters = counters;
+	pthread_mutex_unlock(&phy_port_stats_mutex);
+
+	return counters;
+}
+
+/**
+ * Counts a packet received on the specified OpenFlow port.
  *
  * @param openflow_port_num The specified OpenFlow port number.
+ * @param bytes             The length of the packet.
+ */
+void openflow_config_count_rx(uint16_t openflow_port_num, uint32_t bytes)
+{
+	if (openflow_port_num > 0
+	        && openflow_port_num < OPENFLOW_MAX_PHYSICAL_PORTS + 1)
+	{
+		openflow_port_counters_type *counters =
+		        &openflow_config_port_counters()[
+		                openflow_config_get_gnet_port_num(openflow_port_num)];
+		openflow_count(&counters->rx_packets, 1);
+		openflow_count(&counters->rx_bytes, bytes);
+	}
+}
+
+/**
+ * Counts a packet sent on the specified OpenFlow port.
  *
- * @return The OpenFlow ofp_port_stats struct corresponding to the
- *         specified port number.
+ * @param openflow_port_num The specified OpenFlow port number.
+ * @param bytes             The length of the packet.
  */
-ofp_port_stats *openflow_config_get_port_stats(uint16_t openflow_port_num)
+void openflow_config_count_tx(uint16_t openflow_port_num, uint32_t bytes)
 {
 	if (openflow_port_num > 0
 	        && openflow_port_num < OPENFLOW_MAX_PHYSICAL_PORTS + 1)
 	{
-		pthread_mutex_lock(&phy_port_stats_mutex);
+		openflow_port_counters_type *counters =
+		        &openflow_config_port_counters()[
+		                openflow_config_get_gnet_port_num(openflow_port_num)];
+		openflow_count(&counters->tx_packets, 1);
+		openflow_count(&counters->tx_bytes, bytes);
+	}
+}
 
-		ofp_port_stats *stats = malloc(sizeof(ofp_port_stats));
-		memcpy(stats,
-		        &phy_port_stats[openflow_config_get_gnet_port_num(
-		                openflow_port_num)], sizeof(ofp_port_stats));
+/**
+ * Copies the statistics of the specified port with the counts of all
+ * threads added up. The port statistics mutex must be held.
+ */
+static void openflow_config_sum_port_stats(uint16_t gnet_port_num,
+        ofp_port_stats *stats)
+{
+	uint64_t rx_packets = 0, tx_packets = 0, rx_bytes = 0, tx_bytes = 0;
+	uint32_t i;
 
-		pthread_mutex_unlock(&phy_port_stats_mutex);
-		return stats;
-	}
-	else
+	for (i = 0; i < num_port_counters_threads; i++)
 	{
-		return NULL;
+		openflow_port_counters_type *counters =
+		        &port_counters_threads[i][gnet_port_num];
+		rx_packets += __atomic_load_n(&counters->rx_packets,
+		        __ATOMIC_RELAXED);
+		tx_packets += __atomic_load_n(&counters->tx_packets,
+		        __ATOMIC_RELAXED);
+		rx_bytes += __atomic_load_n(&counters->rx_bytes, __ATOMIC_RELAXED);
+		tx_bytes += __atomic_load_n(&counters->tx_bytes, __ATOMIC_RELAXED);
 	}
+
+	*stats = phy_port_stats[gnet_port_num];
+	stats->rx_packets = htonll(rx_packets);
+	stats->tx_packets = htonll(tx_packets);
+	stats->rx_bytes = htonll(rx_bytes);
+	stats->tx_bytes = htonll(tx_bytes);
 }
 
 /**
- * Sets the OpenFlow ofp_port_stats struct corresponding to the specified
+ * Gets the OpenFlow ofp_port_stats struct corresponding to the specified
  * OpenFlow port number.
  *
  * @param openflow_port_num The specified OpenFlow port number.
- * @param stats             The new ofp_port_stats struct.
+ * @param stats             The struct to fill in.
+ *
+ * @return 0 if the port exists, -1 otherwise.
  */
-void openflow_config_set_port_stats(uint16_t openflow_port_num,
+int32_t openflow_config_get_port_stats(uint16_t openflow_port_num,
         ofp_port_stats *stats)
 {
 	if (openflow_port_num > 0
 	        && openflow_port_num < OPENFLOW_MAX_PHYSICAL_PORTS + 1)
 	{
 		pthread_mutex_lock(&phy_port_stats_mutex);
-		phy_port_stats[openflow_config_get_gnet_port_num(openflow_port_num)] =
-		        *stats;
+		openflow_config_sum_port_stats(
+		        openflow_config_get_gnet_port_num(openflow_port_num), stats);
 		pthread_mutex_unlock(&phy_port_stats_mutex);
+		return 0;
+	}
+	else
+	{
+		return -1;
 	}
 }
 
@@ -354,8 +493,10 @@ void openflow_config_print_port_stat(uint32_t index)
 		return;
 	}
 
-	ofp_port_stats *stats = &phy_port_stats[openflow_config_get_gnet_port_num(
-	        index)];
+	ofp_port_stats port_stats;
+	openflow_config_sum_port_stats(openflow_config_get_gnet_port_num(index),
+	        &port_stats);
+	ofp_port_stats *stats = &port_stats;
 
 	printf("\n");
 	printf("=========\n");
@@ -380,7 +521,7 @@ void openflow_config_print_port_stats()
 	uint32_t i;
 	for (i = 1; i <= OPENFLOW_MAX_PHYSICAL_PORTS; i++)
 	{
-		openflow_config_print_port(i);
+		openflow_config_print_port_stat(i);
 	}
 }
 
@@ -409,6 +550,33 @@ void openflow_config_set_switch_config_flags(uint16_t flags)
 	pthread_mutex_unlock(&switch_config_flags_mutex);
 }
 
+/**
+ * Gets the number of bytes of a packet that a table miss sends to the
+ * controller.
+ *
+ * @return The miss send length in host byte order.
+ */
+uint16_t openflow_config_get_miss_send_len()
+{
+	pthread_mutex_lock(&switch_config_flags_mutex);
+	uint16_t len = miss_send_len;
+	pthread_mutex_unlock(&switch_config_flags_mutex);
+	return len;
+}
+
+/**
+ * Sets the number of bytes of a packet that a table miss sends to the
+ * controller.
+ *
+ * @param len The miss send length in host byte order.
+ */
+void openflow_config_set_miss_send_len(uint16_t len)
+{
+	pthread_mutex_lock(&switch_config_flags_mutex);
+	miss_send_len = len;
+	pthread_mutex_unlock(&switch_config_flags_mutex);
+}
+
 /**
  * Gets the OpenFlow switch features.
  *
@@ -431,8 +599,8 @@ ofp_switch_features openflow_config_get_switch_features()
 		}
 	}
 
-	switch_features.n_buffers = htonl(0);
-	switch_features.n_tables = 1;
+	switch_features.n_buffers = htonl(OPENFLOW_PKT_BUFFERS);
+	switch_features.n_tables = OPENFLOW_NUM_TABLES;
 	switch_features.capabilities = htonl(
 	        OFPC_FLOW_STATS | OFPC_TABLE_STATS | OFPC_PORT_STATS
 	                | OFPC_ARP_MATCH_IP);
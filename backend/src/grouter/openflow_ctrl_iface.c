@@ -20,10 +20,22 @@
  *   - Matching of IP addresses in ARP packets is supported.
  *   - VLAN tag actions and matching are supported, though no other component
  *     of GINI currently supports VLAN tags.
- *   - Barrier requests and replies are supported, but are currently meaningless
- *     since only one thread is assigned to the controller-switch interface.
- *     If this changes, then the implementation for this feature will have to
- *     be updated.
+ *   - Barrier requests and replies are supported. Messages are handled one
+ *     at a time by the controller thread, and a flow mod waits for the
+ *     OpenFlow workers to finish the lookups they started, so everything
+ *     before a barrier has taken effect when it is answered.
+ *   - The controller thread runs a poll loop over the controller socket. It
+ *     connects without blocking, backing off between attempts, reassembles
+ *     messages that arrive split or several to a read, and sends an echo
+ *     request when the controller has been quiet for a while. Other threads
+ *     write straight to the socket when nothing is queued and otherwise add
+ *     to a bounded queue that the controller thread sends in batches.
+ *   - Flow, aggregate, table and port stats replies are built a message at a
+ *     time as the send queue drains, so their size and the memory they take
+ *     do not depend on the size of the flowtable. Until the last message is
+ *     out, messages from the controller wait in the receive buffer and flows
+ *     do not expire, which keeps the reply consistent; changes made from
+ *     the CLI in the meantime may still show.
  *   - Port statistics only count packets and bytes received by and transmitted
  *     from the port abstractions in the OpenFlow packet processor. This does
  *     not take into account the fact that packets may be dropped by GNET
@@ -34,8 +46,11 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <slack/err.h>
 #include <stddef.h>
@@ -43,8 +58,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "ethernet.h"
 #include "gnet.h"
 #include "grouter.h"
 #include "ip.h"
@@ -53,13 +70,59 @@
 #include "openflow_config.h"
 #include "openflow_defs.h"
 #include "openflow_flowtable.h"
+#include "openflow_pkt_buffer.h"
 #include "openflow_pkt_proc.h"
 #include "protocols.h"
 #include "tcp.h"
-
-// Controller socket file descriptor
-static int32_t ofc_socket_fd;
-static pthread_mutex_t ofc_socket_mutex;
+#include "probes.h"
+#include "clock.h"
+
+// Controller socket file descriptor, -1 when there is none. The controller
+// thread opens and closes it; other threads write to it under the mutex.
+static int32_t ofc_socket_fd = -1;
+static pthread_mutex_t ofc_socket_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Messages the socket did not take yet, oldest first (the first one may be
+// partly sent), protected by the socket mutex
+static openflow_ctrl_iface_msg_type
+        send_queue[OPENFLOW_CTRL_IFACE_SEND_QUEUE_MSGS];
+static uint32_t send_queue_head = 0;
+static uint32_t send_queue_count = 0;
+static uint32_t send_queue_bytes = 0;
+static uint32_t send_queue_offset = 0;
+
+// Socket of a connection attempt that is still in progress
+static int32_t connecting_fd = -1;
+
+// Bytes received from the controller that do not make a whole message yet
+static uint8_t *recv_buffer = NULL;
+static uint32_t recv_length = 0;
+
+// Written to when the controller thread has to look at the send queue or
+// at a reconnect request
+static int32_t wakeup_fds[2] = { -1, -1 };
+
+// State of the connection, only used by the controller thread
+static uint8_t conn_state = OPENFLOW_CTRL_IFACE_DISCONNECTED;
+static int32_t controller_port = 0;
+static uint32_t backoff_ms = OPENFLOW_CTRL_IFACE_BACKOFF_MIN_MS;
+static uint64_t next_attempt = 0;
+static uint64_t last_recv = 0;
+static uint64_t echo_sent = 0;
+static uint64_t echo_rtt = 0;
+static volatile uint32_t echo_interval_ms =
+        OPENFLOW_CTRL_IFACE_ECHO_INTERVAL_MS;
+// 1 once the controller has turned on table IDs in flow mods
+static uint8_t flow_mod_table_id = 0;
+
+// Channel counters, updated under the socket mutex
+static uint64_t msgs_received = 0;
+static uint64_t msgs_sent = 0;
+static uint64_t msgs_dropped = 0;
+static uint64_t connections = 0;
+
+// Stats reply in progress, only used by the controller thread
+static openflow_ctrl_iface_stats_stream_type stats_stream;
 
 // Transaction ID counter
 static uint32_t xid = 0;
@@ -125,6 +188,20 @@ static void openflow_ctrl_iface_conn_down()
 	pthread_mutex_unlock(&connection_status_mutex);
 }
 
+/**
+ * Wakes the controller thread up from its poll.
+ */
+static void openflow_ctrl_iface_wakeup()
+{
+	uint8_t byte = 0;
+	if (wakeup_fds[1] >= 0 && write(wakeup_fds[1], &byte, 1) < 0
+	        && errno != EAGAIN)
+	{
+		verbose(1, "[openflow_ctrl_iface_wakeup]:: Could not wake up the"
+				" controller thread.");
+	}
+}
+
 /**
  * Requests that the switch reconnect to the controller.
  */
@@ -133,6 +210,19 @@ void openflow_ctrl_iface_reconnect()
 	pthread_mutex_lock(&reconnect_mutex);
 	reconnect = 1;
 	pthread_mutex_unlock(&reconnect_mutex);
+	openflow_ctrl_iface_wakeup();
+}
+
+/**
+ * Sets the interval without messages from the controller after which an
+ * echo request is sent.
+ *
+ * @param interval_ms The interval in milliseconds.
+ */
+void openflow_ctrl_iface_set_echo_interval(uint32_t interval_ms)
+{
+	echo_interval_ms = interval_ms;
+	openflow_ctrl_iface_wakeup();
 }
 
 /**
@@ -171,54 +261,166 @@ static ofp_error_msg *openflow_ctrl_iface_create_error_msg()
 }
 
 /**
- * Sends an OpenFlow message to the controller TCP socket.
+ * Frees the messages of the send queue. The socket mutex must be held.
+ */
+static void openflow_ctrl_iface_clear_send_queue()
+{
+	while (send_queue_count > 0)
+	{
+		free(send_queue[send_queue_head].data);
+		send_queue_head = (send_queue_head + 1)
+		        % OPENFLOW_CTRL_IFACE_SEND_QUEUE_MSGS;
+		send_queue_count--;
+	}
+	send_queue_head = 0;
+	send_queue_bytes = 0;
+	send_queue_offset = 0;
+}
+
+/**
+ * Sends an OpenFlow message to the controller TCP socket. The message is
+ * written right away if nothing is queued before it; whatever the socket
+ * does not take is copied to the send queue, so this never blocks.
  *
  * @param data A pointer to the message.
- * @param len  The length of the message in bytes.
+ * @param len  The length of the message in host byte order.
  *
- * @return The number of bytes sent, or a negative value if an error occurred.
+ * @return The number of bytes sent or queued, or a negative value if an
+ *         error occurred.
  */
 static int32_t openflow_ctrl_iface_send(void *data, uint32_t len)
 {
 	pthread_mutex_lock(&ofc_socket_mutex);
 
-	uint8_t counter = 0;
-	uint32_t sent = 0;
-	while (sent < len && counter < OPENFLOW_CTRL_IFACE_SEND_TIMEOUT)
+	if (ofc_socket_fd < 0)
 	{
-		int32_t ret = send(ofc_socket_fd, ((uint8_t *) data) + sent, len - sent,
-		        0);
+		pthread_mutex_unlock(&ofc_socket_mutex);
+		verbose(2, "[openflow_ctrl_iface_send]:: Not connected to the"
+				" controller, message not sent.");
+		return OPENFLOW_CTRL_IFACE_ERR_CONN_CLOSED;
+	}
 
-		if (ret < 0)
+	uint32_t sent = 0;
+	if (send_queue_count == 0)
+	{
+		int32_t ret = send(ofc_socket_fd, data, len,
+		        MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK
+		        && errno != EINTR)
 		{
 			pthread_mutex_unlock(&ofc_socket_mutex);
 			verbose(1, "[openflow_ctrl_iface_send]:: Unknown error occurred"
 					" while sending message.");
 			return OPENFLOW_CTRL_IFACE_ERR_UNKNOWN;
 		}
-		else if (ret == 0)
-		{
-			counter += 1;
-			sleep(1);
-		}
-		else if (ret < len - sent)
+		if (ret > 0) sent = ret;
+		if (sent == len)
 		{
-			sent += ret;
-			sleep(1);
+			msgs_sent++;
+			pthread_mutex_unlock(&ofc_socket_mutex);
+			return len;
 		}
-		sent += ret;
+	}
+	else if (send_queue_count == OPENFLOW_CTRL_IFACE_SEND_QUEUE_MSGS
+	        || send_queue_bytes + len > OPENFLOW_CTRL_IFACE_SEND_QUEUE_BYTES)
+	{
+		msgs_dropped++;
+		pthread_mutex_unlock(&ofc_socket_mutex);
+		verbose(1, "[openflow_ctrl_iface_send]:: Send queue full, message"
+				" dropped.");
+		return OPENFLOW_CTRL_IFACE_ERR_QUEUE_FULL;
 	}
 
-	if (sent < len)
+	uint8_t *copy = malloc(len - sent);
+	if (copy == NULL)
 	{
+		msgs_dropped++;
 		pthread_mutex_unlock(&ofc_socket_mutex);
-		verbose(1, "[openflow_ctrl_iface_send]:: Send timeout reached"
-				" while sending message.");
-		return OPENFLOW_CTRL_IFACE_ERR_SEND_TIMEOUT;
+		verbose(1, "[openflow_ctrl_iface_send]:: Could not allocate memory,"
+				" message dropped.");
+		return OPENFLOW_CTRL_IFACE_ERR_QUEUE_FULL;
 	}
+	memcpy(copy, (uint8_t *) data + sent, len - sent);
+
+	uint32_t tail = (send_queue_head + send_queue_count)
+	        % OPENFLOW_CTRL_IFACE_SEND_QUEUE_MSGS;
+	send_queue[tail].data = copy;
+	send_queue[tail].length = len - sent;
+	send_queue_count++;
+	send_queue_bytes += len - sent;
+	// The controller thread only polls for writing while the queue is not
+	// empty
+	int wake = (send_queue_count == 1);
+	pthread_mutex_unlock(&ofc_socket_mutex);
+
+	if (wake) openflow_ctrl_iface_wakeup();
+	return len;
+}
+
+/**
+ * Sends as much of the send queue as the socket takes, up to
+ * OPENFLOW_CTRL_IFACE_SEND_BATCH messages per call to sendmsg.
+ *
+ * @return 0, or a negative value if an error occurred.
+ */
+static int32_t openflow_ctrl_iface_flush()
+{
+	struct iovec iov[OPENFLOW_CTRL_IFACE_SEND_BATCH];
+	struct msghdr msghdr;
+
+	pthread_mutex_lock(&ofc_socket_mutex);
+	while (send_queue_count > 0)
+	{
+		uint32_t i, n = send_queue_count < OPENFLOW_CTRL_IFACE_SEND_BATCH ?
+		        send_queue_count : OPENFLOW_CTRL_IFACE_SEND_BATCH;
+		for (i = 0; i < n; i++)
+		{
+			openflow_ctrl_iface_msg_type *msg = &send_queue[(send_queue_head
+			        + i) % OPENFLOW_CTRL_IFACE_SEND_QUEUE_MSGS];
+			uint32_t offset = i == 0 ? send_queue_offset : 0;
+			iov[i].iov_base = msg->data + offset;
+			iov[i].iov_len = msg->length - offset;
+		}
+		memset(&msghdr, 0, sizeof(msghdr));
+		msghdr.msg_iov = iov;
+		msghdr.msg_iovlen = n;
+
+		ssize_t ret = sendmsg(ofc_socket_fd, &msghdr,
+		        MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0)
+		{
+			pthread_mutex_unlock(&ofc_socket_mutex);
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			{
+				return 0;
+			}
+			verbose(1, "[openflow_ctrl_iface_flush]:: Unknown error occurred"
+					" while sending messages.");
+			return OPENFLOW_CTRL_IFACE_ERR_UNKNOWN;
+		}
 
+		send_queue_bytes -= ret;
+		while (ret > 0)
+		{
+			openflow_ctrl_iface_msg_type *msg = &send_queue[send_queue_head];
+			uint32_t left = msg->length - send_queue_offset;
+			if (ret < left)
+			{
+				send_queue_offset += ret;
+				break;
+			}
+			ret -= left;
+			free(msg->data);
+			send_queue_head = (send_queue_head + 1)
+			        % OPENFLOW_CTRL_IFACE_SEND_QUEUE_MSGS;
+			send_queue_count--;
+			send_queue_offset = 0;
+			msgs_sent++;
+		}
+		if (send_queue_offset > 0) break;
+	}
 	pthread_mutex_unlock(&ofc_socket_mutex);
-	return sent;
+	return 0;
 }
 
 /**
@@ -241,105 +443,20 @@ static int32_t openflow_ctrl_iface_send_error(uint16_t type, uint16_t code,
 	error_msg->type = htons(type);
 	error_msg->code = htons(code);
 
-	if (orig_msg->length > 64)
-	{
-		error_msg->header.length += 64;
-		memcpy(error_msg->data, orig_msg, 64);
-	}
-	else
+	uint16_t data_len = ntohs(orig_msg->length);
+	if (data_len > OPENFLOW_ERROR_MSG_MIN_DATA_SIZE)
 	{
-		error_msg->header.length += orig_msg->length;
-		memcpy(error_msg->data, orig_msg, orig_msg->length);
+		data_len = OPENFLOW_ERROR_MSG_MIN_DATA_SIZE;
 	}
+	memcpy(error_msg->data, orig_msg, data_len);
+	error_msg->header.length = htons(sizeof(ofp_error_msg) + data_len);
 
-	int32_t ret = openflow_ctrl_iface_send(error_msg, sizeof(ofp_error_msg));
+	int32_t ret = openflow_ctrl_iface_send(error_msg,
+	        sizeof(ofp_error_msg) + data_len);
 	free(error_msg);
 	return ret;
 }
 
-/**
- * Gets the next OpenFlow message from the controller TCP socket. The message
- * is created using dynamically-allocated memory and must be freed when no
- * longer needed.
- *
- * @param ptr_to_msg A pointer to a void pointer. The void pointer will be
- *                   replaced with a pointer to the message if one is received.
- *
- * @return The number of bytes in the message, 0 if no message was received,
- *         or a negative value if an error occurred.
- */
-static int32_t openflow_ctrl_iface_recv(ofp_header **ptr_to_msg)
-{
-	pthread_mutex_lock(&ofc_socket_mutex);
-
-	ofp_header header;
-	int32_t ret = recv(ofc_socket_fd, &header, sizeof(header), MSG_DONTWAIT);
-	if (ret == 0)
-	{
-		pthread_mutex_unlock(&ofc_socket_mutex);
-		verbose(1, "[openflow_ctrl_iface_recv]:: Controller connection"
-				" closed while receiving message header.");
-		return OPENFLOW_CTRL_IFACE_ERR_CONN_CLOSED;
-	}
-	else if (ret == -1)
-	{
-		pthread_mutex_unlock(&ofc_socket_mutex);
-		if (errno == EAGAIN) return 0;
-		verbose(1, "[openflow_ctrl_iface_recv]:: Unknown error occurred"
-				" while receiving message header.");
-		return OPENFLOW_CTRL_IFACE_ERR_UNKNOWN;
-	}
-
-	if (header.version != OFP_VERSION)
-	{
-		pthread_mutex_unlock(&ofc_socket_mutex);
-		verbose(1, "[openflow_ctrl_iface_recv]:: Bad OpenFlow version number"
-				" found in message header.");
-		int32_t ret = openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST,
-		        OFPBRC_BAD_VERSION, &header);
-		if (ret < 0) return ret;
-		return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
-	}
-	else if (header.type > OPENFLOW_MAX_MSG_TYPE)
-	{
-		pthread_mutex_unlock(&ofc_socket_mutex);
-		verbose(1, "[openflow_ctrl_iface_recv]:: Unsupported message type"
-				" found in message header.");
-		int32_t ret = openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST,
-		        OFPBRC_BAD_TYPE, &header);
-		if (ret < 0) return ret;
-		return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
-	}
-
-	void *msg = malloc(ntohs(header.length));
-	memcpy(msg, &header, sizeof(header));
-
-	if (ntohs(header.length) - sizeof(header) > 0)
-	{
-		ret = recv(ofc_socket_fd, msg + sizeof(header),
-		        ntohs(header.length) - sizeof(header), 0);
-		if (ret == 0)
-		{
-			pthread_mutex_unlock(&ofc_socket_mutex);
-			verbose(1, "[openflow_ctrl_iface_recv]:: Controller connection"
-					" closed while receiving message body.");
-			return OPENFLOW_CTRL_IFACE_ERR_CONN_CLOSED;
-		}
-		else if (ret == -1)
-		{
-			pthread_mutex_unlock(&ofc_socket_mutex);
-			if (errno == EAGAIN) return 0;
-			verbose(1, "[openflow_ctrl_iface_recv]:: Unknown error occurred"
-					" while receiving message body.");
-			return OPENFLOW_CTRL_IFACE_ERR_UNKNOWN;
-		}
-	}
-
-	*ptr_to_msg = msg;
-	pthread_mutex_unlock(&ofc_socket_mutex);
-	return ntohs(header.length);
-}
-
 /**
  * Sends a hello message to the OpenFlow controller.
  *
@@ -369,7 +486,6 @@ static int32_t openflow_ctrl_iface_recv_hello(ofp_hello *msg)
 	if (msg->header.version < OFP_VERSION || msg->header.type != OFPT_HELLO
 	        || ntohs(msg->header.length) < 8)
 	{
-		printf("%u\n", ntohs(msg->header.length));
 		if (msg->header.version < OFP_VERSION)
 		{
 			verbose(1, "[openflow_ctrl_iface_recv_hello]:: Incompatible"
@@ -396,32 +512,6 @@ static int32_t openflow_ctrl_iface_recv_hello(ofp_hello *msg)
 	return 0;
 }
 
-/**
- * Performs the initial OpenFlow controller connection setup, which consists
- * of the hello request-reply exchange.
- *
- * @return The number of bytes sent, or a negative value if an error occurred.
- */
-static int32_t openflow_ctrl_iface_hello_req_rep()
-{
-	verbose(2, "[openflow_ctrl_iface_hello_req_rep]:: Performing controller"
-			" hello request-reply exchange.");
-	int32_t ret = openflow_ctrl_iface_send_hello();
-	if (ret < 0) return ret;
-
-	ofp_hello* msg;
-	do
-	{
-		ret = openflow_ctrl_iface_recv((ofp_header **) &msg);
-	}
-	while (ret == 0);
-	if (ret < 0) return ret;
-
-	ret = openflow_ctrl_iface_recv_hello(msg);
-	free(msg);
-	return ret;
-}
-
 /**
  * Processes an echo request message from the OpenFlow controller.
  *
@@ -472,7 +562,7 @@ static int32_t openflow_ctrl_iface_send_echo_rep(uint8_t *echo_raw,
 	uint16_t msg_len = sizeof(ofp_header) + echo_raw_len;
 	ofp_header *msg = openflow_ctrl_iface_create_msg(OFPT_ECHO_REPLY, msg_len);
 	msg->xid = xid;
-	memcpy(msg + sizeof(ofp_header), echo_raw, echo_raw_len);
+	memcpy((uint8_t *) msg + sizeof(ofp_header), echo_raw, echo_raw_len);
 
 	int32_t ret = openflow_ctrl_iface_send(msg, msg_len);
 	free(msg);
@@ -548,33 +638,6 @@ static int32_t openflow_ctrl_iface_send_features_rep(uint32_t xid)
 	return ret;
 }
 
-/**
- * Performs the initial OpenFlow features request-reply exchange.
- *
- * @return The number of bytes sent, or a negative value if an error occurred.
- */
-static int32_t openflow_ctrl_iface_features_req_rep()
-{
-	verbose(2, "[openflow_ctrl_iface_features_req_rep]:: Performing controller"
-			" features request-reply exchange.");
-	ofp_header *msg;
-	int32_t ret;
-	do
-	{
-		ret = openflow_ctrl_iface_recv(&msg);
-	}
-	while (ret == 0);
-	if (ret < 0) return ret;
-
-	ret = openflow_ctrl_iface_recv_features_req(msg);
-	;
-	if (ret < 0) return ret;
-
-	ret = openflow_ctrl_iface_send_features_rep(msg->xid);
-	free(msg);
-	return ret;
-}
-
 /**
  * Processes a get configuration request from the OpenFlow controller.
  *
@@ -619,9 +682,7 @@ static int32_t openflow_ctrl_iface_send_get_config_rep(uint32_t xid)
 	                OFPT_GET_CONFIG_REPLY, msg_len);
 	msg->header.xid = xid;
 	msg->flags = openflow_config_get_switch_config_flags();
-	// This OpenFlow implementation has no buffers, so miss_send_len is not
-	// stored and is always zero
-	msg->miss_send_len = 0;
+	msg->miss_send_len = htons(openflow_config_get_miss_send_len());
 
 	int32_t ret = openflow_ctrl_iface_send(msg, msg_len);
 	free(msg);
@@ -653,6 +714,7 @@ static int32_t openflow_ctrl_iface_recv_set_config(ofp_switch_config *msg)
 	}
 
 	openflow_config_set_switch_config_flags(msg->flags);
+	openflow_config_set_miss_send_len(ntohs(msg->miss_send_len));
 
 	return 0;
 }
@@ -680,26 +742,48 @@ static int32_t openflow_ctrl_iface_recv_packet_out(ofp_packet_out *msg)
 		if (ret < 0) return ret;
 		return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
 	}
-	if (ntohl(msg->buffer_id) != -1)
+	if (sizeof(ofp_packet_out) + ntohs(msg->actions_len)
+	        > ntohs(msg->header.length))
 	{
 		verbose(1, "[openflow_ctrl_iface_recv_packet_out]:: Unexpected"
-				" message length found in message of type OFPT_PACKET_OUT from"
+				" actions length found in message of type OFPT_PACKET_OUT from"
 				" controller.");
 		int32_t ret = openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST,
-		        OFPBRC_BUFFER_UNKNOWN, &msg->header);
+		        OFPBRC_BAD_LEN, &msg->header);
 		if (ret < 0) return ret;
 		return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
 	}
 
 	gpacket_t packet;
-	uint16_t in_port = openflow_config_get_gnet_port_num(ntohs(msg->in_port));
-	if (in_port < MAX_INTERFACES && findInterface(in_port) != NULL)
+	uint32_t buffer_id = ntohl(msg->buffer_id);
+	if (buffer_id != OPENFLOW_PKT_BUFFER_NONE)
+	{
+		// The packet data of the message is ignored for a buffered packet
+		int32_t ret = openflow_pkt_buffer_retrieve(buffer_id, &packet);
+		if (ret < 0)
+		{
+			ret = openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST,
+			        ret == OPENFLOW_PKT_BUFFER_ERR_EMPTY ? OFPBRC_BUFFER_EMPTY :
+			                OFPBRC_BUFFER_UNKNOWN, &msg->header);
+			if (ret < 0) return ret;
+			return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
+		}
+	}
+	else
 	{
-		packet.frame.src_interface = in_port;
+		uint16_t in_port = openflow_config_get_gnet_port_num(
+		        ntohs(msg->in_port));
+		if (in_port < MAX_INTERFACES && findInterface(in_port) != NULL)
+		{
+			packet.frame.src_interface = in_port;
+		}
+		uint32_t data_len = ntohs(msg->header.length) - sizeof(ofp_packet_out)
+		        - ntohs(msg->actions_len);
+		if (data_len > sizeof(pkt_data_t)) data_len = sizeof(pkt_data_t);
+		memcpy(&packet.data,
+		        ((uint8_t *) msg->actions) + ntohs(msg->actions_len), data_len);
+		parsePacket(&packet);
 	}
-	memcpy(&packet.data, ((uint8_t *) msg->actions) + htons(msg->actions_len),
-	        ntohs(msg->header.length) - sizeof(ofp_packet_out)
-	                - ntohs(msg->actions_len));
 
 	uint32_t actions = htons(msg->actions_len) / sizeof(ofp_action_header);
 	uint32_t i;
@@ -736,16 +820,46 @@ static int32_t openflow_ctrl_iface_recv_flow_mod(ofp_flow_mod *msg)
 		return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
 	}
 
+	// Without table IDs, a flow mod adds to the first table and deletes
+	// from all of them, as if there were only the one
+	uint8_t table_id = OPENFLOW_TABLE_ALL;
+	if (flow_mod_table_id)
+	{
+		table_id = ntohs(msg->command) >> 8;
+		msg->command = htons(ntohs(msg->command) & 0xff);
+	}
+
 	uint16_t error_type;
 	uint16_t error_code;
-	ret = openflow_flowtable_modify(msg, &error_type, &error_type);
+	ret = openflow_flowtable_modify(msg, table_id, &error_type, &error_code);
 	if (ret < 0)
 	{
-		int32_t ret = openflow_ctrl_iface_send_error(error_type, error_code,
-		        &msg->header);
+		// The flowtable gives the error in network byte order
+		int32_t ret = openflow_ctrl_iface_send_error(ntohs(error_type),
+		        ntohs(error_code), &msg->header);
 		if (ret < 0) return ret;
 		return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
 	}
+
+	// A buffered packet goes through the table again, which now has the
+	// new entry
+	uint16_t command = ntohs(msg->command);
+	uint32_t buffer_id = ntohl(msg->buffer_id);
+	if (buffer_id != OPENFLOW_PKT_BUFFER_NONE && command != OFPFC_DELETE
+	        && command != OFPFC_DELETE_STRICT)
+	{
+		gpacket_t packet;
+		ret = openflow_pkt_buffer_retrieve(buffer_id, &packet);
+		if (ret < 0)
+		{
+			ret = openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST,
+			        ret == OPENFLOW_PKT_BUFFER_ERR_EMPTY ? OFPBRC_BUFFER_EMPTY :
+			                OFPBRC_BUFFER_UNKNOWN, &msg->header);
+			if (ret < 0) return ret;
+			return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
+		}
+		openflow_pkt_proc_handle_packet(&packet);
+	}
 	return 0;
 }
 
@@ -814,28 +928,45 @@ static int32_t openflow_ctrl_iface_recv_port_mod(ofp_port_mod *msg)
 
 /**
  * Sends a packet in message to the OpenFlow controller containing the
- * specified packet.
+ * specified packet. A packet longer than max_len is buffered and only its
+ * first max_len bytes are sent; if no buffer is free, the whole packet is
+ * sent. Packet in messages over the rate limit of the input port are not
+ * sent at all.
  *
- * @param packet A pointer to the packet to send to the OpenFlow controller.
- * @param reason The reason the packet is being sent to the controller.
+ * @param packet  A pointer to the packet to send to the OpenFlow controller.
+ * @param reason  The reason the packet is being sent to the controller.
+ * @param max_len The number of bytes of the packet to send.
  *
  * @return The number of bytes sent, or a negative value if an error occurred.
  */
-int32_t openflow_ctrl_iface_send_packet_in(gpacket_t *packet, uint8_t reason)
+int32_t openflow_ctrl_iface_send_packet_in(gpacket_t *packet, uint8_t reason,
+        uint16_t max_len)
 {
-	if (openflow_ctrl_iface_get_conn_state())
+	PROBE2(packet_in, packet, reason);
+	if (openflow_ctrl_iface_get_conn_state()
+	        && openflow_pkt_buffer_admit(packet->frame.src_interface))
 	{
-		uint16_t msg_len = sizeof(ofp_packet_in) + sizeof(pkt_data_t)
-		        - (sizeof(ofp_packet_in) - offsetof(ofp_packet_in, data));
+		uint32_t total_len = findPacketSize(&packet->data);
+		if (total_len > sizeof(pkt_data_t)) total_len = sizeof(pkt_data_t);
+
+		uint32_t buffer_id = OPENFLOW_PKT_BUFFER_NONE;
+		uint32_t data_len = total_len;
+		if (max_len < total_len)
+		{
+			buffer_id = openflow_pkt_buffer_store(packet, total_len);
+			if (buffer_id != OPENFLOW_PKT_BUFFER_NONE) data_len = max_len;
+		}
+
+		uint16_t msg_len = offsetof(ofp_packet_in, data) + data_len;
 		ofp_packet_in *msg = (ofp_packet_in *) openflow_ctrl_iface_create_msg(
 		        OFPT_PACKET_IN, msg_len);
 		msg->header.xid = htonl(openflow_ctrl_iface_get_xid());
-		msg->buffer_id = htonl(-1);
-		msg->total_len = htons(sizeof(pkt_data_t));
+		msg->buffer_id = htonl(buffer_id);
+		msg->total_len = htons(total_len);
 		msg->in_port = htons(
 		        openflow_config_get_of_port_num(packet->frame.src_interface));
 		msg->reason = reason;
-		memcpy(msg->data, &packet->data, sizeof(pkt_data_t));
+		memcpy(msg->data, &packet->data, data_len);
 
 		int32_t ret = openflow_ctrl_iface_send(msg, msg_len);
 		free(msg);
@@ -848,37 +979,28 @@ int32_t openflow_ctrl_iface_send_packet_in(gpacket_t *packet, uint8_t reason)
 }
 
 /**
- * Sends a flow removed message to the OpenFlow controller.
+ * Sends flow removed messages to the OpenFlow controller, all of them in
+ * one write.
  *
- * @param entry  A pointer to the flowtable entry that is being removed from
- *               the flowtable.
- * @param reason The reason the flow is being removed.
+ * @param msgs  The flow removed messages, filled in except for the header.
+ * @param count The number of messages.
  *
  * @return The number of bytes sent, or a negative value if an error occurred.
  */
-int32_t openflow_ctrl_iface_send_flow_removed(
-        openflow_flowtable_entry_type *entry, uint8_t reason)
+int32_t openflow_ctrl_iface_send_flow_removed(ofp_flow_removed *msgs,
+        uint32_t count)
 {
 	if (openflow_ctrl_iface_get_conn_state())
 	{
-		uint16_t msg_len = sizeof(ofp_flow_removed);
-		ofp_flow_removed *msg =
-		        (ofp_flow_removed *) openflow_ctrl_iface_create_msg(
-		                OFPT_FLOW_REMOVED, msg_len);
-		msg->header.xid = htonl(openflow_ctrl_iface_get_xid());
-		msg->match = entry->match;
-		msg->cookie = entry->cookie;
-		msg->priority = entry->priority;
-		msg->reason = reason;
-		msg->duration_sec = entry->stats.duration_sec;
-		msg->duration_nsec = entry->stats.duration_nsec;
-		msg->idle_timeout = entry->idle_timeout;
-		msg->packet_count = entry->stats.packet_count;
-		msg->byte_count = entry->stats.byte_count;
-
-		int32_t ret = openflow_ctrl_iface_send(msg, msg_len);
-		free(msg);
-		return ret;
+		uint32_t i;
+		for (i = 0; i < count; i++)
+		{
+			msgs[i].header.version = OFP_VERSION;
+			msgs[i].header.type = OFPT_FLOW_REMOVED;
+			msgs[i].header.length = htons(sizeof(ofp_flow_removed));
+			msgs[i].header.xid = htonl(openflow_ctrl_iface_get_xid());
+		}
+		return openflow_ctrl_iface_send(msgs, sizeof(ofp_flow_removed) * count);
 	}
 	else
 	{
@@ -949,7 +1071,7 @@ static int32_t openflow_ctrl_iface_recv_stats_req(ofp_stats_request *msg)
 	}
 	else if (type == OFPST_TABLE)
 	{
-		expected_length = sizeof(ofp_stats_request) + sizeof(ofp_table_stats);
+		expected_length = sizeof(ofp_stats_request);
 	}
 	else if (type == OFPST_PORT)
 	{
@@ -992,12 +1114,186 @@ static int32_t openflow_ctrl_iface_recv_stats_req(ofp_stats_request *msg)
 }
 
 /**
- * Sends a stats reply message to the OpenFlow controller.
+ * Writes the next part of the body of the stats reply in progress, starting
+ * where the previous part ended.
+ *
+ * @param buf The buffer to write to.
+ * @param len The length of the buffer in bytes.
+ *
+ * @return The number of bytes written.
+ */
+static uint32_t openflow_ctrl_iface_stats_stream_fill(uint8_t *buf,
+        uint32_t len)
+{
+	uint32_t written = 0;
+
+	if (stats_stream.type == OFPST_FLOW)
+	{
+		ofp_flow_stats_request *request = &stats_stream.request.flow;
+		return openflow_flowtable_get_flow_stats(&request->match,
+		        request->out_port, request->table_id, &stats_stream.cursor,
+		        buf, len);
+	}
+	else if (stats_stream.type == OFPST_AGGREGATE)
+	{
+		// Only the totals go out, so the whole table is read at once, the
+		// flowtable mutex being released after each batch
+		ofp_aggregate_stats_request *request = &stats_stream.request.aggregate;
+		ofp_aggregate_stats_reply *body = &stats_stream.aggregate;
+		while (stats_stream.cursor != OPENFLOW_FLOWTABLE_NIL)
+		{
+			openflow_flowtable_get_aggregate_stats(&request->match,
+			        request->out_port, request->table_id,
+			        &stats_stream.cursor, body);
+		}
+
+		ofp_aggregate_stats_reply *reply = (ofp_aggregate_stats_reply *) buf;
+		memset(reply, 0, sizeof(ofp_aggregate_stats_reply));
+		reply->packet_count = htonll(body->packet_count);
+		reply->byte_count = htonll(body->byte_count);
+		reply->flow_count = htonl(body->flow_count);
+		return sizeof(ofp_aggregate_stats_reply);
+	}
+	else if (stats_stream.type == OFPST_TABLE)
+	{
+		while (stats_stream.cursor < OPENFLOW_NUM_TABLES
+		        && written + sizeof(ofp_table_stats) <= len)
+		{
+			ofp_table_stats stats = openflow_flowtable_get_table_stats(
+			        stats_stream.cursor++);
+			memcpy(buf + written, &stats, sizeof(ofp_table_stats));
+			written += sizeof(ofp_table_stats);
+		}
+		if (stats_stream.cursor >= OPENFLOW_NUM_TABLES)
+		{
+			stats_stream.cursor = OPENFLOW_FLOWTABLE_NIL;
+		}
+	}
+	else if (stats_stream.type == OFPST_PORT)
+	{
+		// A port that does not exist gets an empty reply
+		uint16_t port_no = ntohs(stats_stream.request.port.port_no);
+		if (port_no != OFPP_NONE)
+		{
+			if (openflow_config_get_port_stats(port_no,
+			        (ofp_port_stats *) buf) == 0)
+			{
+				written = sizeof(ofp_port_stats);
+			}
+			stats_stream.cursor = OPENFLOW_FLOWTABLE_NIL;
+			return written;
+		}
+
+		// OFPP_NONE asks for every port
+		if (stats_stream.cursor == 0) stats_stream.cursor = 1;
+		while (stats_stream.cursor <= OPENFLOW_MAX_PHYSICAL_PORTS
+		        && written + sizeof(ofp_port_stats) <= len)
+		{
+			openflow_config_get_port_stats(stats_stream.cursor++,
+			        (ofp_port_stats *) (buf + written));
+			written += sizeof(ofp_port_stats);
+		}
+		if (stats_stream.cursor > OPENFLOW_MAX_PHYSICAL_PORTS)
+		{
+			stats_stream.cursor = OPENFLOW_FLOWTABLE_NIL;
+		}
+	}
+	else
+	{
+		stats_stream.cursor = OPENFLOW_FLOWTABLE_NIL;
+	}
+
+	return written;
+}
+
+/**
+ * Ends the stats reply in progress, if any.
+ */
+static void openflow_ctrl_iface_stats_stream_end()
+{
+	if (!stats_stream.active) return;
+	if (stats_stream.type == OFPST_FLOW || stats_stream.type == OFPST_AGGREGATE)
+	{
+		openflow_flowtable_stats_end();
+	}
+	stats_stream.active = 0;
+	stats_stream.pending = 0;
+}
+
+/**
+ * Sends the next messages of the stats reply in progress while the send
+ * queue holds less than OPENFLOW_CTRL_IFACE_STATS_QUEUE_BYTES, and ends the
+ * reply after its last message. Every message but the last one has the
+ * OFPSF_REPLY_MORE flag.
+ *
+ * @return 0, or a negative value if an error occurred.
+ */
+static int32_t openflow_ctrl_iface_stats_stream_run()
+{
+	ofp_stats_reply *msg = stats_stream.msg;
+
+	while (stats_stream.active)
+	{
+		if (stats_stream.pending == 0)
+		{
+			pthread_mutex_lock(&ofc_socket_mutex);
+			uint32_t queued = send_queue_bytes;
+			pthread_mutex_unlock(&ofc_socket_mutex);
+			if (queued >= OPENFLOW_CTRL_IFACE_STATS_QUEUE_BYTES) return 0;
+
+			// Fill the message until the next part does not fit or there is
+			// nothing left
+			uint32_t body_len = 0, cursor;
+			uint32_t room = OPENFLOW_CTRL_IFACE_STATS_REPLY_BYTES
+			        - sizeof(ofp_stats_reply);
+			do
+			{
+				cursor = stats_stream.cursor;
+				body_len += openflow_ctrl_iface_stats_stream_fill(
+				        (uint8_t *) msg->body + body_len, room - body_len);
+			}
+			while (stats_stream.cursor != OPENFLOW_FLOWTABLE_NIL
+			        && stats_stream.cursor != cursor);
+
+			stats_stream.pending = sizeof(ofp_stats_reply) + body_len;
+			memset(msg, 0, sizeof(ofp_stats_reply));
+			msg->header.version = OFP_VERSION;
+			msg->header.type = OFPT_STATS_REPLY;
+			msg->header.length = htons(stats_stream.pending);
+			msg->header.xid = stats_stream.xid;
+			msg->type = htons(stats_stream.type);
+			if (stats_stream.cursor != OPENFLOW_FLOWTABLE_NIL)
+			{
+				msg->flags = htons(OFPSF_REPLY_MORE);
+			}
+		}
+
+		// Messages from other threads may have taken the room left in the
+		// queue, in which case the message is sent again once it drains
+		int32_t ret = openflow_ctrl_iface_send(msg, stats_stream.pending);
+		if (ret == OPENFLOW_CTRL_IFACE_ERR_QUEUE_FULL) return 0;
+		if (ret < 0) return ret;
+		stats_stream.pending = 0;
+
+		if (stats_stream.cursor == OPENFLOW_FLOWTABLE_NIL)
+		{
+			openflow_ctrl_iface_stats_stream_end();
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Sends a stats reply message to the OpenFlow controller. A description
+ * reply is sent right away; the others start a reply that is sent a message
+ * at a time (see openflow_ctrl_iface_stats_stream_run).
  *
  * @param orig_msg A pointer to the stats request message received from the
  *                 OpenFlow controller.
  *
- * @return The number of bytes sent, or a negative value if an error occurred.
+ * @return 0 or the number of bytes sent, or a negative value if an error
+ *         occurred.
  */
 static int32_t openflow_ctrl_iface_send_stats_rep(ofp_stats_request *orig_msg)
 {
@@ -1022,190 +1318,77 @@ static int32_t openflow_ctrl_iface_send_stats_rep(ofp_stats_request *orig_msg)
 		free(msg);
 		return ret;
 	}
-	else if (type == OFPST_FLOW)
+
+	openflow_ctrl_iface_stats_stream_end();
+	memset(&stats_stream.request, 0, sizeof(stats_stream.request));
+	memcpy(&stats_stream.request, orig_msg->body,
+	        ntohs(orig_msg->header.length) - sizeof(ofp_stats_request));
+	memset(&stats_stream.aggregate, 0, sizeof(ofp_aggregate_stats_reply));
+	stats_stream.type = type;
+	stats_stream.xid = orig_msg->header.xid;
+	stats_stream.cursor = 0;
+	stats_stream.pending = 0;
+	stats_stream.active = 1;
+	if (type == OFPST_FLOW || type == OFPST_AGGREGATE)
 	{
-		ofp_flow_stats_request *orig_body =
-		        (ofp_flow_stats_request *) orig_msg->body;
+		openflow_flowtable_stats_begin();
+	}
 
-		int32_t bytes_sent = 0;
-		uint32_t i = 0;
-		ofp_flow_stats *stats;
-		openflow_flowtable_action_type *actions;
-
-		while (i < OPENFLOW_MAX_FLOWTABLE_ENTRIES)
-		{
-			if (openflow_flowtable_get_entry_stats(&orig_body->match,
-			        orig_body->out_port, i, &i, orig_body->table_id, &stats,
-			        &actions))
-			{
-				uint16_t msg_len = sizeof(ofp_stats_reply)
-				        + sizeof(ofp_flow_stats);
-
-				uint32_t j = 0;
-				for (j = 0; j < OPENFLOW_MAX_ACTIONS; j++)
-				{
-					if (actions[j].active)
-					{
-						msg_len += ntohs(actions[j].header.len);
-						stats->length = htons(
-						        ntohs(stats->length)
-						                + ntohs(actions[j].header.len));
-					}
-				}
-
-				ofp_stats_reply *msg =
-				        (ofp_stats_reply *) openflow_ctrl_iface_create_msg(
-				                OFPT_STATS_REPLY, msg_len);
-				msg->header.xid = orig_msg->header.xid;
-				msg->type = htons(OFPST_FLOW);
-				msg->flags = htons(OFPSF_REPLY_MORE);
-
-				memcpy(msg->body, stats, sizeof(ofp_flow_stats));
-
-				uint32_t len_index = 0;
-				for (j = 0; i < OPENFLOW_MAX_ACTIONS; j++)
-				{
-					if (actions[j].active)
-					{
-						memcpy(
-						        (uint8_t *) (((uint8_t *) msg->body) + len_index),
-						        &actions[j].header,
-						        ntohs(actions[j].header.len));
-						len_index += ntohs(actions[j].header.len);
-					}
-				}
-
-				int32_t ret = openflow_ctrl_iface_send(msg, msg_len);
-				free(msg);
-				free(stats);
-				free(actions);
-				if (ret < 0) return ret;
-				bytes_sent += ret;
-
-				i += 1;
-			}
-			else
-			{
-				break;
-			}
-		}
+	return openflow_ctrl_iface_stats_stream_run();
+}
 
-		uint16_t msg_len = sizeof(ofp_stats_reply);
-		ofp_stats_reply *msg =
-		        (ofp_stats_reply *) openflow_ctrl_iface_create_msg(
-		                OFPT_STATS_REPLY, msg_len);
-		msg->header.xid = orig_msg->header.xid;
-		msg->type = htons(OFPST_FLOW);
-		msg->flags = 0;
+/**
+ * Processes a vendor message from the OpenFlow controller. The only one
+ * supported is the Nicira message that turns table IDs in flow mods on or
+ * off.
+ *
+ * @param msg The vendor message received from the OpenFlow controller.
+ *
+ * @return 0, or a negative value if an error occurred.
+ */
+static int32_t openflow_ctrl_iface_recv_vendor(ofp_header *msg)
+{
+	verbose(2, "[openflow_ctrl_iface_parse_message]:: Received"
+			" message from controller of type OFPT_VENDOR.");
 
-		int32_t ret = openflow_ctrl_iface_send(msg, msg_len);
-		free(msg);
+	openflow_nx_flow_mod_table_id_type *nx_msg =
+	        (openflow_nx_flow_mod_table_id_type *) msg;
+	if (ntohs(msg->length) < sizeof(ofp_header) + 2 * sizeof(uint32_t))
+	{
+		verbose(1, "[openflow_ctrl_iface_recv_vendor]:: Unexpected message"
+				" length found in message of type OFPT_VENDOR from"
+				" controller.");
+		int32_t ret = openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST,
+		        OFPBRC_BAD_LEN, msg);
 		if (ret < 0) return ret;
-		return ret + bytes_sent;
+		return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
 	}
-	else if (type == OFPST_AGGREGATE)
+	if (ntohl(nx_msg->vendor) != OPENFLOW_NX_VENDOR_ID)
 	{
-		ofp_flow_stats_request *orig_body =
-		        (ofp_flow_stats_request *) orig_msg->body;
-
-		uint32_t i = 0;
-		ofp_flow_stats *stats;
-		openflow_flowtable_action_type *actions;
-
-		ofp_aggregate_stats_reply body;
-		body.byte_count = 0;
-		body.packet_count = 0;
-		body.flow_count = 0;
-
-		while (i < OPENFLOW_MAX_FLOWTABLE_ENTRIES)
-		{
-			if (openflow_flowtable_get_entry_stats(&orig_body->match,
-			        orig_body->out_port, i, &i, orig_body->table_id, &stats,
-			        &actions))
-			{
-				body.byte_count = ntohll(
-				        htonll(body.byte_count) + stats->byte_count);
-				body.packet_count = ntohll(
-				        htonll(body.packet_count) + stats->packet_count);
-				body.flow_count = ntohl(htonl(body.flow_count) + 1);
-
-				i += 1;
-			}
-		}
-
-		uint16_t msg_len = sizeof(ofp_stats_reply)
-		        + sizeof(ofp_aggregate_stats_reply);
-		ofp_stats_reply *msg =
-		        (ofp_stats_reply *) openflow_ctrl_iface_create_msg(
-		                OFPT_STATS_REPLY, msg_len);
-		msg->header.xid = orig_msg->header.xid;
-		msg->type = htons(OFPST_AGGREGATE);
-		msg->flags = 0;
-
-		memcpy(msg->body, &body, sizeof(ofp_aggregate_stats_reply));
-
-		int32_t ret = openflow_ctrl_iface_send(msg, msg_len);
-		free(msg);
-		return ret;
+		int32_t ret = openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST,
+		        OFPBRC_BAD_VENDOR, msg);
+		if (ret < 0) return ret;
+		return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
 	}
-	else if (type == OFPST_TABLE)
+	if (ntohl(nx_msg->subtype) != OPENFLOW_NXT_FLOW_MOD_TABLE_ID)
 	{
-		uint32_t msg_len = sizeof(ofp_stats_reply) + (sizeof(ofp_table_stats));
-		ofp_stats_reply *msg =
-		        (ofp_stats_reply *) openflow_ctrl_iface_create_msg(
-		                OFPT_STATS_REPLY, msg_len);
-		msg->header.xid = orig_msg->header.xid;
-		msg->type = htons(OFPST_TABLE);
-		msg->flags = 0;
-
-		ofp_table_stats stats = openflow_flowtable_get_table_stats();
-		memcpy(msg->body, &stats, sizeof(ofp_table_stats));
-
-		int32_t ret = openflow_ctrl_iface_send(msg, msg_len);
-		free(msg);
-		return ret;
+		int32_t ret = openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST,
+		        OFPBRC_BAD_SUBTYPE, msg);
+		if (ret < 0) return ret;
+		return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
 	}
-	else if (type == OFPST_PORT)
+	if (ntohs(msg->length) != sizeof(openflow_nx_flow_mod_table_id_type))
 	{
-		ofp_port_stats_request *orig_body =
-		        (ofp_port_stats_request *) orig_msg->body;
-
-		ofp_port_stats *port_stats = openflow_config_get_port_stats(
-		        ntohs(orig_body->port_no));
-		if (port_stats != NULL)
-		{
-			uint16_t msg_len = sizeof(ofp_stats_reply) + sizeof(ofp_port_stats);
-			ofp_stats_reply *msg =
-			        (ofp_stats_reply *) openflow_ctrl_iface_create_msg(
-			                OFPT_STATS_REPLY, msg_len);
-			msg->header.xid = orig_msg->header.xid;
-			msg->type = htons(OFPST_PORT);
-			msg->flags = 0;
-
-			memcpy(msg->body, &port_stats, sizeof(ofp_port_stats));
-
-			int32_t ret = openflow_ctrl_iface_send(msg, msg_len);
-			free(msg);
-			free(port_stats);
-			return ret;
-		}
-		else
-		{
-			uint16_t msg_len = sizeof(ofp_stats_reply);
-			ofp_stats_reply *msg =
-			        (ofp_stats_reply *) openflow_ctrl_iface_create_msg(
-			                OFPT_STATS_REPLY, msg_len);
-			msg->header.xid = orig_msg->header.xid;
-			msg->type = htons(OFPST_PORT);
-			msg->flags = 0;
-
-			int32_t ret = openflow_ctrl_iface_send(msg, msg_len);
-			free(msg);
-			return ret;
-		}
+		int32_t ret = openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST,
+		        OFPBRC_BAD_LEN, msg);
+		if (ret < 0) return ret;
+		return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
 	}
 
-	return OPENFLOW_CTRL_IFACE_ERR_UNKNOWN;
+	flow_mod_table_id = nx_msg->set ? 1 : 0;
+	verbose(2, "[openflow_ctrl_iface_recv_vendor]:: Table IDs in flow mods"
+			" turned %s.", flow_mod_table_id ? "on" : "off");
+	return 0;
 }
 
 /**
@@ -1295,11 +1478,24 @@ static int32_t openflow_ctrl_iface_parse_message(ofp_header *msg)
 		}
 		case OFPT_ECHO_REQUEST:
 		{
-			uint8_t *echo_data;
+			uint8_t *echo_data = NULL;
 			ret = openflow_ctrl_iface_recv_echo_req(msg, &echo_data);
 			if (ret < 0) return ret;
 			ret = openflow_ctrl_iface_send_echo_rep(echo_data,
-			        msg->length - sizeof(ofp_header), msg->xid);
+			        ntohs(msg->length) - sizeof(ofp_header), msg->xid);
+			break;
+		}
+		case OFPT_ECHO_REPLY:
+		{
+			if (echo_sent != 0) echo_rtt = clockNow() - echo_sent;
+			echo_sent = 0;
+			break;
+		}
+		case OFPT_FEATURES_REQUEST:
+		{
+			ret = openflow_ctrl_iface_recv_features_req(msg);
+			if (ret < 0) return ret;
+			ret = openflow_ctrl_iface_send_features_rep(msg->xid);
 			break;
 		}
 		case OFPT_GET_CONFIG_REQUEST:
@@ -1349,21 +1545,18 @@ static int32_t openflow_ctrl_iface_parse_message(ofp_header *msg)
 			ret = openflow_ctrl_iface_send_barrier_rep(barrier_request->xid);
 			break;
 		}
+		case OFPT_VENDOR:
+		{
+			ret = openflow_ctrl_iface_recv_vendor(msg);
+			break;
+		}
 		default:
 		{
 			verbose(1, "[openflow_ctrl_iface_parse_message]:: Unexpected"
 					" message type " PRIu8 "found in message from controller.",
 			        msg->type);
-			if (msg->type == OFPT_VENDOR)
-			{
-				ret = openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST,
-				        OFPBRC_BAD_VENDOR, msg);
-			}
-			else
-			{
-				ret = openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST,
-				        OFPBRC_BAD_TYPE, msg);
-			}
+			ret = openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST,
+			        OFPBRC_BAD_TYPE, msg);
 			break;
 		}
 	}
@@ -1402,98 +1595,447 @@ int32_t openflow_ctrl_iface_parse_packet(gpacket_t *packet)
 }
 
 /**
- * OpenFlow controller thread. Connects to controller and passes incoming
- * packets to handlers.
+ * Prints the state of the controller connection to the console.
+ */
+void openflow_ctrl_iface_print_status()
+{
+	static const char *state_names[] = { "Disconnected", "Connecting",
+	        "Waiting for hello", "Waiting for features request", "Connected" };
+
+	pthread_mutex_lock(&ofc_socket_mutex);
+	uint64_t received = msgs_received, sent = msgs_sent;
+	uint64_t dropped = msgs_dropped, conns = connections;
+	uint32_t queued = send_queue_count, queued_bytes = send_queue_bytes;
+	pthread_mutex_unlock(&ofc_socket_mutex);
+
+	printf("\n");
+	printf("Controller port: %" PRId32 "\n", controller_port);
+	printf("State: %s\n", state_names[conn_state]);
+	printf("Connections: %" PRIu64 "\n", conns);
+	printf("Reconnect backoff: %" PRIu32 " ms\n", backoff_ms);
+	printf("Echo interval: %" PRIu32 " ms\n", echo_interval_ms);
+	printf("Last echo round trip: %.3f ms\n", echo_rtt / 1e6);
+	printf("Messages received: %" PRIu64 "\n", received);
+	printf("Messages sent: %" PRIu64 "\n", sent);
+	printf("Messages dropped: %" PRIu64 "\n", dropped);
+	printf("Send queue: %" PRIu32 " messages, %" PRIu32 " bytes\n", queued,
+	        queued_bytes);
+	printf("\n");
+}
+
+/**
+ * Closes the controller connection and schedules the next attempt to
+ * connect after the current backoff, which is then doubled.
+ */
+static void openflow_ctrl_iface_disconnect()
+{
+	if (conn_state != OPENFLOW_CTRL_IFACE_DISCONNECTED)
+	{
+		verbose(2, "[openflow_ctrl_iface_disconnect]:: Disconnected from"
+				" controller.");
+	}
+	openflow_ctrl_iface_conn_down();
+
+	// Give whatever is left, like an error explaining the disconnect, a
+	// last chance to go out
+	if (conn_state > OPENFLOW_CTRL_IFACE_CONNECTING)
+	{
+		openflow_ctrl_iface_flush();
+	}
+
+	pthread_mutex_lock(&ofc_socket_mutex);
+	if (ofc_socket_fd >= 0) close(ofc_socket_fd);
+	ofc_socket_fd = -1;
+	if (connecting_fd >= 0) close(connecting_fd);
+	connecting_fd = -1;
+	openflow_ctrl_iface_clear_send_queue();
+	pthread_mutex_unlock(&ofc_socket_mutex);
+
+	openflow_ctrl_iface_stats_stream_end();
+	recv_length = 0;
+	echo_sent = 0;
+	conn_state = OPENFLOW_CTRL_IFACE_DISCONNECTED;
+	next_attempt = clockNow() + backoff_ms * 1000000ULL;
+	backoff_ms *= 2;
+	if (backoff_ms > OPENFLOW_CTRL_IFACE_BACKOFF_MAX_MS)
+	{
+		backoff_ms = OPENFLOW_CTRL_IFACE_BACKOFF_MAX_MS;
+	}
+}
+
+/**
+ * Starts connecting to the controller without waiting for the connection to
+ * be established.
+ *
+ * @return 0, or a negative value if an error occurred.
+ */
+static int32_t openflow_ctrl_iface_connect()
+{
+	verbose(2, "[openflow_ctrl_iface_connect]:: Connecting to controller.");
+
+	struct sockaddr_in ofc_sock_addr;
+	memset(&ofc_sock_addr, 0, sizeof(ofc_sock_addr));
+	ofc_sock_addr.sin_family = AF_INET;
+	ofc_sock_addr.sin_port = htons(controller_port);
+	inet_aton("127.0.0.1", &ofc_sock_addr.sin_addr);
+
+	int32_t fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+	{
+		verbose(1, "[openflow_ctrl_iface_connect]:: Could not create the"
+				" controller socket.");
+		return OPENFLOW_CTRL_IFACE_ERR_UNKNOWN;
+	}
+	int32_t one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (connect(fd, (struct sockaddr*) &ofc_sock_addr, sizeof(ofc_sock_addr))
+	        != 0 && errno != EINPROGRESS)
+	{
+		verbose(2, "[openflow_ctrl_iface_connect]:: Failed to connect to"
+				" controller socket.");
+		close(fd);
+		return OPENFLOW_CTRL_IFACE_ERR_CONN_CLOSED;
+	}
+
+	// Other threads only see the socket once it is connected
+	connecting_fd = fd;
+	conn_state = OPENFLOW_CTRL_IFACE_CONNECTING;
+	last_recv = clockNow();
+	return 0;
+}
+
+/**
+ * Completes a connection attempt once the socket is writable and sends the
+ * hello message.
+ *
+ * @return 0, or a negative value if the attempt failed.
+ */
+static int32_t openflow_ctrl_iface_connect_done()
+{
+	int32_t error = 0;
+	socklen_t error_len = sizeof(error);
+	if (getsockopt(connecting_fd, SOL_SOCKET, SO_ERROR, &error, &error_len)
+	        != 0 || error != 0)
+	{
+		verbose(2, "[openflow_ctrl_iface_connect_done]:: Failed to connect"
+				" to controller socket.");
+		return OPENFLOW_CTRL_IFACE_ERR_CONN_CLOSED;
+	}
+
+	pthread_mutex_lock(&ofc_socket_mutex);
+	ofc_socket_fd = connecting_fd;
+	connecting_fd = -1;
+	connections++;
+	pthread_mutex_unlock(&ofc_socket_mutex);
+	conn_state = OPENFLOW_CTRL_IFACE_HELLO;
+	last_recv = clockNow();
+	flow_mod_table_id = 0;
+
+	int32_t ret = openflow_ctrl_iface_send_hello();
+	if (ret < 0) return ret;
+	return 0;
+}
+
+/**
+ * Handles one message from the controller, moving the connection through
+ * the hello and features exchanges.
+ *
+ * @param msg The message, aligned on 8 bytes.
+ *
+ * @return 0, or a negative value if the connection has to be closed.
+ */
+static int32_t openflow_ctrl_iface_handle_message(ofp_header *msg)
+{
+	if (conn_state == OPENFLOW_CTRL_IFACE_HELLO)
+	{
+		if (openflow_ctrl_iface_recv_hello((ofp_hello *) msg) < 0)
+		{
+			return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
+		}
+		conn_state = OPENFLOW_CTRL_IFACE_FEATURES;
+		return 0;
+	}
+
+	if (msg->type == OFPT_HELLO) return 0;
+	if (msg->version != OFP_VERSION && msg->type != OFPT_ERROR)
+	{
+		verbose(1, "[openflow_ctrl_iface_handle_message]:: Unexpected"
+				" OpenFlow version found in message from controller.");
+		openflow_ctrl_iface_send_error(OFPET_BAD_REQUEST, OFPBRC_BAD_VERSION,
+		        msg);
+		return 0;
+	}
+
+	int32_t ret = openflow_ctrl_iface_parse_message(msg);
+	if (msg->type == OFPT_FEATURES_REQUEST && ret >= 0
+	        && conn_state == OPENFLOW_CTRL_IFACE_FEATURES)
+	{
+		verbose(2, "[openflow_ctrl_iface_handle_message]:: Connected to"
+				" controller.");
+		conn_state = OPENFLOW_CTRL_IFACE_CONNECTED;
+		backoff_ms = OPENFLOW_CTRL_IFACE_BACKOFF_MIN_MS;
+		openflow_ctrl_iface_conn_up();
+	}
+	return 0;
+}
+
+/**
+ * Handles every whole message in the receive buffer, stopping early while a
+ * stats reply is in progress. What is left stays at the start of the buffer.
+ *
+ * @return 0, or a negative value if the connection has to be closed.
+ */
+static int32_t openflow_ctrl_iface_handle_buffered()
+{
+	uint32_t offset = 0;
+	int32_t ret = 0;
+	while (!stats_stream.active
+	        && recv_length - offset >= sizeof(ofp_header))
+	{
+		ofp_header *msg = (ofp_header *) (recv_buffer + offset);
+		uint16_t msg_len = ntohs(msg->length);
+		if (msg_len < sizeof(ofp_header))
+		{
+			verbose(1, "[openflow_ctrl_iface_handle_buffered]:: Unexpected"
+					" message length found in message from controller.");
+			return OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
+		}
+		if (recv_length - offset < msg_len) break;
+
+		// The handlers cast the message to structures with 64-bit fields
+		if (offset % 8 != 0)
+		{
+			memmove(recv_buffer, recv_buffer + offset, recv_length - offset);
+			recv_length -= offset;
+			offset = 0;
+			msg = (ofp_header *) recv_buffer;
+		}
+
+		msgs_received++;
+		if (openflow_ctrl_iface_handle_message(msg) < 0)
+		{
+			ret = OPENFLOW_CTRL_IFACE_ERR_OPENFLOW;
+			break;
+		}
+		offset += msg_len;
+	}
+
+	if (offset > 0)
+	{
+		memmove(recv_buffer, recv_buffer + offset, recv_length - offset);
+		recv_length -= offset;
+	}
+	return ret;
+}
+
+/**
+ * Reads what the controller socket has and handles the messages in the
+ * receive buffer. A message that is not complete yet, or that has to wait
+ * for a stats reply, stays in the buffer.
+ *
+ * @return 0, or a negative value if the connection has to be closed.
+ */
+static int32_t openflow_ctrl_iface_read()
+{
+	// The buffer only fills up with messages waiting for a stats reply
+	if (recv_length == OPENFLOW_CTRL_IFACE_RECV_BUFFER)
+	{
+		return openflow_ctrl_iface_handle_buffered();
+	}
+
+	ssize_t ret = recv(ofc_socket_fd, recv_buffer + recv_length,
+	        OPENFLOW_CTRL_IFACE_RECV_BUFFER - recv_length, 0);
+	if (ret == 0)
+	{
+		verbose(2, "[openflow_ctrl_iface_read]:: Controller closed the"
+				" connection.");
+		return OPENFLOW_CTRL_IFACE_ERR_CONN_CLOSED;
+	}
+	if (ret < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		{
+			return 0;
+		}
+		verbose(1, "[openflow_ctrl_iface_read]:: Unknown error occurred"
+				" while receiving message.");
+		return OPENFLOW_CTRL_IFACE_ERR_UNKNOWN;
+	}
+	recv_length += ret;
+	last_recv = clockNow();
+
+	return openflow_ctrl_iface_handle_buffered();
+}
+
+/**
+ * Sends an echo request to the controller.
+ *
+ * @return The number of bytes sent, or a negative value if an error occurred.
+ */
+static int32_t openflow_ctrl_iface_send_echo_req()
+{
+	uint16_t msg_len = sizeof(ofp_header);
+	ofp_header *msg = openflow_ctrl_iface_create_msg(OFPT_ECHO_REQUEST,
+	        msg_len);
+	msg->xid = htonl(openflow_ctrl_iface_get_xid());
+
+	int32_t ret = openflow_ctrl_iface_send(msg, msg_len);
+	free(msg);
+	return ret;
+}
+
+/**
+ * Connects, sends echo requests and closes a connection that stopped
+ * answering, as due at the specified time.
+ *
+ * @param now The current time in nanoseconds.
+ *
+ * @return The time in milliseconds until the next of these is due, or -1.
+ */
+static int32_t openflow_ctrl_iface_run_timers(uint64_t now)
+{
+	uint64_t interval = echo_interval_ms * 1000000ULL;
+	uint64_t deadline;
+
+	if (conn_state == OPENFLOW_CTRL_IFACE_DISCONNECTED)
+	{
+		if (now >= next_attempt && openflow_ctrl_iface_connect() < 0)
+		{
+			openflow_ctrl_iface_disconnect();
+		}
+	}
+	else if (now - last_recv
+	        >= interval * OPENFLOW_CTRL_IFACE_ECHO_MISSES)
+	{
+		verbose(1, "[openflow_ctrl_iface_run_timers]:: Controller did not"
+				" answer, closing the connection.");
+		openflow_ctrl_iface_disconnect();
+	}
+	else if (conn_state == OPENFLOW_CTRL_IFACE_CONNECTED && echo_sent == 0
+	        && now - last_recv >= interval)
+	{
+		echo_sent = now;
+		openflow_ctrl_iface_send_echo_req();
+	}
+
+	if (conn_state == OPENFLOW_CTRL_IFACE_DISCONNECTED)
+	{
+		deadline = next_attempt;
+	}
+	else if (conn_state == OPENFLOW_CTRL_IFACE_CONNECTED && echo_sent == 0)
+	{
+		deadline = last_recv + interval;
+	}
+	else
+	{
+		deadline = last_recv + interval * OPENFLOW_CTRL_IFACE_ECHO_MISSES;
+	}
+	if (deadline <= now) return 0;
+	return (deadline - now) / 1000000 + 1;
+}
+
+/**
+ * OpenFlow controller thread. Keeps the switch connected to the controller
+ * and passes incoming messages to handlers.
  *
  * @param port Pointer to the controller TCP port number.
  */
 static void openflow_ctrl_iface(void *port)
 {
-	int32_t *port_num = (int32_t *) port;
-	if (*port_num < 1 || *port_num > 65535)
+	controller_port = *((int32_t *) port);
+	free(port);
+	if (controller_port < 1 || controller_port > 65535)
 	{
 		fatal("[openflow_ctrl_iface]:: Invalid controller TCP port number"
-				" %" PRId32 ".", *port_num);
+				" %" PRId32 ".", controller_port);
 		exit(1);
 	}
 
-	verbose(2, "[openflow_ctrl_iface]:: Sleeping for 30 seconds to allow"
-			" controller to be configured before connecting.");
-	sleep(30);
-
 	openflow_config_init_phy_ports();
+	next_attempt = clockNow();
 
 	while (1)
 	{
-		verbose(2, "[openflow_ctrl_iface]:: Connecting to controller.");
-
-		struct sockaddr_in ofc_sock_addr;
-		ofc_sock_addr.sin_family = AF_INET;
-		ofc_sock_addr.sin_port = htons(*port_num);
-		inet_aton("127.0.0.1", &ofc_sock_addr.sin_addr);
-
-		pthread_mutex_lock(&ofc_socket_mutex);
-		ofc_socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-		int32_t status = connect(ofc_socket_fd,
-		        (struct sockaddr*) &ofc_sock_addr, sizeof(ofc_sock_addr));
-		if (status != 0)
+		pthread_mutex_lock(&reconnect_mutex);
+		uint8_t reconnect_requested = reconnect;
+		reconnect = 0;
+		pthread_mutex_unlock(&reconnect_mutex);
+		if (reconnect_requested)
 		{
-			verbose(2, "[openflow_ctrl_iface]:: Failed to connect to"
-					" controller socket. Retrying...");
-			pthread_mutex_unlock(&ofc_socket_mutex);
-			continue;
+			openflow_ctrl_iface_disconnect();
+			backoff_ms = OPENFLOW_CTRL_IFACE_BACKOFF_MIN_MS;
+			next_attempt = clockNow();
 		}
-		pthread_mutex_unlock(&ofc_socket_mutex);
-
-		openflow_ctrl_iface_hello_req_rep();
-		openflow_ctrl_iface_features_req_rep();
-		openflow_ctrl_iface_conn_up();
 
-		verbose(2, "[openflow_ctrl_iface]:: Receiving messages.");
+		int32_t timeout = openflow_ctrl_iface_run_timers(clockNow());
 
-		while (1)
+		// Continue the stats reply in progress as the send queue drains, and
+		// handle the messages that waited for it once it is done
+		if (stats_stream.active)
 		{
-			// Receive a message from controller
-			ofp_header *msg = NULL;
-			int32_t ret;
-			do
+			int32_t ret = openflow_ctrl_iface_stats_stream_run();
+			if (ret >= 0 && !stats_stream.active)
 			{
-				ret = openflow_ctrl_iface_recv(&msg);
-				if (ret == 0)
-				{
-					pthread_mutex_lock(&reconnect_mutex);
-					if (reconnect == 1)
-					{
-						msg = NULL;
-						pthread_mutex_unlock(&reconnect_mutex);
-						break;
-					}
-					pthread_mutex_unlock(&reconnect_mutex);
-
-					sleep(1);
-				}
+				ret = openflow_ctrl_iface_handle_buffered();
 			}
-			while (ret == 0);
+			if (ret < 0) openflow_ctrl_iface_disconnect();
+		}
 
-			if (msg == NULL)
+		struct pollfd fds[2];
+		nfds_t nfds = 1;
+		fds[0].fd = wakeup_fds[0];
+		fds[0].events = POLLIN;
+		if (conn_state != OPENFLOW_CTRL_IFACE_DISCONNECTED)
+		{
+			pthread_mutex_lock(&ofc_socket_mutex);
+			if (conn_state == OPENFLOW_CTRL_IFACE_CONNECTING)
 			{
-				// Controller connection lost or reconnect requested
-				pthread_mutex_lock(&ofc_socket_mutex);
-				close(ofc_socket_fd);
-				pthread_mutex_unlock(&ofc_socket_mutex);
-				openflow_ctrl_iface_conn_down();
-				break;
+				fds[1].fd = connecting_fd;
+				fds[1].events = POLLOUT;
 			}
 			else
 			{
-				// Process received message
-				openflow_ctrl_iface_parse_message(msg);
-				free(msg);
+				fds[1].fd = ofc_socket_fd;
+				fds[1].events =
+				        (recv_length < OPENFLOW_CTRL_IFACE_RECV_BUFFER ? POLLIN : 0)
+				        | (send_queue_count > 0 ? POLLOUT : 0);
 			}
+			pthread_mutex_unlock(&ofc_socket_mutex);
+			fds[1].revents = 0;
+			nfds = 2;
 		}
-	}
 
-	free(port);
+		if (poll(fds, nfds, timeout) < 0 && errno != EINTR)
+		{
+			verbose(1, "[openflow_ctrl_iface]:: Unknown error occurred while"
+					" waiting for the controller socket.");
+			sleep(1);
+			continue;
+		}
+
+		if (fds[0].revents & POLLIN)
+		{
+			uint8_t drain[64];
+			while (read(wakeup_fds[0], drain, sizeof(drain)) > 0);
+		}
+		if (nfds < 2 || fds[1].revents == 0) continue;
+
+		int32_t ret = 0;
+		if (conn_state == OPENFLOW_CTRL_IFACE_CONNECTING)
+		{
+			ret = openflow_ctrl_iface_connect_done();
+		}
+		else
+		{
+			if (fds[1].revents & POLLOUT) ret = openflow_ctrl_iface_flush();
+			if (ret >= 0 && (fds[1].revents & (POLLIN | POLLERR | POLLHUP)))
+			{
+				ret = openflow_ctrl_iface_read();
+			}
+		}
+		if (ret < 0) openflow_ctrl_iface_disconnect();
+	}
 }
 
 /**
@@ -1508,6 +2050,18 @@ pthread_t openflow_ctrl_iface_init(int32_t port_num)
 	int32_t threadstat;
 	pthread_t threadid;
 
+	recv_buffer = malloc(OPENFLOW_CTRL_IFACE_RECV_BUFFER);
+	stats_stream.msg = malloc(OPENFLOW_CTRL_IFACE_STATS_REPLY_BYTES);
+	if (recv_buffer == NULL || stats_stream.msg == NULL
+	        || pipe(wakeup_fds) != 0)
+	{
+		fatal("[openflow_ctrl_iface_init]:: Could not allocate the"
+				" controller interface.");
+		exit(1);
+	}
+	fcntl(wakeup_fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(wakeup_fds[1], F_SETFL, O_NONBLOCK);
+
 	int32_t *pn = malloc(sizeof(int));
 	*pn = port_num;
 	threadstat = pthread_create((pthread_t *) &threadid, NULL,
@@ -5,6 +5,7 @@
 #include "openflow_flowtable.h"
 
 #include <inttypes.h>
+#include <sched.h>
 #include <string.h>
 #include <time.h>
 #include <arpa/inet.h>
@@ -26,10 +27,46 @@
 #include "simplequeue.h"
 #include "tcp.h"
 #include "udp.h"
+#include "logging.h"
+#include "clock.h"
 
 // OpenFlow flowtable
 static openflow_flowtable_type *flowtable;
-static pthread_mutex_t flowtable_mutex;
+
+// Everything but packet lookups takes the mutex. Lookups take no lock: a
+// thread marks itself as reading until it releases the entry it got, and a
+// writer that changes the table first sets flowtable_busy, which keeps new
+// lookups out, and waits for the threads still reading (see
+// openflow_flowtable_write_begin). Counters and stats only need the mutex.
+static pthread_mutex_t flowtable_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile uint32_t flowtable_busy = 0;
+
+// Changes whenever a lookup could give a different result, which makes the
+// flow caches forget what they hold; never reset, so that cached results do
+// not survive a release and init of the flowtable either
+static uint32_t flowtable_version = 1;
+
+// Lookup state of the threads that look up packets, registered under the
+// mutex the first time they do
+static __thread openflow_flowtable_thread_type *flowtable_thread = NULL;
+static openflow_flowtable_thread_type *flowtable_threads[OPENFLOW_MAX_THREADS];
+static uint32_t num_flowtable_threads = 0;
+
+// Flow removed messages of the entries deleted under the mutex, sent after
+// it is released (see openflow_flowtable_send_flow_removed)
+static ofp_flow_removed *flow_removed_batch = NULL;
+static uint32_t flow_removed_count = 0;
+static uint32_t flow_removed_size = 0;
+
+// Indexes of the entries that a non-strict modify or delete applies to,
+// under the mutex (see openflow_flowtable_find_matching_entries)
+static uint32_t *matching_indexes = NULL;
+static uint32_t num_matching = 0;
+static uint32_t matching_size = 0;
+
+// Number of stats replies being read a part at a time, during which flows
+// do not expire (see openflow_flowtable_stats_begin)
+static uint32_t flowtable_stats_readers = 0;
 
 // Forward declaration of debugging functions
 static void openflow_flowtable_print_entry_no_lock(uint32_t index);
@@ -45,23 +82,318 @@ static void openflow_flowtable_set_flow_stats_defaults(ofp_flow_stats *stats)
 	stats->table_id = 0;
 }
 
+/**
+ * Gives the calling thread, which holds the mutex, the flowtable to itself:
+ * lookups that start from now on wait, and the ones in progress are waited
+ * for. Flow mods are rare next to packets, so they pay for the lookups not
+ * taking a lock.
+ */
+static void openflow_flowtable_write_begin(void)
+{
+	uint32_t i;
+
+	__atomic_store_n(&flowtable_busy, 1, __ATOMIC_SEQ_CST);
+	for (i = 0; i < num_flowtable_threads; i++)
+	{
+		if (flowtable_threads[i] == flowtable_thread) continue;
+		while (__atomic_load_n(&flowtable_threads[i]->reading,
+		        __ATOMIC_SEQ_CST))
+		{
+			sched_yield();
+		}
+	}
+}
+
+/**
+ * Lets lookups run again after openflow_flowtable_write_begin.
+ */
+static void openflow_flowtable_write_end(void)
+{
+	__atomic_store_n(&flowtable_busy, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Starts a lookup on the calling thread. Lookups nest, for packets that an
+ * action sends back to the table; only the outermost one waits for a
+ * writer, since the writer may be waiting for it.
+ */
+static void openflow_flowtable_read_begin(openflow_flowtable_thread_type *thread)
+{
+	if (thread->depth++ > 0) return;
+
+	while (1)
+	{
+		__atomic_store_n(&thread->reading, 1, __ATOMIC_SEQ_CST);
+		if (!__atomic_load_n(&flowtable_busy, __ATOMIC_SEQ_CST)) return;
+
+		__atomic_store_n(&thread->reading, 0, __ATOMIC_RELEASE);
+		while (__atomic_load_n(&flowtable_busy, __ATOMIC_ACQUIRE))
+		{
+			sched_yield();
+		}
+	}
+}
+
+/**
+ * Ends a lookup started with openflow_flowtable_read_begin.
+ */
+static void openflow_flowtable_read_end(openflow_flowtable_thread_type *thread)
+{
+	if (--thread->depth == 0)
+	{
+		__atomic_store_n(&thread->reading, 0, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * Returns the lookup state of the calling thread, registering the thread
+ * the first time.
+ */
+static openflow_flowtable_thread_type *openflow_flowtable_thread(void)
+{
+	openflow_flowtable_thread_type *thread = flowtable_thread;
+	if (thread != NULL) return thread;
+
+	pthread_mutex_lock(&flowtable_mutex);
+	if (num_flowtable_threads == OPENFLOW_MAX_THREADS
+	        || (thread = calloc(1, sizeof(openflow_flowtable_thread_type)))
+	                == NULL
+	        || (thread->counters = calloc(flowtable->max_entries,
+	                sizeof(openflow_flowtable_counters_type))) == NULL)
+	{
+		fatal("[openflow_flowtable_thread]:: Could not set up flowtable"
+				" lookups for another thread.");
+	}
+	thread->num_counters = flowtable->max_entries;
+	// Generation 0 marks the (zeroed) cache slots as empty
+	thread->cache.microflow_generation = 1;
+	thread->cache.megaflow_generation = 1;
+	flowtable_threads[num_flowtable_threads++] = thread;
+	flowtable_thread = thread;
+	pthread_mutex_unlock(&flowtable_mutex);
+
+	return thread;
+}
+
+/**
+ * Resizes the per-thread entry counters of every thread to the specified
+ * number of entries, keeping the counts of the entries that remain. No
+ * thread may be reading.
+ *
+ * @return 0 if no error occurred, -1 otherwise.
+ */
+static int32_t openflow_flowtable_resize_counters(uint32_t max_entries)
+{
+	openflow_flowtable_counters_type *counters[OPENFLOW_MAX_THREADS];
+	uint32_t i, n;
+
+	for (i = 0; i < num_flowtable_threads; i++)
+	{
+		counters[i] = calloc(max_entries,
+		        sizeof(openflow_flowtable_counters_type));
+		if (counters[i] == NULL)
+		{
+			while (i > 0) free(counters[--i]);
+			return -1;
+		}
+	}
+	for (i = 0; i < num_flowtable_threads; i++)
+	{
+		openflow_flowtable_thread_type *thread = flowtable_threads[i];
+		n = thread->num_counters < max_entries ?
+		        thread->num_counters : max_entries;
+		memcpy(counters[i], thread->counters,
+		        sizeof(openflow_flowtable_counters_type) * n);
+		free(thread->counters);
+		thread->counters = counters[i];
+		thread->num_counters = max_entries;
+	}
+	return 0;
+}
+
+/**
+ * Zeroes the per-thread counters of the entry at the specified index. No
+ * thread may be reading.
+ */
+static void openflow_flowtable_clear_counters(uint32_t index)
+{
+	uint32_t i;
+	for (i = 0; i < num_flowtable_threads; i++)
+	{
+		memset(&flowtable_threads[i]->counters[index], 0,
+		        sizeof(openflow_flowtable_counters_type));
+	}
+}
+
+/**
+ * Adds up the per-thread counters of the entry at the specified index.
+ *
+ * @param index        The index of the entry.
+ * @param packet_count Set to the number of packets matched.
+ * @param byte_count   Set to the number of bytes matched.
+ * @param last_matched Set to the last time a thread matched the entry, or 0.
+ */
+static void openflow_flowtable_sum_counters(uint32_t index,
+        uint64_t *packet_count, uint64_t *byte_count, time_t *last_matched)
+{
+	uint32_t i;
+
+	*packet_count = 0;
+	*byte_count = 0;
+	*last_matched = 0;
+	for (i = 0; i < num_flowtable_threads; i++)
+	{
+		openflow_flowtable_counters_type *counters =
+		        &flowtable_threads[i]->counters[index];
+		*packet_count += __atomic_load_n(&counters->packet_count,
+		        __ATOMIC_RELAXED);
+		*byte_count += __atomic_load_n(&counters->byte_count,
+		        __ATOMIC_RELAXED);
+		time_t matched = __atomic_load_n(&counters->last_matched,
+		        __ATOMIC_RELAXED);
+		if (matched > *last_matched) *last_matched = matched;
+	}
+}
+
+/**
+ * Adds the per-thread lookup counters to the statistics of every table.
+ */
+static void openflow_flowtable_update_table_stats(void)
+{
+	uint64_t lookup_count, matched_count;
+	uint32_t i, t;
+
+	for (t = 0; t < OPENFLOW_NUM_TABLES; t++)
+	{
+		lookup_count = 0;
+		matched_count = 0;
+		for (i = 0; i < num_flowtable_threads; i++)
+		{
+			lookup_count += __atomic_load_n(
+			        &flowtable_threads[i]->lookup_count[t], __ATOMIC_RELAXED);
+			matched_count += __atomic_load_n(
+			        &flowtable_threads[i]->matched_count[t], __ATOMIC_RELAXED);
+		}
+		flowtable->tables[t].stats.lookup_count = htonll(lookup_count);
+		flowtable->tables[t].stats.matched_count = htonll(matched_count);
+	}
+}
+
+/**
+ * Updates the statistics of the specified entry: adds up its per-thread
+ * counters and sets its last matched time and duration.
+ *
+ * @param index The index of the entry to update.
+ */
+static void openflow_flowtable_update_entry_stats(uint32_t index)
+{
+	openflow_flowtable_entry_type *entry = &flowtable->entries[index];
+	uint64_t packet_count, byte_count;
+	time_t last_matched, now = clockSeconds();
+
+	openflow_flowtable_sum_counters(index, &packet_count, &byte_count,
+	        &last_matched);
+	if (last_matched > entry->last_matched)
+	{
+		entry->last_matched = last_matched;
+	}
+	entry->stats.packet_count = htonll(packet_count);
+	entry->stats.byte_count = htonll(byte_count);
+
+	double duration = difftime(now, entry->added);
+	entry->stats.duration_sec = htonl((uint32_t) duration);
+	entry->stats.duration_nsec = 0;
+}
+
+/**
+ * Empties the lookup structures and puts every entry on the free list. The
+ * entries must already be cleared.
+ */
+static void openflow_flowtable_reset_index(void)
+{
+	uint32_t i, t;
+
+	flowtable_version++;
+	for (t = 0; t < OPENFLOW_NUM_TABLES; t++)
+	{
+		openflow_flowtable_table_type *table = &flowtable->tables[t];
+		for (i = 0; i < table->num_exact_buckets; i++)
+		{
+			table->exact_buckets[i] = OPENFLOW_FLOWTABLE_NIL;
+		}
+		table->num_exact = 0;
+		table->num_entries = 0;
+		for (i = 0; i < OPENFLOW_PRIORITY_BUCKETS; i++)
+		{
+			table->priority_buckets[i] = OPENFLOW_FLOWTABLE_NIL;
+		}
+
+		for (i = 0; i < table->max_tuples; i++)
+		{
+			free(table->tuples[i].buckets);
+		}
+		free(table->tuples);
+		free(table->tuple_order);
+		table->tuples = NULL;
+		table->tuple_order = NULL;
+		table->num_tuples = 0;
+		table->max_tuples = 0;
+	}
+
+	for (i = 0; i < OPENFLOW_TIMER_WHEEL_LEVELS * OPENFLOW_TIMER_WHEEL_SLOTS;
+	        i++)
+	{
+		flowtable->timer_slots[i] = OPENFLOW_FLOWTABLE_NIL;
+	}
+	flowtable->timer_now = clockSeconds();
+
+	// Pushed in reverse so that the lowest indexes are used first
+	flowtable->num_free = 0;
+	for (i = flowtable->max_entries; i > 0; i--)
+	{
+		if (!flowtable->entries[i - 1].active)
+		{
+			flowtable->free_entries[flowtable->num_free++] = i - 1;
+		}
+	}
+}
+
 /**
  * Set flowtable defaults.
  */
 static void openflow_flowtable_set_defaults(void)
 {
+	uint32_t i;
+
 	pthread_mutex_lock(&flowtable_mutex);
+	openflow_flowtable_write_begin();
 
 	// Clear flowtable
-	memset(flowtable, 0, sizeof(openflow_flowtable_type));
+	memset(flowtable->entries, 0,
+	        sizeof(openflow_flowtable_entry_type) * flowtable->max_entries);
+	openflow_flowtable_reset_index();
+	for (i = 0; i < num_flowtable_threads; i++)
+	{
+		memset(flowtable_threads[i]->counters, 0,
+		        sizeof(openflow_flowtable_counters_type)
+		                * flowtable_threads[i]->num_counters);
+		memset(flowtable_threads[i]->lookup_count, 0,
+		        sizeof(flowtable_threads[i]->lookup_count));
+		memset(flowtable_threads[i]->matched_count, 0,
+		        sizeof(flowtable_threads[i]->matched_count));
+	}
 
 	// Initialize table stats
-	flowtable->stats.table_id = 0;
-	strncpy(flowtable->stats.name, OPENFLOW_TABLE_NAME,
-	OFP_MAX_TABLE_NAME_LEN);
-	flowtable->stats.name[OFP_MAX_TABLE_NAME_LEN - 1] = '\0';
-	flowtable->stats.max_entries = htonl(OPENFLOW_MAX_FLOWTABLE_ENTRIES);
-	flowtable->stats.wildcards = htonl(OFPFW_ALL);
+	for (i = 0; i < OPENFLOW_NUM_TABLES; i++)
+	{
+		ofp_table_stats *stats = &flowtable->tables[i].stats;
+		memset(stats, 0, sizeof(ofp_table_stats));
+		stats->table_id = i;
+		strncpy(stats->name, OPENFLOW_TABLE_NAME, OFP_MAX_TABLE_NAME_LEN);
+		stats->name[OFP_MAX_TABLE_NAME_LEN - 1] = '\0';
+		stats->max_entries = htonl(flowtable->tables[i].max_entries);
+		stats->wildcards = htonl(OFPFW_ALL);
+	}
 
 	// Default flowtable entry (send all packets to normal router processing)
 	ofp_flow_mod *flow_mod = calloc(sizeof(ofp_flow_mod) +
@@ -75,25 +407,67 @@ static void openflow_flowtable_set_defaults(void)
 
 	flow_mod->command = OFPFC_ADD;
 	flow_mod->match.wildcards = htonl(OFPFW_ALL);
-	flow_mod->priority = htonl(1);
+	flow_mod->priority = htons(1);
 
 	flow_mod->actions[0].type = htons(OFPAT_OUTPUT);
 	flow_mod->actions[0].len = htons(sizeof(ofp_action_output));
 	((ofp_action_output *) &flow_mod->actions[0])->port = htons(OFPP_NORMAL);
 
+	openflow_flowtable_write_end();
 	pthread_mutex_unlock(&flowtable_mutex);
 
-	openflow_flowtable_modify(flow_mod, NULL, NULL);
+	openflow_flowtable_modify(flow_mod, 0, NULL, NULL);
 	free(flow_mod);
 }
 
+/**
+ * Returns the number of hash buckets for the specified number of entries
+ * (the next power of 2, so the hash can be masked).
+ */
+static uint32_t openflow_flowtable_num_buckets(uint32_t num_entries)
+{
+	uint32_t n = OPENFLOW_FLOWTABLE_MIN_BUCKETS;
+	while (n < num_entries)
+	{
+		n <<= 1;
+	}
+	return n;
+}
+
 /**
  * Initializes the flowtable.
  */
 void openflow_flowtable_init(void)
 {
+	uint32_t t;
+
 	pthread_mutex_lock(&flowtable_mutex);
-	flowtable = malloc(sizeof(openflow_flowtable_type));
+	flowtable = calloc(1, sizeof(openflow_flowtable_type));
+	for (t = 0; t < OPENFLOW_NUM_TABLES; t++)
+	{
+		openflow_flowtable_table_type *table = &flowtable->tables[t];
+		table->max_entries = OPENFLOW_DEFAULT_FLOWTABLE_ENTRIES;
+		table->miss = OPENFLOW_TABLE_MISS_CONTROLLER;
+		table->num_exact_buckets = openflow_flowtable_num_buckets(
+		        table->max_entries);
+		table->exact_buckets = malloc(sizeof(uint32_t)
+		        * table->num_exact_buckets);
+		if (!table->exact_buckets)
+		{
+			fatal("[openflow_flowtable_init]:: Could not allocate the"
+					" flowtable.");
+		}
+		flowtable->max_entries += table->max_entries;
+	}
+	flowtable->entries = calloc(flowtable->max_entries,
+	        sizeof(openflow_flowtable_entry_type));
+	flowtable->free_entries = malloc(sizeof(uint32_t) * flowtable->max_entries);
+	if (!flowtable->entries || !flowtable->free_entries
+	        || openflow_flowtable_resize_counters(flowtable->max_entries) < 0)
+	{
+		fatal("[openflow_flowtable_init]:: Could not allocate the"
+				" flowtable.");
+	}
 	pthread_mutex_unlock(&flowtable_mutex);
 
 	openflow_flowtable_set_defaults();
@@ -105,681 +479,1194 @@ void openflow_flowtable_init(void)
 void openflow_flowtable_release(void)
 {
 	pthread_mutex_lock(&flowtable_mutex);
+	openflow_flowtable_write_begin();
 
-	flowtable = malloc(sizeof(openflow_flowtable_type));
 	if (flowtable)
 	{
+		uint32_t i, t;
+		for (t = 0; t < OPENFLOW_NUM_TABLES; t++)
+		{
+			openflow_flowtable_table_type *table = &flowtable->tables[t];
+			for (i = 0; i < table->max_tuples; i++)
+			{
+				free(table->tuples[i].buckets);
+			}
+			free(table->tuples);
+			free(table->tuple_order);
+			free(table->exact_buckets);
+		}
+		free(flowtable->free_entries);
+		free(flowtable->entries);
 		free(flowtable);
 	}
 	flowtable = NULL;
+	free(matching_indexes);
+	matching_indexes = NULL;
+	matching_size = 0;
 
+	openflow_flowtable_write_end();
 	pthread_mutex_unlock(&flowtable_mutex);
 }
 
 /**
- * Compares two IP addresses.
+ * Fills an ofp_match with the header fields of the specified packet, in
+ * network byte order, from the headers parsed when the packet was received.
+ * The key is built once per lookup and tested against every entry.
  *
- * @param ip_1   The first IP address to compare.
- * @param ip_2   The second IP address to compare.
- * @param ip_len The number of bits in the IP address to compare.
- *
- * @return 1 if the IP addresses are the same, 0 otherwise.
+ * @param packet The packet.
+ * @param key    The match to fill in.
  */
-static uint8_t openflow_flowtable_ip_compare(uint32_t ip_1, uint32_t ip_2,
-        uint8_t ip_len)
+static void openflow_flowtable_packet_key(gpacket_t *packet, ofp_match *key)
 {
-	return (ip_1 >> ((OFPFW_NW_DST_ALL >> OFPFW_NW_DST_SHIFT) - ip_len))
-	        == (ip_2 >> ((OFPFW_NW_DST_ALL >> OFPFW_NW_DST_SHIFT) - ip_len)) ?
-	        1 : 0;
+	pkt_meta_t *meta = packetMeta(packet);
+
+	memset(key, 0, sizeof(ofp_match));
+	key->in_port = htons(
+	        openflow_config_get_of_port_num(packet->frame.src_interface));
+	memcpy(key->dl_src, packet->data.header.src, OFP_ETH_ALEN);
+	memcpy(key->dl_dst, packet->data.header.dst, OFP_ETH_ALEN);
+	key->dl_vlan = htons(meta->vlan);
+	key->dl_vlan_pcp = meta->vlan_pcp;
+	key->dl_type = htons(meta->dl_type);
+
+	// IP header, or the addresses and opcode of an ARP packet
+	key->nw_tos = meta->nw_tos;
+	key->nw_proto = meta->nw_proto;
+	key->nw_src = htonl(meta->nw_src);
+	key->nw_dst = htonl(meta->nw_dst);
+
+	// TCP/UDP ports or ICMP type and code, unless the packet is a fragment
+	key->tp_src = htons(meta->tp_src);
+	key->tp_dst = htons(meta->tp_dst);
 }
 
 /**
- * Determines whether the specified OpenFlow match matches the specified packet.
- *
- * @param match  The match to test the packet against.
- * @param packet The packet to test.
+ * Returns the priority of the specified entry in host byte order.
+ */
+static inline uint16_t openflow_flowtable_priority(
+        const openflow_flowtable_entry_type *entry)
+{
+	return ntohs((uint16_t) entry->priority);
+}
+
+/**
+ * Builds the mask of the fields that the specified match compares: all ones
+ * in a field that a packet must equal, the prefix for the IP addresses and
+ * zero in everything else. Which fields count depends on the wildcards as
+ * well as on the frame type and IP protocol of the match itself.
  *
- * @return 1 if the packet matches the match, 0 otherwise.
+ * @param match The match.
+ * @param mask  The mask to fill in.
  */
-static uint8_t openflow_flowtable_match_packet(ofp_match *match,
-        gpacket_t *packet)
+static void openflow_flowtable_mask(const ofp_match *match, ofp_match *mask)
 {
-	// Default headers
-	uint16_t in_port = htons(
-	        openflow_config_get_of_port_num(packet->frame.src_interface));
-	uint8_t dl_src[OFP_ETH_ALEN];
-	uint8_t dl_dst[OFP_ETH_ALEN];
-	uint16_t dl_vlan = 0;
-	uint8_t dl_vlan_pcp = 0;
-	uint16_t dl_type = packet->data.header.prot;
-	uint8_t nw_tos = 0;
-	uint8_t nw_proto = 0;
-	uint32_t nw_src = 0;
-	uint32_t nw_dst = 0;
-	uint16_t tp_src = 0;
-	uint16_t tp_dst = 0;
-	memcpy(&dl_src, packet->data.header.src, OFP_ETH_ALEN);
-	memcpy(&dl_dst, packet->data.header.dst, OFP_ETH_ALEN);
-
-	// Accept match if all fields wildcard is present in match
-	if (ntohl(match->wildcards) == OFPFW_ALL)
-	{
-		verbose(2, "[openflow_flowtable_match_packet]:: Packet matched (all"
-				" field wildcard).");
-		return 1;
-	}
-
-	// Set headers for IEEE 802.3 Ethernet frame
-	if (ntohs(packet->data.header.prot) < OFP_DL_TYPE_ETH2_CUTOFF)
-	{
-		if (packet->data.data[0] == IEEE_802_2_DSAP_SNAP)
-		{
-			// SNAP
-			if (packet->data.data[2] & IEEE_802_2_CTRL_8_BITS)
-			{
-				// 8-bit control field
-				uint32_t oui;
-				memcpy(&oui, &packet->data.data[3], sizeof(uint8_t) * 3);
-				if (ntohl(oui) == 0)
-				{
-					memcpy(&dl_type, &packet->data.data[6],
-					        sizeof(uint8_t) * 2);
-				}
-				else
-				{
-					dl_type = htons(OFP_DL_TYPE_NOT_ETH_TYPE);
-				}
+	uint32_t wildcards = ntohl(match->wildcards);
+	uint16_t dl_type = ntohs(match->dl_type);
+	uint32_t bits;
 
-			}
-			else
-			{
-				// 16-bit control field
-				uint32_t oui;
-				memcpy(&oui, &packet->data.data[4], sizeof(uint8_t) * 3);
-				if (ntohl(oui) == 0)
-				{
-					memcpy(&dl_type, &packet->data.data[7],
-					        sizeof(uint8_t) * 2);
-				}
-				else
-				{
-					dl_type = htons(OFP_DL_TYPE_NOT_ETH_TYPE);
-				}
-			}
-		}
-		else
-		{
-			// No SNAP
-			dl_type = htons(OFP_DL_TYPE_NOT_ETH_TYPE);
-		}
-	}
+	memset(mask, 0, sizeof(ofp_match));
 
-	// Set headers for IEEE 802.1Q Ethernet frame
-	if (ntohs(packet->data.header.prot) == ETHERTYPE_IEEE_802_1Q)
-	{
-		verbose(2, "[openflow_flowtable_match_packet]:: Setting headers for"
-				" IEEE 802.1Q Ethernet frame.");
-		pkt_data_vlan_t *vlan_data = (pkt_data_vlan_t *) &packet->data;
-		dl_vlan = htons(ntohs(vlan_data->header.tci) & 0xFFF);
-		dl_vlan_pcp = htons(ntohs(vlan_data->header.tci) >> 13);
-		dl_type = vlan_data->header.prot;
-	}
-	else
+	if (!(wildcards & OFPFW_IN_PORT)) mask->in_port = 0xffff;
+	if (!(wildcards & OFPFW_DL_SRC)) memset(mask->dl_src, 0xff, OFP_ETH_ALEN);
+	if (!(wildcards & OFPFW_DL_DST)) memset(mask->dl_dst, 0xff, OFP_ETH_ALEN);
+	if (!(wildcards & OFPFW_DL_VLAN))
 	{
-		dl_vlan = ntohs(OFP_VLAN_NONE);
+		mask->dl_vlan = 0xffff;
+		if (!(wildcards & OFPFW_DL_VLAN_PCP)) mask->dl_vlan_pcp = 0xff;
 	}
 
-	// Set headers for ARP packet
-	if (ntohs(packet->data.header.prot) == ARP_PROTOCOL)
+	// The network and transport fields only count with a frame type
+	if (wildcards & OFPFW_DL_TYPE) return;
+	mask->dl_type = 0xffff;
+
+	if (dl_type == IP_PROTOCOL && !(wildcards & OFPFW_NW_TOS))
 	{
-		verbose(2, "[openflow_flowtable_match_packet]:: Setting headers for"
-				" ARP.");
-		arp_packet_t *arp_packet = (arp_packet_t *) &packet->data.data;
-		nw_proto = ntohs(arp_packet->arp_opcode);
-		COPY_IP(&nw_src, &arp_packet->src_ip_addr);
-		COPY_IP(&nw_dst, &arp_packet->dst_ip_addr);
+		mask->nw_tos = 0xff;
 	}
 
-	// Set headers for IP packet
-	if (ntohs(packet->data.header.prot) == IP_PROTOCOL)
-	{
-		verbose(2, "[openflow_flowtable_match_packet]:: Setting headers for"
-				" IP.");
-		ip_packet_t *ip_packet = (ip_packet_t *) &packet->data.data;
-		nw_proto = ip_packet->ip_prot;
-		COPY_IP(&nw_src, &ip_packet->ip_src);
-		COPY_IP(&nw_dst, &ip_packet->ip_dst);
-		nw_tos = ip_packet->ip_tos;
+	if (dl_type != IP_PROTOCOL && dl_type != ARP_PROTOCOL) return;
 
-		if (!(ntohs(ip_packet->ip_frag_off) & 0x1fff)
-		        && !(ntohs(ip_packet->ip_frag_off) & 0x2000))
-		{
-			// IP packet is not fragmented
-			verbose(2, "[openflow_flowtable_match_packet]:: IP packet is not"
-					" fragmented.");
-			if (ip_packet->ip_prot == TCP_PROTOCOL)
-			{
-				// TCP packet
-				verbose(2, "[openflow_flowtable_match_packet]:: Setting"
-						" headers for TCP.");
-				uint32_t ip_header_length = ip_packet->ip_hdr_len * 4;
-				tcp_packet_type *tcp_packet =
-				        (tcp_packet_type *) ((uint8_t *) ip_packet
-				                + ip_header_length);
-				tp_src = tcp_packet->src_port;
-				tp_dst = tcp_packet->dst_port;
-			}
-			else if (ip_packet->ip_prot == UDP_PROTOCOL)
-			{
-				// UDP packet
-				verbose(2, "[openflow_flowtable_match_packet]:: Setting"
-						" headers for UDP.");
-				uint32_t ip_header_length = ip_packet->ip_hdr_len * 4;
-				udp_packet_type *udp_packet =
-				        (udp_packet_type *) ((uint8_t *) ip_packet
-				                + ip_header_length);
-				tp_src = udp_packet->src_port;
-				tp_dst = udp_packet->dst_port;
-			}
-			else if (ip_packet->ip_prot == ICMP_PROTOCOL)
-			{
-				// ICMP packet
-				verbose(2, "[openflow_flowtable_match_packet]:: Setting"
-						" headers for ICMP.");
-				int ip_header_length = ip_packet->ip_hdr_len * 4;
-				icmphdr_t *icmp_packet = (icmphdr_t *) ((uint8_t *) ip_packet
-				        + ip_header_length);
-				tp_src = htons((uint16_t) icmp_packet->type);
-				tp_dst = htons((uint16_t) icmp_packet->code);
-			}
-		}
-	}
+	if (!(wildcards & OFPFW_NW_PROTO)) mask->nw_proto = 0xff;
 
-	// Reject match on input port
-	if (!(ntohl(match->wildcards) & OFPFW_IN_PORT) && in_port != match->in_port)
-	{
-		verbose(2, "[openflow_flowtable_match_packet]:: Packet not matched"
-				" (switch input port).");
-		return 0;
-	}
+	bits = (wildcards & OFPFW_NW_SRC_MASK) >> OFPFW_NW_SRC_SHIFT;
+	if (bits < 32) mask->nw_src = htonl(0xffffffff << bits);
+	bits = (wildcards & OFPFW_NW_DST_MASK) >> OFPFW_NW_DST_SHIFT;
+	if (bits < 32) mask->nw_dst = htonl(0xffffffff << bits);
 
-	// Reject match on Ethernet source MAC address
-	if (!(ntohl(match->wildcards) & OFPFW_DL_SRC)
-	        && memcmp(dl_src, match->dl_src, OFP_ETH_ALEN))
+	if (dl_type == IP_PROTOCOL && !(wildcards & OFPFW_NW_PROTO)
+	        && (match->nw_proto == ICMP_PROTOCOL
+	                || match->nw_proto == TCP_PROTOCOL
+	                || match->nw_proto == UDP_PROTOCOL))
 	{
-		verbose(2, "[openflow_flowtable_match_packet]:: Packet not matched"
-				" (source MAC address).");
-		return 0;
+		if (!(wildcards & OFPFW_TP_SRC)) mask->tp_src = 0xffff;
+		if (!(wildcards & OFPFW_TP_DST)) mask->tp_dst = 0xffff;
 	}
+}
 
-	// Reject match on Ethernet destination MAC address
-	if (!(ntohl(match->wildcards) & OFPFW_DL_DST)
-	        && memcmp(dl_dst, match->dl_dst, OFP_ETH_ALEN))
-	{
-		verbose(2, "[openflow_flowtable_match_packet]:: Packet not matched"
-				" (destination MAC address).");
-		return 0;
-	}
+#define OPENFLOW_MATCH_WORDS    (sizeof(ofp_match) / sizeof(uint32_t))
 
-	// Reject match on Ethernet VLAN ID
-	if (!(ntohl(match->wildcards) & OFPFW_DL_VLAN) && dl_vlan != match->dl_vlan)
-	{
-		verbose(2, "[openflow_flowtable_match_packet]:: Packet not matched"
-				" (VLAN ID).");
-		return 0;
-	}
+/**
+ * Sets key to the specified match with the specified mask applied.
+ */
+static inline void openflow_flowtable_apply_mask(const ofp_match *match,
+        const ofp_match *mask, ofp_match *key)
+{
+	uint32_t m[OPENFLOW_MATCH_WORDS], k[OPENFLOW_MATCH_WORDS];
+	uint32_t i;
 
-	// Reject match on Ethernet VLAN priority
-	if (!(ntohl(match->wildcards) & OFPFW_DL_VLAN)
-	        && !(ntohl(match->wildcards) & OFPFW_DL_VLAN_PCP)
-	        && dl_vlan_pcp != match->dl_vlan_pcp)
+	memcpy(k, match, sizeof(ofp_match));
+	memcpy(m, mask, sizeof(ofp_match));
+	for (i = 0; i < OPENFLOW_MATCH_WORDS; i++)
 	{
-		verbose(2, "[openflow_flowtable_match_packet]:: Packet not matched"
-				" (VLAN priority).");
-		return 0;
+		k[i] &= m[i];
 	}
+	memcpy(key, k, sizeof(ofp_match));
+}
+
+/**
+ * Adds the fields of the specified mask to another one.
+ */
+static inline void openflow_flowtable_add_mask(ofp_match *mask,
+        const ofp_match *fields)
+{
+	uint32_t m[OPENFLOW_MATCH_WORDS], f[OPENFLOW_MATCH_WORDS];
+	uint32_t i;
 
-	// Reject match on Ethernet frame type
-	if (!(ntohl(match->wildcards) & OFPFW_DL_TYPE) && dl_type != match->dl_type)
+	memcpy(m, mask, sizeof(ofp_match));
+	memcpy(f, fields, sizeof(ofp_match));
+	for (i = 0; i < OPENFLOW_MATCH_WORDS; i++)
 	{
-		verbose(2, "[openflow_flowtable_match_packet]:: Packet not matched"
-				" (Ethernet frame type).");
-		return 0;
+		m[i] |= f[i];
 	}
+	memcpy(mask, m, sizeof(ofp_match));
+}
 
-	// Reject match on IP type of service
-	if (!(ntohl(match->wildcards) & OFPFW_DL_TYPE)
-	        && ntohs(match->dl_type) == IP_PROTOCOL
-	        && !(ntohl(match->wildcards) & OFPFW_NW_TOS)
-	        && nw_tos != match->nw_tos)
+/**
+ * Returns 1 if every field that the first mask compares is compared by the
+ * second one as well, 0 otherwise.
+ */
+static inline uint8_t openflow_flowtable_mask_subset(const ofp_match *mask,
+        const ofp_match *of)
+{
+	uint32_t m[OPENFLOW_MATCH_WORDS], o[OPENFLOW_MATCH_WORDS];
+	uint32_t i;
+
+	memcpy(m, mask, sizeof(ofp_match));
+	memcpy(o, of, sizeof(ofp_match));
+	for (i = 0; i < OPENFLOW_MATCH_WORDS; i++)
 	{
-		verbose(2, "[openflow_flowtable_match_packet]:: Packet not matched"
-				" (IP type of service).");
-		return 0;
+		if (m[i] & ~o[i]) return 0;
 	}
+	return 1;
+}
 
-	// Reject match on IP protocol or ARP opcode
-	if (!(ntohl(match->wildcards) & OFPFW_DL_TYPE)
-	        && (ntohs(match->dl_type) == IP_PROTOCOL
-	                || ntohs(match->dl_type) == ARP_PROTOCOL)
-	        && !(ntohl(match->wildcards) & OFPFW_NW_PROTO)
-	        && nw_proto != match->nw_proto)
+/**
+ * Hashes the specified masked key.
+ */
+static inline uint32_t openflow_flowtable_hash(const ofp_match *key)
+{
+	uint32_t k[OPENFLOW_MATCH_WORDS];
+	uint32_t h = 0, i;
+
+	memcpy(k, key, sizeof(ofp_match));
+	for (i = 0; i < OPENFLOW_MATCH_WORDS; i++)
 	{
-		verbose(2, "[openflow_flowtable_match_packet]:: Packet not matched"
-				" (IP protocol or ARP opcode).");
-		return 0;
+		uint32_t w = k[i] * 0xcc9e2d51;
+		w = (w << 15) | (w >> 17);
+		h ^= w * 0x1b873593;
+		h = ((h << 13) | (h >> 19)) * 5 + 0xe6546b64;
 	}
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	return h;
+}
 
-	// Reject match on IP source address
-	uint8_t ip_src_len = (OFPFW_NW_SRC_ALL >> OFPFW_NW_SRC_SHIFT)
-	        - ((ntohl(match->wildcards) & OFPFW_NW_SRC_MASK)
-	                >> OFPFW_NW_SRC_SHIFT);
-	if (!(ntohl(match->wildcards) & OFPFW_DL_TYPE)
-	        && (ntohs(match->dl_type) == IP_PROTOCOL
-	                || ntohs(match->dl_type) == ARP_PROTOCOL))
+/**
+ * Rebuilds the list of the tuples of the specified table that are in use,
+ * sorted by decreasing maximum priority.
+ */
+static void openflow_flowtable_sort_tuples(openflow_flowtable_table_type *table)
+{
+	uint32_t i, j, n = 0;
+
+	for (i = 0; i < table->max_tuples; i++)
 	{
-		if (ip_src_len > 0
-		        && !openflow_flowtable_ip_compare(ntohl(nw_src),
-		                ntohl(match->nw_src), ip_src_len))
+		if (table->tuples[i].count == 0) continue;
+
+		uint16_t priority = table->tuples[i].max_priority;
+		for (j = n; j > 0
+		        && table->tuples[table->tuple_order[j - 1]].max_priority
+		                < priority; j--)
 		{
-			verbose(2, "[openflow_flowtable_match_packet]:: Packet not"
-					" matched (IP source address).");
-			return 0;
+			table->tuple_order[j] = table->tuple_order[j - 1];
 		}
+		table->tuple_order[j] = i;
+		n++;
 	}
+	table->num_tuples = n;
+}
 
-	// Reject match on IP destination address
-	uint8_t ip_dst_len = (OFPFW_NW_DST_ALL >> OFPFW_NW_DST_SHIFT)
-	        - ((ntohl(match->wildcards) & OFPFW_NW_DST_MASK)
-	                >> OFPFW_NW_DST_SHIFT);
-	if (!(ntohl(match->wildcards) & OFPFW_DL_TYPE)
-	        && (ntohs(match->dl_type) == IP_PROTOCOL
-	                || ntohs(match->dl_type) == ARP_PROTOCOL))
+/**
+ * Finds the tuple of the specified table with the specified mask, optionally
+ * creating it.
+ *
+ * @return The index of the tuple, or OPENFLOW_FLOWTABLE_NIL if there is none
+ *         and create is 0.
+ */
+static uint32_t openflow_flowtable_find_tuple(
+        openflow_flowtable_table_type *table, const ofp_match *mask,
+        uint8_t create)
+{
+	uint32_t i, slot = OPENFLOW_FLOWTABLE_NIL;
+
+	for (i = 0; i < table->max_tuples; i++)
 	{
-		if (ip_dst_len > 0
-		        && !openflow_flowtable_ip_compare(ntohl(nw_dst),
-		                ntohl(match->nw_dst), ip_dst_len))
+		if (table->tuples[i].count == 0)
+		{
+			if (slot == OPENFLOW_FLOWTABLE_NIL) slot = i;
+			continue;
+		}
+		if (!memcmp(&table->tuples[i].mask, mask, sizeof(ofp_match)))
 		{
-			verbose(2, "[openflow_flowtable_match_packet]:: Packet not"
-					" matched (IP destination address).");
-			return 0;
+			return i;
 		}
 	}
+	if (!create) return OPENFLOW_FLOWTABLE_NIL;
 
-	// Reject match on TCP/UDP source port or ICMP type
-	if (!(ntohl(match->wildcards) & OFPFW_DL_TYPE)
-	        && ntohs(match->dl_type) == IP_PROTOCOL)
+	if (slot == OPENFLOW_FLOWTABLE_NIL)
 	{
-		if (!(ntohl(match->wildcards) & OFPFW_NW_PROTO)
-		        && (match->nw_proto == ICMP_PROTOCOL
-		                || match->nw_proto == TCP_PROTOCOL
-		                || match->nw_proto == UDP_PROTOCOL))
+		uint32_t max = table->max_tuples ? table->max_tuples * 2 : 8;
+		openflow_flowtable_tuple_type *tuples = realloc(table->tuples,
+		        sizeof(openflow_flowtable_tuple_type) * max);
+		uint32_t *order = realloc(table->tuple_order, sizeof(uint32_t) * max);
+		if (!tuples || !order)
 		{
-			if (!(ntohl(match->wildcards) & OFPFW_TP_SRC)
-			        && tp_src != match->tp_src)
-			{
-				verbose(2, "[openflow_flowtable_match_packet]:: Packet not"
-						" matched (TCP/UDP source port or ICMP type).");
-				return 0;
-			}
+			fatal("[openflow_flowtable_find_tuple]:: Could not allocate the"
+					" flowtable tuples.");
 		}
+		table->tuples = tuples;
+		table->tuple_order = order;
+
+		memset(&tuples[table->max_tuples], 0,
+		        sizeof(openflow_flowtable_tuple_type)
+		                * (max - table->max_tuples));
+		slot = table->max_tuples;
+		table->max_tuples = max;
 	}
 
-	// Reject match on TCP/UDP destination port or ICMP code
-	if (!(ntohl(match->wildcards) & OFPFW_DL_TYPE)
-	        && ntohs(match->dl_type) == IP_PROTOCOL)
+	openflow_flowtable_tuple_type *tuple = &table->tuples[slot];
+	free(tuple->buckets);
+	tuple->buckets = malloc(sizeof(uint32_t) * OPENFLOW_FLOWTABLE_MIN_BUCKETS);
+	if (!tuple->buckets)
 	{
-		if (!(ntohl(match->wildcards) & OFPFW_NW_PROTO)
-		        && (match->nw_proto == ICMP_PROTOCOL
-		                || match->nw_proto == TCP_PROTOCOL
-		                || match->nw_proto == UDP_PROTOCOL))
+		fatal("[openflow_flowtable_find_tuple]:: Could not allocate the"
+				" flowtable tuples.");
+	}
+	tuple->num_buckets = OPENFLOW_FLOWTABLE_MIN_BUCKETS;
+	for (i = 0; i < tuple->num_buckets; i++)
+	{
+		tuple->buckets[i] = OPENFLOW_FLOWTABLE_NIL;
+	}
+	tuple->mask = *mask;
+	tuple->count = 0;
+	tuple->max_priority = 0;
+	return slot;
+}
+
+/**
+ * Doubles the number of hash buckets of the specified tuple.
+ */
+static void openflow_flowtable_grow_tuple(openflow_flowtable_tuple_type *tuple)
+{
+	uint32_t num_buckets = tuple->num_buckets * 2;
+	uint32_t *buckets = malloc(sizeof(uint32_t) * num_buckets);
+	uint32_t b, i, next;
+
+	// A longer chain is still correct, so keep it if memory is short
+	if (!buckets) return;
+	for (b = 0; b < num_buckets; b++)
+	{
+		buckets[b] = OPENFLOW_FLOWTABLE_NIL;
+	}
+	for (b = 0; b < tuple->num_buckets; b++)
+	{
+		for (i = tuple->buckets[b]; i != OPENFLOW_FLOWTABLE_NIL; i = next)
+		{
+			openflow_flowtable_entry_type *entry = &flowtable->entries[i];
+			next = entry->next;
+			entry->next = buckets[entry->hash & (num_buckets - 1)];
+			buckets[entry->hash & (num_buckets - 1)] = i;
+		}
+	}
+	free(tuple->buckets);
+	tuple->buckets = buckets;
+	tuple->num_buckets = num_buckets;
+}
+
+/**
+ * Adds the active entry at the specified index to the lookup structures of
+ * its table: the exact-match hash table if it has no wildcards, its tuple
+ * otherwise.
+ */
+static void openflow_flowtable_index_add(uint32_t index)
+{
+	openflow_flowtable_entry_type *entry = &flowtable->entries[index];
+	openflow_flowtable_table_type *table = &flowtable->tables[entry->table_id];
+	ofp_match mask;
+	uint32_t *head;
+
+	flowtable_version++;
+	openflow_flowtable_mask(&entry->match, &mask);
+	openflow_flowtable_apply_mask(&entry->match, &mask, &entry->key);
+	entry->hash = openflow_flowtable_hash(&entry->key);
+
+	if (entry->match.wildcards == 0)
+	{
+		entry->tuple = OPENFLOW_FLOWTABLE_NIL;
+		head = &table->exact_buckets[entry->hash
+		        & (table->num_exact_buckets - 1)];
+		table->num_exact++;
+	}
+	else
+	{
+		uint32_t t = openflow_flowtable_find_tuple(table, &mask, 1);
+		openflow_flowtable_tuple_type *tuple = &table->tuples[t];
+		if (tuple->count >= tuple->num_buckets)
+		{
+			openflow_flowtable_grow_tuple(tuple);
+		}
+		entry->tuple = t;
+		head = &tuple->buckets[entry->hash & (tuple->num_buckets - 1)];
+
+		if (tuple->count++ == 0
+		        || openflow_flowtable_priority(entry) > tuple->max_priority)
+		{
+			tuple->max_priority = openflow_flowtable_priority(entry);
+			openflow_flowtable_sort_tuples(table);
+		}
+	}
+
+	entry->next = *head;
+	*head = index;
+
+	head = &table->priority_buckets[openflow_flowtable_priority(entry)
+	        & (OPENFLOW_PRIORITY_BUCKETS - 1)];
+	entry->priority_prev = OPENFLOW_FLOWTABLE_NIL;
+	entry->priority_next = *head;
+	if (*head != OPENFLOW_FLOWTABLE_NIL)
+	{
+		flowtable->entries[*head].priority_prev = index;
+	}
+	*head = index;
+}
+
+/**
+ * Removes the entry at the specified index from the lookup structures.
+ */
+static void openflow_flowtable_index_remove(uint32_t index)
+{
+	openflow_flowtable_entry_type *entry = &flowtable->entries[index];
+	openflow_flowtable_table_type *table = &flowtable->tables[entry->table_id];
+	openflow_flowtable_tuple_type *tuple = NULL;
+	uint32_t *link;
+
+	if (entry->tuple == OPENFLOW_FLOWTABLE_NIL)
+	{
+		link = &table->exact_buckets[entry->hash
+		        & (table->num_exact_buckets - 1)];
+	}
+	else
+	{
+		tuple = &table->tuples[entry->tuple];
+		link = &tuple->buckets[entry->hash & (tuple->num_buckets - 1)];
+	}
+
+	while (*link != OPENFLOW_FLOWTABLE_NIL && *link != index)
+	{
+		link = &flowtable->entries[*link].next;
+	}
+	if (*link == OPENFLOW_FLOWTABLE_NIL) return;
+	*link = entry->next;
+	flowtable_version++;
+	entry->next = OPENFLOW_FLOWTABLE_NIL;
+
+	if (entry->priority_prev == OPENFLOW_FLOWTABLE_NIL)
+	{
+		table->priority_buckets[openflow_flowtable_priority(entry)
+		        & (OPENFLOW_PRIORITY_BUCKETS - 1)] = entry->priority_next;
+	}
+	else
+	{
+		flowtable->entries[entry->priority_prev].priority_next =
+		        entry->priority_next;
+	}
+	if (entry->priority_next != OPENFLOW_FLOWTABLE_NIL)
+	{
+		flowtable->entries[entry->priority_next].priority_prev =
+		        entry->priority_prev;
+	}
+
+	if (tuple == NULL)
+	{
+		table->num_exact--;
+		return;
+	}
+
+	if (--tuple->count == 0)
+	{
+		free(tuple->buckets);
+		tuple->buckets = NULL;
+		tuple->num_buckets = 0;
+		openflow_flowtable_sort_tuples(table);
+	}
+	else if (openflow_flowtable_priority(entry) == tuple->max_priority)
+	{
+		// Find the new maximum; stop early at another entry with the old one
+		uint16_t max = 0;
+		uint32_t b, i;
+		for (b = 0; b < tuple->num_buckets && max < tuple->max_priority; b++)
 		{
-			if (!(ntohl(match->wildcards) & OFPFW_TP_DST)
-			        && tp_dst != match->tp_dst)
+			for (i = tuple->buckets[b]; i != OPENFLOW_FLOWTABLE_NIL;
+			        i = flowtable->entries[i].next)
 			{
-				verbose(2, "[openflow_flowtable_match_packet]:: Packet not"
-						" matched (TCP/UDP destination port or ICMP code).");
-				return 0;
+				uint16_t priority = openflow_flowtable_priority(
+				        &flowtable->entries[i]);
+				if (priority > max) max = priority;
 			}
 		}
+		if (max != tuple->max_priority)
+		{
+			tuple->max_priority = max;
+			openflow_flowtable_sort_tuples(table);
+		}
 	}
-
-	verbose(2, "[openflow_flowtable_match_packet]:: Packet matched.");
-	return 1;
 }
 
 /**
- * Retrieves the matching flowtable entry for the specified packet. Increments
- * the packet and byte count statistics for that entry.
+ * Finds the entry of the specified table for the specified packet key: an
+ * exact-match entry if there is one, otherwise the highest priority wildcard
+ * entry. The tuples
+ * are searched in order of their highest priority, so the search ends at
+ * the first tuple that cannot hold a better entry than the one found.
+ *
+ * The fields that the lookup looked at are added to wc, if given: any packet
+ * that agrees with the key on those fields gets the same entry.
  *
- * This function dynamically allocates memory that must be freed manually
- * afterwards for its return value.
+ * The flowtable lock must be held.
  *
- * @param packet The specified packet.
+ * @param table The table.
+ * @param key   The packet key (see openflow_flowtable_packet_key).
+ * @param wc    The mask of the fields looked at, cleared by the caller.
  *
- * @return The matching flowtable entry.
+ * @return The matching entry, or NULL.
  */
-openflow_flowtable_entry_type *openflow_flowtable_get_entry_for_packet(
-        gpacket_t *packet)
+static openflow_flowtable_entry_type *openflow_flowtable_lookup(
+        const openflow_flowtable_table_type *table, const ofp_match *key,
+        ofp_match *wc)
 {
-	pthread_mutex_lock(&flowtable_mutex);
+	openflow_flowtable_entry_type *best = NULL;
+	uint16_t best_priority = 0;
+	ofp_match masked;
+	uint32_t h, i, t;
 
-	uint32_t current_priority = 0;
-	openflow_flowtable_entry_type *current_entry = NULL;
-	uint32_t i;
-	for (i = 0; i < OPENFLOW_MAX_FLOWTABLE_ENTRIES; i++)
+	// An exact-match entry can only match a packet of its own frame type
+	// and protocol, so those decide which fields the exact check used
+	if (wc != NULL && table->num_exact > 0)
 	{
-		// Reject match for inactive entry
-		if (!flowtable->entries[i].active) continue;
+		openflow_flowtable_mask(key, &masked);
+		openflow_flowtable_add_mask(wc, &masked);
+	}
 
-		openflow_flowtable_entry_type *entry = &flowtable->entries[i];
-		ofp_match *match = &entry->match;
-		uint8_t is_match = openflow_flowtable_match_packet(match, packet);
-		if (is_match)
+	h = openflow_flowtable_hash(key);
+	for (i = table->exact_buckets[h & (table->num_exact_buckets - 1)];
+	        i != OPENFLOW_FLOWTABLE_NIL; i = flowtable->entries[i].next)
+	{
+		if (flowtable->entries[i].hash == h
+		        && !memcmp(&flowtable->entries[i].key, key, sizeof(ofp_match)))
 		{
-			if (match->wildcards == 0)
-			{
-				// Exact match
-				verbose(2, "[openflow_flowtable_get_entry_for_packet]::"
-						" Found exact match at index %" PRIu32 ".", i);
-				current_entry = entry;
-				break;
-			}
-			else if (entry->priority >= current_priority)
+			verbose(2, "[openflow_flowtable_lookup]:: Found exact match at"
+					" index %" PRIu32 ".", i);
+			return &flowtable->entries[i];
+		}
+	}
+
+	for (t = 0; t < table->num_tuples; t++)
+	{
+		openflow_flowtable_tuple_type *tuple =
+		        &table->tuples[table->tuple_order[t]];
+		if (best != NULL && tuple->max_priority <= best_priority) break;
+
+		if (wc != NULL) openflow_flowtable_add_mask(wc, &tuple->mask);
+		openflow_flowtable_apply_mask(key, &tuple->mask, &masked);
+		h = openflow_flowtable_hash(&masked);
+		for (i = tuple->buckets[h & (tuple->num_buckets - 1)];
+		        i != OPENFLOW_FLOWTABLE_NIL; i = flowtable->entries[i].next)
+		{
+			openflow_flowtable_entry_type *entry = &flowtable->entries[i];
+			if (entry->hash == h
+			        && !memcmp(&entry->key, &masked, sizeof(ofp_match))
+			        && (best == NULL
+			                || openflow_flowtable_priority(entry)
+			                        > best_priority))
 			{
-				// Possible wildcard match, but wait to see if there
-				// are any other wildcard matches with higher priority
-				verbose(2, "[openflow_flowtable_get_entry_for_packet]::"
-						" Found possible match at index %" PRIu32 ".", i);
-				current_entry = entry;
-				current_priority = entry->priority;
+				verbose(2, "[openflow_flowtable_lookup]:: Found wildcard"
+						" match at index %" PRIu32 ".", i);
+				best = entry;
+				best_priority = openflow_flowtable_priority(entry);
 			}
 		}
 	}
 
-	flowtable->stats.lookup_count = htonll(
-	        ntohll(flowtable->stats.lookup_count) + 1);
+	return best;
+}
+
+/**
+ * Returns the entry at the specified index, or NULL for no entry.
+ */
+static inline openflow_flowtable_entry_type *openflow_flowcache_entry(
+        uint32_t index)
+{
+	return index == OPENFLOW_FLOWTABLE_NIL ? NULL : &flowtable->entries[index];
+}
+
+/**
+ * Hashes the specified key for a flow cache, which holds the results of
+ * every table.
+ */
+static inline uint32_t openflow_flowcache_hash(const ofp_match *key,
+        uint8_t table_id)
+{
+	return openflow_flowtable_hash(key) + table_id * 0x9e3779b9;
+}
 
-	if (current_entry == NULL)
+/**
+ * Stores a result in the specified cache slot.
+ *
+ * @return 1 if the slot held another current result, 0 otherwise.
+ */
+static inline uint8_t openflow_flowcache_store(
+        openflow_flowcache_slot_type *slot, uint32_t generation,
+        uint8_t table_id, const ofp_match *key, uint32_t hash, uint32_t mask,
+        uint32_t entry)
+{
+	uint8_t evicted = slot->generation == generation
+	        && (slot->hash != hash || slot->mask != mask
+	                || slot->table_id != table_id
+	                || memcmp(&slot->key, key, sizeof(ofp_match)));
+
+	slot->key = *key;
+	slot->hash = hash;
+	slot->mask = mask;
+	slot->table_id = table_id;
+	slot->entry = entry;
+	slot->generation = generation;
+	return evicted;
+}
+
+/**
+ * Searches the megaflow cache for the specified packet key, once for each
+ * of its masks.
+ *
+ * @param cache    The flow caches of the calling thread.
+ * @param table_id The table the key is looked up in.
+ * @param key      The packet key.
+ * @param index    Set to the index of the cached entry on a hit.
+ *
+ * @return 1 on a hit, 0 otherwise.
+ */
+static uint8_t openflow_flowcache_find_megaflow(openflow_flowcache_type *cache,
+        uint8_t table_id, const ofp_match *key, uint32_t *index)
+{
+	openflow_flowcache_slot_type *slot;
+	ofp_match masked;
+	uint32_t h, m;
+
+	for (m = 0; m < cache->num_masks; m++)
 	{
-		verbose(2, "[openflow_flowtable_get_entry_for_packet]::"
-				" No entry found.");
-		pthread_mutex_unlock(&flowtable_mutex);
-		return NULL;
+		openflow_flowtable_apply_mask(key, &cache->masks[m], &masked);
+		h = openflow_flowcache_hash(&masked, table_id);
+		slot = &cache->megaflow[(h + m) & (OPENFLOW_MEGAFLOW_SLOTS - 1)];
+		if (slot->generation == cache->megaflow_generation
+		        && slot->mask == m && slot->hash == h
+		        && slot->table_id == table_id
+		        && !memcmp(&slot->key, &masked, sizeof(ofp_match)))
+		{
+			*index = slot->entry;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Looks up the specified packet key in the specified table and caches the
+ * result in the megaflow cache, masked with the fields the lookup looked at.
+ *
+ * @param cache    The flow caches of the calling thread.
+ * @param table_id The table to look the key up in.
+ * @param key      The packet key.
+ *
+ * @return The index of the matching entry, or OPENFLOW_FLOWTABLE_NIL.
+ */
+static uint32_t openflow_flowcache_fill_megaflow(openflow_flowcache_type *cache,
+        uint8_t table_id, const ofp_match *key)
+{
+	openflow_flowtable_entry_type *entry;
+	openflow_flowcache_slot_type *slot;
+	ofp_match wc, masked;
+	uint32_t h, m, index;
+	uint8_t evicted;
+
+	memset(&wc, 0, sizeof(ofp_match));
+	entry = openflow_flowtable_lookup(&flowtable->tables[table_id], key, &wc);
+	index = entry ? (uint32_t) (entry - flowtable->entries)
+	        : OPENFLOW_FLOWTABLE_NIL;
+
+	for (m = 0; m < cache->num_masks; m++)
+	{
+		if (!memcmp(&cache->masks[m], &wc, sizeof(ofp_match))) break;
+	}
+	if (m == OPENFLOW_MEGAFLOW_MAX_MASKS)
+	{
+		// Out of masks: start the megaflow cache over
+		cache->megaflow_generation++;
+		cache->num_masks = 0;
+		openflow_count(&cache->invalidations, 1);
+		m = 0;
+	}
+	if (m == cache->num_masks)
+	{
+		cache->masks[cache->num_masks++] = wc;
+	}
+
+	openflow_flowtable_apply_mask(key, &wc, &masked);
+	h = openflow_flowcache_hash(&masked, table_id);
+	slot = &cache->megaflow[(h + m) & (OPENFLOW_MEGAFLOW_SLOTS - 1)];
+	evicted = openflow_flowcache_store(slot, cache->megaflow_generation,
+	        table_id, &masked, h, m, index);
+	openflow_count(&cache->megaflow_evictions, evicted);
+	return index;
+}
+
+/**
+ * Finds the entry for the specified packet key through the flow caches of
+ * the calling thread, filling them from the flowtable on a miss.
+ *
+ * The microflow cache is direct mapped on the whole key. The megaflow cache
+ * holds the key masked with the fields that the flowtable lookup looked at,
+ * so one slot covers every packet that the lookup cannot tell apart. Misses
+ * are cached too. Any change to the flowtable invalidates both.
+ *
+ * The calling thread must be reading the flowtable.
+ *
+ * @param cache    The flow caches of the calling thread.
+ * @param table_id The table to look the key up in.
+ * @param key      The packet key.
+ *
+ * @return The matching entry, or NULL.
+ */
+static openflow_flowtable_entry_type *openflow_flowcache_lookup(
+        openflow_flowcache_type *cache, uint8_t table_id, const ofp_match *key)
+{
+	openflow_flowcache_slot_type *slot;
+	uint32_t h, index;
+	uint8_t evicted;
+
+	if (cache->version != flowtable_version)
+	{
+		cache->version = flowtable_version;
+		cache->microflow_generation++;
+		cache->megaflow_generation++;
+		cache->num_masks = 0;
+		openflow_count(&cache->invalidations, 1);
+	}
+
+	h = openflow_flowcache_hash(key, table_id);
+	slot = &cache->microflow[h & (OPENFLOW_MICROFLOW_SLOTS - 1)];
+	if (slot->generation == cache->microflow_generation && slot->hash == h
+	        && slot->table_id == table_id
+	        && !memcmp(&slot->key, key, sizeof(ofp_match)))
+	{
+		openflow_count(&cache->microflow_hits, 1);
+		return openflow_flowcache_entry(slot->entry);
+	}
+
+	if (openflow_flowcache_find_megaflow(cache, table_id, key, &index))
+	{
+		openflow_count(&cache->megaflow_hits, 1);
 	}
 	else
 	{
-		// Increment stats
-		flowtable->stats.matched_count = htonll(
-		        ntohll(flowtable->stats.matched_count) + 1);
-		current_entry->stats.packet_count = htonll(
-		        ntohll(current_entry->stats.packet_count) + 1);
-		current_entry->stats.byte_count = htonll(
-		        ntohll(current_entry->stats.byte_count) + sizeof(pkt_data_t));
-		time(&current_entry->last_matched);
-
-		// Make copy of entry for use outside this function
-		openflow_flowtable_entry_type *return_entry = malloc(
-		        sizeof(openflow_flowtable_entry_type));
-		memcpy(return_entry, current_entry,
-		        sizeof(openflow_flowtable_entry_type));
-		pthread_mutex_unlock(&flowtable_mutex);
-		return return_entry;
+		openflow_count(&cache->misses, 1);
+		index = openflow_flowcache_fill_megaflow(cache, table_id, key);
 	}
+
+	evicted = openflow_flowcache_store(slot, cache->microflow_generation,
+	        table_id, key, h, 0, index);
+	openflow_count(&cache->microflow_evictions, evicted);
+	return openflow_flowcache_entry(index);
 }
 
 /**
- * Determines whether there is an entry in the flowtable that overlaps the
- * specified entry. An entry overlaps another entry if a single packet may
- * match both, and both entries have the same priority.
+ * Retrieves the matching entry of the specified table for the specified
+ * packet. Counts the packet and its bytes for that entry in the counters of
+ * the calling thread.
  *
- * @param flow_mod A pointer to an ofp_flow_mod struct containing the specified
- *                 entry.
- * @param index    A pointer to a variable used to store the index of the
- *                 overlapping entry, if any.
+ * The entry is returned by reference and stays valid until it is given back
+ * with openflow_flowtable_release_entry(): flow mods wait for it, other
+ * lookups do not.
  *
- * @return 1 if a match is found, 0 otherwise.
+ * @param packet   The specified packet.
+ * @param length   The length of the packet in bytes.
+ * @param table_id The table to look the packet up in.
+ *
+ * @return The matching flowtable entry, or NULL if there is none.
  */
-static uint8_t openflow_flowtable_find_overlapping_entry(ofp_flow_mod *flow_mod,
-        uint32_t *index)
+const openflow_flowtable_entry_type *openflow_flowtable_get_entry_for_packet(
+        gpacket_t *packet, uint32_t length, uint8_t table_id)
 {
-	uint32_t i;
-	for (i = 0; i < OPENFLOW_MAX_FLOWTABLE_ENTRIES; i++)
+	openflow_flowtable_thread_type *thread = openflow_flowtable_thread();
+	ofp_match key;
+
+	if (table_id >= OPENFLOW_NUM_TABLES) return NULL;
+
+	openflow_flowtable_packet_key(packet, &key);
+	openflow_flowtable_read_begin(thread);
+
+	openflow_flowtable_entry_type *entry = openflow_flowcache_lookup(
+	        &thread->cache, table_id, &key);
+	openflow_count(&thread->lookup_count[table_id], 1);
+
+	if (entry == NULL)
 	{
-		openflow_flowtable_entry_type *entry = &flowtable->entries[i];
+		verbose(2, "[openflow_flowtable_get_entry_for_packet]::"
+				" No entry found.");
+		openflow_flowtable_read_end(thread);
+		return NULL;
+	}
 
-		// Reject overlap if entry inactive
-		if (!entry->active) continue;
+	openflow_flowtable_counters_type *counters =
+	        &thread->counters[entry - flowtable->entries];
+	openflow_count(&thread->matched_count[table_id], 1);
+	openflow_count(&counters->packet_count, 1);
+	openflow_count(&counters->byte_count, length);
+	// The timer of the entry catches up with this when it goes off
+	__atomic_store_n(&counters->last_matched, clockSeconds(), __ATOMIC_RELAXED);
 
-		// Reject overlap if priorities are not the same
-		if (entry->priority != flow_mod->priority) continue;
+	return entry;
+}
 
-		ofp_match *flow_mod_match = &flow_mod->match;
-		ofp_match *entry_match = &entry->match;
+/**
+ * Gives back an entry returned by openflow_flowtable_get_entry_for_packet.
+ *
+ * @param entry The entry.
+ */
+void openflow_flowtable_release_entry(const openflow_flowtable_entry_type *entry)
+{
+	if (entry != NULL) openflow_flowtable_read_end(flowtable_thread);
+}
 
-		// Accept overlap if either entry uses the all fields wildcard
-		if (ntohl(flow_mod_match->wildcards) == OFPFW_ALL
-		        || ntohl(entry_match->wildcards) == OFPFW_ALL)
-		{
-			*index = i;
-			return 1;
-		}
+/**
+ * Changes the maximum number of entries of the specified table. The entries
+ * of all tables are allocated together, so this resizes the flowtable too;
+ * it can shrink only down to its highest active entry, and the table only
+ * down to the number of entries it has.
+ *
+ * @param table_id    The table.
+ * @param max_entries The new maximum.
+ *
+ * @return 0 if no error occurred, -1 otherwise.
+ */
+int32_t openflow_flowtable_set_max_entries(uint8_t table_id,
+        uint32_t max_entries)
+{
+	uint32_t i, copied;
 
-		// In general, reject overlap if both entries do not use a wildcard
-		// and have differing values for a particular field
+	if (table_id >= OPENFLOW_NUM_TABLES || max_entries < 1
+	        || max_entries > OPENFLOW_MAX_FLOWTABLE_ENTRIES)
+	{
+		return -1;
+	}
 
-		// Reject overlap on input port
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_IN_PORT)
-		        && !(ntohl(entry_match->wildcards) & OFPFW_IN_PORT))
-		{
-			if (flow_mod_match->in_port != entry_match->in_port)
-			{
-				continue;
-			}
-		}
+	pthread_mutex_lock(&flowtable_mutex);
 
-		// Reject overlap on Ethernet source MAC address
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_SRC)
-		        && !(ntohl(entry_match->wildcards) & OFPFW_DL_SRC))
+	openflow_flowtable_table_type *table = &flowtable->tables[table_id];
+	if (max_entries < table->num_entries)
+	{
+		verbose(1, "[openflow_flowtable_set_max_entries]:: Table %" PRIu8
+				" has %" PRIu32 " entries, not shrinking it.", table_id,
+		        table->num_entries);
+		pthread_mutex_unlock(&flowtable_mutex);
+		return -1;
+	}
+
+	uint32_t pool_entries = flowtable->max_entries - table->max_entries
+	        + max_entries;
+	for (i = pool_entries; i < flowtable->max_entries; i++)
+	{
+		if (flowtable->entries[i].active)
 		{
-			if (memcmp(flow_mod_match->dl_src, entry_match->dl_src,
-			OFP_ETH_ALEN))
-			{
-				continue;
-			}
+			verbose(1, "[openflow_flowtable_set_max_entries]:: Entry %"
+					PRIu32 " is active, not shrinking the flowtable.", i);
+			pthread_mutex_unlock(&flowtable_mutex);
+			return -1;
 		}
+	}
+
+	openflow_flowtable_write_begin();
+
+	uint32_t num_buckets = openflow_flowtable_num_buckets(max_entries);
+	openflow_flowtable_entry_type *entries = calloc(pool_entries,
+	        sizeof(openflow_flowtable_entry_type));
+	uint32_t *free_entries = malloc(sizeof(uint32_t) * pool_entries);
+	uint32_t *buckets = malloc(sizeof(uint32_t) * num_buckets);
+	if (!entries || !free_entries || !buckets
+	        || openflow_flowtable_resize_counters(pool_entries) < 0)
+	{
+		free(entries);
+		free(free_entries);
+		free(buckets);
+		openflow_flowtable_write_end();
+		pthread_mutex_unlock(&flowtable_mutex);
+		return -1;
+	}
+
+	// The tuple chains and the hash tables of the other tables use indexes,
+	// which do not change
+	copied = pool_entries < flowtable->max_entries ?
+	        pool_entries : flowtable->max_entries;
+	memcpy(entries, flowtable->entries,
+	        sizeof(openflow_flowtable_entry_type) * copied);
+	free(flowtable->entries);
+	free(flowtable->free_entries);
+	free(table->exact_buckets);
+	flowtable->entries = entries;
+	flowtable->free_entries = free_entries;
+	flowtable->max_entries = pool_entries;
+	table->exact_buckets = buckets;
+	table->num_exact_buckets = num_buckets;
+	table->max_entries = max_entries;
 
-		// Reject overlap on Ethernet destination MAC address
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_DST)
-		        && !(ntohl(entry_match->wildcards) & OFPFW_DL_DST))
+	for (i = 0; i < num_buckets; i++)
+	{
+		buckets[i] = OPENFLOW_FLOWTABLE_NIL;
+	}
+	flowtable->num_free = 0;
+	for (i = pool_entries; i > 0; i--)
+	{
+		openflow_flowtable_entry_type *entry = &entries[i - 1];
+		if (!entry->active)
 		{
-			if (memcmp(flow_mod_match->dl_dst, entry_match->dl_dst,
-			OFP_ETH_ALEN))
-			{
-				continue;
-			}
+			free_entries[flowtable->num_free++] = i - 1;
 		}
-
-		// Reject overlap on Ethernet VLAN ID
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_VLAN)
-		        && !(ntohl(entry_match->wildcards) & OFPFW_DL_VLAN))
+		else if (entry->table_id == table_id
+		        && entry->tuple == OPENFLOW_FLOWTABLE_NIL)
 		{
-			if (flow_mod_match->dl_vlan != entry_match->dl_vlan)
-			{
-				continue;
-			}
+			entry->next = buckets[entry->hash & (num_buckets - 1)];
+			buckets[entry->hash & (num_buckets - 1)] = i - 1;
 		}
+	}
+	table->stats.max_entries = htonl(max_entries);
+	flowtable_version++;
 
-		// Reject overlap on Ethernet VLAN priority
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_VLAN)
-		        && !(ntohl(entry_match->wildcards) & OFPFW_DL_VLAN))
-		{
-			if (ntohs(flow_mod_match->dl_vlan) != OFP_VLAN_NONE
-			        && ntohs(entry_match->dl_vlan) != OFP_VLAN_NONE)
-			{
-				// In addition to general rules, reject overlap only if
-				// both entries do not use a wildcard or the value
-				// OFP_VLAN_NONE for VLAN IDs
-				if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_VLAN_PCP)
-				        && !(ntohl(entry_match->wildcards) & OFPFW_DL_VLAN_PCP))
-				{
-					if (flow_mod_match->dl_vlan_pcp != entry_match->dl_vlan_pcp)
-					{
-						continue;
-					}
-				}
-			}
+	openflow_flowtable_write_end();
+	pthread_mutex_unlock(&flowtable_mutex);
+	return 0;
+}
+
+/**
+ * Returns the maximum number of entries of the specified table, or of all
+ * tables together for OPENFLOW_TABLE_ALL.
+ */
+uint32_t openflow_flowtable_get_max_entries(uint8_t table_id)
+{
+	if (table_id == OPENFLOW_TABLE_ALL) return flowtable->max_entries;
+	if (table_id >= OPENFLOW_NUM_TABLES) return 0;
+	return flowtable->tables[table_id].max_entries;
+}
+
+/**
+ * Sets what the specified table does with packets that match none of its
+ * entries.
+ *
+ * @param table_id The table.
+ * @param miss     OPENFLOW_TABLE_MISS_CONTROLLER, OPENFLOW_TABLE_MISS_CONTINUE
+ *                 or OPENFLOW_TABLE_MISS_DROP.
+ *
+ * @return 0 if no error occurred, -1 otherwise.
+ */
+int32_t openflow_flowtable_set_table_miss(uint8_t table_id, uint8_t miss)
+{
+	if (table_id >= OPENFLOW_NUM_TABLES || miss > OPENFLOW_TABLE_MISS_DROP)
+	{
+		return -1;
+	}
+
+	// Lookups read it without the mutex
+	__atomic_store_n(&flowtable->tables[table_id].miss, miss,
+	        __ATOMIC_RELAXED);
+	return 0;
+}
+
+/**
+ * Returns what the specified table does with packets that match none of its
+ * entries (OPENFLOW_TABLE_MISS_DROP for a table that does not exist).
+ */
+uint8_t openflow_flowtable_get_table_miss(uint8_t table_id)
+{
+	if (table_id >= OPENFLOW_NUM_TABLES) return OPENFLOW_TABLE_MISS_DROP;
+	return __atomic_load_n(&flowtable->tables[table_id].miss,
+	        __ATOMIC_RELAXED);
+}
+
+/**
+ * Prints the counters of the flow caches, summed over the threads.
+ */
+void openflow_flowtable_print_cache_stats(void)
+{
+	uint64_t microflow_hits = 0, megaflow_hits = 0, misses = 0;
+	uint64_t microflow_evictions = 0, megaflow_evictions = 0;
+	uint64_t invalidations = 0, lookups;
+	uint32_t i;
+
+	// The counters are read while the threads update them
+	pthread_mutex_lock(&flowtable_mutex);
+	for (i = 0; i < num_flowtable_threads; i++)
+	{
+		openflow_flowcache_type *cache = &flowtable_threads[i]->cache;
+		microflow_hits += cache->microflow_hits;
+		megaflow_hits += cache->megaflow_hits;
+		misses += cache->misses;
+		microflow_evictions += cache->microflow_evictions;
+		megaflow_evictions += cache->megaflow_evictions;
+		invalidations += cache->invalidations;
+	}
+	uint32_t num_threads = num_flowtable_threads;
+	pthread_mutex_unlock(&flowtable_mutex);
+
+	lookups = microflow_hits + megaflow_hits + misses;
+	printf("Flow caches: %" PRIu32 " threads, %" PRIu32 " microflow and %"
+	        PRIu32 " megaflow slots each\n", num_threads,
+	        OPENFLOW_MICROFLOW_SLOTS, OPENFLOW_MEGAFLOW_SLOTS);
+	printf("Lookups: %" PRIu64 "\n", lookups);
+	printf("Microflow hits: %" PRIu64 " (%.1f%%)\n", microflow_hits,
+	        lookups ? 100.0 * microflow_hits / lookups : 0.0);
+	printf("Megaflow hits: %" PRIu64 " (%.1f%%)\n", megaflow_hits,
+	        lookups ? 100.0 * megaflow_hits / lookups : 0.0);
+	printf("Misses (flowtable lookups): %" PRIu64 "\n", misses);
+	printf("Microflow evictions: %" PRIu64 "\n", microflow_evictions);
+	printf("Megaflow evictions: %" PRIu64 "\n", megaflow_evictions);
+	printf("Invalidations: %" PRIu64 "\n", invalidations);
+}
+
+/**
+ * Prints how the flowtable entries are organized for lookups.
+ */
+void openflow_flowtable_print_lookup_info(void)
+{
+	static const char *miss_names[] = { "controller", "continue", "drop" };
+	uint32_t i, t;
+
+	pthread_mutex_lock(&flowtable_mutex);
+	printf("Maximum number of entries (all tables): %" PRIu32 "\n",
+	        flowtable->max_entries);
+	for (i = 0; i < OPENFLOW_NUM_TABLES; i++)
+	{
+		openflow_flowtable_table_type *table = &flowtable->tables[i];
+		printf("Table %" PRIu32 ":\n", i);
+		printf("\tMaximum number of entries: %" PRIu32 "\n",
+		        table->max_entries);
+		printf("\tActive entries: %" PRIu32 "\n", table->num_entries);
+		printf("\tTable miss: %s\n", miss_names[table->miss]);
+		printf("\tExact-match entries: %" PRIu32 " (%" PRIu32 " buckets)\n",
+		        table->num_exact, table->num_exact_buckets);
+		printf("\tWildcard tuples: %" PRIu32 "\n", table->num_tuples);
+		for (t = 0; t < table->num_tuples; t++)
+		{
+			openflow_flowtable_tuple_type *tuple =
+			        &table->tuples[table->tuple_order[t]];
+			printf("\t\tTuple %" PRIu32 ": %" PRIu32 " entries, highest"
+			        " priority %" PRIu16 ", %" PRIu32 " buckets\n", t,
+			        tuple->count, tuple->max_priority, tuple->num_buckets);
 		}
+	}
+	pthread_mutex_unlock(&flowtable_mutex);
+}
+
+/**
+ * Builds the mask of the fields that the specified entry compares.
+ */
+static inline void openflow_flowtable_entry_mask(
+        const openflow_flowtable_entry_type *entry, ofp_match *mask)
+{
+	if (entry->tuple == OPENFLOW_FLOWTABLE_NIL)
+	{
+		openflow_flowtable_mask(&entry->match, mask);
+	}
+	else
+	{
+		*mask = flowtable->tables[entry->table_id].tuples[entry->tuple].mask;
+	}
+}
+
+/**
+ * Returns 1 if the specified entry has an output action for the specified
+ * port, or if the port is OFPP_NONE, 0 otherwise.
+ *
+ * @param entry    The entry.
+ * @param out_port The port, in host byte order.
+ */
+static uint8_t openflow_flowtable_has_output(
+        const openflow_flowtable_entry_type *entry, uint16_t out_port)
+{
+	uint32_t j;
 
-		// Reject overlap on Ethernet frame type
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_TYPE)
-		        && !(ntohl(entry_match->wildcards) & OFPFW_DL_TYPE))
+	if (out_port == OFPP_NONE) return 1;
+	for (j = 0; j < OPENFLOW_MAX_ACTIONS; j++)
+	{
+		if (entry->actions[j].active)
 		{
-			if (flow_mod_match->dl_type != entry_match->dl_type)
+			ofp_action_output *action =
+			        (ofp_action_output *) &entry->actions[j].header;
+			if (ntohs(action->type) == OFPAT_OUTPUT
+			        && ntohs(action->port) == out_port)
 			{
-				continue;
+				return 1;
 			}
 		}
+	}
+	return 0;
+}
+
+/**
+ * Returns 1 if the specified entry covers the specified match, as a
+ * non-strict modify or delete selects entries: the entry compares every field
+ * that the match compares, with the same value. It may compare more.
+ *
+ * @param entry The entry.
+ * @param mask  The mask of the match (see openflow_flowtable_mask).
+ * @param key   The match with the mask applied.
+ */
+static uint8_t openflow_flowtable_covers(
+        const openflow_flowtable_entry_type *entry, const ofp_match *mask,
+        const ofp_match *key)
+{
+	ofp_match entry_mask, masked;
+
+	openflow_flowtable_entry_mask(entry, &entry_mask);
+	if (!openflow_flowtable_mask_subset(mask, &entry_mask)) return 0;
+	openflow_flowtable_apply_mask(&entry->key, mask, &masked);
+	return !memcmp(&masked, key, sizeof(ofp_match));
+}
+
+/**
+ * Determines whether there is an entry in the specified table that overlaps
+ * the specified entry. An entry overlaps another entry if a single packet may
+ * match both, and both entries have the same priority: they agree on every
+ * field that both of them compare.
+ *
+ * Only tuples with entries of that priority are searched. A tuple whose
+ * fields the entry all compares is probed once, for the masked key of the
+ * entry. The entries of the other tuples with the same priority are found
+ * through the priority chains and compared one by one.
+ *
+ * @param flow_mod A pointer to an ofp_flow_mod struct containing the specified
+ *                 entry.
+ * @param table_id The table to search.
+ * @param index    A pointer to a variable used to store the index of the
+ *                 overlapping entry, if any.
+ *
+ * @return 1 if a match is found, 0 otherwise.
+ */
+static uint8_t openflow_flowtable_find_overlapping_entry(ofp_flow_mod *flow_mod,
+        uint8_t table_id, uint32_t *index)
+{
+	openflow_flowtable_table_type *table = &flowtable->tables[table_id];
+	uint16_t priority = ntohs(flow_mod->priority);
+	uint8_t exact = flow_mod->match.wildcards == 0;
+	uint8_t walk = 0;
+	ofp_match mask, key, masked, entry_mask;
+	uint32_t h, i, t;
+
+	openflow_flowtable_mask(&flow_mod->match, &mask);
+	openflow_flowtable_apply_mask(&flow_mod->match, &mask, &key);
 
-		// Reject overlap on IP type of service
-		if (ntohs(flow_mod_match->dl_type) == IP_PROTOCOL
-		        && flow_mod_match->dl_type == entry_match->dl_type)
+	// Exact-match entries compare every field of their frame type and
+	// protocol, so two of them overlap only if they have the same key
+	if (table->num_exact > 0)
+	{
+		if (exact)
 		{
-			// In addition to general rules, reject overlap only if
-			// both entries match the IP protocol
-			if (!(ntohl(flow_mod_match->wildcards) & OFPFW_NW_TOS)
-			        && !(ntohl(entry_match->wildcards) & OFPFW_NW_TOS))
+			h = openflow_flowtable_hash(&key);
+			for (i = table->exact_buckets[h & (table->num_exact_buckets - 1)];
+			        i != OPENFLOW_FLOWTABLE_NIL; i = flowtable->entries[i].next)
 			{
-				if (flow_mod_match->nw_tos != entry_match->nw_tos)
+				openflow_flowtable_entry_type *entry = &flowtable->entries[i];
+				if (entry->hash == h
+				        && openflow_flowtable_priority(entry) == priority
+				        && !memcmp(&entry->key, &key, sizeof(ofp_match)))
 				{
-					continue;
+					*index = i;
+					return 1;
 				}
 			}
 		}
-
-		// Reject overlap on IP protocol or ARP opcode
-		if ((ntohs(flow_mod_match->dl_type) == IP_PROTOCOL
-		        || ntohs(flow_mod_match->dl_type) == ARP_PROTOCOL)
-		        && flow_mod_match->dl_type == entry_match->dl_type)
+		else
 		{
-			// In addition to general rules, reject overlap only if
-			// both entries match the IP or ARP protocol
-			if (!(ntohl(flow_mod_match->wildcards) & OFPFW_NW_TOS)
-			        && !(ntohl(entry_match->wildcards) & OFPFW_NW_TOS))
-			{
-				if (flow_mod_match->nw_tos != entry_match->nw_tos)
-				{
-					continue;
-				}
-			}
+			walk = 1;
 		}
+	}
 
-		// Match on IP source address
-		if ((ntohs(flow_mod_match->dl_type) == IP_PROTOCOL
-		        || ntohs(flow_mod_match->dl_type) == ARP_PROTOCOL)
-		        && flow_mod_match->dl_type == entry_match->dl_type)
-		{
-			// In addition to general rules, reject overlap only if
-			// both entries match the IP or ARP protocol
-			uint8_t ip_len_flow = (OFPFW_NW_SRC_ALL >> OFPFW_NW_SRC_SHIFT)
-			        - ((ntohl(flow_mod_match->wildcards) & OFPFW_NW_SRC_MASK)
-			                >> OFPFW_NW_SRC_SHIFT);
-			uint8_t ip_len_entry = (OFPFW_NW_SRC_ALL >> OFPFW_NW_SRC_SHIFT)
-			        - ((ntohl(entry_match->wildcards) & OFPFW_NW_SRC_MASK)
-			                >> OFPFW_NW_SRC_SHIFT);
-			if (ip_len_flow > 0 && ip_len_entry > 0)
-			{
-				// For the purposes of checking whether the IP source addresses
-				// differ, only compare the bits that are not wildcarded by
-				// either entry
-				if (!openflow_flowtable_ip_compare(
-				        ntohl(flow_mod_match->nw_src),
-				        ntohl(entry_match->nw_src),
-				        ip_len_flow < ip_len_entry ?
-				                ip_len_flow : ip_len_entry))
-				{
-					continue;
-				}
-			}
+	for (t = 0; t < table->num_tuples; t++)
+	{
+		openflow_flowtable_tuple_type *tuple =
+		        &table->tuples[table->tuple_order[t]];
+		if (tuple->max_priority < priority) break;
+		if (!openflow_flowtable_mask_subset(&tuple->mask, &mask))
+		{
+			walk = 1;
+			continue;
 		}
 
-		// Match on IP destination address
-		if ((ntohs(flow_mod_match->dl_type) == IP_PROTOCOL
-		        || ntohs(flow_mod_match->dl_type) == ARP_PROTOCOL)
-		        && flow_mod_match->dl_type == entry_match->dl_type)
-		{
-			// In addition to general rules, reject overlap only if
-			// both entries match the IP or ARP protocol
-			uint8_t ip_len_flow = (OFPFW_NW_DST_ALL >> OFPFW_NW_DST_SHIFT)
-			        - ((ntohl(flow_mod_match->wildcards) & OFPFW_NW_DST_MASK)
-			                >> OFPFW_NW_DST_SHIFT);
-			uint8_t ip_len_entry = (OFPFW_NW_DST_ALL >> OFPFW_NW_DST_SHIFT)
-			        - ((ntohl(entry_match->wildcards) & OFPFW_NW_DST_MASK)
-			                >> OFPFW_NW_DST_SHIFT);
-			if (ip_len_flow > 0 && ip_len_entry > 0)
+		openflow_flowtable_apply_mask(&key, &tuple->mask, &masked);
+		h = openflow_flowtable_hash(&masked);
+		for (i = tuple->buckets[h & (tuple->num_buckets - 1)];
+		        i != OPENFLOW_FLOWTABLE_NIL; i = flowtable->entries[i].next)
+		{
+			openflow_flowtable_entry_type *entry = &flowtable->entries[i];
+			if (entry->hash == h
+			        && openflow_flowtable_priority(entry) == priority
+			        && !memcmp(&entry->key, &masked, sizeof(ofp_match)))
 			{
-				// For the purposes of checking whether the IP destination
-				// addresses differ, only compare the bits that are not
-				// wildcarded by either entry
-				if (!openflow_flowtable_ip_compare(
-				        ntohl(flow_mod_match->nw_dst),
-				        ntohl(entry_match->nw_dst),
-				        ip_len_flow < ip_len_entry ?
-				                ip_len_flow : ip_len_entry))
-				{
-					continue;
-				}
+				*index = i;
+				return 1;
 			}
 		}
+	}
+	if (!walk) return 0;
+
+	for (i = table->priority_buckets[priority & (OPENFLOW_PRIORITY_BUCKETS - 1)];
+	        i != OPENFLOW_FLOWTABLE_NIL; i = flowtable->entries[i].priority_next)
+	{
+		openflow_flowtable_entry_type *entry = &flowtable->entries[i];
+		if (openflow_flowtable_priority(entry) != priority) continue;
 
-		// Reject overlap on TCP/UDP source port or ICMP type
-		if (ntohs(flow_mod_match->dl_type) == IP_PROTOCOL
-		        && flow_mod_match->dl_type == entry_match->dl_type)
+		// Skip the entries that were probed for above
+		openflow_flowtable_entry_mask(entry, &entry_mask);
+		if (entry->tuple == OPENFLOW_FLOWTABLE_NIL ? exact :
+		        openflow_flowtable_mask_subset(&entry_mask, &mask))
 		{
-			if ((flow_mod_match->nw_proto == ICMP_PROTOCOL
-			        || flow_mod_match->nw_proto == TCP_PROTOCOL
-			        || flow_mod_match->nw_proto == UDP_PROTOCOL)
-			        && flow_mod_match->nw_proto == entry_match->nw_proto)
-			{
-				// In addition to general rules, reject overlap only if
-				// both entries match the IP protocol, as well as either the
-				// ICMP, TCP, or UDP protocol
-				if (!(ntohl(flow_mod_match->wildcards) & OFPFW_TP_SRC)
-				        && !(ntohl(entry_match->wildcards) & OFPFW_TP_SRC))
-				{
-					if (flow_mod_match->tp_src != entry_match->tp_src)
-					{
-						continue;
-					}
-				}
-			}
+			continue;
 		}
 
-		// Reject overlap on TCP/UDP destination port or ICMP code
-		if (ntohs(flow_mod_match->dl_type) == IP_PROTOCOL
-		        && flow_mod_match->dl_type == entry_match->dl_type)
+		openflow_flowtable_apply_mask(&key, &entry_mask, &masked);
+		openflow_flowtable_apply_mask(&entry->key, &mask, &entry_mask);
+		if (!memcmp(&masked, &entry_mask, sizeof(ofp_match)))
 		{
-			if ((flow_mod_match->nw_proto == ICMP_PROTOCOL
-			        || flow_mod_match->nw_proto == TCP_PROTOCOL
-			        || flow_mod_match->nw_proto == UDP_PROTOCOL)
-			        && flow_mod_match->nw_proto == entry_match->nw_proto)
-			{
-				// In addition to general rules, reject overlap only if
-				// both entries match the IP protocol, as well as either the
-				// ICMP, TCP, or UDP protocol
-				if (!(ntohl(flow_mod_match->wildcards) & OFPFW_TP_DST)
-				        && !(ntohl(entry_match->wildcards) & OFPFW_TP_DST))
-				{
-					if (flow_mod_match->tp_dst != entry_match->tp_dst)
-					{
-						continue;
-					}
-				}
-			}
+			*index = i;
+			return 1;
 		}
-
-		*index = i;
-		return 1;
 	}
 
 	return 0;
@@ -789,332 +1676,223 @@ static uint8_t openflow_flowtable_find_overlapping_entry(ofp_flow_mod *flow_mod,
  * Determines whether there is an entry in the flowtable that matches the
  * specified entry. An entry matches another entry if the ofp_match struct in
  * the second entry is identical to or more specific than the ofp_match struct
- * in the second entry.
+ * in the first entry (see openflow_flowtable_covers).
  *
  * @param flow_mod    A pointer to an ofp_flow_mod struct containing the
  * 					  specified entry.
  * @param index       A pointer to a variable used to store the index of the
  *                    matching entry, if any.
  * @param start_index The index at which to begin matching comparisons.
+ * @param end_index   The index at which to stop matching comparisons.
  * @param out_port    The output port which entries are required to have an
  *                    action for to be matched, in host byte order.
+ * @param table_id    The table to search, or OPENFLOW_TABLE_ALL.
  *
  * @return 1 if a match is found, 0 otherwise.
  */
 static uint8_t openflow_flowtable_find_matching_entry(ofp_match *flow_mod_match,
-        uint32_t *index, uint32_t start_index, uint16_t out_port)
+        uint32_t *index, uint32_t start_index, uint32_t end_index,
+        uint16_t out_port, uint8_t table_id)
 {
-	uint32_t i, j;
-	for (i = start_index; i < OPENFLOW_MAX_FLOWTABLE_ENTRIES; i++)
+	ofp_match mask, key;
+	uint32_t i;
+
+	if (end_index > flowtable->max_entries)
 	{
-		// Reject match for inactive entries
-		if (!flowtable->entries[i].active) continue;
+		end_index = flowtable->max_entries;
+	}
+	openflow_flowtable_mask(flow_mod_match, &mask);
+	openflow_flowtable_apply_mask(flow_mod_match, &mask, &key);
+	for (i = start_index; i < end_index; i++)
+	{
+		openflow_flowtable_entry_type *entry = &flowtable->entries[i];
 
-		// Verify that this entry contains an output action for the specified
-		// port, if one was specified; if there is no such action, then we can
-		// reject the match
-		uint8_t out_port_match = 0;
-		if (out_port != OFPP_NONE)
-		{
-			for (j = 0; j < OPENFLOW_MAX_ACTIONS; j++)
-			{
-				if (flowtable->entries[i].actions[j].active)
-				{
-					ofp_action_output *action =
-					        (ofp_action_output *) &flowtable->entries[i].actions[j].header;
-					if (ntohs(action->type) == OFPAT_OUTPUT
-					        && ntohs(action->port) == out_port)
-					{
-						out_port_match = 1;
-						break;
-					}
-				}
-			}
-		}
-		if (out_port != OFPP_NONE && !out_port_match)
+		// Reject match for inactive entries and entries in other tables
+		if (!entry->active) continue;
+		if (table_id != OPENFLOW_TABLE_ALL && entry->table_id != table_id)
 		{
 			continue;
 		}
 
-		// In general, reject the match if the specified field is not
-		// wildcarded in the query and either the query does not match the
-		// entry or the field is wildcarded in the entry
-
-		ofp_match *entry_match = &flowtable->entries[i].match;
-
-		// Accept match if query entry has the all fields wildcard
-		if (ntohl(flow_mod_match->wildcards) == OFPFW_ALL)
+		if (openflow_flowtable_has_output(entry, out_port)
+		        && openflow_flowtable_covers(entry, &mask, &key))
 		{
 			*index = i;
 			return 1;
 		}
+	}
 
-		// Reject match on input port
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_IN_PORT))
-		{
-			if ((ntohl(entry_match->wildcards) & OFPFW_IN_PORT)
-			        || entry_match->in_port != flow_mod_match->in_port)
-			{
-				continue;
-			}
-		}
-
-		// Reject match on Ethernet source MAC address
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_SRC))
-		{
-			if ((ntohl(entry_match->wildcards) & OFPFW_DL_SRC)
-			        || memcmp(flow_mod_match->dl_src, entry_match->dl_src,
-			        OFP_ETH_ALEN))
-			{
-				continue;
-			}
-		}
-
-		// Reject match on Ethernet destination MAC address
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_DST))
-		{
-			if ((ntohl(entry_match->wildcards) & OFPFW_DL_DST)
-			        || memcmp(flow_mod_match->dl_dst, entry_match->dl_dst,
-			        OFP_ETH_ALEN))
-			{
-				continue;
-			}
-		}
+	return 0;
+}
 
-		// Reject match on Ethernet VLAN ID
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_VLAN))
+/**
+ * Adds an index to the matching entries.
+ */
+static void openflow_flowtable_add_matching(uint32_t index)
+{
+	if (num_matching == matching_size)
+	{
+		uint32_t size = matching_size ? matching_size * 2 : 64;
+		uint32_t *indexes = realloc(matching_indexes, sizeof(uint32_t) * size);
+		if (!indexes)
 		{
-			if ((ntohl(entry_match->wildcards) & OFPFW_DL_VLAN)
-			        || entry_match->dl_vlan != flow_mod_match->dl_vlan)
-			{
-				continue;
-			}
+			fatal("[openflow_flowtable_add_matching]:: Could not allocate"
+					" the matching entries.");
 		}
+		matching_indexes = indexes;
+		matching_size = size;
+	}
+	matching_indexes[num_matching++] = index;
+}
 
-		// Reject match on Ethernet VLAN priority
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_VLAN))
-		{
-			if (ntohs(flow_mod_match->dl_vlan) != OFP_VLAN_NONE)
-			{
-				// In addition to general rule, reject match only if VLAN
-				// ID is not wildcarded in the query entry and the VLAN ID
-				// is not set to OFP_VLAN_NONE in the query entry
-				if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_VLAN_PCP))
-				{
-					if ((ntohl(entry_match->wildcards) & OFPFW_DL_VLAN)
-					        || ntohs(entry_match->dl_vlan) == OFP_VLAN_NONE
-					        || (ntohl(entry_match->wildcards)
-					                & OFPFW_DL_VLAN_PCP)
-					        || entry_match->dl_vlan_pcp
-					                != flow_mod_match->dl_vlan_pcp)
-					{
-						// In addition to general rule, reject match if VLAN ID
-						// is wildcarded in the entry or if VLAN ID is set to
-						// OFP_VLAN_NONE in the entry
-						continue;
-					}
-				}
-			}
-		}
+/**
+ * Finds every entry in the flowtable that matches the specified entry, as
+ * openflow_flowtable_find_matching_entry does, and puts their indexes in
+ * matching_indexes.
+ *
+ * Only tuples that compare every field of the specified entry can hold such
+ * entries. A tuple that compares exactly those fields is probed once for the
+ * masked key; the others are searched entry by entry.
+ *
+ * @param flow_mod_match The match of the specified entry.
+ * @param out_port       The output port which entries are required to have
+ *                       an action for to be matched, in host byte order.
+ * @param table_id       The table to search, or OPENFLOW_TABLE_ALL.
+ *
+ * @return The number of matching entries.
+ */
+static uint32_t openflow_flowtable_find_matching_entries(
+        ofp_match *flow_mod_match, uint16_t out_port, uint8_t table_id)
+{
+	ofp_match mask, key;
+	uint32_t b, h, i, t, n;
 
-		// Reject match on Ethernet frame type
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_TYPE))
-		{
-			if ((ntohl(entry_match->wildcards) & OFPFW_DL_TYPE)
-			        || entry_match->dl_type != flow_mod_match->dl_type)
-			{
-				continue;
-			}
-		}
+	num_matching = 0;
+	openflow_flowtable_mask(flow_mod_match, &mask);
+	openflow_flowtable_apply_mask(flow_mod_match, &mask, &key);
+	h = openflow_flowtable_hash(&key);
 
-		// Reject match on IP type of service
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_NW_TOS))
-		{
-			if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_TYPE)
-			        && ntohs(flow_mod_match->dl_type) == IP_PROTOCOL)
-			{
-				// In addition to general rule, reject match only if the query
-				// entry matches the IP protocol
-				if ((ntohl(entry_match->wildcards) & OFPFW_NW_TOS)
-				        || entry_match->nw_tos != flow_mod_match->nw_tos
-				        || (ntohl(entry_match->wildcards) & OFPFW_DL_TYPE)
-				        || entry_match->dl_type != flow_mod_match->dl_type)
-				{
-					// In addition to general rule, reject match if the entry
-					// does not match the query entry protocol
-					continue;
-				}
-			}
-		}
+	for (t = 0; t < OPENFLOW_NUM_TABLES; t++)
+	{
+		if (table_id != OPENFLOW_TABLE_ALL && t != table_id) continue;
+		openflow_flowtable_table_type *table = &flowtable->tables[t];
 
-		// Reject match IP protocol or ARP opcode
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_NW_PROTO))
+		// An exact-match entry that matches an exact-match entry has its key
+		if (table->num_exact > 0 && flow_mod_match->wildcards == 0)
 		{
-			if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_TYPE)
-			        && (ntohs(flow_mod_match->dl_type) == IP_PROTOCOL
-			                || ntohs(flow_mod_match->dl_type) == ARP_PROTOCOL))
+			for (i = table->exact_buckets[h & (table->num_exact_buckets - 1)];
+			        i != OPENFLOW_FLOWTABLE_NIL; i = flowtable->entries[i].next)
 			{
-				// In addition to general rule, reject match only if the query
-				// entry matches the IP or ARP protocol
-				if ((ntohl(entry_match->wildcards) & OFPFW_NW_PROTO)
-				        || entry_match->nw_proto != flow_mod_match->nw_proto
-				        || (ntohl(entry_match->wildcards) & OFPFW_DL_TYPE)
-				        || entry_match->dl_type != flow_mod_match->dl_type)
+				openflow_flowtable_entry_type *entry = &flowtable->entries[i];
+				if (entry->hash == h
+				        && !memcmp(&entry->key, &key, sizeof(ofp_match))
+				        && openflow_flowtable_has_output(entry, out_port))
 				{
-					// In addition to general rule, reject match if the entry
-					// does not match the query entry protocol
-					continue;
+					openflow_flowtable_add_matching(i);
 				}
 			}
 		}
-
-		// Reject match on IP source address
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_TYPE)
-		        && (ntohs(flow_mod_match->dl_type) == IP_PROTOCOL
-		                || ntohs(flow_mod_match->dl_type) == ARP_PROTOCOL))
+		else if (table->num_exact > 0)
 		{
-			// In addition to general rule, reject match only if the query
-			// entry matches the IP or ARP protocol
-			uint8_t ip_len_flow = (OFPFW_NW_SRC_ALL >> OFPFW_NW_SRC_SHIFT)
-			        - ((ntohl(flow_mod_match->wildcards) & OFPFW_NW_SRC_MASK)
-			                >> OFPFW_NW_SRC_SHIFT);
-			if (ip_len_flow > 0)
+			for (b = 0; b < table->num_exact_buckets; b++)
 			{
-				uint8_t ip_len_entry = (OFPFW_NW_SRC_ALL >> OFPFW_NW_SRC_SHIFT)
-				        - ((ntohl(entry_match->wildcards) & OFPFW_NW_SRC_MASK)
-				                >> OFPFW_NW_SRC_SHIFT);
-				// In addition to general rule, reject match if the entry
-				// does not match the query entry protocol or if the query
-				// entry has fewer wildcarded bits than the entry
-				if ((ntohl(entry_match->wildcards) & OFPFW_DL_TYPE)
-				        || entry_match->dl_type != flow_mod_match->dl_type
-				        || ip_len_entry < ip_len_flow
-				        || !openflow_flowtable_ip_compare(
-				                ntohl(entry_match->nw_src),
-				                ntohl(flow_mod_match->nw_src), ip_len_flow))
+				for (i = table->exact_buckets[b]; i != OPENFLOW_FLOWTABLE_NIL;
+				        i = flowtable->entries[i].next)
 				{
-					// For the purposes of checking whether the IP source
-					// addresses differ, compare the bits that are not
-					// wildcarded by the query entry
-					continue;
+					openflow_flowtable_entry_type *entry =
+					        &flowtable->entries[i];
+					if (openflow_flowtable_has_output(entry, out_port)
+					        && openflow_flowtable_covers(entry, &mask, &key))
+					{
+						openflow_flowtable_add_matching(i);
+					}
 				}
 			}
 		}
 
-		// Reject match on IP destination address
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_TYPE)
-		        && (ntohs(flow_mod_match->dl_type) == IP_PROTOCOL
-		                || ntohs(flow_mod_match->dl_type) == ARP_PROTOCOL))
+		for (n = 0; n < table->num_tuples; n++)
 		{
-			// In addition to general rule, reject match only if the query
-			// entry matches the IP or ARP protocol
-			uint8_t ip_len_flow = (OFPFW_NW_DST_ALL >> OFPFW_NW_DST_SHIFT)
-			        - ((ntohl(flow_mod_match->wildcards) & OFPFW_NW_DST_MASK)
-			                >> OFPFW_NW_DST_SHIFT);
-			if (ip_len_flow > 0)
-			{
-				uint8_t ip_len_entry = (OFPFW_NW_DST_ALL >> OFPFW_NW_DST_SHIFT)
-				        - ((ntohl(entry_match->wildcards) & OFPFW_NW_DST_MASK)
-				                >> OFPFW_NW_DST_SHIFT);
-				// In addition to general rule, reject match if the entry
-				// does not match the query entry protocol or if the query
-				// entry has fewer wildcarded bits than the entry
-				if ((ntohl(entry_match->wildcards) & OFPFW_DL_TYPE)
-				        || entry_match->dl_type != flow_mod_match->dl_type
-				        || ip_len_entry < ip_len_flow
-				        || !openflow_flowtable_ip_compare(
-				                ntohl(entry_match->nw_dst),
-				                ntohl(flow_mod_match->nw_dst), ip_len_flow))
-				{
-					// For the purposes of checking whether the IP destination
-					// addresses differ, compare the bits that are not
-					// wildcarded by the query entry
-					continue;
-				}
-			}
-		}
+			openflow_flowtable_tuple_type *tuple =
+			        &table->tuples[table->tuple_order[n]];
+			if (!openflow_flowtable_mask_subset(&mask, &tuple->mask)) continue;
 
-		// Reject match on TCP/UDP source port or ICMP type
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_TP_SRC))
-		{
-			if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_TYPE)
-			        && ntohs(flow_mod_match->dl_type) == IP_PROTOCOL
-			        && !(ntohl(flow_mod_match->wildcards) & OFPFW_NW_PROTO)
-			        && (flow_mod_match->nw_proto == ICMP_PROTOCOL
-			                || flow_mod_match->nw_proto == TCP_PROTOCOL
-			                || flow_mod_match->nw_proto == UDP_PROTOCOL))
+			if (!memcmp(&tuple->mask, &mask, sizeof(ofp_match)))
 			{
-				// In addition to general rule, reject match only if the query
-				// entry matches the IP protocol, as well as the ICMP, TCP or
-				// UDP protocol
-				if ((ntohl(entry_match->wildcards) & OFPFW_DL_TYPE)
-				        || entry_match->dl_type != flow_mod_match->dl_type
-				        || (ntohl(entry_match->wildcards) & OFPFW_NW_PROTO)
-				        || entry_match->nw_proto != flow_mod_match->nw_proto
-				        || (ntohl(entry_match->wildcards) & OFPFW_TP_SRC)
-				        || entry_match->tp_src != flow_mod_match->tp_src)
+				for (i = tuple->buckets[h & (tuple->num_buckets - 1)];
+				        i != OPENFLOW_FLOWTABLE_NIL;
+				        i = flowtable->entries[i].next)
 				{
-					// In addition to general rule, reject match if the entry
-					// does not match the query entry protocol
-					continue;
+					openflow_flowtable_entry_type *entry =
+					        &flowtable->entries[i];
+					if (entry->hash == h
+					        && !memcmp(&entry->key, &key, sizeof(ofp_match))
+					        && openflow_flowtable_has_output(entry, out_port))
+					{
+						openflow_flowtable_add_matching(i);
+					}
 				}
+				continue;
 			}
-		}
 
-		// Reject match on TCP/UDP destination port or ICMP code
-		if (!(ntohl(flow_mod_match->wildcards) & OFPFW_TP_DST))
-		{
-			if (!(ntohl(flow_mod_match->wildcards) & OFPFW_DL_TYPE)
-			        && ntohs(flow_mod_match->dl_type) == IP_PROTOCOL
-			        && !(ntohl(flow_mod_match->wildcards) & OFPFW_NW_PROTO)
-			        && (flow_mod_match->nw_proto == ICMP_PROTOCOL
-			                || flow_mod_match->nw_proto == TCP_PROTOCOL
-			                || flow_mod_match->nw_proto == UDP_PROTOCOL))
+			for (b = 0; b < tuple->num_buckets; b++)
 			{
-				// In addition to general rule, reject match only if the query
-				// entry matches the IP protocol, as well as the ICMP, TCP or
-				// UDP protocol
-				if ((ntohl(entry_match->wildcards) & OFPFW_DL_TYPE)
-				        || entry_match->dl_type != flow_mod_match->dl_type
-				        || (ntohl(entry_match->wildcards) & OFPFW_NW_PROTO)
-				        || entry_match->nw_proto != flow_mod_match->nw_proto
-				        || (ntohl(entry_match->wildcards) & OFPFW_TP_DST)
-				        || entry_match->tp_dst != flow_mod_match->tp_dst)
+				for (i = tuple->buckets[b]; i != OPENFLOW_FLOWTABLE_NIL;
+				        i = flowtable->entries[i].next)
 				{
-					// In addition to general rule, reject match if the entry
-					// does not match the query entry protocol
-					continue;
+					openflow_flowtable_entry_type *entry =
+					        &flowtable->entries[i];
+					if (openflow_flowtable_has_output(entry, out_port)
+					        && openflow_flowtable_covers(entry, &mask, &key))
+					{
+						openflow_flowtable_add_matching(i);
+					}
 				}
 			}
 		}
-
-		*index = i;
-		return 1;
 	}
 
-	return 0;
+	return num_matching;
 }
 
 /**
- * Determines whether there is an entry in the flowtable that is identical to
- * the specified entry. An entry is identical to another entry if they share
- * the same priority and have identical header fields.
+ * Determines whether there is an entry in the specified table that is
+ * identical to the specified entry. An entry is identical to another entry if
+ * they share the same priority and have identical header fields, which puts
+ * them in the same hash chain of the same tuple.
  *
  * @param flow_mod An ofp_flow_mod struct containing the specified entry.
+ * @param table_id The table to search.
  * @param index    A pointer to a variable used to store the index of the
  *                 identical entry, if any.
  *
  * @return 1 if a match is found, 0 otherwise.
  */
 static uint8_t openflow_flowtable_find_identical_entry(ofp_flow_mod* flow_mod,
-        uint32_t *index)
+        uint8_t table_id, uint32_t *index)
 {
-	uint32_t i;
-	for (i = 0; i < OPENFLOW_MAX_FLOWTABLE_ENTRIES; i++)
+	openflow_flowtable_table_type *table = &flowtable->tables[table_id];
+	ofp_match mask, key;
+	uint32_t *buckets, num_buckets, h, i;
+
+	openflow_flowtable_mask(&flow_mod->match, &mask);
+	openflow_flowtable_apply_mask(&flow_mod->match, &mask, &key);
+	if (flow_mod->match.wildcards == 0)
+	{
+		buckets = table->exact_buckets;
+		num_buckets = table->num_exact_buckets;
+	}
+	else
 	{
-		// Reject match if entry inactive
-		if (!flowtable->entries[i].active) continue;
+		uint32_t t = openflow_flowtable_find_tuple(table, &mask, 0);
+		if (t == OPENFLOW_FLOWTABLE_NIL) return 0;
+		buckets = table->tuples[t].buckets;
+		num_buckets = table->tuples[t].num_buckets;
+	}
 
+	h = openflow_flowtable_hash(&key);
+	for (i = buckets[h & (num_buckets - 1)]; i != OPENFLOW_FLOWTABLE_NIL;
+	        i = flowtable->entries[i].next)
+	{
 		// Check if the entries' priorities are the same and whether their
 		// header fields are identical (i.e. they have identical matches)
 		if (flowtable->entries[i].priority == flow_mod->priority
@@ -1129,6 +1907,167 @@ static uint8_t openflow_flowtable_find_identical_entry(ofp_flow_mod* flow_mod,
 	return 0;
 }
 
+/**
+ * Returns the timer wheel slot for an entry that expires at the specified
+ * time. Entries that are due go in the next slot the wheel will run, and
+ * entries too far ahead for the wheel in its last slot, from which they are
+ * filed again.
+ */
+static uint32_t openflow_flowtable_timer_slot(time_t expires)
+{
+	time_t now = flowtable->timer_now;
+
+	if (expires <= now) expires = now + 1;
+	if (expires - now < OPENFLOW_TIMER_WHEEL_SLOTS)
+	{
+		return expires & (OPENFLOW_TIMER_WHEEL_SLOTS - 1);
+	}
+
+	time_t last = (now >> OPENFLOW_TIMER_WHEEL_BITS)
+	        + OPENFLOW_TIMER_WHEEL_SLOTS - 1;
+	time_t turn = expires >> OPENFLOW_TIMER_WHEEL_BITS;
+	if (turn > last) turn = last;
+	return OPENFLOW_TIMER_WHEEL_SLOTS
+	        + (turn & (OPENFLOW_TIMER_WHEEL_SLOTS - 1));
+}
+
+/**
+ * Adds the entry at the specified index to the timer wheel slot for its
+ * expiry time.
+ */
+static void openflow_flowtable_timer_insert(uint32_t index)
+{
+	openflow_flowtable_entry_type *entry = &flowtable->entries[index];
+	uint32_t slot = openflow_flowtable_timer_slot(entry->expires);
+
+	entry->timer_slot = slot;
+	entry->timer_prev = OPENFLOW_FLOWTABLE_NIL;
+	entry->timer_next = flowtable->timer_slots[slot];
+	if (entry->timer_next != OPENFLOW_FLOWTABLE_NIL)
+	{
+		flowtable->entries[entry->timer_next].timer_prev = index;
+	}
+	flowtable->timer_slots[slot] = index;
+}
+
+/**
+ * Removes the entry at the specified index from the timer wheel, if it is
+ * in it.
+ */
+static void openflow_flowtable_timer_remove(uint32_t index)
+{
+	openflow_flowtable_entry_type *entry = &flowtable->entries[index];
+
+	if (entry->expires == 0) return;
+
+	if (entry->timer_prev == OPENFLOW_FLOWTABLE_NIL)
+	{
+		flowtable->timer_slots[entry->timer_slot] = entry->timer_next;
+	}
+	else
+	{
+		flowtable->entries[entry->timer_prev].timer_next = entry->timer_next;
+	}
+	if (entry->timer_next != OPENFLOW_FLOWTABLE_NIL)
+	{
+		flowtable->entries[entry->timer_next].timer_prev = entry->timer_prev;
+	}
+	entry->expires = 0;
+}
+
+/**
+ * Puts the entry at the specified index on the timer wheel for the earlier
+ * of its idle and hard expiry times, or takes it off if it has no timeout.
+ * Matches do not move the entry; when the idle timer goes off it is put
+ * back for the idle timeout after the last match, if there was one since.
+ */
+static void openflow_flowtable_timer_schedule(uint32_t index)
+{
+	openflow_flowtable_entry_type *entry = &flowtable->entries[index];
+	uint16_t idle_timeout = ntohs(entry->idle_timeout);
+	uint16_t hard_timeout = ntohs(entry->hard_timeout);
+	time_t expires = 0;
+
+	openflow_flowtable_timer_remove(index);
+
+	if (idle_timeout != 0)
+	{
+		expires = entry->last_matched + idle_timeout;
+	}
+	if (hard_timeout != 0
+	        && (expires == 0 || entry->last_modified + hard_timeout < expires))
+	{
+		expires = entry->last_modified + hard_timeout;
+	}
+	if (expires == 0) return;
+
+	entry->expires = expires;
+	openflow_flowtable_timer_insert(index);
+}
+
+/**
+ * Adds a flow removed message for the entry at the specified index, whose
+ * stats are up to date, to the batch sent by
+ * openflow_flowtable_send_flow_removed.
+ */
+static void openflow_flowtable_queue_flow_removed(uint32_t index,
+        uint8_t reason)
+{
+	openflow_flowtable_entry_type *entry = &flowtable->entries[index];
+
+	if (flow_removed_count == flow_removed_size)
+	{
+		uint32_t size = flow_removed_size ?
+		        flow_removed_size * 2 : OPENFLOW_FLOW_REMOVED_BATCH;
+		ofp_flow_removed *batch = realloc(flow_removed_batch,
+		        sizeof(ofp_flow_removed) * size);
+		if (batch == NULL)
+		{
+			verbose(1, "[openflow_flowtable_queue_flow_removed]:: Could"
+					" not allocate memory, dropping flow removed message.");
+			return;
+		}
+		flow_removed_batch = batch;
+		flow_removed_size = size;
+	}
+
+	ofp_flow_removed *msg = &flow_removed_batch[flow_removed_count++];
+	memset(msg, 0, sizeof(ofp_flow_removed));
+	msg->match = entry->match;
+	msg->cookie = entry->cookie;
+	msg->priority = entry->priority;
+	msg->reason = reason;
+	msg->duration_sec = entry->stats.duration_sec;
+	msg->duration_nsec = entry->stats.duration_nsec;
+	msg->idle_timeout = entry->idle_timeout;
+	msg->packet_count = entry->stats.packet_count;
+	msg->byte_count = entry->stats.byte_count;
+}
+
+/**
+ * Sends the flow removed messages queued by deletions to the controller.
+ * Called without the mutex, so that lookups and flow mods do not wait for
+ * the controller connection.
+ */
+static void openflow_flowtable_send_flow_removed(void)
+{
+	pthread_mutex_lock(&flowtable_mutex);
+	ofp_flow_removed *batch = flow_removed_batch;
+	uint32_t count = flow_removed_count;
+	flow_removed_batch = NULL;
+	flow_removed_count = 0;
+	flow_removed_size = 0;
+	pthread_mutex_unlock(&flowtable_mutex);
+
+	if (count > 0)
+	{
+		verbose(2, "[openflow_flowtable_send_flow_removed]:: Sending %"
+				PRIu32 " flow removed messages.", count);
+		openflow_ctrl_iface_send_flow_removed(batch, count);
+	}
+	free(batch);
+}
+
 /**
  * Deletes the entry with the specified index from the flowtable.
  *
@@ -1139,13 +2078,18 @@ static void openflow_flowtable_delete_entry_at_index(uint32_t i,uint8_t reason)
 {
 	if (ntohs(flowtable->entries[i].flags) & OFPFF_SEND_FLOW_REM)
 	{
-		openflow_ctrl_iface_send_flow_removed(&flowtable->entries[i],
-		        reason);
+		openflow_flowtable_update_entry_stats(i);
+		openflow_flowtable_queue_flow_removed(i, reason);
 	}
 
-	flowtable->stats.active_count = htonl(
-	        ntohl(flowtable->stats.active_count) - 1);
+	openflow_flowtable_table_type *table =
+	        &flowtable->tables[flowtable->entries[i].table_id];
+	openflow_flowtable_timer_remove(i);
+	openflow_flowtable_index_remove(i);
+	table->num_entries--;
+	table->stats.active_count = htonl(table->num_entries);
 	memset(&flowtable->entries[i], 0, sizeof(openflow_flowtable_entry_type));
+	flowtable->free_entries[flowtable->num_free++] = i;
 }
 
 /**
@@ -1158,7 +2102,10 @@ static void openflow_flowtable_delete_entry_at_index(uint32_t i,uint8_t reason)
  *                   populated (in network byte order) if an error occurs.
  * @param error_code A pointer to an error code variable that will be
  *                   populated (in network byte order) if an error occurs.
- * @param reset      If 1, resets the statistics associated with the entry.
+ * @param reset      If 1, sets up the entry from the flow modification and
+ *                   resets its statistics. If 0, only replaces its actions
+ *                   (a modify leaves the match, priority, cookie, flags,
+ *                   timeouts and statistics of an entry alone).
  */
 static int32_t openflow_flowtable_modify_entry_at_index(ofp_flow_mod *flow_mod,
         uint32_t index, uint16_t *error_type, uint16_t *error_code,
@@ -1172,11 +2119,31 @@ static int32_t openflow_flowtable_modify_entry_at_index(ofp_flow_mod *flow_mod,
 	ofp_action_header *action_header;
 	while (action_block_index < ntohs(flow_mod->header.length))
 	{
+		if (actions_index >= OPENFLOW_MAX_ACTIONS)
+		{
+			verbose(2, "[openflow_flowtable_modify_entry_at_index]::"
+					" Too many actions. Not modifying entry.");
+			*error_type = htons(OFPET_BAD_ACTION);
+			*error_code = htons(OFPBAC_TOO_MANY);
+			return -1;
+		}
+
 		// Use temporary pointer to increment pointer address by bytes
 		char *tmp_ptr = (char *) flow_mod;
 		tmp_ptr += action_block_index;
 		action_header = (ofp_action_header *) tmp_ptr;
 
+		// Every supported action fits in an openflow_flowtable_action_type
+		if (ntohs(action_header->len) < sizeof(ofp_action_header)
+		        || ntohs(action_header->len) > OPENFLOW_MAX_ACTION_SIZE)
+		{
+			verbose(2, "[openflow_flowtable_modify_entry_at_index]::"
+					" Action of invalid length. Not modifying entry.");
+			*error_type = htons(OFPET_BAD_ACTION);
+			*error_code = htons(OFPBAC_BAD_LEN);
+			return -1;
+		}
+
 		memcpy(&actions[actions_index].header, action_header,
 		        ntohs(action_header->len));
 
@@ -1191,11 +2158,48 @@ static int32_t openflow_flowtable_modify_entry_at_index(ofp_flow_mod *flow_mod,
 		}
 		if (ntohs(actions[actions_index].header.type) == OFPAT_VENDOR)
 		{
-			verbose(2, "[openflow_flowtable_modify_entry_at_index]::"
-					" OFPAT_VENDOR action not supported. Not modifying entry.");
-			*error_type = htons(OFPET_FLOW_MOD_FAILED);
-			*error_code = htons(OFPFMFC_UNSUPPORTED);
-			return -1;
+			// Only the goto table action (Nicira resubmit to a later table)
+			openflow_nx_action_resubmit_type *resubmit =
+			        (openflow_nx_action_resubmit_type *) action_header;
+			if (ntohs(resubmit->len) != sizeof(openflow_nx_action_resubmit_type))
+			{
+				verbose(2, "[openflow_flowtable_modify_entry_at_index]::"
+						" OFPAT_VENDOR action not of length 16. Not"
+						" modifying entry.");
+				*error_type = htons(OFPET_BAD_ACTION);
+				*error_code = htons(OFPBAC_BAD_LEN);
+				return -1;
+			}
+			if (ntohl(resubmit->vendor) != OPENFLOW_NX_VENDOR_ID)
+			{
+				verbose(2, "[openflow_flowtable_modify_entry_at_index]::"
+						" OFPAT_VENDOR action of unknown vendor. Not"
+						" modifying entry.");
+				*error_type = htons(OFPET_BAD_ACTION);
+				*error_code = htons(OFPBAC_BAD_VENDOR);
+				return -1;
+			}
+			if (ntohs(resubmit->subtype) != OPENFLOW_NXAST_RESUBMIT_TABLE)
+			{
+				verbose(2, "[openflow_flowtable_modify_entry_at_index]::"
+						" OFPAT_VENDOR action of unknown type. Not modifying"
+						" entry.");
+				*error_type = htons(OFPET_BAD_ACTION);
+				*error_code = htons(OFPBAC_BAD_VENDOR_TYPE);
+				return -1;
+			}
+			// The pipeline only goes forward, so it always ends
+			if (ntohs(resubmit->in_port) != OFPP_IN_PORT
+			        || resubmit->table <= flowtable->entries[index].table_id
+			        || resubmit->table >= OPENFLOW_NUM_TABLES)
+			{
+				verbose(2, "[openflow_flowtable_modify_entry_at_index]::"
+						" Goto table action must go to a later table. Not"
+						" modifying entry.");
+				*error_type = htons(OFPET_BAD_ACTION);
+				*error_code = htons(OFPBAC_BAD_ARGUMENT);
+				return -1;
+			}
 		}
 		if ((ntohs(actions[actions_index].header.type) > OFPAT_ENQUEUE)
 		        && (ntohs(actions[actions_index].header.type) < OFPAT_VENDOR))
@@ -1314,23 +2318,41 @@ static int32_t openflow_flowtable_modify_entry_at_index(ofp_flow_mod *flow_mod,
 
 		action_block_index += ntohs(action_header->len);
 		actions_index += 1;
-		if (actions_index > OPENFLOW_MAX_ACTIONS)
+	}
+
+	flowtable->entries[index].last_modified = clockSeconds();
+	for (i = 0; i < OPENFLOW_MAX_ACTIONS; i++)
+	{
+		if (i < actions_index)
 		{
-			verbose(2, "[openflow_flowtable_modify_entry_at_index]::"
-					" Too many actions. Not modifying entry.");
-			*error_type = htons(OFPET_BAD_ACTION);
-			*error_code = htons(OFPBAC_TOO_MANY);
-			return -1;
+			flowtable->entries[index].actions[i] = actions[i];
+			flowtable->entries[index].actions[i].active = 1;
+		}
+		else
+		{
+			flowtable->entries[index].actions[i].active = 0;
 		}
 	}
 
-	if (reset)
+	if (!reset)
 	{
-		memset(&flowtable->entries[index].stats, 0, sizeof(ofp_flow_stats));
-		openflow_flowtable_set_flow_stats_defaults(
-		        &flowtable->entries[index].stats);
+		openflow_flowtable_timer_schedule(index);
+		verbose(2, "[openflow_flowtable_modify_entry_at_index]:: Modified"
+				" actions of entry at index %" PRIu32 ".", index);
+		return 0;
 	}
 
+	memset(&flowtable->entries[index].stats, 0, sizeof(ofp_flow_stats));
+	openflow_flowtable_set_flow_stats_defaults(&flowtable->entries[index].stats);
+	flowtable->entries[index].stats.table_id =
+	        flowtable->entries[index].table_id;
+	openflow_flowtable_clear_counters(index);
+
+	// The match and priority decide where the entry is indexed
+	if (flowtable->entries[index].active)
+	{
+		openflow_flowtable_index_remove(index);
+	}
 	flowtable->entries[index].active = 1;
 
 	flowtable->entries[index].match = flow_mod->match;
@@ -1339,8 +2361,7 @@ static int32_t openflow_flowtable_modify_entry_at_index(ofp_flow_mod *flow_mod,
 	flowtable->entries[index].cookie = flow_mod->cookie;
 	flowtable->entries[index].stats.cookie = flow_mod->cookie;
 
-	time(&flowtable->entries[index].last_matched);
-	time(&flowtable->entries[index].last_modified);
+	flowtable->entries[index].last_matched = clockSeconds();
 
 	flowtable->entries[index].idle_timeout = flow_mod->idle_timeout;
 	flowtable->entries[index].stats.idle_timeout = flow_mod->idle_timeout;
@@ -1352,18 +2373,9 @@ static int32_t openflow_flowtable_modify_entry_at_index(ofp_flow_mod *flow_mod,
 	flowtable->entries[index].stats.priority = flow_mod->priority;
 
 	flowtable->entries[index].flags = flow_mod->flags;
-	for (i = 0; i < OPENFLOW_MAX_ACTIONS; i++)
-	{
-		if (i < actions_index)
-		{
-			flowtable->entries[index].actions[i] = actions[i];
-			flowtable->entries[index].actions[i].active = 1;
-		}
-		else
-		{
-			flowtable->entries[index].actions[i].active = 0;
-		}
-	}
+
+	openflow_flowtable_index_add(index);
+	openflow_flowtable_timer_schedule(index);
 
 	verbose(2, "[openflow_flowtable_modify_entry_at_index]:: Modified entry"
 			" at index %" PRIu32 ".", index);
@@ -1372,9 +2384,10 @@ static int32_t openflow_flowtable_modify_entry_at_index(ofp_flow_mod *flow_mod,
 }
 
 /**
- * Adds the specified entry to the flowtable.
+ * Adds the specified entry to the specified table.
  *
  * @param flow_mod   The struct containing the entry to add to the flowtable.
+ * @param table_id   The table to add the entry to.
  * @param error_type A pointer to an error type variable that will be
  *                   populated (in network byte order) if an error occurs.
  * @param error_code A pointer to an error code variable that will be
@@ -1383,15 +2396,16 @@ static int32_t openflow_flowtable_modify_entry_at_index(ofp_flow_mod *flow_mod,
  * @return 0 if no error occurred, -1 otherwise.
  */
 static int32_t openflow_flowtable_add(ofp_flow_mod* flow_mod,
-        uint16_t *error_type, uint16_t *error_code)
+        uint8_t table_id, uint16_t *error_type, uint16_t *error_code)
 {
+	openflow_flowtable_table_type *table = &flowtable->tables[table_id];
 	uint32_t i;
 	uint16_t flags = ntohs(flow_mod->flags);
 
 	if (flags & OFPFF_CHECK_OVERLAP)
 	{
 		verbose(2, "[openflow_flowtable_add]:: OFPFF_CHECK_OVERLAP flag set.");
-		if (openflow_flowtable_find_overlapping_entry(flow_mod, &i))
+		if (openflow_flowtable_find_overlapping_entry(flow_mod, table_id, &i))
 		{
 			verbose(2, "[openflow_flowtable_add]:: Overlapping entry found at"
 					" index %" PRIu32 ". Not adding to table.", i);
@@ -1401,43 +2415,55 @@ static int32_t openflow_flowtable_add(ofp_flow_mod* flow_mod,
 		}
 	}
 
-	if (openflow_flowtable_find_identical_entry(flow_mod, &i))
+	if (openflow_flowtable_find_identical_entry(flow_mod, table_id, &i))
 	{
+		// The old entry stays as it was if the new one is rejected
 		verbose(2, "[openflow_flowtable_add]:: Replacing flowtable entry at"
 				" index %" PRIu32 ".", i);
-		memset(&flowtable->entries[i], 0,
-		        sizeof(openflow_flowtable_entry_type));
-		return openflow_flowtable_modify_entry_at_index(flow_mod, i, error_type,
-		        error_code, 0);
+		if (openflow_flowtable_modify_entry_at_index(flow_mod, i, error_type,
+		        error_code, 1) < 0)
+		{
+			return -1;
+		}
+		flowtable->entries[i].added = clockSeconds();
+		return 0;
 	}
 
-	for (i = 0; i < OPENFLOW_MAX_FLOWTABLE_ENTRIES; i++)
+	// The table sizes add up to the number of entries, so a table that is
+	// not full always finds a free one
+	if (table->num_entries < table->max_entries && flowtable->num_free > 0)
 	{
-		if (!flowtable->entries[i].active)
-		{
-			flowtable->stats.active_count = htonl(
-			        ntohl(flowtable->stats.active_count) + 1);
+		i = flowtable->free_entries[flowtable->num_free - 1];
 
-			verbose(2, "[openflow_flowtable_add]:: Adding flowtable entry at"
-					" index %" PRIu32 ".", i);
-			memset(&flowtable->entries[i], 0,
-			        sizeof(openflow_flowtable_entry_type));
-			time(&flowtable->entries[i].added);
-			return openflow_flowtable_modify_entry_at_index(flow_mod, i,
-			        error_type, error_code, 1);
+		verbose(2, "[openflow_flowtable_add]:: Adding flowtable entry at"
+				" index %" PRIu32 " in table %" PRIu8 ".", i, table_id);
+		memset(&flowtable->entries[i], 0,
+		        sizeof(openflow_flowtable_entry_type));
+		flowtable->entries[i].table_id = table_id;
+		flowtable->entries[i].added = clockSeconds();
+		if (openflow_flowtable_modify_entry_at_index(flow_mod, i, error_type,
+		        error_code, 1) < 0)
+		{
+			return -1;
 		}
+		flowtable->num_free--;
+		table->num_entries++;
+		table->stats.active_count = htonl(table->num_entries);
+		return 0;
 	}
 
-	verbose(2, "[openflow_flowtable_add]:: No room in flowtable to add entry.");
+	verbose(2, "[openflow_flowtable_add]:: No room in table %" PRIu8 " to add"
+			" entry.", table_id);
 	*error_type = htons(OFPET_FLOW_MOD_FAILED);
 	*error_code = htons(OFPFMFC_ALL_TABLES_FULL);
 	return -1;
 }
 
 /**
- * Modifies the specified entry in the flowtable.
+ * Modifies the specified entry in the specified table.
  *
  * @param flow_mod   The struct containing the entry to edit in the flowtable.
+ * @param table_id   The table of the entry.
  * @param error_type A pointer to an error type variable that will be
  *                   populated (in network byte order) if an error occurs.
  * @param error_code A pointer to an error code variable that will be
@@ -1446,48 +2472,38 @@ static int32_t openflow_flowtable_add(ofp_flow_mod* flow_mod,
  * @return 0 if no error occurred, -1 otherwise.
  */
 static int32_t openflow_flowtable_edit(ofp_flow_mod *flow_mod,
-        uint16_t *error_type, uint16_t *error_code)
+        uint8_t table_id, uint16_t *error_type, uint16_t *error_code)
 {
-	uint32_t i;
-	uint32_t start_index = 0;
+	uint32_t i, n;
 
-	uint8_t found_match = 0;
-	while (start_index < OPENFLOW_MAX_FLOWTABLE_ENTRIES)
+	n = openflow_flowtable_find_matching_entries(&flow_mod->match, OFPP_NONE,
+	        table_id);
+	if (n == 0)
 	{
-		if (openflow_flowtable_find_matching_entry(&flow_mod->match, &i,
-		        start_index, OFPP_NONE))
-		{
-			verbose(2, "[openflow_flowtable_edit]:: Editing flowtable entry at"
-					" index %" PRIu32 ".", i);
-			int32_t ret = openflow_flowtable_modify_entry_at_index(flow_mod, i,
-			        error_type, error_code, 0);
-			if (ret < 0)
-			{
-				return ret;
-			}
-			start_index = i + 1;
-			found_match = 1;
-		}
-		else
-		{
-			break;
-		}
+		return openflow_flowtable_add(flow_mod, table_id, error_type,
+		        error_code);
 	}
 
-	if (!found_match)
-	{
-		return openflow_flowtable_add(flow_mod, error_type, error_code);
-	}
-	else
+	for (i = 0; i < n; i++)
 	{
-		return 0;
+		verbose(2, "[openflow_flowtable_edit]:: Editing flowtable entry at"
+				" index %" PRIu32 ".", matching_indexes[i]);
+		int32_t ret = openflow_flowtable_modify_entry_at_index(flow_mod,
+		        matching_indexes[i], error_type, error_code, 0);
+		if (ret < 0)
+		{
+			return ret;
+		}
 	}
+
+	return 0;
 }
 
 /**
- * Strictly modifies the specified entry in the flowtable.
+ * Strictly modifies the specified entry in the specified table.
  *
  * @param flow_mod   The struct containing the entry to edit in the flowtable.
+ * @param table_id   The table of the entry.
  * @param error_type A pointer to an error type variable that will be
  *                   populated (in network byte order) if an error occurs.
  * @param error_code A pointer to an error code variable that will be
@@ -1496,11 +2512,11 @@ static int32_t openflow_flowtable_edit(ofp_flow_mod *flow_mod,
  * @return 0 if no error occurred, -1 otherwise.
  */
 static int32_t openflow_flowtable_edit_strict(ofp_flow_mod *flow_mod,
-        uint16_t *error_type, uint16_t *error_code)
+        uint8_t table_id, uint16_t *error_type, uint16_t *error_code)
 {
 	uint32_t i;
 
-	if (openflow_flowtable_find_identical_entry(flow_mod, &i))
+	if (openflow_flowtable_find_identical_entry(flow_mod, table_id, &i))
 	{
 		verbose(2, "[openflow_flowtable_edit_strict]:: Editing flowtable entry"
 				" at index %" PRIu32 ".", i);
@@ -1508,13 +2524,14 @@ static int32_t openflow_flowtable_edit_strict(ofp_flow_mod *flow_mod,
 		        error_code, 0);
 	}
 
-	return openflow_flowtable_add(flow_mod, error_type, error_code);
+	return openflow_flowtable_add(flow_mod, table_id, error_type, error_code);
 }
 
 /**
- * Deletes the specified entry or entries in the flowtable.
+ * Deletes the specified entry or entries in the specified table.
  *
  * @param flow_mod   The struct containing the entry to edit in the flowtable.
+ * @param table_id   The table of the entries, or OPENFLOW_TABLE_ALL.
  * @param error_type A pointer to an error type variable that will be
  *                   populated (in network byte order) if an error occurs.
  * @param error_code A pointer to an error code variable that will be
@@ -1523,35 +2540,28 @@ static int32_t openflow_flowtable_edit_strict(ofp_flow_mod *flow_mod,
  * @return 0 if no error occurred, -1 otherwise.
  */
 static int32_t openflow_flowtable_delete(ofp_flow_mod *flow_mod,
-        uint16_t *error_type, uint16_t *error_code)
+        uint8_t table_id, uint16_t *error_type, uint16_t *error_code)
 {
-	uint32_t i;
-	uint32_t start_index = 0;
+	uint32_t i, n;
 
-	uint8_t found_match = 0;
-	while (start_index < OPENFLOW_MAX_FLOWTABLE_ENTRIES)
+	n = openflow_flowtable_find_matching_entries(&flow_mod->match,
+	        ntohs(flow_mod->out_port), table_id);
+	for (i = 0; i < n; i++)
 	{
-		if (openflow_flowtable_find_matching_entry(&flow_mod->match, &i,
-		        start_index, ntohs(flow_mod->out_port)))
-		{
-			verbose(2, "[openflow_flowtable_delete]:: Deleting flowtable entry"
-					" at index %" PRIu32 ".", i);
-			openflow_flowtable_delete_entry_at_index(i, OFPRR_DELETE);
-			start_index = i + 1;
-		}
-		else
-		{
-			break;
-		}
+		verbose(2, "[openflow_flowtable_delete]:: Deleting flowtable entry"
+				" at index %" PRIu32 ".", matching_indexes[i]);
+		openflow_flowtable_delete_entry_at_index(matching_indexes[i],
+		        OFPRR_DELETE);
 	}
 
 	return 0;
 }
 
 /**
- * Strictly deletes the specified entry or entries in the flowtable.
+ * Strictly deletes the specified entry or entries in the specified table.
  *
  * @param flow_mod   The struct containing the entry to edit in the flowtable.
+ * @param table_id   The table of the entry, or OPENFLOW_TABLE_ALL.
  * @param error_type A pointer to an error type variable that will be
  *                   populated (in network byte order) if an error occurs.
  * @param error_code A pointer to an error code variable that will be
@@ -1560,15 +2570,19 @@ static int32_t openflow_flowtable_delete(ofp_flow_mod *flow_mod,
  * @return 0 if no error occurred, -1 otherwise.
  */
 static int32_t openflow_flowtable_delete_strict(ofp_flow_mod *flow_mod,
-        uint16_t *error_type, uint16_t *error_code)
+        uint8_t table_id, uint16_t *error_type, uint16_t *error_code)
 {
-	uint32_t i;
+	uint32_t i, t;
 
-	if (openflow_flowtable_find_identical_entry(flow_mod, &i))
+	for (t = 0; t < OPENFLOW_NUM_TABLES; t++)
 	{
-		verbose(2, "[openflow_flowtable_delete_strict]:: Deleting flowtable"
-				" entry at index %" PRIu32 ".", i);
-		openflow_flowtable_delete_entry_at_index(i, OFPRR_DELETE);
+		if (table_id != OPENFLOW_TABLE_ALL && t != table_id) continue;
+		if (openflow_flowtable_find_identical_entry(flow_mod, t, &i))
+		{
+			verbose(2, "[openflow_flowtable_delete_strict]:: Deleting"
+					" flowtable entry at index %" PRIu32 ".", i);
+			openflow_flowtable_delete_entry_at_index(i, OFPRR_DELETE);
+		}
 	}
 
 	return 0;
@@ -1578,6 +2592,8 @@ static int32_t openflow_flowtable_delete_strict(ofp_flow_mod *flow_mod,
  * Applies the specified modification to the flowtable.
  *
  * @param modify_info The modification to apply to the flowtable.
+ * @param table_id    The table to apply it to. OPENFLOW_TABLE_ALL deletes
+ *                    from every table and adds to the first one.
  * @param error_type  A pointer to an error type variable that will be
  *                    populated (in network byte order) if an error occurs.
  * @param error_code  A pointer to an error code variable that will be
@@ -1585,44 +2601,62 @@ static int32_t openflow_flowtable_delete_strict(ofp_flow_mod *flow_mod,
  *
  * @return 0 if no error occurred, -1 otherwise.
  */
-int32_t openflow_flowtable_modify(ofp_flow_mod *flow_mod, uint16_t *error_type,
-        uint16_t *error_code)
+int32_t openflow_flowtable_modify(ofp_flow_mod *flow_mod, uint8_t table_id,
+        uint16_t *error_type, uint16_t *error_code)
 {
+	uint16_t command = ntohs(flow_mod->command);
+	if (table_id == OPENFLOW_TABLE_ALL && command != OFPFC_DELETE
+	        && command != OFPFC_DELETE_STRICT)
+	{
+		table_id = 0;
+	}
+	if (table_id >= OPENFLOW_NUM_TABLES && table_id != OPENFLOW_TABLE_ALL)
+	{
+		verbose(2, "[openflow_flowtable_modify]:: Table %" PRIu8 " does not"
+				" exist.", table_id);
+		*error_type = htons(OFPET_FLOW_MOD_FAILED);
+		*error_code = htons(OFPFMFC_BAD_COMMAND);
+		return -1;
+	}
+
 	pthread_mutex_lock(&flowtable_mutex);
+	openflow_flowtable_write_begin();
 
-	uint16_t command = ntohs(flow_mod->command);
 	int32_t status;
 	if (command == OFPFC_ADD)
 	{
 		verbose(2, "[openflow_flowtable_modify]:: Modify command is"
 				" OFPFC_ADD.");
-		status = openflow_flowtable_add(flow_mod, error_type, error_code);
+		status = openflow_flowtable_add(flow_mod, table_id, error_type,
+		        error_code);
 	}
 	else if (command == OFPFC_MODIFY)
 	{
 		verbose(2, "[openflow_flowtable_modify]:: Modify command is"
 				" OFPFC_MODIFY.");
-		status = openflow_flowtable_edit(flow_mod, error_type, error_code);
+		status = openflow_flowtable_edit(flow_mod, table_id, error_type,
+		        error_code);
 	}
 	else if (command == OFPFC_MODIFY_STRICT)
 	{
 		verbose(2, "[openflow_flowtable_modify]:: Modify command is"
 				" OFPFC_MODIFY_STRICT.");
-		status = openflow_flowtable_edit_strict(flow_mod, error_type,
-		        error_code);
+		status = openflow_flowtable_edit_strict(flow_mod, table_id,
+		        error_type, error_code);
 	}
 	else if (command == OFPFC_DELETE)
 	{
 		verbose(2, "[openflow_flowtable_modify]:: Modify command is"
 				" OFPFC_DELETE.");
-		status = openflow_flowtable_delete(flow_mod, error_type, error_code);
+		status = openflow_flowtable_delete(flow_mod, table_id, error_type,
+		        error_code);
 	}
 	else if (command == OFPFC_DELETE_STRICT)
 	{
 		verbose(2, "[openflow_flowtable_modify]:: Modify command is"
 				" OFPFC_DELETE_STRICT.");
-		status = openflow_flowtable_delete_strict(flow_mod, error_type,
-		        error_code);
+		status = openflow_flowtable_delete_strict(flow_mod, table_id,
+		        error_type, error_code);
 	}
 	else
 	{
@@ -1633,96 +2667,178 @@ int32_t openflow_flowtable_modify(ofp_flow_mod *flow_mod, uint16_t *error_type,
 		status = -1;
 	}
 
+	openflow_flowtable_write_end();
 	pthread_mutex_unlock(&flowtable_mutex);
+	openflow_flowtable_send_flow_removed();
 	return status;
 }
 
 /**
- * Updates the duration statistics for the specified entry.
- *
- * @param index The index of the entry to update.
+ * Holds off flow expiry while a stats reply is read from the flowtable a
+ * part at a time, so that entries do not disappear between the parts.
+ * Entries that time out in the meantime expire once it ends.
  */
-static void openflow_flowtable_update_entry_stats(uint32_t index)
+void openflow_flowtable_stats_begin(void)
 {
-	time_t now;
-	time(&now);
+	pthread_mutex_lock(&flowtable_mutex);
+	flowtable_stats_readers++;
+	pthread_mutex_unlock(&flowtable_mutex);
+}
 
-	double duration = difftime(now, flowtable->entries[index].added);
-	flowtable->entries[index].stats.duration_sec = htonl((uint32_t) duration);
-	flowtable->entries[index].stats.duration_nsec = 0;
+/**
+ * Ends what openflow_flowtable_stats_begin started.
+ */
+void openflow_flowtable_stats_end(void)
+{
+	pthread_mutex_lock(&flowtable_mutex);
+	if (flowtable_stats_readers > 0) flowtable_stats_readers--;
+	pthread_mutex_unlock(&flowtable_mutex);
 }
 
 /**
- * Retrieves the flow statistics for the first matching flow.
+ * Writes the flow statistics of the entries that match the specified match,
+ * each followed by its actions, as the body of a flow stats reply. Reading
+ * starts at the entry the cursor points to and stops when the next entry
+ * does not fit in the buffer or OPENFLOW_FLOWTABLE_STATS_BATCH entries have
+ * been looked at, so the mutex is only held for a short time.
  *
- * This function returns dynamically allocated memory referenced by
- * ptr_to_flow_stats and ptr_to_actions which must be manually free.
+ * @param match    A pointer to the match to match entries against.
+ * @param out_port The output port which entries are required to have an
+ *                 action for to be matched, in network byte order.
+ * @param table_id The table to read from, or OPENFLOW_TABLE_ALL.
+ * @param cursor   A pointer to the index to start reading at, 0 for the first
+ *                 part. It is advanced past the entries read, and set to
+ *                 OPENFLOW_FLOWTABLE_NIL once every entry has been read.
+ * @param buf      The buffer to write to.
+ * @param len      The length of the buffer in bytes.
  *
- * @param match             A pointer to the match to match entries against.
- *                          The flow statistics for the first matching entry
- *                          will be returned.
- * @param out_port          The output port which entries are required to have
- *                          an action for to be matched, in network byte order.
- * @param index             The index at which to begin searching the
- *                          flowtable.
- * @param match_index       A pointer to a variable used to store the index of
- *                          the matching entry, if any.
- * @param table_index       The index of the table to read from.
- * @param ptr_to_flow_stats A pointer to an ofp_flow_stats struct pointer. The
- *                          inner pointer will be replaced by a pointer to the
- *                          matching ofp_flow_stats struct if one is found.
- * @param ptr_to_actions    A pointer to an openflow_flowtable_action_type
- *                          struct pointer. The inner pointer will be replaced
- *                          by a pointer to the matching
- *                          openflow_flowtable_action_type struct if one is
- *                          found.
- *
- * @return 1 if a match is found, 0 otherwise.
+ * @return The number of bytes written, which may be 0 even if the cursor
+ *         did not reach the end.
  */
-int32_t openflow_flowtable_get_entry_stats(ofp_match *match, uint16_t out_port,
-        uint32_t index, uint32_t *match_index, uint8_t table_index,
-        ofp_flow_stats **ptr_to_flow_stats,
-        openflow_flowtable_action_type **ptr_to_actions)
+uint32_t openflow_flowtable_get_flow_stats(ofp_match *match,
+        uint16_t out_port, uint8_t table_id, uint32_t *cursor, uint8_t *buf,
+        uint32_t len)
 {
-	if (table_index != 0 && table_index != 255) return 0;
+	uint32_t index, written = 0;
 
-	pthread_mutex_lock(&flowtable_mutex);
+	if (table_id >= OPENFLOW_NUM_TABLES && table_id != OPENFLOW_TABLE_ALL)
+	{
+		*cursor = OPENFLOW_FLOWTABLE_NIL;
+		return 0;
+	}
 
-	if (openflow_flowtable_find_matching_entry(match, match_index, index,
-	        ntohs(out_port)))
+	pthread_mutex_lock(&flowtable_mutex);
+	uint32_t end = *cursor + OPENFLOW_FLOWTABLE_STATS_BATCH;
+	while (*cursor < flowtable->max_entries)
 	{
-		verbose(2, "[openflow_flowtable_get_flow_stats]:: Retrieving"
-				" flow statistics for entry at index %" PRIu32 ".",
-		        *match_index);
+		if (!openflow_flowtable_find_matching_entry(match, &index, *cursor,
+		        end, ntohs(out_port), table_id))
+		{
+			*cursor = end;
+			break;
+		}
+
+		openflow_flowtable_entry_type *entry = &flowtable->entries[index];
+		uint32_t i, length = sizeof(ofp_flow_stats);
+		for (i = 0; i < OPENFLOW_MAX_ACTIONS; i++)
+		{
+			if (entry->actions[i].active)
+			{
+				length += ntohs(entry->actions[i].header.len);
+			}
+		}
+		if (written + length > len)
+		{
+			*cursor = index;
+			pthread_mutex_unlock(&flowtable_mutex);
+			return written;
+		}
 
-		openflow_flowtable_update_entry_stats(*match_index);
-		*ptr_to_flow_stats = malloc(sizeof(ofp_flow_stats));
-		memcpy(*ptr_to_flow_stats, &flowtable->entries[*match_index].stats,
-		        sizeof(ofp_flow_stats));
+		openflow_flowtable_update_entry_stats(index);
+		ofp_flow_stats *stats = (ofp_flow_stats *) (buf + written);
+		memcpy(stats, &entry->stats, sizeof(ofp_flow_stats));
+		stats->length = htons(length);
+		written += sizeof(ofp_flow_stats);
+		for (i = 0; i < OPENFLOW_MAX_ACTIONS; i++)
+		{
+			if (entry->actions[i].active)
+			{
+				uint16_t action_len = ntohs(entry->actions[i].header.len);
+				memcpy(buf + written, &entry->actions[i].header, action_len);
+				written += action_len;
+			}
+		}
+		*cursor = index + 1;
+	}
+
+	if (*cursor >= flowtable->max_entries) *cursor = OPENFLOW_FLOWTABLE_NIL;
+	pthread_mutex_unlock(&flowtable_mutex);
+	return written;
+}
 
-		*ptr_to_actions = malloc(sizeof(openflow_flowtable_action_type));
-		memcpy(*ptr_to_actions, &flowtable->entries[*match_index].actions,
-		        sizeof(openflow_flowtable_action_type));
+/**
+ * Adds the statistics of the entries that match the specified match to an
+ * aggregate stats reply, reading at most OPENFLOW_FLOWTABLE_STATS_BATCH
+ * entries starting at the entry the cursor points to.
+ *
+ * @param match    A pointer to the match to match entries against.
+ * @param out_port The output port which entries are required to have an
+ *                 action for to be matched, in network byte order.
+ * @param table_id The table to read from, or OPENFLOW_TABLE_ALL.
+ * @param cursor   A pointer to the index to start reading at, 0 for the first
+ *                 part. It is advanced past the entries read, and set to
+ *                 OPENFLOW_FLOWTABLE_NIL once every entry has been read.
+ * @param body     The aggregate stats to add to, in host byte order.
+ */
+void openflow_flowtable_get_aggregate_stats(ofp_match *match,
+        uint16_t out_port, uint8_t table_id, uint32_t *cursor,
+        ofp_aggregate_stats_reply *body)
+{
+	uint32_t index;
 
-		pthread_mutex_unlock(&flowtable_mutex);
-		return 1;
+	if (table_id >= OPENFLOW_NUM_TABLES && table_id != OPENFLOW_TABLE_ALL)
+	{
+		*cursor = OPENFLOW_FLOWTABLE_NIL;
+		return;
 	}
 
+	pthread_mutex_lock(&flowtable_mutex);
+	uint32_t end = *cursor + OPENFLOW_FLOWTABLE_STATS_BATCH;
+	while (openflow_flowtable_find_matching_entry(match, &index, *cursor, end,
+	        ntohs(out_port), table_id))
+	{
+		uint64_t packet_count, byte_count;
+		time_t last_matched;
+		openflow_flowtable_sum_counters(index, &packet_count, &byte_count,
+		        &last_matched);
+		body->packet_count += packet_count;
+		body->byte_count += byte_count;
+		body->flow_count++;
+		*cursor = index + 1;
+	}
+	*cursor = end < flowtable->max_entries ? end : OPENFLOW_FLOWTABLE_NIL;
 	pthread_mutex_unlock(&flowtable_mutex);
-	return 0;
 }
 
 /**
- * Gets the standard table statistics for the OpenFlow flowtable.
+ * Gets the standard table statistics for the specified table.
+ *
+ * @param table_id The table, below OPENFLOW_NUM_TABLES.
  *
- * @return The standard table statistics for the OpenFlow flowtable.
+ * @return The standard table statistics for the table.
  */
-ofp_table_stats openflow_flowtable_get_table_stats()
+ofp_table_stats openflow_flowtable_get_table_stats(uint8_t table_id)
 {
+	ofp_table_stats stats;
+
+	memset(&stats, 0, sizeof(ofp_table_stats));
+	if (table_id >= OPENFLOW_NUM_TABLES) return stats;
+
 	pthread_mutex_lock(&flowtable_mutex);
-	ofp_table_stats *stats = &flowtable->stats;
+	openflow_flowtable_update_table_stats();
+	stats = flowtable->tables[table_id].stats;
 	pthread_mutex_unlock(&flowtable_mutex);
-	return *stats;
+	return stats;
 }
 
 /**
@@ -2098,6 +3214,12 @@ static void openflow_flowtable_print_action(ofp_action_header *action)
 		printf("\t\tTCP/UDP destination port or ICMP code: %" PRIu16 "\n",
 		        ntohs(((ofp_action_tp_port *) action)->tp_port));
 	}
+	else if (ntohs(action->type) == OFPAT_VENDOR)
+	{
+		printf("\t\tType: Goto table\n");
+		printf("\t\tTable: %" PRIu8 "\n",
+		        ((openflow_nx_action_resubmit_type *) action)->table);
+	}
 	else
 	{
 		printf("\t\tType: %" PRIu16 "\n", ntohs(action->type));
@@ -2119,9 +3241,16 @@ static void openflow_flowtable_print_entry_no_lock(uint32_t index)
 	printf("=========\n");
 	printf("\n");
 
+	if (flowtable->entries[index].active)
+	{
+		openflow_flowtable_update_entry_stats(index);
+	}
+
 	openflow_flowtable_entry_type entry = flowtable->entries[index];
 	if (entry.active)
 	{
+		printf("Table: %" PRIu8 "\n", entry.table_id);
+
 		printf("Match:\n");
 		openflow_flowtable_print_match(&entry.match);
 
@@ -2142,7 +3271,7 @@ static void openflow_flowtable_print_entry_no_lock(uint32_t index)
 		printf("Last modified timeout (seconds): %" PRIu16 "\n",
 		        ntohs(entry.hard_timeout));
 
-		printf("Priority: %" PRIu32 "\n", ntohs(entry.hard_timeout));
+		printf("Priority: %" PRIu16 "\n", openflow_flowtable_priority(&entry));
 
 		printf("Entry flags: %" PRIu16 "\n", ntohs(entry.flags));
 		if (ntohs(entry.flags) & OFPFF_SEND_FLOW_REM)
@@ -2179,19 +3308,29 @@ static void openflow_flowtable_print_entry_no_lock(uint32_t index)
 void openflow_flowtable_print_entry(uint32_t index)
 {
 	pthread_mutex_lock(&flowtable_mutex);
-	openflow_flowtable_print_entry_no_lock(index);
+	if (index >= flowtable->max_entries)
+	{
+		printf("Entry index invalid\n");
+	}
+	else
+	{
+		openflow_flowtable_print_entry_no_lock(index);
+	}
 	pthread_mutex_unlock(&flowtable_mutex);
 }
 
 /**
- * Prints the OpenFlow flowtable entries to the CLI.
+ * Prints the active OpenFlow flowtable entries to the CLI.
  */
 void openflow_flowtable_print_entries()
 {
 	uint32_t i;
-	for (i = 0; i < OPENFLOW_MAX_FLOWTABLE_ENTRIES; i++)
+	for (i = 0; i < flowtable->max_entries; i++)
 	{
-		openflow_flowtable_print_entry(i);
+		if (flowtable->entries[i].active)
+		{
+			openflow_flowtable_print_entry(i);
+		}
 	}
 }
 
@@ -2204,7 +3343,7 @@ void openflow_flowtable_print_entry_stat(uint32_t index)
 {
 	pthread_mutex_lock(&flowtable_mutex);
 
-	if (index < 0 || index >= OPENFLOW_MAX_FLOWTABLE_ENTRIES)
+	if (index < 0 || index >= flowtable->max_entries)
 	{
 		printf("Entry index invalid\n");
 		pthread_mutex_unlock(&flowtable_mutex);
@@ -2249,140 +3388,237 @@ void openflow_flowtable_print_entry_stat(uint32_t index)
 }
 
 /**
- * Prints the statistics for all entries in the flowtable.
+ * Prints the statistics for all active entries in the flowtable.
  */
 void openflow_flowtable_print_entry_stats()
 {
 	uint32_t i;
-	for (i = 0; i < OPENFLOW_MAX_FLOWTABLE_ENTRIES; i++)
+	for (i = 0; i < flowtable->max_entries; i++)
 	{
-		openflow_flowtable_print_entry_stat(i);
+		if (flowtable->entries[i].active)
+		{
+			openflow_flowtable_print_entry_stat(i);
+		}
 	}
 }
 
 /**
- * Prints the statistics for the flowtable.
+ * Prints the statistics for the specified table.
  */
-void openflow_flowtable_print_table_stats()
+static void openflow_flowtable_print_table_stat(uint8_t table_id)
 {
-	pthread_mutex_lock(&flowtable_mutex);
+	ofp_table_stats *stats = &flowtable->tables[table_id].stats;
+
 	printf("\n");
 	printf("=========\n");
-	printf("Table %d\n", flowtable->stats.table_id);
+	printf("Table %d\n", stats->table_id);
 	printf("=========\n");
 	printf("\n");
 
-	printf("Name: %s\n", flowtable->stats.name);
+	printf("Name: %s\n", stats->name);
 
-	if (ntohl(flowtable->stats.wildcards) == OFPFW_ALL)
+	if (ntohl(stats->wildcards) == OFPFW_ALL)
 	{
 		printf("Wildcards: All fields\n");
 	}
 	else
 	{
 		printf("Wildcards:\n");
-		if (ntohl(flowtable->stats.wildcards) & OFPFW_IN_PORT)
+		if (ntohl(stats->wildcards) & OFPFW_IN_PORT)
 		{
 			printf("\tInput port\n");
 		}
-		if (ntohl(flowtable->stats.wildcards) & OFPFW_DL_SRC)
+		if (ntohl(stats->wildcards) & OFPFW_DL_SRC)
 		{
 			printf("\tEthernet source MAC address\n");
 		}
-		if (ntohl(flowtable->stats.wildcards) & OFPFW_DL_DST)
+		if (ntohl(stats->wildcards) & OFPFW_DL_DST)
 		{
 			printf("\tEthernet destination MAC address\n");
 		}
-		if (ntohl(flowtable->stats.wildcards) & OFPFW_DL_VLAN)
+		if (ntohl(stats->wildcards) & OFPFW_DL_VLAN)
 		{
 			printf("\tEthernet VLAN ID\n");
 		}
-		if ((ntohl(flowtable->stats.wildcards) & OFPFW_DL_VLAN_PCP))
+		if ((ntohl(stats->wildcards) & OFPFW_DL_VLAN_PCP))
 		{
 			printf("\tEthernet VLAN priority\n");
 		}
-		if (ntohl(flowtable->stats.wildcards) & OFPFW_DL_TYPE)
+		if (ntohl(stats->wildcards) & OFPFW_DL_TYPE)
 		{
 			printf("\tEthernet frame type\n");
 		}
-		if (ntohl(flowtable->stats.wildcards) & OFPFW_NW_TOS)
+		if (ntohl(stats->wildcards) & OFPFW_NW_TOS)
 		{
 			printf("\t\tIP type of service\n");
 		}
-		if (ntohl(flowtable->stats.wildcards) & OFPFW_NW_PROTO)
+		if (ntohl(stats->wildcards) & OFPFW_NW_PROTO)
 		{
 			printf("\t\tIP protocol or ARP opcode\n");
 		}
-		if (ntohl(flowtable->stats.wildcards) & OFPFW_TP_SRC)
+		if (ntohl(stats->wildcards) & OFPFW_TP_SRC)
 		{
 			printf("\t\tTCP/UDP source port or ICMP type\n");
 		}
-		if (ntohl(flowtable->stats.wildcards) & OFPFW_TP_DST)
+		if (ntohl(stats->wildcards) & OFPFW_TP_DST)
 		{
 			printf("\t\tTCP/UDP destination port or ICMP code\n");
 		}
 	}
 
 	printf("Maximum number of supported entries: %" PRIu32 "\n",
-	        ntohl(flowtable->stats.max_entries));
+	        ntohl(stats->max_entries));
 	printf("Number of active entries: %" PRIu32 "\n",
-	        ntohl(flowtable->stats.active_count));
+	        ntohl(stats->active_count));
 	printf("Number of packets looked up in tables: %" PRIu64 "\n",
-	        ntohll(flowtable->stats.lookup_count));
+	        ntohll(stats->lookup_count));
 	printf("Number of packets that hit table: %" PRIu64 "\n",
-	        ntohll(flowtable->stats.matched_count));
+	        ntohll(stats->matched_count));
+}
+
+/**
+ * Prints the statistics for every table of the flowtable.
+ */
+void openflow_flowtable_print_table_stats()
+{
+	uint32_t i;
 
+	pthread_mutex_lock(&flowtable_mutex);
+	openflow_flowtable_update_table_stats();
+	for (i = 0; i < OPENFLOW_NUM_TABLES; i++)
+	{
+		openflow_flowtable_print_table_stat(i);
+	}
 	pthread_mutex_unlock(&flowtable_mutex);
 }
 
 /**
- * OpenFlow timeout thread.
+ * Checks the entry at the specified index, whose timer went off at the
+ * specified time: deletes it if it has expired, otherwise puts it back on
+ * the timer wheel.
+ *
+ * @param index   The index of the entry.
+ * @param now     The time the timer went off.
+ * @param writing Set to 1 once lookups have been stopped for a deletion.
  */
-static void openflow_flowtable_timeout()
+static void openflow_flowtable_timer_expire(uint32_t index, time_t now,
+        uint8_t *writing)
 {
-	while (1)
+	openflow_flowtable_entry_type *entry = &flowtable->entries[index];
+	uint16_t idle_timeout = ntohs(entry->idle_timeout);
+	uint16_t hard_timeout = ntohs(entry->hard_timeout);
+	uint8_t reason;
+
+	entry->expires = 0;
+	if (idle_timeout != 0)
 	{
-		pthread_mutex_lock(&flowtable_mutex);
+		openflow_flowtable_update_entry_stats(index);
+	}
 
-		uint32_t i;
-		for (i = 0; i < OPENFLOW_MAX_FLOWTABLE_ENTRIES; i++)
+	if (idle_timeout != 0 && entry->last_matched + idle_timeout <= now)
+	{
+		verbose(2, "[openflow_flowtable_timer_expire]:: Entry %" PRIu32
+				" idle timeout.", index);
+		reason = OFPRR_IDLE_TIMEOUT;
+	}
+	else if (hard_timeout != 0 && entry->last_modified + hard_timeout <= now)
+	{
+		verbose(2, "[openflow_flowtable_timer_expire]:: Entry %" PRIu32
+				" hard timeout.", index);
+		reason = OFPRR_HARD_TIMEOUT;
+	}
+	else
+	{
+		openflow_flowtable_timer_schedule(index);
+		return;
+	}
+
+	// Lookups only have to stop if something expires
+	if (!*writing)
+	{
+		openflow_flowtable_write_begin();
+		*writing = 1;
+	}
+	openflow_flowtable_delete_entry_at_index(index, reason);
+}
+
+/**
+ * Runs the timer wheel up to the specified time. Only the entries whose
+ * timers go off are looked at, so this costs nothing for the entries that
+ * do not expire yet.
+ */
+static void openflow_flowtable_timer_run(time_t now)
+{
+	uint8_t writing = 0;
+	uint32_t index, next;
+
+	while (flowtable->timer_now < now)
+	{
+		time_t tick = ++flowtable->timer_now;
+		uint32_t slot = tick & (OPENFLOW_TIMER_WHEEL_SLOTS - 1);
+
+		// At the start of each turn of the first level, the entries of the
+		// next second-level slot move down to the first level
+		if (slot == 0)
 		{
-			if (flowtable->entries[i].active)
+			uint32_t upper = OPENFLOW_TIMER_WHEEL_SLOTS
+			        + ((tick >> OPENFLOW_TIMER_WHEEL_BITS)
+			                & (OPENFLOW_TIMER_WHEEL_SLOTS - 1));
+			index = flowtable->timer_slots[upper];
+			flowtable->timer_slots[upper] = OPENFLOW_FLOWTABLE_NIL;
+			for (; index != OPENFLOW_FLOWTABLE_NIL; index = next)
 			{
-				time_t now;
-				time(&now);
-
-				double idle_diff = difftime(now,
-				        flowtable->entries[i].last_matched);
-				if (flowtable->entries[i].idle_timeout != 0)
+				next = flowtable->entries[index].timer_next;
+				if (flowtable->entries[index].expires <= tick)
 				{
-					if (idle_diff > ntohs(flowtable->entries[i].idle_timeout))
-					{
-						verbose(2, "[openflow_flowtable_timeout]:: Entry"
-								" %d idle timeout.", i);
-						openflow_flowtable_delete_entry_at_index(i,
-								OFPRR_IDLE_TIMEOUT);
-						continue;
-					}
+					openflow_flowtable_timer_expire(index, tick, &writing);
 				}
-
-				double hard_diff = difftime(now,
-				        flowtable->entries[i].last_modified);
-				if (flowtable->entries[i].hard_timeout != 0)
+				else
 				{
-					if (hard_diff > htons(flowtable->entries[i].hard_timeout))
-					{
-						verbose(2, "[openflow_flowtable_timeout]:: Entry"
-								" %d hard timeout.", i);
-						openflow_flowtable_delete_entry_at_index(i,
-								OFPRR_HARD_TIMEOUT);
-						continue;
-					}
+					openflow_flowtable_timer_insert(index);
 				}
 			}
 		}
 
-		pthread_mutex_unlock(&flowtable_mutex);
+		index = flowtable->timer_slots[slot];
+		flowtable->timer_slots[slot] = OPENFLOW_FLOWTABLE_NIL;
+		for (; index != OPENFLOW_FLOWTABLE_NIL; index = next)
+		{
+			next = flowtable->entries[index].timer_next;
+			openflow_flowtable_timer_expire(index, tick, &writing);
+		}
+	}
+
+	if (writing) openflow_flowtable_write_end();
+}
+
+/**
+ * Removes the entries whose timeouts have gone off by the specified time
+ * and sends the flow removed messages for them. Nothing expires while a
+ * stats reply is being read.
+ *
+ * @param now The current time in seconds.
+ */
+void openflow_flowtable_expire(time_t now)
+{
+	pthread_mutex_lock(&flowtable_mutex);
+	if (flowtable_stats_readers == 0)
+	{
+		openflow_flowtable_timer_run(now);
+	}
+	pthread_mutex_unlock(&flowtable_mutex);
+
+	openflow_flowtable_send_flow_removed();
+}
+
+/**
+ * OpenFlow timeout thread.
+ */
+static void openflow_flowtable_timeout()
+{
+	while (1)
+	{
+		openflow_flowtable_expire(clockSeconds());
 		sleep(1);
 	}
 }
@@ -0,0 +1,283 @@
+/**
+ * openflow_pkt_buffer.c - OpenFlow packet in buffers and rate limiting
+ *
+ * A packet in message only carries the first miss_send_len bytes of the
+ * packet; the rest stays in a buffer that a packet out or flow modification
+ * can release by its buffer ID. Buffers are handed out round robin and all
+ * live for the same time, so the next buffer in line is always the oldest
+ * one and is either free or expired, or every buffer is still in use.
+ *
+ * The low OPENFLOW_PKT_BUFFER_BITS of a buffer ID are the buffer and the
+ * rest counts the packets stored, so an ID is not valid any more once its
+ * buffer has been reused.
+ *
+ * Each port also has a token bucket that limits how many packet in messages
+ * its table misses and controller actions can send, so that a miss storm
+ * does not flood the controller connection.
+ */
+
+#include "openflow_pkt_buffer.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <slack/err.h>
+
+#include "clock.h"
+#include "openflow_config.h"
+#include "openflow_defs.h"
+
+// Packet buffers, protected by the buffer mutex
+static openflow_pkt_buffer_type pkt_buffers[OPENFLOW_PKT_BUFFERS];
+static uint32_t next_buffer = 0;
+static uint32_t buffer_counter = 0;
+static pthread_mutex_t pkt_buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Buffer counters
+static uint64_t buffers_stored = 0;
+static uint64_t buffers_retrieved = 0;
+static uint64_t buffers_expired = 0;
+static uint64_t buffers_full = 0;
+
+// Packet in token buckets, one for each port
+static openflow_packet_in_limiter_type limiters[OPENFLOW_MAX_PHYSICAL_PORTS];
+static volatile uint32_t packet_in_rate = OPENFLOW_PACKET_IN_RATE;
+static volatile uint32_t packet_in_burst = OPENFLOW_PACKET_IN_BURST;
+
+/**
+ * Initializes the packet buffers and the packet in rate limiters.
+ */
+void openflow_pkt_buffer_init()
+{
+	uint32_t i;
+	pthread_mutex_lock(&pkt_buffers_mutex);
+	for (i = 0; i < OPENFLOW_PKT_BUFFERS; i++)
+	{
+		pkt_buffers[i].buffer_id = OPENFLOW_PKT_BUFFER_NONE;
+		pkt_buffers[i].expires = 0;
+	}
+	next_buffer = 0;
+	pthread_mutex_unlock(&pkt_buffers_mutex);
+
+	for (i = 0; i < OPENFLOW_MAX_PHYSICAL_PORTS; i++)
+	{
+		pthread_mutex_init(&limiters[i].mutex, NULL);
+		limiters[i].tokens = packet_in_burst * 1000000000ULL;
+		limiters[i].last_refill = clockNow();
+		limiters[i].sent = 0;
+		limiters[i].suppressed = 0;
+	}
+}
+
+/**
+ * Keeps a copy of the specified packet for the controller.
+ *
+ * @param packet The packet to keep.
+ * @param length The length of the packet data in bytes.
+ *
+ * @return The buffer ID of the copy, or OPENFLOW_PKT_BUFFER_NONE if all
+ *         buffers are in use.
+ */
+uint32_t openflow_pkt_buffer_store(gpacket_t *packet, uint32_t length)
+{
+	uint64_t now = clockNow();
+	if (length > sizeof(pkt_data_t)) length = sizeof(pkt_data_t);
+
+	pthread_mutex_lock(&pkt_buffers_mutex);
+	openflow_pkt_buffer_type *buffer = &pkt_buffers[next_buffer];
+	if (buffer->buffer_id != OPENFLOW_PKT_BUFFER_NONE)
+	{
+		if (now < buffer->expires)
+		{
+			buffers_full++;
+			pthread_mutex_unlock(&pkt_buffers_mutex);
+			verbose(2, "[openflow_pkt_buffer_store]:: All packet buffers in"
+					" use, sending the whole packet.");
+			return OPENFLOW_PKT_BUFFER_NONE;
+		}
+		buffers_expired++;
+	}
+
+	uint32_t buffer_id;
+	do
+	{
+		buffer_id = (++buffer_counter << OPENFLOW_PKT_BUFFER_BITS)
+		        | next_buffer;
+	}
+	while (buffer_id == OPENFLOW_PKT_BUFFER_NONE);
+
+	buffer->buffer_id = buffer_id;
+	buffer->expires = now + OPENFLOW_PKT_BUFFER_TIMEOUT_MS * 1000000ULL;
+	buffer->packet.frame = packet->frame;
+	memcpy(&buffer->packet.data, &packet->data, length);
+	next_buffer = (next_buffer + 1) % OPENFLOW_PKT_BUFFERS;
+	buffers_stored++;
+	pthread_mutex_unlock(&pkt_buffers_mutex);
+
+	return buffer_id;
+}
+
+/**
+ * Takes a packet out of its buffer, which becomes free.
+ *
+ * @param buffer_id The buffer ID in host byte order.
+ * @param packet    A pointer to the packet to fill in.
+ *
+ * @return 0, OPENFLOW_PKT_BUFFER_ERR_EMPTY if the packet was already taken or
+ *         OPENFLOW_PKT_BUFFER_ERR_UNKNOWN if the buffer ID is not valid (any
+ *         more).
+ */
+int32_t openflow_pkt_buffer_retrieve(uint32_t buffer_id, gpacket_t *packet)
+{
+	openflow_pkt_buffer_type *buffer =
+	        &pkt_buffers[buffer_id % OPENFLOW_PKT_BUFFERS];
+
+	pthread_mutex_lock(&pkt_buffers_mutex);
+	if (buffer->buffer_id != buffer_id)
+	{
+		uint8_t empty = buffer->buffer_id == OPENFLOW_PKT_BUFFER_NONE;
+		pthread_mutex_unlock(&pkt_buffers_mutex);
+		verbose(1, "[openflow_pkt_buffer_retrieve]:: Packet buffer %" PRIu32
+				" not found.", buffer_id);
+		return empty ? OPENFLOW_PKT_BUFFER_ERR_EMPTY :
+		        OPENFLOW_PKT_BUFFER_ERR_UNKNOWN;
+	}
+	if (clockNow() >= buffer->expires)
+	{
+		buffer->buffer_id = OPENFLOW_PKT_BUFFER_NONE;
+		buffers_expired++;
+		pthread_mutex_unlock(&pkt_buffers_mutex);
+		verbose(1, "[openflow_pkt_buffer_retrieve]:: Packet buffer %" PRIu32
+				" expired.", buffer_id);
+		return OPENFLOW_PKT_BUFFER_ERR_UNKNOWN;
+	}
+
+	memcpy(packet, &buffer->packet, sizeof(gpacket_t));
+	buffer->buffer_id = OPENFLOW_PKT_BUFFER_NONE;
+	buffers_retrieved++;
+	pthread_mutex_unlock(&pkt_buffers_mutex);
+	return 0;
+}
+
+/**
+ * Takes a packet in token for the specified port, counting the packet in as
+ * suppressed if there is none.
+ *
+ * @param gnet_port_num The GNET port number the packet came in on.
+ *
+ * @return 1 if the packet in may be sent, 0 if not.
+ */
+uint8_t openflow_pkt_buffer_admit(uint16_t gnet_port_num)
+{
+	if (gnet_port_num >= OPENFLOW_MAX_PHYSICAL_PORTS) return 1;
+
+	openflow_packet_in_limiter_type *limiter = &limiters[gnet_port_num];
+	uint64_t rate = packet_in_rate;
+	uint64_t depth = packet_in_burst * 1000000000ULL;
+	uint64_t now = clockNow();
+	uint8_t admit = 1;
+
+	pthread_mutex_lock(&limiter->mutex);
+	if (rate > 0)
+	{
+		// Refilling for longer than it takes to fill the bucket changes
+		// nothing, and this keeps the product from overflowing
+		uint64_t elapsed = now > limiter->last_refill ?
+		        now - limiter->last_refill : 0;
+		if (elapsed > depth / rate) elapsed = depth / rate + 1;
+		limiter->tokens += elapsed * rate;
+		if (limiter->tokens > depth) limiter->tokens = depth;
+
+		if (limiter->tokens >= 1000000000ULL)
+		{
+			limiter->tokens -= 1000000000ULL;
+		}
+		else
+		{
+			admit = 0;
+		}
+	}
+	limiter->last_refill = now;
+	if (admit)
+	{
+		limiter->sent++;
+	}
+	else
+	{
+		limiter->suppressed++;
+	}
+	pthread_mutex_unlock(&limiter->mutex);
+
+	return admit;
+}
+
+/**
+ * Sets the packet in rate limit of every port.
+ *
+ * @param rate  The number of packet in messages per second, or 0 for no
+ *              limit.
+ * @param burst The number of packet in messages that may be sent at once.
+ */
+void openflow_pkt_buffer_set_rate(uint32_t rate, uint32_t burst)
+{
+	packet_in_rate = rate;
+	packet_in_burst = burst;
+
+	uint32_t i;
+	for (i = 0; i < OPENFLOW_MAX_PHYSICAL_PORTS; i++)
+	{
+		pthread_mutex_lock(&limiters[i].mutex);
+		limiters[i].tokens = burst * 1000000000ULL;
+		pthread_mutex_unlock(&limiters[i].mutex);
+	}
+}
+
+/**
+ * Prints the packet buffer and packet in counters to the console.
+ */
+void openflow_pkt_buffer_print_stats()
+{
+	uint64_t now = clockNow();
+	uint32_t i, in_use = 0;
+
+	pthread_mutex_lock(&pkt_buffers_mutex);
+	for (i = 0; i < OPENFLOW_PKT_BUFFERS; i++)
+	{
+		if (pkt_buffers[i].buffer_id != OPENFLOW_PKT_BUFFER_NONE
+		        && now < pkt_buffers[i].expires) in_use++;
+	}
+	printf("\n");
+	printf("Packet buffers: %" PRIu32 " of %" PRIu32 " in use\n", in_use,
+	        OPENFLOW_PKT_BUFFERS);
+	printf("Packets buffered: %" PRIu64 "\n", buffers_stored);
+	printf("Packets released: %" PRIu64 "\n", buffers_retrieved);
+	printf("Buffers expired: %" PRIu64 "\n", buffers_expired);
+	printf("Packets not buffered (all buffers in use): %" PRIu64 "\n",
+	        buffers_full);
+	pthread_mutex_unlock(&pkt_buffers_mutex);
+
+	if (packet_in_rate > 0)
+	{
+		printf("Packet in limit: %" PRIu32 " per second, bursts of %" PRIu32
+		"\n", packet_in_rate, packet_in_burst);
+	}
+	else
+	{
+		printf("Packet in limit: None\n");
+	}
+
+	for (i = 0; i < OPENFLOW_MAX_PHYSICAL_PORTS; i++)
+	{
+		pthread_mutex_lock(&limiters[i].mutex);
+		uint64_t sent = limiters[i].sent;
+		uint64_t suppressed = limiters[i].suppressed;
+		pthread_mutex_unlock(&limiters[i].mutex);
+		if (sent == 0 && suppressed == 0) continue;
+		printf("Port %" PRIu16 ": %" PRIu64 " packet in sent, %" PRIu64
+		" suppressed\n", openflow_config_get_of_port_num(i), sent,
+		        suppressed);
+	}
+	printf("\n");
+}
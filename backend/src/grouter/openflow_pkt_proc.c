@@ -11,14 +11,19 @@
 
 #include "grouter.h"
 #include "ip.h"
+#include "drop.h"
+#include "ethernet.h"
 #include "openflow.h"
 #include "openflow_config.h"
 #include "openflow_flowtable.h"
 #include "openflow_ctrl_iface.h"
+#include "openflow_pkt_buffer.h"
 #include "openflow_pkt_proc.h"
 #include "protocols.h"
 #include "tcp.h"
 #include "udp.h"
+#include "logging.h"
+#include "probes.h"
 
 // GNET packet core
 static pktcore_t *packet_core;
@@ -110,6 +115,7 @@ static int32_t openflow_pkt_proc_send_packet_to_queue(gpacket_t *packet,
 {
 	gpacket_t *new_packet = malloc(sizeof(gpacket_t));
 	memcpy(new_packet, packet, sizeof(gpacket_t));
+	LATENCY_STAMP(new_packet, LAT_OUTQ);
 	int32_t ret = writeQueue(queue, new_packet, sizeof(gpacket_t));
 	if (ret == 1)
 	{
@@ -133,40 +139,11 @@ static int32_t openflow_pkt_proc_send_packet_to_queue(gpacket_t *packet,
 static int32_t openflow_pkt_proc_forward_packet_to_port(gpacket_t *packet,
         uint16_t of_port, uint8_t flood)
 {
-	ofp_phy_port *port = openflow_config_get_phy_port(of_port);
+	// Return if port does not exist, is administratively or physically down
+	// or packet is a flood packet but flooding is disabled for this port
+	if (!openflow_config_port_can_send(of_port, flood)) return 0;
 
-	// Return if port does not exist
-	if (port == NULL) return 0;
-
-	// Return if port is administratively down or packet is a flood packet but
-	// flooding is disabled for this port
-	uint32_t config = ntohl(port->config);
-	if (config & OFPPC_PORT_DOWN)
-	{
-		free(port);
-		return 0;
-	}
-	if (flood && (config & OFPPC_NO_FLOOD))
-	{
-		free(port);
-		return 0;
-	}
-
-	// Return if port is physically down
-	uint32_t state = ntohl(port->state);
-	if (state & OFPPS_LINK_DOWN)
-	{
-		free(port);
-		return 0;
-	}
-
-	free(port);
-
-	ofp_port_stats *stats = openflow_config_get_port_stats(of_port);
-	stats->tx_packets = htonll(ntohll(stats->tx_packets) + 1);
-	stats->tx_bytes = htonll(ntohll(stats->tx_bytes) + sizeof(pkt_data_t));
-	openflow_config_set_port_stats(of_port, stats);
-	free(stats);
+	openflow_config_count_tx(of_port, findPacketSize(&packet->data));
 
 	uint32_t gnet_port_num = openflow_config_get_gnet_port_num(of_port);
 	packet->frame.dst_interface = gnet_port_num;
@@ -181,6 +158,7 @@ void openflow_pkt_proc_init(pktcore_t *core)
 {
 	packet_core = core;
 	openflow_flowtable_init();
+	openflow_pkt_buffer_init();
 }
 
 /**
@@ -195,63 +173,101 @@ int32_t openflow_pkt_proc_handle_packet(gpacket_t *packet)
 	// Update statistics for input port
 	uint16_t of_port = openflow_config_get_of_port_num(
 	        packet->frame.src_interface);
-	ofp_port_stats *stats = openflow_config_get_port_stats(of_port);
-	stats->rx_packets = htonll(ntohll(stats->rx_packets) + 1);
-	stats->rx_bytes = htonll(ntohll(stats->rx_bytes) + sizeof(pkt_data_t));
-	openflow_config_set_port_stats(of_port, stats);
-	free(stats);
+	uint32_t length = findPacketSize(&packet->data);
+	openflow_config_count_rx(of_port, length);
 
-	if (ntohs(packet->data.header.prot) == IP_PROTOCOL)
+	if (packetMeta(packet)->flags & PKT_META_FRAG)
 	{
-		ip_packet_t *ip_packet = (ip_packet_t *) &packet->data.data;
-		if (!(ntohs(ip_packet->ip_frag_off) & 0x1fff)
-		        && !(ntohs(ip_packet->ip_frag_off) & 0x2000))
+		// Fragmented IP packet
+		uint16_t flags = ntohs(openflow_config_get_switch_config_flags());
+		if (flags & OFPC_FRAG_DROP)
 		{
-			// Fragmented IP packet
-			uint16_t flags = ntohs(openflow_config_get_switch_config_flags());
-			if (flags & OFPC_FRAG_DROP)
-			{
-				// Switch configured to drop fragmented IP packets
-				verbose(2, "[openflow_pkt_proc_handle_packet]::"
-						" Dropping fragmented IP packet.");
-				return 0;
-			}
+			// Switch configured to drop fragmented IP packets
+			verbose(2, "[openflow_pkt_proc_handle_packet]::"
+					" Dropping fragmented IP packet.");
+			countDrop(packet, packet->frame.src_interface, DROP_OPENFLOW_FRAG);
+			return 0;
 		}
 	}
 
-	openflow_flowtable_entry_type *matching_entry =
-	        openflow_flowtable_get_entry_for_packet(packet);
-	if (matching_entry != NULL)
+	// Each table ends the pipeline or passes the packet on to a later table,
+	// through a goto table action or its miss behaviour
+	uint8_t table_id = 0;
+	while (1)
 	{
-		verbose(2, "[openflow_pkt_proc_handle_packet]:: Performing actions"
-				" on packet with flowtable match.");
-		uint8_t action_performed = 0;
-		uint32_t i;
-		for (i = 0; i < OPENFLOW_MAX_ACTIONS; i++)
+		// The entry is only valid until it is released
+		const openflow_flowtable_entry_type *matching_entry =
+		        openflow_flowtable_get_entry_for_packet(packet, length,
+		                table_id);
+		if (matching_entry != NULL)
 		{
-			if (matching_entry->actions[i].active)
+			PROBE2(flow_match, packet, matching_entry->priority);
+			verbose(2, "[openflow_pkt_proc_handle_packet]:: Performing actions"
+					" on packet with match in table %" PRIu8 ".", table_id);
+			uint8_t action_performed = 0;
+			uint8_t next_table = 0;
+			uint32_t i;
+			for (i = 0; i < OPENFLOW_MAX_ACTIONS; i++)
 			{
-				int32_t ret = openflow_pkt_proc_perform_action(
-				        &matching_entry->actions[i].header, packet);
+				if (!matching_entry->actions[i].active) continue;
+
+				// The only vendor action the flowtable takes is goto table,
+				// which comes after the other actions of the entry
+				const ofp_action_header *header =
+				        &matching_entry->actions[i].header;
+				if (ntohs(header->type) == OFPAT_VENDOR)
+				{
+					next_table = ((const openflow_nx_action_resubmit_type *)
+					        header)->table;
+					action_performed = 1;
+					continue;
+				}
+
+				int32_t ret = openflow_pkt_proc_perform_action(header, packet);
 				if (ret >= 0) action_performed = 1;
 			}
+
+			if (!action_performed)
+			{
+				verbose(2, "[openflow_pkt_proc_handle_packet]:: Dropping packet"
+						" with no valid actions.");
+				countDrop(packet, packet->frame.src_interface,
+				        DROP_OPENFLOW_NO_ACTION);
+			}
+
+			openflow_flowtable_release_entry(matching_entry);
+			if (next_table == 0) return 0;
+
+			verbose(2, "[openflow_pkt_proc_handle_packet]:: Going to table %"
+					PRIu8 ".", next_table);
+			table_id = next_table;
+			continue;
 		}
 
-		if (!action_performed)
+		uint8_t miss = openflow_flowtable_get_table_miss(table_id);
+		if (miss == OPENFLOW_TABLE_MISS_CONTINUE
+		        && table_id + 1 < OPENFLOW_NUM_TABLES)
+		{
+			table_id++;
+			continue;
+		}
+		else if (miss != OPENFLOW_TABLE_MISS_CONTROLLER)
 		{
 			verbose(2, "[openflow_pkt_proc_handle_packet]:: Dropping packet"
-					" with no valid actions.");
+					" with no match in table %" PRIu8 ".", table_id);
+			countDrop(packet, packet->frame.src_interface,
+			        DROP_OPENFLOW_TABLE_MISS);
+			return 0;
+		}
+		else
+		{
+			PROBE1(flow_miss, packet);
+			verbose(2, "[openflow_pkt_proc_handle_packet]:: Forwarding packet"
+					" with no flowtable match to controller.");
+			int32_t ret = openflow_ctrl_iface_send_packet_in(packet,
+			        OFPR_NO_MATCH, openflow_config_get_miss_send_len());
+			return ret;
 		}
-
-		free(matching_entry);
-		return 0;
-	}
-	else
-	{
-		verbose(2, "[openflow_pkt_proc_handle_packet]:: Forwarding packet"
-				" with no flowtable match to controller.");
-		int32_t ret = openflow_ctrl_iface_send_packet_in(packet, OFPR_NO_MATCH);
-		return ret;
 	}
 }
 
@@ -263,14 +279,19 @@ int32_t openflow_pkt_proc_handle_packet(gpacket_t *packet)
  *
  * @return 0, or a negative value if an error occurred.
  */
-int32_t openflow_pkt_proc_perform_action(ofp_action_header *header,
+int32_t openflow_pkt_proc_perform_action(const ofp_action_header *header,
         gpacket_t *packet)
 {
 	uint16_t header_type = ntohs(header->type);
+
+	// Every other action rewrites headers, so parse them again when needed
+	if (header_type != OFPAT_OUTPUT) packet->frame.meta.valid = 0;
+
 	if (header_type == OFPAT_OUTPUT)
 	{
 		// Send packet to output port
-		ofp_action_output *output_action = (ofp_action_output *) header;
+		const ofp_action_output *output_action =
+		        (const ofp_action_output *) header;
 		uint16_t port = ntohs(output_action->port);
 		if (port == OFPP_IN_PORT)
 		{
@@ -348,7 +369,8 @@ int32_t openflow_pkt_proc_perform_action(ofp_action_header *header,
 			// Forward packet to controller
 			verbose(2, "[openflow_pkt_proc_perform_action]:: Performing"
 					" OFPAT_OUTPUT action with OFPP_CONTROLLER.");
-			return openflow_ctrl_iface_send_packet_in(packet, OFPR_ACTION);
+			return openflow_ctrl_iface_send_packet_in(packet, OFPR_ACTION,
+			        ntohs(output_action->max_len));
 		}
 		else if (port == OFPP_LOCAL)
 		{
@@ -370,7 +392,8 @@ int32_t openflow_pkt_proc_perform_action(ofp_action_header *header,
 		// Modify VLAN ID
 		verbose(2, "[openflow_pkt_proc_perform_action]:: Performing"
 				" OFPAT_SET_VLAN_VID action.");
-		ofp_action_vlan_vid *vlan_vid_action = (ofp_action_vlan_vid *) header;
+		const ofp_action_vlan_vid *vlan_vid_action =
+		        (const ofp_action_vlan_vid *) header;
 		if (ntohs(packet->data.header.prot) == ETHERTYPE_IEEE_802_1Q)
 		{
 			// Existing VLAN header
@@ -392,7 +415,8 @@ int32_t openflow_pkt_proc_perform_action(ofp_action_header *header,
 		// Modify VLAN priority
 		verbose(2, "[openflow_pkt_proc_perform_action]:: Performing"
 				" OFPAT_SET_VLAN_PCP action.");
-		ofp_action_vlan_pcp *vlan_pcp_action = (ofp_action_vlan_pcp *) header;
+		const ofp_action_vlan_pcp *vlan_pcp_action =
+		        (const ofp_action_vlan_pcp *) header;
 		if (ntohs(packet->data.header.prot) == ETHERTYPE_IEEE_802_1Q)
 		{
 			// Existing VLAN header
@@ -431,7 +455,8 @@ int32_t openflow_pkt_proc_perform_action(ofp_action_header *header,
 		// Modify Ethernet source MAC address
 		verbose(2, "[openflow_pkt_proc_perform_action]:: Performing"
 				" OFPAT_SET_DL_SRC action.");
-		ofp_action_dl_addr *dl_addr_action = (ofp_action_dl_addr *) header;
+		const ofp_action_dl_addr *dl_addr_action =
+		        (const ofp_action_dl_addr *) header;
 		COPY_MAC(&packet->data.header.src, &dl_addr_action->dl_addr);
 		return 0;
 	}
@@ -440,7 +465,8 @@ int32_t openflow_pkt_proc_perform_action(ofp_action_header *header,
 		// Modify Ethernet destination MAC address
 		verbose(2, "[openflow_pkt_proc_perform_action]:: Performing"
 				" OFPAT_SET_DL_DST action.");
-		ofp_action_dl_addr *dl_addr_action = (ofp_action_dl_addr *) header;
+		const ofp_action_dl_addr *dl_addr_action =
+		        (const ofp_action_dl_addr *) header;
 		COPY_MAC(&packet->data.header.dst, &dl_addr_action->dl_addr);
 		return 0;
 	}
@@ -449,7 +475,8 @@ int32_t openflow_pkt_proc_perform_action(ofp_action_header *header,
 		// Modify IP source address
 		verbose(2, "[openflow_pkt_proc_perform_action]:: Performing"
 				" OFPAT_SET_NW_SRC action.");
-		ofp_action_nw_addr *nw_addr_action = (ofp_action_nw_addr *) header;
+		const ofp_action_nw_addr *nw_addr_action =
+		        (const ofp_action_nw_addr *) header;
 		if (ntohs(packet->data.header.prot) == IP_PROTOCOL)
 		{
 			ip_packet_t *ip_packet = (ip_packet_t *) &packet->data.data;
@@ -468,7 +495,8 @@ int32_t openflow_pkt_proc_perform_action(ofp_action_header *header,
 		// Modify IP destination address
 		verbose(2, "[openflow_pkt_proc_perform_action]:: Performing"
 				" OFPAT_SET_NW_DST action.");
-		ofp_action_nw_addr *nw_addr_action = (ofp_action_nw_addr *) header;
+		const ofp_action_nw_addr *nw_addr_action =
+		        (const ofp_action_nw_addr *) header;
 		if (ntohs(packet->data.header.prot) == IP_PROTOCOL)
 		{
 			ip_packet_t *ip_packet = (ip_packet_t *) &packet->data.data;
@@ -487,7 +515,8 @@ int32_t openflow_pkt_proc_perform_action(ofp_action_header *header,
 		// Modify IP type of service
 		verbose(2, "[openflow_pkt_proc_perform_action]:: Performing"
 				" OFPAT_SET_NW_TOS action.");
-		ofp_action_nw_tos *nw_tos_action = (ofp_action_nw_tos *) header;
+		const ofp_action_nw_tos *nw_tos_action =
+		        (const ofp_action_nw_tos *) header;
 		if (ntohs(packet->data.header.prot) == IP_PROTOCOL)
 		{
 			ip_packet_t *ip_packet = (ip_packet_t *) &packet->data.data;
@@ -506,7 +535,8 @@ int32_t openflow_pkt_proc_perform_action(ofp_action_header *header,
 		// Modify TCP/UDP source port
 		verbose(2, "[openflow_pkt_proc_perform_action]:: Performing"
 				" OFPAT_SET_TP_SRC action.");
-		ofp_action_tp_port *tp_port_action = (ofp_action_tp_port *) header;
+		const ofp_action_tp_port *tp_port_action =
+		        (const ofp_action_tp_port *) header;
 		if (ntohs(packet->data.header.prot) == IP_PROTOCOL)
 		{
 			ip_packet_t *ip_packet = (ip_packet_t *) &packet->data.data;
@@ -541,7 +571,8 @@ int32_t openflow_pkt_proc_perform_action(ofp_action_header *header,
 		// Modify TCP/UDP destination port
 		verbose(2, "[openflow_pkt_proc_perform_action]:: Performing"
 				" OFPAT_SET_TP_DST action.");
-		ofp_action_tp_port *tp_port_action = (ofp_action_tp_port *) header;
+		const ofp_action_tp_port *tp_port_action =
+		        (const ofp_action_tp_port *) header;
 		if (ntohs(packet->data.header.prot) == IP_PROTOCOL)
 		{
 			ip_packet_t *ip_packet = (ip_packet_t *) &packet->data.data;
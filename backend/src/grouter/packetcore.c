@@ -12,6 +12,12 @@
  * inserts the chosen packet into a work queue that is not part of the
  * packet core. The work queue is serviced by one or more worker threads
  * (for now we have one worker thread).
+ *
+ * In OpenFlow mode packets skip the queues and the scheduler: each one goes
+ * to the work queue of one of the OpenFlow workers, picked by the flow hash
+ * of the packet. The packets of a flow are therefore handled by a single
+ * worker, in the order they arrived, while different flows are spread over
+ * all of them.
  */
 #define _XOPEN_SOURCE             500
 #include <unistd.h>
@@ -23,6 +29,7 @@
 #include <pthread.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <arpa/inet.h>
 #include "protocols.h"
 #include "packetcore.h"
@@ -33,6 +40,9 @@
 #include "filter.h"
 #include "arp.h"
 #include "ip.h"
+#include "drop.h"
+#include "logging.h"
+#include "probes.h"
 
 extern classlist_t *classifier;
 extern filtertab_t *filter;
@@ -109,8 +119,12 @@ pktcore_t *createPacketCore(char *rname, simplequeue_t *outQ, simplequeue_t *wor
 	pcore->packetcnt = 0;
 	pcore->outputQ = outQ;
 	pcore->workQ = workQ;
+	memset(pcore->openflowWorkQ, 0, sizeof(pcore->openflowWorkQ));
+	memset(pcore->openflowworker, 0, sizeof(pcore->openflowworker));
+	pcore->openflowworkers = 0;
 	if (rconfig.openflow) {
-		pcore->openflowWorkQ = openflowWorkQ;
+		pcore->openflowWorkQ[0] = openflowWorkQ;
+		pcore->openflowworkers = 1;
 	}
 	pcore->maxqsize = MAX_QUEUE_SIZE;
 	pcore->qdiscs = initQDiscTable();
@@ -196,18 +210,26 @@ void printQueueStats(pktcore_t *pcore)
 	Lister *klster;
 	char *nxtkey;
 	simplequeue_t *nextq;
+	int i;
 
 	keylst = map_keys(pcore->queues);
 	klster = lister_create(keylst);
 
-	printf("NOT YET IMPLEMENTED \n");
+	printf("%-12s %6s %6s %10s %12s %10s %12s %8s %8s %9s %9s %9s\n", "queue", "depth",
+	       "max", "enq pkts", "enq bytes", "deq pkts", "deq bytes", "taildrop", "reddrop",
+	       "min (us)", "avg (us)", "max (us)");
 	while (nxtkey = ((char *)lister_next(klster)))
 	{
 		nextq = map_get(pcore->queues, nxtkey);
-		printf("Stats for %s \n", nxtkey);
+		printSimpleQueueStats(nextq);
 	}
 	lister_release(klster);
 	list_release(keylst);
+
+	printSimpleQueueStats(pcore->workQ);
+	for (i = 0; i < pcore->openflowworkers; i++)
+		printSimpleQueueStats(pcore->openflowWorkQ[i]);
+	printSimpleQueueStats(pcore->outputQ);
 }
 
 
@@ -360,6 +382,7 @@ void *packetProcessor(void *pc)
 		verbose(2, "[packetProcessor]:: Waiting for a packet...");
 		readQueue(pcore->workQ, (void **)&in_pkt, &pktsize);
 		pthread_testcancel();
+		LATENCY_STAMP(in_pkt, LAT_WORK);
 		verbose(2, "[packetProcessor]:: Got a packet for further processing..");
 
 		// get the protocol field within the packet... and switch it accordingly
@@ -377,41 +400,77 @@ void *packetProcessor(void *pc)
 		default:
 			verbose(1, "[packetProcessor]:: Packet discarded: Unknown protocol protocol");
 			// TODO: should we generate ICMP errors here.. check router RFCs
-			free(in_pkt);
+			dropPacket(in_pkt, in_pkt->frame.src_interface, DROP_UNKNOWN_PROTO);
 			break;
 		}
 	}
 }
 
-int PktCoreOpenflowWorkerInit(pktcore_t *pcore)
+/*
+ * Starts nworkers OpenFlow packet processors (at least one and at most
+ * MAX_OPENFLOW_WORKERS), each reading its own work queue. The first queue
+ * is the one given to createPacketCore; the others are created here.
+ * Returns the number of workers started, fewer than asked if a thread could
+ * not be created, or -1 if none could.
+ */
+int PktCoreOpenflowWorkerInit(pktcore_t *pcore, int nworkers)
 {
-	int threadstat, threadid;
+	char qname[MAX_NAME_LEN];
+	int threadstat, i;
 
-	threadstat = pthread_create((pthread_t *)&threadid, NULL,
-	                            (void *)openflowPacketProcessor,
-								(void *)pcore);
-	if (threadstat != 0)
+	if (nworkers < 1)
+		nworkers = 1;
+	if (nworkers > MAX_OPENFLOW_WORKERS)
 	{
-		verbose(1, "[PktCoreOpenflowWorkerInit]:: unable to create thread.. ");
-		return -1;
+		verbose(1, "[PktCoreOpenflowWorkerInit]:: limiting the OpenFlow workers to %d.. ", MAX_OPENFLOW_WORKERS);
+		nworkers = MAX_OPENFLOW_WORKERS;
 	}
 
-	return threadid;
+	// the flowtable has to be there before the first worker looks up a packet
+	openflow_pkt_proc_init(pcore);
+
+	for (i = 1; i < nworkers; i++)
+	{
+		sprintf(qname, "Work queue for OpenFlow worker %d", i);
+		pcore->openflowWorkQ[i] = createSimpleQueue(qname, INFINITE_Q_SIZE, 0, 1);
+	}
+
+	for (i = 0; i < nworkers; i++)
+	{
+		threadstat = pthread_create(&(pcore->openflowworker[i]), NULL,
+		                            (void *)openflowPacketProcessor,
+		                            (void *)pcore->openflowWorkQ[i]);
+		if (threadstat != 0)
+		{
+			verbose(1, "[PktCoreOpenflowWorkerInit]:: unable to create thread.. ");
+			if (i == 0)
+				return -1;
+			// run with the workers that did start, so they get packets
+			// and are cancelled at shutdown
+			nworkers = i;
+			break;
+		}
+	}
+
+	// enqueuePacket only spreads packets over the queues from now on
+	__atomic_store_n(&(pcore->openflowworkers), nworkers, __ATOMIC_RELEASE);
+	verbose(2, "[PktCoreOpenflowWorkerInit]:: started %d OpenFlow workers.. ", nworkers);
+	return nworkers;
 }
 
-void *openflowPacketProcessor(void *pc) {
-	pktcore_t *pcore = (pktcore_t *)pc;
+void *openflowPacketProcessor(void *wq) {
+	simplequeue_t *openflowWorkQ = (simplequeue_t *)wq;
 	gpacket_t *in_pkt;
 	int pktsize;
 
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
-	openflow_pkt_proc_init(pcore);
 	while (1)
 	{
 		verbose(2, "[openflowPacketProcessor]:: Waiting for a packet...");
-		readQueue(pcore->openflowWorkQ, (void **)&in_pkt, &pktsize);
+		readQueue(openflowWorkQ, (void **)&in_pkt, &pktsize);
 		pthread_testcancel();
+		LATENCY_STAMP(in_pkt, LAT_WORK);
 		verbose(2, "[openflowPacketProcessor]:: Got a packet for further"
 			" processing..");
 
@@ -454,19 +513,22 @@ char *tagPacket(pktcore_t *pcore, gpacket_t *in_pkt)
 		}
 	}
 
-	if (found == TRUE)
-		return cdef->cname;
-	else
-		return defaultstr;
+	qname = (found == TRUE) ? cdef->cname : defaultstr;
+	PROBE2(classify, in_pkt, qname);
+	return qname;
 }
 
 
 int enqueuePacket(pktcore_t *pcore, gpacket_t *in_pkt, int pktsize,
 	uint8_t openflow)
 {
+	LATENCY_STAMP(in_pkt, LAT_ENQ);
 	if (openflow)
 	{
-		writeQueue(pcore->openflowWorkQ, in_pkt, pktsize);
+		// scales the flow hash down to a worker without a division
+		uint32_t nworkers = __atomic_load_n(&(pcore->openflowworkers), __ATOMIC_ACQUIRE);
+		uint32_t w = ((uint64_t)packetMeta(in_pkt)->hash * nworkers) >> 32;
+		return writeQueue(pcore->openflowWorkQ[w], in_pkt, pktsize);
 	}
 	else
 	{
@@ -477,7 +539,7 @@ int enqueuePacket(pktcore_t *pcore, gpacket_t *in_pkt, int pktsize,
 		if (filteredPacket(filter, in_pkt))
 		{
 			verbose(2, "[enqueuePacket]:: Packet filtered..!");
-			free(in_pkt);
+			dropPacket(in_pkt, in_pkt->frame.src_interface, DROP_FILTERED);
 			return EXIT_FAILURE;
 		}
 
@@ -488,7 +550,7 @@ int enqueuePacket(pktcore_t *pcore, gpacket_t *in_pkt, int pktsize,
 		qkey = tagPacket(pcore, in_pkt);
 
 		verbose(2, "[enqueuePacket]:: simple packet queuer ..");
-		if (prog_verbosity_level() >= 3)
+		if (LOG_ENABLED(3))
 			printGPacket(in_pkt, 6, "QUEUER");
 
 		pthread_mutex_lock(&(pcore->qlock));
@@ -498,7 +560,7 @@ int enqueuePacket(pktcore_t *pcore, gpacket_t *in_pkt, int pktsize,
 		{
 			fatal("[enqueuePacket]:: Invalid %s key presented for queue retrieval", qkey);
 			pthread_mutex_unlock(&(pcore->qlock));
-			free(in_pkt);
+			dropPacket(in_pkt, in_pkt->frame.src_interface, DROP_NO_QUEUE);
 			return EXIT_FAILURE;             // packet dropped..
 		}
 
@@ -507,7 +569,8 @@ int enqueuePacket(pktcore_t *pcore, gpacket_t *in_pkt, int pktsize,
 		if (thisq->cursize >= thisq->maxsize)
 		{
 			verbose(2, "[enqueuePacket]:: Packet dropped.. Queue for [%s] is full.. cursize %d..  ", qkey, thisq->cursize);
-			free(in_pkt);
+			countQueueDrop(thisq, QSTATS_TAILDROP);
+			dropPacket(in_pkt, in_pkt->frame.src_interface, DROP_QUEUE_FULL);
 			pthread_mutex_unlock(&(pcore->qlock));
 			return EXIT_FAILURE;
 		}
@@ -515,7 +578,8 @@ int enqueuePacket(pktcore_t *pcore, gpacket_t *in_pkt, int pktsize,
 		if ( (!strcmp(thisq->qdisc, "red")) && (redDiscard(thisq, in_pkt)) )
 		{
 			verbose(2, "[enqueuePacket]:: RED Discarded Packet .. ");
-			free(in_pkt);
+			countQueueDrop(thisq, QSTATS_REDDROP);
+			dropPacket(in_pkt, in_pkt->frame.src_interface, DROP_RED);
 			pthread_mutex_unlock(&(pcore->qlock));
 			return EXIT_FAILURE;
 		}
@@ -538,20 +602,20 @@ int enqueuePacket(pktcore_t *pcore, gpacket_t *in_pkt, int pktsize,
 int redDiscard(simplequeue_t *thisq, gpacket_t *ipkt)
 {
 	double m;
-	double curraccesstime, pb, pa;
-	struct timeval tval;
+	uint64_t now;
+	double pb, pa;
 	int discarded = 0;
 
-	gettimeofday(&tval, NULL);
-	curraccesstime = tval.tv_usec * 0.000001;
-	curraccesstime += tval.tv_sec;
-
 	// calculate queue average..
 	if (thisq->cursize > 0)
 		thisq->avgqsize = thisq->avgqsize + 0.9 * (thisq->cursize - thisq->avgqsize);
 	else
 	{
-		m = (curraccesstime - thisq->prevaccesstime)/0.0001;
+		// idle time since the last dequeue in units of 100 microseconds; both
+		// come from clockNow(), but another thread may have stamped it after
+		// this one read the clock
+		now = clockNow();
+		m = (now > thisq->lastdeqtime) ? (now - thisq->lastdeqtime) / 100000.0 : 0;
 		thisq->avgqsize = pow(0.1, m) * thisq->avgqsize;
 	}
 
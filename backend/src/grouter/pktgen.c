@@ -0,0 +1,268 @@
+/*
+ * pktgen.c (synthetic packet generator)
+ *
+ * Sends templated Ethernet/IPv4/UDP or TCP frames through an interface's
+ * todev routine at a given rate, size distribution and destination
+ * range, so one gRouter can load another over VPL links.
+ */
+
+#include "pktgen.h"
+#include "message.h"
+#include "gnet.h"
+#include "ip.h"
+#include "udp.h"
+#include "protocols.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <slack/std.h>
+#include <slack/err.h>
+
+static pktgen_config_t pktgen;
+static int pktgen_started;
+
+
+static uint64_t pktgenNow()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * One's complement sum of len bytes, big endian words.
+ */
+static uint32_t pktgenSum(uchar *buf, int len, uint32_t sum)
+{
+	int i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += (buf[i] << 8) | buf[i + 1];
+	if (len & 1)
+		sum += buf[len - 1] << 8;
+	return sum;
+}
+
+static uint16_t pktgenFold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	return htons((uint16_t)~sum);
+}
+
+
+static int pktgenFrameSize(unsigned int *seed)
+{
+	int r;
+
+	switch (pktgen.size_mode)
+	{
+	case PKTGEN_SIZE_UNIFORM:
+		return pktgen.size_min + rand_r(seed) % (pktgen.size_max - pktgen.size_min + 1);
+	case PKTGEN_SIZE_IMIX:
+		r = rand_r(seed) % 12;
+		return (r < 7) ? 64 : ((r < 11) ? 576 : 1514);
+	default:
+		return pktgen.size_min;
+	}
+}
+
+
+/*
+ * Fill in a frame of the given size for destination dst (host order).
+ */
+static void pktgenBuild(interface_t *iface, gpacket_t *pkt, int size, uint32_t dst, uint32_t seq)
+{
+	ip_packet_t *ip_pkt = (ip_packet_t *)pkt->data.data;
+	uchar *l4 = (uchar *)ip_pkt + sizeof(ip_packet_t);
+	int iplen = size - sizeof(pkt->data.header);
+	int l4len = iplen - sizeof(ip_packet_t);
+	uint32_t sum, addr;
+	uchar pseudo[4];
+
+	COPY_MAC(pkt->data.header.dst, pktgen.dst_mac);
+	COPY_MAC(pkt->data.header.src, iface->mac_addr);
+	pkt->data.header.prot = htons(IP_PROTOCOL);
+	pkt->frame.dst_interface = iface->interface_id;
+
+	ip_pkt->ip_version = 4;
+	ip_pkt->ip_hdr_len = 5;
+	ip_pkt->ip_tos = 0;
+	ip_pkt->ip_pkt_len = htons(iplen);
+	ip_pkt->ip_identifier = htons((uint16_t)seq);
+	ip_pkt->ip_frag_off = 0;
+	ip_pkt->ip_ttl = 64;
+	ip_pkt->ip_prot = pktgen.proto;
+	addr = htonl(pktgen.src_ip);
+	memcpy(ip_pkt->ip_src, &addr, 4);
+	addr = htonl(dst);
+	memcpy(ip_pkt->ip_dst, &addr, 4);
+	ip_pkt->ip_cksum = 0;
+	ip_pkt->ip_cksum = htons(checksum((uchar *)ip_pkt, ip_pkt->ip_hdr_len * 2));
+
+	if (pktgen.proto == UDP_PROTOCOL)
+	{
+		udp_packet_type *udp = (udp_packet_type *)l4;
+		udp->src_port = htons(pktgen.sport);
+		udp->dst_port = htons(pktgen.dport);
+		udp->length = htons(l4len);
+		udp->checksum = 0;                  // optional for IPv4
+	} else
+	{
+		// tcp_packet_type has 16 bit sequence numbers, use the system header
+		struct tcphdr *tcp = (struct tcphdr *)l4;
+		bzero(tcp, sizeof(struct tcphdr));
+		tcp->th_sport = htons(pktgen.sport);
+		tcp->th_dport = htons(pktgen.dport);
+		tcp->th_seq = htonl(seq);
+		tcp->th_off = sizeof(struct tcphdr) / 4;
+		tcp->th_flags = TH_ACK | TH_PUSH;
+		tcp->th_win = htons(65535);
+		pseudo[0] = 0;
+		pseudo[1] = pktgen.proto;
+		pseudo[2] = l4len >> 8;
+		pseudo[3] = l4len & 0xFF;
+		sum = pktgenSum(ip_pkt->ip_src, 8, 0);
+		sum = pktgenSum(pseudo, 4, sum);
+		sum = pktgenSum(l4, l4len, sum);
+		tcp->th_sum = pktgenFold(sum);
+	}
+}
+
+
+static void *pktgenHandler(void *arg)
+{
+	interface_t *iface;
+	gpacket_t *pkt;
+	unsigned int seed = (unsigned int)pktgenNow();
+	uint64_t start, next, gap;
+	uint32_t dst = pktgen.dst_first;
+	struct timespec ts;
+	int size;
+
+	gap = (pktgen.rate > 0) ? (uint64_t)(1e9 / pktgen.rate) : 0;
+	start = next = pktgenNow();
+
+	while (pktgen.running && ((pktgen.count == 0) || (pktgen.sent < pktgen.count)))
+	{
+		if ((iface = findInterface(pktgen.iface)) == NULL)
+		{
+			error("[pktgenHandler]:: interface %d went away, pktgen stopped ", pktgen.iface);
+			break;
+		}
+		if (gap > 0)
+		{
+			ts.tv_sec = next / 1000000000ULL;
+			ts.tv_nsec = next % 1000000000ULL;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+				;
+			next += gap;
+		}
+
+		if ((pkt = (gpacket_t *)malloc(sizeof(gpacket_t))) == NULL)
+		{
+			fatal("[pktgenHandler]:: unable to allocate memory for packet.. ");
+			break;
+		}
+		bzero(pkt, sizeof(gpacket_t));
+		size = pktgenFrameSize(&seed);
+		pktgenBuild(iface, pkt, size, dst, pktgen.sent);
+		dst = (dst == pktgen.dst_last) ? pktgen.dst_first : dst + 1;
+
+		// todev sends the frame and frees the packet
+		iface->devdriver->todev((void *)pkt);
+		pktgen.sent++;
+		pktgen.bytes += size;
+		pktgen.elapsed = (pktgenNow() - start) / 1e9;
+	}
+	pktgen.elapsed = (pktgenNow() - start) / 1e9;
+	pktgen.running = 0;
+	pktgenShow();
+	return NULL;
+}
+
+
+int pktgenStart(pktgen_config_t *cfg)
+{
+	int maxframe = sizeof(((pkt_data_t *)0)->header) + DEFAULT_MTU;
+	int hdrs = sizeof(((pkt_data_t *)0)->header) + sizeof(ip_packet_t) +
+		((cfg->proto == TCP_PROTOCOL) ? sizeof(struct tcphdr) : sizeof(udp_packet_type));
+
+	if (pktgen.running)
+	{
+		error("[pktgenStart]:: pktgen is already running ");
+		return EXIT_FAILURE;
+	}
+	if (findInterface(cfg->iface) == NULL)
+	{
+		error("[pktgenStart]:: interface %d does not exist ", cfg->iface);
+		return EXIT_FAILURE;
+	}
+	if (cfg->size_mode != PKTGEN_SIZE_IMIX)
+	{
+		if (cfg->size_min < PKTGEN_MIN_FRAME)
+			cfg->size_min = PKTGEN_MIN_FRAME;
+		if (cfg->size_min < hdrs)
+			cfg->size_min = hdrs;
+		if (cfg->size_max > maxframe)
+			cfg->size_max = maxframe;
+		if (cfg->size_min > cfg->size_max)
+		{
+			error("[pktgenStart]:: frame size must be between %d and %d ", hdrs, maxframe);
+			return EXIT_FAILURE;
+		}
+	}
+	if (cfg->dst_last < cfg->dst_first)
+	{
+		error("[pktgenStart]:: empty destination range ");
+		return EXIT_FAILURE;
+	}
+	if (pktgen.threadid != 0)
+		pthread_join(pktgen.threadid, NULL);
+
+	pktgen = *cfg;
+	pktgen.sent = pktgen.bytes = 0;
+	pktgen.elapsed = 0;
+	pktgen.running = 1;
+	pktgen_started = 1;
+	if (pthread_create(&(pktgen.threadid), NULL, pktgenHandler, NULL) != 0)
+	{
+		error("[pktgenStart]:: unable to create the pktgen thread ");
+		pktgen.running = 0;
+		pktgen.threadid = 0;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+void pktgenStop()
+{
+	pktgen.running = 0;
+	if (pktgen.threadid != 0)
+	{
+		pthread_join(pktgen.threadid, NULL);
+		pktgen.threadid = 0;
+	}
+}
+
+
+void pktgenShow()
+{
+	double pps = (pktgen.elapsed > 0) ? pktgen.sent / pktgen.elapsed : 0;
+	double bps = (pktgen.elapsed > 0) ? pktgen.bytes * 8 / pktgen.elapsed : 0;
+
+	if (!pktgen_started)
+	{
+		printf("pktgen has not been started \n");
+		return;
+	}
+	printf("pktgen on interface %d %s: %lu packets, %lu bytes in %.3f s (%.0f pps, %.2f Mbps) \n",
+	       pktgen.iface, pktgen.running ? "running" : "finished", pktgen.sent, pktgen.bytes,
+	       pktgen.elapsed, pps, bps / 1e6);
+}
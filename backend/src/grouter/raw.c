@@ -17,8 +17,10 @@
 #include "gnet.h"
 #include "arp.h"
 #include "ip.h"
+#include "drop.h"
 #include "ethernet.h"
 #include "icmp.h"
+#include "logging.h"
 
 #include <netinet/in.h>
 #include <errno.h>
@@ -137,7 +139,7 @@ void* fromRawDev(void *arg)
                 (COMPARE_MAC(in_pkt->data.header.dst, bcast_mac) != 0))
         {
             verbose(2, "[fromRawDev]:: Packet[%d] dropped .. not for this router!? ", pktsize);
-            free(in_pkt);
+            dropPacket(in_pkt, iface->interface_id, DROP_NOT_FOR_ME);
             continue;
         }
 		
@@ -145,6 +147,9 @@ void* fromRawDev(void *arg)
         in_pkt->frame.src_interface = iface->interface_id;
         COPY_MAC(in_pkt->frame.src_hw_addr, iface->mac_addr);
         COPY_IP(in_pkt->frame.src_ip_addr, iface->ip_addr);
+        LATENCY_STAMP(in_pkt, LAT_RX);
+        GNETCountRx(iface, in_pkt);
+        parsePacket(in_pkt);
 	
 	
 	char buf[20];
@@ -157,7 +162,7 @@ void* fromRawDev(void *arg)
 	if (filteredPacket(filter, in_pkt))
         {
             verbose(2, "[fromRawDev]:: Packet filtered..!");
-            free(in_pkt);
+            dropPacket(in_pkt, iface->interface_id, DROP_FILTERED);
             continue;   // skip the rest of the loop
         }
 
@@ -251,6 +251,9 @@ void rdp_stopnwait_recv_callback (
 void rdp_stopnwait_resend_packet(void *arg) {
 	struct stopnwait_context *context = (struct stopnwait_context *) arg;
 
+	//The timer thread goes through lwIP like the packet path does
+	LOCK_TCPIP_CORE();
+
 	//Retrive the pcb representing the connection from the context
 	struct udp_pcb *pcb = context->pcb;
 	//Allocate a new pbuffer in which to resend the message
@@ -272,6 +275,7 @@ void rdp_stopnwait_resend_packet(void *arg) {
 
 	//Reset the pcb's local port to the actual port without the sequence number.
 	pcb->local_port = actual_port;
+	UNLOCK_TCPIP_CORE();
 }
 
 void rdp_stopnwait_shutdown() {
@@ -433,6 +437,7 @@ err_t rdp_gobackn_send (struct udp_pcb *pcb, struct pbuf *p){
 void rdp_gobackn_resend_packet (void *arg){
 	struct gobackn_context *context = (struct gobackn_context *) arg;
 
+	LOCK_TCPIP_CORE();
 	int end = context->next_seq_num;
 	if(context->seq_start == end && context->num_pcb_stored == MAX_N_CALLBACK) {
 		end = (end-1)%MAX_N_CALLBACK;
@@ -451,6 +456,7 @@ void rdp_gobackn_resend_packet (void *arg){
 		//Resend the packet
 		udp_send(pcb, p);
 	}
+	UNLOCK_TCPIP_CORE();
 
 }
 
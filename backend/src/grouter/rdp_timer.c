@@ -4,7 +4,6 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <pthread.h>
-#include <sys/timeb.h> 
 #include "grouter.h"
 #include "ip.h"
 #include "udp.h"
@@ -15,6 +14,7 @@
 #include "opt.h"
 #include "rdp.h"
 #include "rdp_timer.h"
+#include "clock.h"
 
 /*****************************
 RDP TIMER 
@@ -22,22 +22,22 @@ RDP TIMER
 void *rdp_run_timer(void *arg) {
 	struct rdp_timer_context *context= (struct rdp_timer_context *) arg;
 
+	// the timer checks its deadline once per tick of the router clock
+	// instead of spinning on the time of day
 	while(!context->shutdown){
-		struct timeb start;
-		ftime(&start);
+		uint64_t start = clockNow();
 
 		while(context->active && !context->shutdown) {
-			struct timeb now;
-			ftime(&now);
-
-			int milliseconds = (int) (1000.0 * (now.time - start.time)) + (now.millitm - start.millitm);
+			int milliseconds = (int) ((clockNow() - start) / 1000000);
 
 			if(milliseconds>=context->time) {
 				context->callback(context->callback_arg);
 				
-				ftime(&start);
-			}
+				start = clockNow();
+			} else
+				clockWaitTick();
 		}
+		clockWaitTick();
 	}
 	// printf("Freeing the timer context\n");
 	free(context);
@@ -0,0 +1,442 @@
+/*
+ * replay.c (pcap replay traffic engine)
+ *
+ * Memory-maps a pcap or pcap-ng capture and injects its Ethernet frames
+ * into the receive path of an interface, the same way the fromXDev
+ * threads do. Used to load the router reproducibly without external
+ * senders.
+ */
+
+#include "replay.h"
+#include "packetcore.h"
+#include "message.h"
+#include "gnet.h"
+#include "gpcap.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <slack/std.h>
+#include <slack/err.h>
+
+#define PCAP_MAGIC_USEC         0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+#define PCAPNG_SPB_TYPE         0x00000003
+
+extern pktcore_t *pcore;
+extern router_config rconfig;
+
+static replay_config_t replay;
+
+
+static uint32_t rd32(replay_file_t *rf, size_t off)
+{
+	uint32_t v;
+
+	memcpy(&v, rf->base + off, sizeof(v));
+	return rf->swapped ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t rd16(replay_file_t *rf, size_t off)
+{
+	uint16_t v;
+
+	memcpy(&v, rf->base + off, sizeof(v));
+	return rf->swapped ? __builtin_bswap16(v) : v;
+}
+
+
+static uint64_t replayNow()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * Map the capture file and check its header.
+ */
+int replayOpen(replay_file_t *rf, char *path)
+{
+	struct stat st;
+	uint32_t magic;
+	int fd;
+
+	bzero(rf, sizeof(replay_file_t));
+	if ((fd = open(path, O_RDONLY)) == -1)
+	{
+		error("[replayOpen]:: unable to open %s: %s ", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if ((fstat(fd, &st) == -1) || (st.st_size < sizeof(pcap_hdr_t)))
+	{
+		error("[replayOpen]:: %s is not a capture file ", path);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	rf->size = st.st_size;
+	rf->base = mmap(NULL, rf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (rf->base == MAP_FAILED)
+	{
+		error("[replayOpen]:: unable to map %s: %s ", path, strerror(errno));
+		rf->base = NULL;
+		return EXIT_FAILURE;
+	}
+	madvise(rf->base, rf->size, MADV_SEQUENTIAL);
+
+	memcpy(&magic, rf->base, sizeof(magic));
+	if (magic == PCAPNG_SHB_TYPE)
+		rf->ng = 1;
+	else if ((magic == PCAP_MAGIC_USEC) || (magic == PCAP_MAGIC_NSEC))
+		rf->nsec = (magic == PCAP_MAGIC_NSEC);
+	else if ((magic == __builtin_bswap32(PCAP_MAGIC_USEC)) || (magic == __builtin_bswap32(PCAP_MAGIC_NSEC)))
+	{
+		rf->swapped = 1;
+		rf->nsec = (magic == __builtin_bswap32(PCAP_MAGIC_NSEC));
+	} else
+	{
+		error("[replayOpen]:: %s: unknown capture format ", path);
+		replayClose(rf);
+		return EXIT_FAILURE;
+	}
+
+	if (!rf->ng && (rd32(rf, offsetof(pcap_hdr_t, network)) != PCAPNG_LINKTYPE_ETHERNET))
+	{
+		error("[replayOpen]:: %s: only Ethernet captures can be replayed ", path);
+		replayClose(rf);
+		return EXIT_FAILURE;
+	}
+	replayRewind(rf);
+	return EXIT_SUCCESS;
+}
+
+
+void replayRewind(replay_file_t *rf)
+{
+	rf->off = rf->ng ? 0 : sizeof(pcap_hdr_t);
+	rf->nifaces = 0;
+	rf->lastts = 0;
+}
+
+
+void replayClose(replay_file_t *rf)
+{
+	if (rf->base != NULL)
+		munmap(rf->base, rf->size);
+	rf->base = NULL;
+}
+
+
+/*
+ * Parse the if_tsresol option of a pcap-ng interface description.
+ */
+static uint64_t replayTsresol(replay_file_t *rf, size_t opt, size_t end)
+{
+	uint16_t code, len;
+	uint8_t res;
+	uint64_t div = 1;
+
+	while (opt + 4 <= end)
+	{
+		code = rd16(rf, opt);
+		len = rd16(rf, opt + 2);
+		if (code == PCAPNG_OPT_ENDOFOPT)
+			break;
+		if ((code == PCAPNG_OPT_IF_TSRESOL) && (len == 1) && (opt + 5 <= end))
+		{
+			res = rf->base[opt + 4];
+			if (res & 0x80)
+				return 1ULL << (res & 0x7f);
+			while (res-- > 0)
+				div *= 10;
+			return div;
+		}
+		opt += 4 + ((len + 3) & ~3);
+	}
+	return 1000000;                     // default resolution: microseconds
+}
+
+
+/*
+ * Return the next frame of the capture. ts is in nanoseconds.
+ * Returns EXIT_FAILURE at the end of the file (or on a damaged block).
+ */
+int replayNext(replay_file_t *rf, uchar **data, uint32_t *caplen, uint32_t *origlen, uint64_t *ts)
+{
+	uint32_t type, blen, id;
+	uint64_t ticks;
+
+	if (!rf->ng)
+	{
+		if (rf->off + sizeof(pcaprec_hdr_t) > rf->size)
+			return EXIT_FAILURE;
+		*caplen = rd32(rf, rf->off + offsetof(pcaprec_hdr_t, incl_len));
+		*origlen = rd32(rf, rf->off + offsetof(pcaprec_hdr_t, orig_len));
+		*ts = (uint64_t)rd32(rf, rf->off) * 1000000000ULL +
+			(uint64_t)rd32(rf, rf->off + 4) * (rf->nsec ? 1 : 1000);
+		// compared with what is left so a huge length cannot wrap around
+		if (*caplen > rf->size - rf->off - sizeof(pcaprec_hdr_t))
+			return EXIT_FAILURE;
+		*data = rf->base + rf->off + sizeof(pcaprec_hdr_t);
+		rf->off += sizeof(pcaprec_hdr_t) + *caplen;
+		return EXIT_SUCCESS;
+	}
+
+	while (rf->off + 12 <= rf->size)
+	{
+		type = rd32(rf, rf->off);
+		if (type == PCAPNG_SHB_TYPE)
+		{
+			// a new section may switch the byte order
+			uint32_t bom;
+			memcpy(&bom, rf->base + rf->off + 8, sizeof(bom));
+			rf->swapped = (bom != PCAPNG_BYTE_ORDER_MAGIC);
+			rf->nifaces = 0;
+		}
+		blen = rd32(rf, rf->off + 4);
+		if ((blen < 12) || (rf->off + blen > rf->size))
+			return EXIT_FAILURE;
+
+		if ((type == PCAPNG_IDB_TYPE) && (rf->nifaces < REPLAY_MAX_IFACES))
+		{
+			rf->linktype[rf->nifaces] = rd16(rf, rf->off + 8);
+			rf->tsdiv[rf->nifaces] = replayTsresol(rf, rf->off + 16, rf->off + blen - 4);
+			rf->nifaces++;
+		} else if ((type == PCAPNG_EPB_TYPE) && (blen >= sizeof(pcapng_epb_t) + 4))
+		{
+			id = rd32(rf, rf->off + 8);
+			*caplen = rd32(rf, rf->off + 20);
+			*origlen = rd32(rf, rf->off + 24);
+			if ((id < rf->nifaces) && (rf->linktype[id] == PCAPNG_LINKTYPE_ETHERNET) &&
+			    (*caplen <= blen - sizeof(pcapng_epb_t) - 4))
+			{
+				ticks = ((uint64_t)rd32(rf, rf->off + 12) << 32) | rd32(rf, rf->off + 16);
+				*ts = (ticks / rf->tsdiv[id]) * 1000000000ULL +
+					((ticks % rf->tsdiv[id]) * 1000000000ULL) / rf->tsdiv[id];
+				rf->lastts = *ts;
+				*data = rf->base + rf->off + sizeof(pcapng_epb_t);
+				rf->off += blen;
+				return EXIT_SUCCESS;
+			}
+		} else if ((type == PCAPNG_SPB_TYPE) && (blen >= 16) && (rf->nifaces > 0) &&
+			   (rf->linktype[0] == PCAPNG_LINKTYPE_ETHERNET))
+		{
+			// simple packet blocks carry no timestamp
+			*origlen = rd32(rf, rf->off + 8);
+			*caplen = (*origlen < blen - 16) ? *origlen : blen - 16;
+			*ts = rf->lastts;
+			*data = rf->base + rf->off + 12;
+			rf->off += blen;
+			return EXIT_SUCCESS;
+		}
+		rf->off += blen;
+	}
+	return EXIT_FAILURE;
+}
+
+
+/*
+ * Sleep until the monotonic time when (nanoseconds).
+ */
+static void replayWaitUntil(uint64_t when)
+{
+	struct timespec ts;
+
+	ts.tv_sec = when / 1000000000ULL;
+	ts.tv_nsec = when % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+
+static void replayPrintRun(char *title, replay_run_t *run)
+{
+	double pps = (run->elapsed > 0) ? run->packets / run->elapsed : 0;
+	double mbps = (run->elapsed > 0) ? run->bytes * 8 / run->elapsed / 1e6 : 0;
+
+	printf("%s: %lu packets, %lu bytes in %.3f s (%.0f pps, %.2f Mbps), "
+	       "%lu dropped, %lu truncated, %lu skipped \n", title, run->packets, run->bytes,
+	       run->elapsed, pps, mbps, run->drops, run->truncated, run->skipped);
+}
+
+
+/*
+ * Inject one pass over the capture.
+ */
+static void replayOnePass(interface_t *iface)
+{
+	gpacket_t *in_pkt;
+	uchar *data;
+	uint32_t caplen, origlen;
+	uint64_t ts, first_ts = 0, start, next, gap;
+	int first = 1;
+
+	bzero(&replay.run, sizeof(replay_run_t));
+	gap = (replay.mode == REPLAY_MODE_PPS) ? (uint64_t)(1e9 / replay.pps) : 0;
+	start = next = replayNow();
+	replayRewind(&replay.file);
+
+	while (replay.running && (replayNext(&replay.file, &data, &caplen, &origlen, &ts) == EXIT_SUCCESS))
+	{
+		if (caplen < sizeof(in_pkt->data.header))
+		{
+			replay.run.skipped++;
+			continue;
+		}
+		if (replay.mode == REPLAY_MODE_ORIGINAL)
+		{
+			if (first)
+				first_ts = ts;
+			if (ts > first_ts)
+				replayWaitUntil(start + (ts - first_ts));
+		} else if (replay.mode == REPLAY_MODE_PPS)
+		{
+			replayWaitUntil(next);
+			next += gap;
+		}
+		first = 0;
+
+		if ((in_pkt = (gpacket_t *)malloc(sizeof(gpacket_t))) == NULL)
+		{
+			fatal("[replayOnePass]:: unable to allocate memory for packet.. ");
+			return;
+		}
+		bzero(in_pkt, sizeof(gpacket_t));
+		if (caplen > sizeof(pkt_data_t))
+		{
+			caplen = sizeof(pkt_data_t);
+			replay.run.truncated++;
+		}
+		memcpy(&(in_pkt->data), data, caplen);
+
+		// the same frame fields the fromXDev threads fill in
+		in_pkt->frame.src_interface = iface->interface_id;
+		COPY_MAC(in_pkt->frame.src_hw_addr, iface->mac_addr);
+		COPY_IP(in_pkt->frame.src_ip_addr, iface->ip_addr);
+		LATENCY_STAMP(in_pkt, LAT_RX);
+		parsePacket(in_pkt);
+
+		if (enqueuePacket(pcore, in_pkt, sizeof(gpacket_t), rconfig.openflow) == EXIT_FAILURE)
+			replay.run.drops++;
+		replay.run.packets++;
+		replay.run.bytes += caplen;
+	}
+	replay.run.elapsed = (replayNow() - start) / 1e9;
+}
+
+
+static void *replayHandler(void *arg)
+{
+	interface_t *iface;
+	char title[MAX_NAME_LEN + 32];          // "replay <path> pass <n>"
+
+	for (replay.loop = 1; replay.running && ((replay.loops == 0) || (replay.loop <= replay.loops)); replay.loop++)
+	{
+		if ((iface = findInterface(replay.iface)) == NULL)
+		{
+			error("[replayHandler]:: interface %d went away, replay stopped ", replay.iface);
+			break;
+		}
+		replayOnePass(iface);
+
+		replay.total.packets += replay.run.packets;
+		replay.total.bytes += replay.run.bytes;
+		replay.total.drops += replay.run.drops;
+		replay.total.truncated += replay.run.truncated;
+		replay.total.skipped += replay.run.skipped;
+		replay.total.elapsed += replay.run.elapsed;
+		snprintf(title, sizeof(title), "replay %s pass %d", replay.path, replay.loop);
+		replayPrintRun(title, &replay.run);
+
+		if (replay.run.packets == 0)
+			break;                      // nothing to replay, don't spin
+	}
+	replayPrintRun("replay total", &replay.total);
+	replayClose(&replay.file);
+	replay.running = 0;
+	return NULL;
+}
+
+
+int replayStart(char *path, int iface, int mode, double pps, int loops)
+{
+	if (replay.running)
+	{
+		error("[replayStart]:: a replay of %s is already running ", replay.path);
+		return EXIT_FAILURE;
+	}
+	if (findInterface(iface) == NULL)
+	{
+		error("[replayStart]:: interface %d does not exist ", iface);
+		return EXIT_FAILURE;
+	}
+	if ((mode == REPLAY_MODE_PPS) && (pps <= 0))
+	{
+		error("[replayStart]:: packet rate must be positive ");
+		return EXIT_FAILURE;
+	}
+	if (replay.threadid != 0)
+		pthread_join(replay.threadid, NULL);
+
+	bzero(&replay, sizeof(replay_config_t));
+	if (replayOpen(&replay.file, path) == EXIT_FAILURE)
+		return EXIT_FAILURE;
+	strncpy(replay.path, path, MAX_NAME_LEN - 1);
+	replay.iface = iface;
+	replay.mode = mode;
+	replay.pps = pps;
+	replay.loops = loops;
+	replay.running = 1;
+
+	if (pthread_create(&(replay.threadid), NULL, replayHandler, NULL) != 0)
+	{
+		error("[replayStart]:: unable to create the replay thread ");
+		replay.running = 0;
+		replay.threadid = 0;
+		replayClose(&replay.file);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+void replayStop()
+{
+	replay.running = 0;
+	if (replay.threadid != 0)
+	{
+		pthread_join(replay.threadid, NULL);
+		replay.threadid = 0;
+	}
+}
+
+
+void replayShow()
+{
+	char *modes[] = {"", "original", "pps", "fast"};
+
+	if (replay.path[0] == '\0')
+	{
+		printf("No replay started \n");
+		return;
+	}
+	printf("Replay %s into interface %d, mode %s", replay.path, replay.iface, modes[replay.mode]);
+	if (replay.mode == REPLAY_MODE_PPS)
+		printf(" (%.0f pps)", replay.pps);
+	if (replay.loops == 0)
+		printf(", loop %d of unlimited", replay.loop);
+	else
+		printf(", loop %d of %d", replay.loop, replay.loops);
+	printf(", %s \n", replay.running ? "running" : "finished");
+	if (replay.running)
+		printf("Current pass: %lu packets, %lu dropped \n", replay.run.packets, replay.run.drops);
+	replayPrintRun("Total", &replay.total);
+}
@@ -9,6 +9,7 @@
 #include "packetcore.h"
 #include "message.h"
 #include "grouter.h"
+#include "logging.h"
 
 /*
  * Roundrobin scheduler implementation -- when the roundrobin scheme is used, we need to use
@@ -53,6 +54,7 @@ void *roundRobinScheduler(void *pc)
 			if (rstatus == EXIT_SUCCESS)
 			{
 				pcore->lastqid = nextqid;
+				LATENCY_STAMP(in_pkt, LAT_SCHED);
 				writeQueue(pcore->workQ, in_pkt, pktsize);
 			}
 
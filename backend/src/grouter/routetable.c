@@ -6,6 +6,8 @@
 
 #include "routetable.h"
 #include "gnet.h"
+#include "logging.h"
+#include "probes.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -80,12 +82,16 @@ int findRouteEntry(route_entry_t route_tbl[], uchar *ip_addr, uchar *nhop, int *
 			COPY_IP(nhop, route_tbl[k].nexthop);
 
 		*ixface = route_tbl[k].interface;
+		TRACE(TRACE_ROUTE, TRACE_IP(ip_addr), TRACE_IP(nhop), *ixface);
+		PROBE3(route_hit, TRACE_IP(ip_addr), TRACE_IP(nhop), *ixface);
 
 		return EXIT_SUCCESS;
 	}
 	else
 	{
 		verbose(2, "[findRouteEntry]:: No match for %s in route table", IP2Dot(tmpbuf, ip_addr));
+		TRACE(TRACE_NO_ROUTE, TRACE_IP(ip_addr), 0, 0);
+		PROBE1(route_miss, TRACE_IP(ip_addr));
 		return EXIT_FAILURE;
 	}
 }
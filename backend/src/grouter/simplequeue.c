@@ -13,8 +13,23 @@
 #include <slack/list.h>
 #include <math.h>
 #include <time.h>
-#include <sys/time.h>
 #include "simplequeue.h"
+#include "logging.h"
+#include "probes.h"
+
+
+static __thread int qstats_slot = -1;
+static int qstats_nextslot = 0;
+
+
+// the statistics slot of the calling thread, assigned on its first use
+static inline qstats_slot_t *queueStatsSlot(simplequeue_t *sq)
+{
+	if (__builtin_expect(qstats_slot < 0, 0))
+		qstats_slot = __sync_fetch_and_add(&qstats_nextslot, 1) % QSTATS_SLOTS;
+	return &(sq->stats[qstats_slot]);
+}
+
 
 // For unbounded queues, set maxsize to 0.
 // For bounded queues, blockonwrite could be true or false. If true,
@@ -26,17 +41,19 @@ simplequeue_t *createSimpleQueue(char *name, int maxsize, int blockonwrite,
 {
 	simplequeue_t *msgqueue;
 
-	if ((msgqueue = (simplequeue_t *) malloc(sizeof(simplequeue_t))) == NULL)
+	// aligned so that the statistics slots fall on separate cache lines
+	if (posix_memalign((void **)&msgqueue, 64, sizeof(simplequeue_t)) != 0)
 	{
 		fatal("[createSimpleQueue]:: Could not allocate memory for message queue structure");
 		return NULL;
 	}
+	memset(msgqueue, 0, sizeof(simplequeue_t));
 	strcpy(msgqueue->name, name);
 	msgqueue->maxsize = maxsize;
 	msgqueue->cursize = 0;
 	msgqueue->bytesleft = 0;
 	msgqueue->avgbyterate = 0.0;
-	msgqueue->prevaccesstime = (long)time(NULL);
+	msgqueue->prevaccesstime = clockNow() * 1e-9;
 	msgqueue->blockonwrite = blockonwrite;
 	msgqueue->blockonread = blockonread;
 
@@ -123,6 +140,7 @@ int writeQueue(simplequeue_t *msgqueue, void *data, int size)
 	}
 	swrap->size = size;
 	swrap->data = data;
+	swrap->enqtime = clockPrecise();
 
 	pthread_mutex_lock(&(msgqueue->qlock));           // lock the queue..
 
@@ -134,6 +152,7 @@ int writeQueue(simplequeue_t *msgqueue, void *data, int size)
 			pthread_cond_wait(&(msgqueue->qfull), &(msgqueue->qlock));
 		else
 		{
+			queueStatsSlot(msgqueue)->taildrops++;
 			pthread_mutex_unlock(&(msgqueue->qlock));
 			free(swrap);
 			return EXIT_FAILURE;
@@ -142,15 +161,39 @@ int writeQueue(simplequeue_t *msgqueue, void *data, int size)
 	list_push(msgqueue->queue, swrap);
 	msgqueue->cursize++;
 	msgqueue->bytesleft += size;
+	queueStatsSlot(msgqueue)->enq_pkts++;
+	queueStatsSlot(msgqueue)->enq_bytes += size;
+	if (msgqueue->cursize > msgqueue->maxdepth)
+		msgqueue->maxdepth = msgqueue->cursize;
 
 	if ((msgqueue->cursize == 1) && (msgqueue->blockonread))
 		pthread_cond_signal(&(msgqueue->qempty));
 
 	pthread_mutex_unlock(&(msgqueue->qlock));
+	PROBE3(enqueue, msgqueue->name, data, size);
 	return EXIT_SUCCESS;
 }
 
 
+// called with the queue lock held for each element taken off the queue
+static void countDequeue(simplequeue_t *msgqueue, simplewrapper_t *swrap)
+{
+	qstats_slot_t *slot = queueStatsSlot(msgqueue);
+	uint64_t now = clockPrecise(), sojourn;
+
+	sojourn = (now > swrap->enqtime) ? (now - swrap->enqtime) : 0;
+	if ((slot->deq_pkts == 0) || (sojourn < slot->sojourn_min))
+		slot->sojourn_min = sojourn;
+	if (sojourn > slot->sojourn_max)
+		slot->sojourn_max = sojourn;
+	slot->sojourn_sum += sojourn;
+	slot->deq_pkts++;
+	slot->deq_bytes += swrap->size;
+	// RED measures idle time against clockNow(), so stamp it from the same view
+	msgqueue->lastdeqtime = clockNow();
+}
+
+
 // TODO: We need to shorten this function.. it is bit long!
 // Just reorganize the loops .. lots of redundant statements.
 int readQueue(simplequeue_t *msgqueue, void **data, int *size)
@@ -165,6 +208,7 @@ int readQueue(simplequeue_t *msgqueue, void **data, int *size)
 		{
 			pthread_cond_wait(&(msgqueue->qempty), &(msgqueue->qlock));
 			swrap = list_shift(msgqueue->queue);
+			countDequeue(msgqueue, swrap);
 			*size = swrap->size;
 			*data = swrap->data;
 			swrap->data = NULL;
@@ -182,6 +226,7 @@ int readQueue(simplequeue_t *msgqueue, void **data, int *size)
 	{
 		msgqueue->cursize--;
 		swrap = list_shift(msgqueue->queue);
+		countDequeue(msgqueue, swrap);
 		*size = swrap->size;
 		*data = swrap->data;
 		swrap->data = NULL;
@@ -192,44 +237,106 @@ int readQueue(simplequeue_t *msgqueue, void **data, int *size)
 	}
 	pthread_mutex_unlock(&(msgqueue->qlock));
 	if (rvalue == EXIT_SUCCESS)
+	{
 		free(swrap);
+		PROBE3(dequeue, msgqueue->name, *data, *size);
+	}
 
-	if (rvalue == EXIT_SUCCESS)
-		computeAvgByteRate(msgqueue, *size);
 	return rvalue;
 }
 
 
+// folds size bytes dequeued since the previous call into the average rate
 void computeAvgByteRate(simplequeue_t *sq, int size)
 {
 	double curraccesstime, tinterval, mfactor;
-	struct timeval tval;
 
-	gettimeofday(&tval, NULL);
-	curraccesstime = tval.tv_usec * 0.000001;
-	curraccesstime += tval.tv_sec;
+	curraccesstime = clockNow() * 1e-9;
 	tinterval = curraccesstime - sq->prevaccesstime;
+	if (tinterval <= 0)
+		return;
 	sq->prevaccesstime = curraccesstime;
 	mfactor = exp(-1.0 * tinterval);
 	sq->avgbyterate = (1 - mfactor)* (size/tinterval) + mfactor * sq->avgbyterate;
 }
 
 
+/*
+ * The average is no longer updated on every read; it is brought up to date
+ * from the dequeued byte count when somebody asks for it.
+ */
 double getAvgByteRate(simplequeue_t *sq)
 {
-	double curraccesstime;
-	struct timeval tval;
+	qstats_t st;
 
-	gettimeofday(&tval, NULL);
-	curraccesstime = tval.tv_usec * 0.000001;
-	curraccesstime += tval.tv_sec;
-	if ((curraccesstime - sq->prevaccesstime) > 1.0)
-		computeAvgByteRate(sq, 0);
+	getQueueStats(sq, &st);
+	computeAvgByteRate(sq, (int)(st.deq_bytes - sq->ratebytes));
+	sq->ratebytes = st.deq_bytes;
 
 	return sq->avgbyterate;
 }
 
 
+// reason is QSTATS_TAILDROP or QSTATS_REDDROP
+void countQueueDrop(simplequeue_t *sq, int reason)
+{
+	if (reason == QSTATS_REDDROP)
+		queueStatsSlot(sq)->reddrops++;
+	else
+		queueStatsSlot(sq)->taildrops++;
+}
+
+
+/*
+ * Adds up the slots without taking the queue lock; a reader running
+ * alongside the data path may see a packet counted as enqueued but not
+ * yet as dequeued, which is fine for statistics.
+ */
+void getQueueStats(simplequeue_t *sq, qstats_t *st)
+{
+	qstats_slot_t *slot;
+	uint64_t sojourn_sum = 0;
+	int i;
+
+	memset(st, 0, sizeof(qstats_t));
+	for (i = 0; i < QSTATS_SLOTS; i++)
+	{
+		slot = &(sq->stats[i]);
+		st->enq_pkts += slot->enq_pkts;
+		st->enq_bytes += slot->enq_bytes;
+		st->taildrops += slot->taildrops;
+		st->reddrops += slot->reddrops;
+		if (slot->deq_pkts == 0)
+			continue;
+		if ((st->deq_pkts == 0) || (slot->sojourn_min < st->sojourn_min))
+			st->sojourn_min = slot->sojourn_min;
+		if (slot->sojourn_max > st->sojourn_max)
+			st->sojourn_max = slot->sojourn_max;
+		st->deq_pkts += slot->deq_pkts;
+		st->deq_bytes += slot->deq_bytes;
+		sojourn_sum += slot->sojourn_sum;
+	}
+	st->maxdepth = sq->maxdepth;
+	if (st->deq_pkts > 0)
+		st->sojourn_avg = sojourn_sum / st->deq_pkts;
+}
+
+
+// one line of the "queue stats" table; sojourn times in microseconds
+void printSimpleQueueStats(simplequeue_t *sq)
+{
+	qstats_t st;
+
+	getQueueStats(sq, &st);
+	printf("%-12s %6d %6d %10llu %12llu %10llu %12llu %8llu %8llu %9.2f %9.2f %9.2f\n",
+	       sq->name, sq->cursize, st.maxdepth,
+	       (unsigned long long)st.enq_pkts, (unsigned long long)st.enq_bytes,
+	       (unsigned long long)st.deq_pkts, (unsigned long long)st.deq_bytes,
+	       (unsigned long long)st.taildrops, (unsigned long long)st.reddrops,
+	       st.sojourn_min / 1e3, st.sojourn_avg / 1e3, st.sojourn_max / 1e3);
+}
+
+
 
 
 
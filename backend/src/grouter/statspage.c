@@ -0,0 +1,314 @@
+/*
+ * statspage.c (publishes the router counters in a shared memory page)
+ *
+ * A thread gathers the interface, queue, drop, table and OpenFlow counters into
+ * a private copy of the page every interval and then copies it into the
+ * mapped file under the sequence lock, so the window in which readers have
+ * to retry is a single memcpy. Gathering only reads counters that the data
+ * path keeps anyway; no lock on the forwarding path is taken except the
+ * flowtable lock for the OpenFlow table statistics.
+ */
+
+#include "statspage.h"
+#include "grouter.h"
+#include "gnet.h"
+#include "packetcore.h"
+#include "classifier.h"
+#include "filter.h"
+#include "routetable.h"
+#include "arp.h"
+#include "drop.h"
+#include "openflow_flowtable.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <slack/std.h>
+#include <slack/err.h>
+
+extern pktcore_t *pcore;
+extern classlist_t *classifier;
+extern filtertab_t *filter;
+extern router_config rconfig;
+extern interface_array_t netarray;
+extern route_entry_t route_tbl[MAX_ROUTES];
+extern arp_entry_t ARPtable[MAX_ARP];
+extern arp_entry_t arp_cache[ARP_CACHE_SIZE];
+
+static stats_page_t *stats_page = NULL;
+static stats_page_t stats_snap;
+static char stats_path[MAX_NAME_LEN];
+static volatile int stats_interval_ms = STATS_DEFAULT_INTERVAL_MS;
+static pthread_t stats_threadid;
+
+
+static uint64_t statsClock(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void statsCollectInterfaces(stats_page_t *snap)
+{
+	interface_t *iface;
+	stats_iface_t *si;
+	int i, j;
+
+	snap->num_ifaces = 0;
+	for (i = 0; (i < MAX_INTERFACES) && (snap->num_ifaces < STATS_MAX_IFACES); i++)
+	{
+		if ((iface = netarray.elem[i]) == NULL)
+			continue;
+		si = &(snap->ifaces[snap->num_ifaces++]);
+		memset(si, 0, sizeof(stats_iface_t));
+		snprintf(si->name, sizeof(si->name), "%s", iface->device_name);
+		si->interface_id = iface->interface_id;
+		si->state = iface->state;
+		si->mtu = iface->device_mtu;
+		memcpy(si->mac_addr, iface->mac_addr, 6);
+		// interface addresses are kept with the first octet last
+		for (j = 0; j < 4; j++)
+			si->ip_addr[j] = iface->ip_addr[3 - j];
+		si->rx_pkts = iface->rx_pkts;
+		si->rx_bytes = iface->rx_bytes;
+		si->tx_pkts = iface->tx_pkts;
+		si->tx_bytes = iface->tx_bytes;
+	}
+}
+
+
+// needs the interface rows, so it runs after statsCollectInterfaces
+static void statsCollectDrops(stats_page_t *snap)
+{
+	stats_drops_t *d = &(snap->drops);
+	int i, r;
+
+	for (i = 0; i < snap->num_ifaces; i++)
+		for (r = 0; r < d->num_reasons; r++)
+			d->ifaces[i][r] = getDropCount(snap->ifaces[i].interface_id, r);
+	for (r = 0; r < d->num_reasons; r++)
+		d->local[r] = getDropCount(-1, r);
+}
+
+
+static void statsCollectQueue(stats_page_t *snap, simplequeue_t *sq)
+{
+	stats_queue_t *sqs;
+	qstats_t st;
+
+	if ((sq == NULL) || (snap->num_queues >= STATS_MAX_QUEUES))
+		return;
+
+	getQueueStats(sq, &st);
+	sqs = &(snap->queues[snap->num_queues++]);
+	memset(sqs, 0, sizeof(stats_queue_t));
+	// queue names may be longer than the page keeps
+	snprintf(sqs->name, sizeof(sqs->name), "%.*s", (int)sizeof(sqs->name) - 1, sq->name);
+	sqs->depth = sq->cursize;
+	sqs->maxsize = sq->maxsize;
+	sqs->maxdepth = st.maxdepth;
+	sqs->enq_pkts = st.enq_pkts;
+	sqs->enq_bytes = st.enq_bytes;
+	sqs->deq_pkts = st.deq_pkts;
+	sqs->deq_bytes = st.deq_bytes;
+	sqs->taildrops = st.taildrops;
+	sqs->reddrops = st.reddrops;
+	sqs->sojourn_min_ns = st.sojourn_min;
+	sqs->sojourn_avg_ns = st.sojourn_avg;
+	sqs->sojourn_max_ns = st.sojourn_max;
+}
+
+
+static void statsCollectQueues(stats_page_t *snap)
+{
+	List *keylst;
+	Lister *klster;
+	char *nxtkey;
+	int i;
+
+	snap->num_queues = 0;
+	if (pcore == NULL)
+		return;
+
+	keylst = map_keys(pcore->queues);
+	klster = lister_create(keylst);
+	while ((nxtkey = (char *)lister_next(klster)) != NULL)
+		statsCollectQueue(snap, map_get(pcore->queues, nxtkey));
+	lister_release(klster);
+	list_release(keylst);
+
+	statsCollectQueue(snap, pcore->workQ);
+	for (i = 0; i < pcore->openflowworkers; i++)
+		statsCollectQueue(snap, pcore->openflowWorkQ[i]);
+	statsCollectQueue(snap, pcore->outputQ);
+}
+
+
+static void statsCollectTables(stats_page_t *snap)
+{
+	stats_tables_t *t = &(snap->tables);
+	int i;
+
+	memset(t, 0, sizeof(stats_tables_t));
+	t->max_routes = MAX_ROUTES;
+	for (i = 0; i < MAX_ROUTES; i++)
+		if (route_tbl[i].is_empty == FALSE)
+			t->routes++;
+	t->max_arp_entries = MAX_ARP;
+	for (i = 0; i < MAX_ARP; i++)
+		if (ARPtable[i].is_empty == FALSE)
+			t->arp_entries++;
+	t->arp_cache_size = ARP_CACHE_SIZE;
+	for (i = 0; i < ARP_CACHE_SIZE; i++)
+		if (arp_cache[i].is_empty == FALSE)
+			t->arp_cache_entries++;
+	if (classifier != NULL)
+		t->classes = classifier->defcnt;
+	t->max_filter_rules = MAX_FILTER_RULES;
+	if (filter != NULL)
+		t->filter_rules = filter->rulecnt;
+}
+
+
+static void statsCollectOpenflow(stats_page_t *snap)
+{
+	ofp_table_stats tstats;
+	uint32_t i;
+
+	memset(&(snap->openflow), 0, sizeof(stats_openflow_t));
+	if (!rconfig.openflow)
+		return;
+
+	// the page has one set of flow counters, so add up the tables
+	snap->openflow.enabled = 1;
+	for (i = 0; i < OPENFLOW_NUM_TABLES; i++)
+	{
+		tstats = openflow_flowtable_get_table_stats(i);
+		snap->openflow.active_flows += ntohl(tstats.active_count);
+		snap->openflow.max_flows += ntohl(tstats.max_entries);
+		snap->openflow.lookups += ntohll(tstats.lookup_count);
+		snap->openflow.matched += ntohll(tstats.matched_count);
+	}
+}
+
+
+// copies the body of the snapshot into the shared page under the seqlock
+static void statsPagePublish(stats_page_t *snap)
+{
+	uint32_t seq = stats_page->seq;
+
+	__atomic_store_n(&(stats_page->seq), seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy((char *)stats_page + STATS_PAGE_BODY, (char *)snap + STATS_PAGE_BODY,
+	       sizeof(stats_page_t) - STATS_PAGE_BODY);
+	__atomic_store_n(&(stats_page->seq), seq + 2, __ATOMIC_RELEASE);
+}
+
+
+void *statsPageHandler(void *arg)
+{
+	struct timespec delay;
+
+	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+	while (1)
+	{
+		delay.tv_sec = stats_interval_ms / 1000;
+		delay.tv_nsec = (stats_interval_ms % 1000) * 1000000L;
+		nanosleep(&delay, NULL);
+		pthread_testcancel();
+
+		statsCollectInterfaces(&stats_snap);
+		statsCollectDrops(&stats_snap);
+		statsCollectQueues(&stats_snap);
+		statsCollectTables(&stats_snap);
+		statsCollectOpenflow(&stats_snap);
+		stats_snap.interval_ms = stats_interval_ms;
+		stats_snap.update_ns = statsClock(CLOCK_MONOTONIC);
+		stats_snap.update_realtime_ns = statsClock(CLOCK_REALTIME);
+		stats_snap.updates++;
+		statsPagePublish(&stats_snap);
+	}
+	return NULL;
+}
+
+
+/*
+ * Creates <config_dir>/<rname>.stats, maps it and starts the thread that
+ * keeps it up to date. The router runs without the page if this fails.
+ */
+int statsPageInit(char *config_dir, char *rname)
+{
+	void *addr;
+	int fd, i;
+
+	sprintf(stats_path, "%s/%s.%s", (config_dir != NULL) ? config_dir : ".", rname, "stats");
+	if ((fd = open(stats_path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0)
+	{
+		error("[statsPageInit]:: unable to create the stats page %s ", stats_path);
+		return EXIT_FAILURE;
+	}
+	if (ftruncate(fd, sizeof(stats_page_t)) < 0)
+	{
+		error("[statsPageInit]:: unable to size the stats page %s ", stats_path);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	addr = mmap(NULL, sizeof(stats_page_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+	{
+		error("[statsPageInit]:: unable to map the stats page %s ", stats_path);
+		return EXIT_FAILURE;
+	}
+
+	stats_page = (stats_page_t *)addr;
+	memset(&stats_snap, 0, sizeof(stats_page_t));
+	stats_snap.pid = getpid();
+	snprintf(stats_snap.router_name, sizeof(stats_snap.router_name), "%s", rname);
+	stats_snap.drops.num_reasons = (DROP_REASONS < STATS_DROP_REASONS) ? DROP_REASONS : STATS_DROP_REASONS;
+	for (i = 0; i < stats_snap.drops.num_reasons; i++)
+		snprintf(stats_snap.drops.reasons[i], sizeof(stats_snap.drops.reasons[i]), "%s", dropReasonName(i));
+	stats_page->magic = STATS_PAGE_MAGIC;
+	stats_page->version = STATS_PAGE_VERSION;
+	stats_page->size = sizeof(stats_page_t);
+	stats_page->seq = 0;
+
+	if (pthread_create(&stats_threadid, NULL, statsPageHandler, NULL) != 0)
+	{
+		error("[statsPageInit]:: unable to create the stats page thread ");
+		return EXIT_FAILURE;
+	}
+	verbose(2, "[statsPageInit]:: publishing statistics in %s ", stats_path);
+	return EXIT_SUCCESS;
+}
+
+
+void statsPageSetInterval(int interval_ms)
+{
+	if (interval_ms < 1)
+	{
+		printf("stats:: the update interval must be at least 1 ms \n");
+		return;
+	}
+	stats_interval_ms = interval_ms;
+}
+
+
+void statsPageShow()
+{
+	if (stats_page == NULL)
+	{
+		printf("Statistics page is not available \n");
+		return;
+	}
+	printf("Statistics page: %s (version %d, %d bytes) \n", stats_path, STATS_PAGE_VERSION,
+	       (int)sizeof(stats_page_t));
+	printf("Update interval: %d ms, updates so far: %llu \n", stats_interval_ms,
+	       (unsigned long long)stats_snap.updates);
+}
@@ -15,8 +15,10 @@
 #include "gnet.h"
 #include "arp.h"
 #include "ip.h"
+#include "drop.h"
 #include "ethernet.h"
 #include "tapio.h"
+#include "logging.h"
 #include <netinet/in.h>
 #include <stdlib.h>
 
@@ -101,7 +103,7 @@ void* fromTapDev(void *arg)
 			(COMPARE_MAC(in_pkt->data.header.dst, bcast_mac) != 0))
 		{
 			verbose(1, "[fromTapDev]:: Packet[%d] dropped .. not for this router!? ", pktsize);
-			free(in_pkt);
+			dropPacket(in_pkt, iface->interface_id, DROP_NOT_FOR_ME);
 			continue;
 		}
 
@@ -109,12 +111,15 @@ void* fromTapDev(void *arg)
 		in_pkt->frame.src_interface = iface->interface_id;
 		COPY_MAC(in_pkt->frame.src_hw_addr, iface->mac_addr);
 		COPY_IP(in_pkt->frame.src_ip_addr, iface->ip_addr);
+		LATENCY_STAMP(in_pkt, LAT_RX);
+		GNETCountRx(iface, in_pkt);
+		parsePacket(in_pkt);
 
 		// check for filtering.. if the it should be filtered.. then drop
 		if (filteredPacket(filter, in_pkt))
 		{
 			verbose(2, "[fromTapDev]:: Packet filtered..!");
-			free(in_pkt);
+			dropPacket(in_pkt, iface->interface_id, DROP_FILTERED);
 			continue;   // skip the rest of the loop
 		}
 
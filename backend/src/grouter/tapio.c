@@ -8,6 +8,7 @@
 #include "vpl.h"
 #include "simplequeue.h"
 #include "message.h"
+#include "logging.h"
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -54,6 +54,7 @@
 #include "tcp.h"
 #include "tcp_impl.h"
 #include "debug.h"
+#include "timer.h"
 
 /**
  * Calculates the TCP checksum for the specified TCP packet.
@@ -1650,8 +1651,36 @@ tcp_pcbs_sane(void)
 }
 #endif /* TCP_DEBUG */
 
+/** Drives tcp_tmr() while there are PCBs that need it */
+static router_timer_t tcp_tmr_timer;
+static u8_t tcp_tmr_timer_active;
+
+/**
+ * Timer handler, called every TCP_TMR_INTERVAL on the timer thread. The
+ * timer stops once no active or TIME-WAIT PCB is left, so an idle stack
+ * costs nothing, and tcp_timer_needed() starts it again.
+ */
+static void
+tcp_tmr_handler(void *arg)
+{
+  LOCK_TCPIP_CORE();
+  tcp_tmr();
+  if (tcp_active_pcbs == NULL && tcp_tw_pcbs == NULL) {
+    tcp_tmr_timer_active = 0;
+    timerStop(&tcp_tmr_timer);
+  }
+  UNLOCK_TCPIP_CORE();
+}
+
+/**
+ * Called from TCP_REG when a PCB is registered, with the core lock held.
+ */
 void
 tcp_timer_needed(void)
 {
+  if (!tcp_tmr_timer_active && (tcp_active_pcbs != NULL || tcp_tw_pcbs != NULL)) {
+    tcp_tmr_timer_active = 1;
+    timerStart(&tcp_tmr_timer, TCP_TMR_INTERVAL, TCP_TMR_INTERVAL, tcp_tmr_handler, NULL);
+  }
 }
 
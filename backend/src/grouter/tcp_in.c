@@ -47,6 +47,7 @@
 #include "ip.h"
 #include "tcp_impl.h"
 #include "memp.h"
+#include "probes.h"
 
 /* These variables are global to all functions involved in the input
    processing of TCP segments. They are set by the tcp_input()
@@ -93,6 +94,7 @@ tcp_input(struct pbuf *p, gpacket_t *in_pkt)
   err_t err;
 
   PERF_START;
+  PROBE2(tcp_input, in_pkt, p->tot_len);
 
   iphdr = (ip_packet_t *)p->payload;
   tcphdr = (struct tcp_hdr *)((u8_t *)p->payload + IPH_HL(iphdr) * 4);
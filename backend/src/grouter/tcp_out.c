@@ -46,6 +46,7 @@
 #include "tcp_impl.h"
 #include "memp.h"
 #include "inet_chksum.h"
+#include "probes.h"
 
 /* Define some copy-macros for checksum-on-copy so that the code looks
    nicer by preventing too many ifdef's. */
@@ -774,6 +775,7 @@ tcp_output(struct tcp_pcb *pcb)
   if (tcp_input_pcb == pcb) {
     return ERR_OK;
   }
+  PROBE3(tcp_output, pcb, pcb->local_port, pcb->remote_port);
 
   wnd = LWIP_MIN(pcb->snd_wnd, pcb->cwnd);
 
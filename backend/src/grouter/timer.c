@@ -0,0 +1,157 @@
+/*
+ * timer.c (the timer thread and the list of armed timers)
+ */
+
+#include "timer.h"
+#include "clock.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <slack/std.h>
+#include <slack/err.h>
+
+
+static router_timer_t *timer_list;          // armed timers, earliest deadline first
+static router_timer_t *timer_running;       // timer whose handler is being called
+static pthread_mutex_t timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;           // the list changed or a handler returned
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+static pthread_t timer_threadid;
+static int timer_status = EXIT_FAILURE;
+
+
+static void timerLink(router_timer_t *timer)
+{
+	router_timer_t **prev = &timer_list;
+
+	while ((*prev != NULL) && ((*prev)->expires <= timer->expires))
+		prev = &(*prev)->next;
+	timer->next = *prev;
+	*prev = timer;
+	timer->armed = 1;
+}
+
+
+static void timerUnlink(router_timer_t *timer)
+{
+	router_timer_t **prev;
+
+	for (prev = &timer_list; *prev != NULL; prev = &(*prev)->next)
+		if (*prev == timer)
+		{
+			*prev = timer->next;
+			break;
+		}
+	timer->next = NULL;
+	timer->armed = 0;
+}
+
+
+void *timerHandler(void *arg)
+{
+	router_timer_t *timer;
+	timer_handler_t handler;
+	struct timespec deadline;
+	uint64_t now;
+
+	pthread_mutex_lock(&timer_mutex);
+	while (1)
+	{
+		timer = timer_list;
+		if (timer == NULL)
+		{
+			pthread_cond_wait(&timer_cond, &timer_mutex);
+			continue;
+		}
+		// the cached clock may lag the deadline by a tick, so read the real one
+		now = clockRead(CLOCK_MONOTONIC);
+		if (now < timer->expires)
+		{
+			deadline.tv_sec = timer->expires / 1000000000ULL;
+			deadline.tv_nsec = timer->expires % 1000000000ULL;
+			pthread_cond_timedwait(&timer_cond, &timer_mutex, &deadline);
+			continue;
+		}
+
+		timerUnlink(timer);
+		if (timer->period_ns > 0)
+		{
+			// stay on the period, but skip the runs a late handler missed
+			timer->expires += timer->period_ns;
+			if (timer->expires <= now)
+				timer->expires = now + timer->period_ns;
+			timerLink(timer);
+		}
+		handler = timer->handler;
+		arg = timer->arg;
+		timer_running = timer;
+		pthread_mutex_unlock(&timer_mutex);
+
+		handler(arg);
+
+		pthread_mutex_lock(&timer_mutex);
+		timer_running = NULL;
+		pthread_cond_broadcast(&timer_cond);
+	}
+	return NULL;
+}
+
+
+static void timerCreateThread()
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&timer_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_create(&timer_threadid, NULL, timerHandler, NULL) != 0)
+	{
+		error("[timerInit]:: unable to create the timer thread ");
+		return;
+	}
+	timer_status = EXIT_SUCCESS;
+	verbose(2, "[timerInit]:: timer thread started ");
+}
+
+
+/*
+ * Starts the timer thread. timerStart() calls this as well, so timers can
+ * be armed before the router has called it.
+ */
+int timerInit()
+{
+	pthread_once(&timer_once, timerCreateThread);
+	return timer_status;
+}
+
+
+void timerStart(router_timer_t *timer, int delay_ms, int period_ms, timer_handler_t handler, void *arg)
+{
+	timerInit();
+
+	pthread_mutex_lock(&timer_mutex);
+	if (timer->armed)
+		timerUnlink(timer);
+	timer->handler = handler;
+	timer->arg = arg;
+	timer->period_ns = (period_ms > 0) ? period_ms * 1000000ULL : 0;
+	timer->expires = clockRead(CLOCK_MONOTONIC) + ((delay_ms > 0) ? delay_ms * 1000000ULL : 0);
+	timerLink(timer);
+	// wake the thread in case this deadline is now the earliest
+	pthread_cond_broadcast(&timer_cond);
+	pthread_mutex_unlock(&timer_mutex);
+}
+
+
+void timerStop(router_timer_t *timer)
+{
+	pthread_mutex_lock(&timer_mutex);
+	if (timer->armed)
+		timerUnlink(timer);
+	// a handler stopping its own timer cannot wait for itself
+	if ((timer_running == timer) && !pthread_equal(pthread_self(), timer_threadid))
+		while (timer_running == timer)
+			pthread_cond_wait(&timer_cond, &timer_mutex);
+	pthread_mutex_unlock(&timer_mutex);
+}
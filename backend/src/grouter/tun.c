@@ -5,6 +5,9 @@
  * Licensed under the GPL.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                                 // recvmmsg()
+#endif
 #include <slack/err.h>
 #include "tun.h"
 #include "packetcore.h"
@@ -15,12 +18,29 @@
 #include "gnet.h"
 #include "arp.h"
 #include "ip.h"
+#include "drop.h"
 #include "ethernet.h"
+#include "logging.h"
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef IP_MTU
+#define IP_MTU 14
+#endif
+
 extern pktcore_t *pcore;
 extern classlist_t *classifier;
 extern filtertab_t *filter;
@@ -28,6 +48,14 @@ extern filtertab_t *filter;
 
 extern router_config rconfig;
 
+// batching state of the tun interfaces, NULL for per packet interfaces
+static tun_batch_t *tun_batch[MAX_INTERFACES];
+
+static int tun_recvfrom(vpl_data_t *vpl, void *buf, int len);
+static int tun_sendto(vpl_data_t *vpl, void *buf, int len);
+static void *fromTunBatchDev(interface_t *iface, tun_batch_t *tb);
+
+
 void *toTunDev(void *arg)
 {
 	gpacket_t *inpkt = (gpacket_t *)arg;
@@ -47,6 +75,16 @@ void *toTunDev(void *arg)
 			COPY_MAC(apkt->src_hw_addr, iface->mac_addr);
 			COPY_IP(apkt->src_ip_addr, gHtonl(tmpbuf, iface->ip_addr));
 		}
+		if (tun_batch[iface->interface_id] != NULL)
+		{
+			// the batch thread sends and frees the packet
+			if (writeQueue(tun_batch[iface->interface_id]->txq, inpkt, sizeof(gpacket_t)) == EXIT_FAILURE)
+			{
+				verbose(2, "[toTunDev]:: batch queue full, packet dropped ");
+				dropPacket(inpkt, iface->interface_id, DROP_TX_FULL);
+			}
+			return arg;
+		}
 		pkt_size = findPacketSize(&(inpkt->data));
 		verbose(2, "[toTunDev]:: tun_sendto called for interface %d.. ", iface->interface_id);
 		tun_sendto(iface->vpl_data, &(inpkt->data), pkt_size);
@@ -59,16 +97,57 @@ void *toTunDev(void *arg)
 }
 
 
+/*
+ * Common receive path: check the destination MAC, tag the packet with
+ * the incoming interface, filter and enqueue. Frees the packet when it
+ * is not accepted.
+ */
+static void tunDeliverPacket(interface_t *iface, gpacket_t *in_pkt, int pktsize)
+{
+    uchar bcast_mac[] = MAC_BCAST_ADDR;
+    char tmpbuf[MAX_TMPBUF_LEN];
+
+    verbose(2, "[fromTunDev]:: Destination MAC is %s ", MAC2Colon(tmpbuf, in_pkt->data.header.dst));
+
+    if ((COMPARE_MAC(in_pkt->data.header.dst, iface->mac_addr) != 0) &&
+            (COMPARE_MAC(in_pkt->data.header.dst, bcast_mac) != 0))
+    {
+        verbose(1, "[fromTunDev]:: Packet[%d] dropped .. not for this router!? ", pktsize);
+        dropPacket(in_pkt, iface->interface_id, DROP_NOT_FOR_ME);
+        return;
+    }
+
+    // copy fields into the message from the packet..
+    in_pkt->frame.src_interface = iface->interface_id;
+    COPY_MAC(in_pkt->frame.src_hw_addr, iface->mac_addr);
+    COPY_IP(in_pkt->frame.src_ip_addr, iface->ip_addr);
+    LATENCY_STAMP(in_pkt, LAT_RX);
+    GNETCountRx(iface, in_pkt);
+    parsePacket(in_pkt);
+
+    // check for filtering.. if the it should be filtered.. then drop
+    if (filteredPacket(filter, in_pkt))
+    {
+        verbose(2, "[fromTunDev]:: Packet filtered..!");
+        dropPacket(in_pkt, iface->interface_id, DROP_FILTERED);
+        return;
+    }
+
+    verbose(2, "[fromTunDev]:: Packet is sent for enqueuing..");
+    enqueuePacket(pcore, in_pkt, sizeof(gpacket_t), rconfig.openflow);
+}
+
+
 void* fromTunDev(void *arg)
 {
     interface_t *iface = (interface_t *) arg;
-    interface_array_t *iarr = (interface_array_t *)iface->iarray;
-    uchar bcast_mac[] = MAC_BCAST_ADDR;
     gpacket_t *in_pkt;
     int pktsize;
-    char tmpbuf[MAX_TMPBUF_LEN];
-    
+
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);		// die as soon as cancelled
+    if (tun_batch[iface->interface_id] != NULL)
+        return fromTunBatchDev(iface, tun_batch[iface->interface_id]);
+
     while (1)
     {
         verbose(2, "[fromTunDev]:: Receiving a packet ...");
@@ -81,32 +160,8 @@ void* fromTunDev(void *arg)
         bzero(in_pkt, sizeof(gpacket_t));
         pktsize = tun_recvfrom(iface->vpl_data, &(in_pkt->data), sizeof(pkt_data_t));
         pthread_testcancel();
-        
-        verbose(2, "[fromTunDev]:: Destination MAC is %s ", MAC2Colon(tmpbuf, in_pkt->data.header.dst));
-      
-        if ((COMPARE_MAC(in_pkt->data.header.dst, iface->mac_addr) != 0) &&
-                (COMPARE_MAC(in_pkt->data.header.dst, bcast_mac) != 0))
-        {
-            verbose(1, "[fromTunDev]:: Packet[%d] dropped .. not for this router!? ", pktsize);
-            free(in_pkt);
-            continue;
-        }
-
-        // copy fields into the message from the packet..
-        in_pkt->frame.src_interface = iface->interface_id;
-        COPY_MAC(in_pkt->frame.src_hw_addr, iface->mac_addr);
-        COPY_IP(in_pkt->frame.src_ip_addr, iface->ip_addr);
 
-        // check for filtering.. if the it should be filtered.. then drop
-        if (filteredPacket(filter, in_pkt))
-        {
-            verbose(2, "[fromTunDev]:: Packet filtered..!");
-            free(in_pkt);
-            continue;   // skip the rest of the loop
-        }
-
-        verbose(2, "[fromTunDev]:: Packet is sent for enqueuing..");
-        enqueuePacket(pcore, in_pkt, sizeof(gpacket_t), rconfig.openflow);
+        tunDeliverPacket(iface, in_pkt, pktsize);
     }
 }
 
@@ -167,7 +222,7 @@ vpl_data_t *tun_connect(short int src_port, uchar* src_IP,
     return pri;
 }
 
-int tun_recvfrom(vpl_data_t *vpl, void *buf, int len)
+static int tun_recvfrom(vpl_data_t *vpl, void *buf, int len)
 {
     int n, rcv_addr_len;
     struct sockaddr_in* dstaddr = (struct sockaddr_in*)vpl->data_addr;
@@ -192,7 +247,7 @@ int tun_recvfrom(vpl_data_t *vpl, void *buf, int len)
         
 }
 
-int tun_sendto(vpl_data_t *vpl, void *buf, int len)
+static int tun_sendto(vpl_data_t *vpl, void *buf, int len)
 {
     int n;
     struct sockaddr_in* dstaddr = (struct sockaddr_in*)vpl->data_addr;
@@ -209,3 +264,383 @@ int tun_sendto(vpl_data_t *vpl, void *buf, int len)
 }
 
 
+/*
+ * Batched tunnel mode
+ */
+
+/*
+ * Send the packed segments in buf. With UDP_SEGMENT the kernel cuts the
+ * buffer into seg_size datagrams (the last one may be shorter) in a single
+ * sendmsg(). If the kernel refuses segmentation, fall back to one
+ * datagram per segment for the rest of the interface's life.
+ */
+static int tun_sendmsg_batch(vpl_data_t *vpl, tun_batch_t *tb, uchar *buf, int len, int nsegs)
+{
+    struct sockaddr_in* dstaddr = (struct sockaddr_in*)vpl->data_addr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cm;
+    char ctrl[CMSG_SPACE(sizeof(uint16_t))];
+    int off;
+
+    if (tb->gso && nsegs > 1)
+    {
+        bzero(&msg, sizeof(msg));
+        iov.iov_base = buf;
+        iov.iov_len = len;
+        msg.msg_name = dstaddr;
+        msg.msg_namelen = sizeof(*dstaddr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *((uint16_t *)CMSG_DATA(cm)) = tb->seg_size;
+
+        tb->tx_calls++;
+        if (sendmsg(vpl->data, &msg, 0) != -1)
+            return EXIT_SUCCESS;
+        if ((errno != EIO) && (errno != EINVAL) && (errno != EMSGSIZE) && (errno != ENOPROTOOPT))
+        {
+            verbose(2, "[tun_sendmsg_batch]:: unable to send batch, error = %s", strerror(errno));
+            return EXIT_FAILURE;
+        }
+        verbose(1, "[tun_sendmsg_batch]:: UDP_SEGMENT not usable (%s), sending segments one by one", strerror(errno));
+        tb->gso = 0;
+    }
+
+    for (off = 0; off < len; off += tb->seg_size)
+    {
+        tb->tx_calls++;
+        if (tun_sendto(vpl, buf + off, ((len - off) < tb->seg_size) ? (len - off) : tb->seg_size) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+static void tunBatchUnlockQueue(void *arg)
+{
+    pthread_mutex_unlock(&(((simplequeue_t *)arg)->qlock));
+}
+
+
+/*
+ * readQueue() for the transmit thread, which may be cancelled in it. The
+ * cleanup handler is pushed here so that no variable of the caller is live
+ * across the setjmp of pthread_cleanup_push.
+ */
+static int tunBatchReadQueue(simplequeue_t *txq, gpacket_t **inpkt, int *inbytes)
+{
+    int rvalue;
+
+    pthread_cleanup_push(tunBatchUnlockQueue, txq);
+    rvalue = readQueue(txq, (void **)inpkt, inbytes);
+    pthread_cleanup_pop(0);
+    return rvalue;
+}
+
+
+/*
+ * Send one batch: blocks for the first packet, then drains whatever else is
+ * already queued (up to a batch) so a lone packet is never held back waiting
+ * for company. A frame that does not fit in a segment ends the batch and is
+ * sent after it on its own.
+ */
+static void tunBatchTxOnce(interface_t *iface, tun_batch_t *tb, uchar *buf)
+{
+    uchar *seg = buf;
+    gpacket_t *inpkt, *big = NULL;
+    tun_frame_hdr_t hdr;
+    int len = 0, seglen = 0, nsegs = 1, nframes = 0, pkt_size = 0, inbytes;
+
+    do
+    {
+        if (tunBatchReadQueue(tb->txq, &inpkt, &inbytes) == EXIT_FAILURE)
+            break;
+        pkt_size = findPacketSize(&(inpkt->data));
+        if (sizeof(tun_frame_hdr_t) + pkt_size > tb->seg_size)
+        {
+            big = inpkt;
+            break;
+        }
+        if (seglen + sizeof(tun_frame_hdr_t) + pkt_size > tb->seg_size)
+        {
+            // pad out the segment, a zero header ends it
+            bzero(seg + seglen, tb->seg_size - seglen);
+            len += tb->seg_size - seglen;
+            seg += tb->seg_size;
+            seglen = 0;
+            nsegs++;
+        }
+        hdr.version = TUN_FRAME_VERSION;
+        hdr.flags = 0;
+        hdr.len = htons(pkt_size);
+        memcpy(seg + seglen, &hdr, sizeof(hdr));
+        memcpy(seg + seglen + sizeof(hdr), &(inpkt->data), pkt_size);
+        seglen += sizeof(hdr) + pkt_size;
+        len += sizeof(hdr) + pkt_size;
+        nframes++;
+        free(inpkt);
+    } while ((tb->txq->cursize > 0) && (nframes < TUN_BATCH_MAX_FRAMES) &&
+             ((nsegs < TUN_BATCH_MAX_SEGS) || (seglen + TUN_SEG_MAX <= tb->seg_size)));
+
+    if (nframes > 0)
+    {
+        tb->tx_frames += nframes;
+        verbose(2, "[tunBatchTxHandler]:: sending %d frames in %d segments on interface %d ", nframes, nsegs, iface->interface_id);
+        tun_sendmsg_batch(iface->vpl_data, tb, buf, len, nsegs);
+    }
+    if (big != NULL)
+    {
+        // the batch is out, so the buffer is free for the lone frame
+        hdr.version = TUN_FRAME_VERSION;
+        hdr.flags = 0;
+        hdr.len = htons(pkt_size);
+        memcpy(buf, &hdr, sizeof(hdr));
+        memcpy(buf + sizeof(hdr), &(big->data), pkt_size);
+        free(big);
+        tb->tx_frames++;
+        tb->tx_calls++;
+        tun_sendto(iface->vpl_data, buf, sizeof(hdr) + pkt_size);
+    }
+}
+
+
+/*
+ * Transmit thread of a batched interface, sending one batch after another
+ * (see tunBatchTxOnce).
+ *
+ * Cancellation is deferred: tun_disable_batch() cancels the thread while it
+ * waits in readQueue() and the cleanup handlers release the queue lock that
+ * pthread_cond_wait() takes back, and the buffer.
+ */
+static void *tunBatchTxHandler(void *arg)
+{
+    interface_t *iface = (interface_t *) arg;
+    tun_batch_t *tb = tun_batch[iface->interface_id];
+    uchar *buf;
+
+    if ((buf = (uchar *)malloc(TUN_BATCH_MAX_SEGS * TUN_SEG_MAX)) == NULL)
+    {
+        fatal("[tunBatchTxHandler]:: unable to allocate batch buffer.. ");
+        return NULL;
+    }
+    pthread_cleanup_push(free, buf);
+    while (1)
+        tunBatchTxOnce(iface, tb, buf);
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+
+/*
+ * Split one segment into frames and hand each one to the receive path.
+ */
+static void tunSplitSegment(interface_t *iface, tun_batch_t *tb, uchar *seg, int seglen)
+{
+    tun_frame_hdr_t hdr;
+    gpacket_t *in_pkt;
+    int off = 0, flen;
+
+    while (off + (int)sizeof(hdr) <= seglen)
+    {
+        memcpy(&hdr, seg + off, sizeof(hdr));
+        flen = ntohs(hdr.len);
+        if (flen == 0)
+            return;                                 // padding
+        if ((hdr.version != TUN_FRAME_VERSION) || (flen > sizeof(pkt_data_t)) ||
+            (off + (int)sizeof(hdr) + flen > seglen))
+        {
+            verbose(2, "[tunSplitSegment]:: malformed frame header, dropping rest of segment ");
+            tb->rx_errors++;
+            return;
+        }
+        off += sizeof(hdr);
+
+        if ((in_pkt = (gpacket_t *)malloc(sizeof(gpacket_t))) == NULL)
+        {
+            fatal("[fromTunDev]:: unable to allocate memory for packet.. ");
+            return;
+        }
+        bzero(in_pkt, sizeof(gpacket_t));
+        memcpy(&(in_pkt->data), seg + off, flen);
+        off += flen;
+        tb->rx_frames++;
+        tunDeliverPacket(iface, in_pkt, flen);
+    }
+}
+
+
+/*
+ * Receive loop of a batched interface: up to TUN_RX_VLEN datagrams per
+ * recvmmsg(), each of which may carry several GRO coalesced segments.
+ */
+static void *fromTunBatchDev(interface_t *iface, tun_batch_t *tb)
+{
+    vpl_data_t *vpl = iface->vpl_data;
+    struct sockaddr_in* dstaddr = (struct sockaddr_in*)vpl->data_addr;
+    struct mmsghdr msgs[TUN_RX_VLEN];
+    struct iovec iovs[TUN_RX_VLEN];
+    struct sockaddr_in rcvaddr[TUN_RX_VLEN];
+    char ctrl[TUN_RX_VLEN][CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cm;
+    uchar *bufs;
+    int i, n, off, len, seg_size;
+
+    if ((bufs = (uchar *)malloc(TUN_RX_VLEN * TUN_RX_BUF_SIZE)) == NULL)
+    {
+        fatal("[fromTunDev]:: unable to allocate receive buffers.. ");
+        return NULL;
+    }
+
+    while (1)
+    {
+        bzero(msgs, sizeof(msgs));
+        for (i = 0; i < TUN_RX_VLEN; i++)
+        {
+            iovs[i].iov_base = bufs + i * TUN_RX_BUF_SIZE;
+            iovs[i].iov_len = TUN_RX_BUF_SIZE;
+            msgs[i].msg_hdr.msg_name = &rcvaddr[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(rcvaddr[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = ctrl[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+        }
+
+        verbose(2, "[fromTunDev]:: Receiving a batch ...");
+        n = recvmmsg(vpl->data, msgs, TUN_RX_VLEN, MSG_WAITFORONE, NULL);
+        pthread_testcancel();
+        if (n == -1)
+        {
+            verbose(2, "[fromTunDev]:: unable to receive batch, error = %s", strerror(errno));
+            continue;
+        }
+        tb->rx_calls++;
+
+        for (i = 0; i < n; i++)
+        {
+            if ((rcvaddr[i].sin_addr.s_addr != dstaddr->sin_addr.s_addr) ||
+                (rcvaddr[i].sin_port != dstaddr->sin_port))
+            {
+                verbose(2, "[fromTunDev]:: source IP or port does not match interface router");
+                continue;
+            }
+
+            len = msgs[i].msg_len;
+            seg_size = len;
+            for (cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm != NULL; cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm))
+                if ((cm->cmsg_level == SOL_UDP) && (cm->cmsg_type == UDP_GRO))
+                    memcpy(&seg_size, CMSG_DATA(cm), sizeof(int));
+            if (seg_size <= 0)
+                seg_size = len;
+
+            for (off = 0; off < len; off += seg_size)
+                tunSplitSegment(iface, tb, bufs + i * TUN_RX_BUF_SIZE + off,
+                                ((len - off) < seg_size) ? (len - off) : seg_size);
+        }
+    }
+}
+
+
+/*
+ * MTU of the route to the peer. IP_MTU needs a connected socket and the
+ * tunnel socket is not connected, so ask a scratch socket.
+ */
+static int tun_path_mtu(vpl_data_t *vpl)
+{
+    struct sockaddr_in* dstaddr = (struct sockaddr_in*)vpl->data_addr;
+    socklen_t optlen = sizeof(int);
+    int fd, mtu = TUN_DEFAULT_PATH_MTU;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        return mtu;
+    if ((connect(fd, (struct sockaddr *)dstaddr, sizeof(*dstaddr)) == -1) ||
+        (getsockopt(fd, IPPROTO_IP, IP_MTU, &mtu, &optlen) == -1))
+        mtu = TUN_DEFAULT_PATH_MTU;
+    close(fd);
+    return mtu;
+}
+
+
+/*
+ * Switch a tun interface to batched mode. Must be called before the
+ * interface is brought up; both ends of the tunnel have to agree.
+ */
+int tun_enable_batch(interface_t *iface)
+{
+    vpl_data_t *vpl = iface->vpl_data;
+    tun_batch_t *tb;
+    int on = 1;
+    int seg;                                        // the socket option is an int, the cmsg a u16
+
+    if ((tb = (tun_batch_t *)malloc(sizeof(tun_batch_t))) == NULL)
+    {
+        error("[tun_enable_batch]:: unable to allocate batch state ");
+        return EXIT_FAILURE;
+    }
+    bzero(tb, sizeof(tun_batch_t));
+
+    tb->seg_size = tun_path_mtu(vpl) - TUN_UDP_OVERHEAD;
+    if (tb->seg_size > TUN_SEG_MAX)
+        tb->seg_size = TUN_SEG_MAX;
+    if (tb->seg_size < TUN_SEG_MIN)
+        tb->seg_size = TUN_SEG_MIN;
+    seg = tb->seg_size;
+
+    // probe segmentation offload; segments still work without it
+    tb->gso = (setsockopt(vpl->data, SOL_UDP, UDP_SEGMENT, &seg, sizeof(seg)) == 0);
+    if (tb->gso)
+    {
+        seg = 0;
+        setsockopt(vpl->data, SOL_UDP, UDP_SEGMENT, &seg, sizeof(seg));
+    }
+    tb->gro = (setsockopt(vpl->data, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0);
+    verbose(2, "[tun_enable_batch]:: interface %d batching, %d byte segments, GSO %s, GRO %s ", iface->interface_id,
+            tb->seg_size, tb->gso ? "on" : "off", tb->gro ? "on" : "off");
+
+    tb->txq = createSimpleQueue("tun batch queue", TUN_BATCH_QSIZE, 0, 1);
+    tun_batch[iface->interface_id] = tb;
+
+    if (pthread_create(&(tb->txthread), NULL, tunBatchTxHandler, (void *)iface) != 0)
+    {
+        error("[tun_enable_batch]:: unable to start transmit thread ");
+        tun_batch[iface->interface_id] = NULL;
+        destroySimpleQueue(tb->txq);
+        free(tb);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/*
+ * Stop batching on a tun interface that is being destroyed, after its
+ * receive thread has been cancelled: wait for the receive thread, which
+ * counts into the batch state, stop the transmit thread and free the
+ * packets it had not sent yet and the batch state, so a later interface
+ * with the same ID starts afresh.
+ */
+void tun_disable_batch(interface_t *iface)
+{
+    tun_batch_t *tb = tun_batch[iface->interface_id];
+    gpacket_t *inpkt;
+    int inbytes;
+
+    if (tb == NULL)
+        return;
+    tun_batch[iface->interface_id] = NULL;
+
+    if (iface->state == INTERFACE_UP)
+        pthread_join(iface->threadid, NULL);
+    pthread_cancel(tb->txthread);
+    pthread_join(tb->txthread, NULL);
+    while ((tb->txq->cursize > 0) && (readQueue(tb->txq, (void **)&inpkt, &inbytes) == EXIT_SUCCESS))
+        free(inpkt);
+    destroySimpleQueue(tb->txq);
+    free(tb);
+}
@@ -5,6 +5,7 @@
  */
 
 #include "grouter.h"
+#include "logging.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
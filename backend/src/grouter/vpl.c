@@ -13,6 +13,7 @@
 
 #include "grouter.h"
 #include "vpl.h"
+#include "console.h"
 #include "simplequeue.h"
 #include <string.h>
 #include <stdlib.h>
@@ -23,16 +24,13 @@
 #include <slack/fio.h>
 #include <sys/stat.h>
 #include "gpcap.h"
+#include "logging.h"
 
 /*
  * Some global variables! These global variables are used for visualizing the
  * packets. For wireshark and graphing tool interfaces. May be we need to find
  * a better structure.. so global variables can be removed?
  */
-int consoleid;                        // FIFO id
-char consolepath[MAX_NAME_LEN];
-pthread_t console_threadid;
-simplequeue_t *consoleq;
 int infoid;
 char infopath[MAX_NAME_LEN];
 pthread_t info_threadid;
@@ -334,7 +332,7 @@ int vpl_recvfrom(vpl_data_t *vpl, void *buf, int len)
                 return(-errno);
         }
         else if(n == 0) return(-ENOTCONN);
-		copy2Queue(consoleq, buf, n);
+        CONSOLE_CAPTURE(buf, n);
         return(n);
 }
 
@@ -343,7 +341,7 @@ int vpl_sendto(vpl_data_t *vpl, void *buf, int len)
 {
 	struct sockaddr_un *data_addr = vpl->data_addr;
 
-	copy2Queue(consoleq, buf, len);
+	CONSOLE_CAPTURE(buf, len);
 	return(__vpl_sendto(vpl->data, buf, len, data_addr, sizeof(*data_addr)));
 }
 
@@ -7,6 +7,7 @@
 #include "packetcore.h"
 #include "message.h"
 #include "grouter.h"
+#include "logging.h"
 
 // WCWeightedFairScheduler: is one part of the W+FQ scheduler.
 // It picks the appropriate job from the system of queues.
@@ -63,6 +64,7 @@ void *weightedFairScheduler(void *pc)
 		{
 			thisq = map_get(pcore->queues, savekey);
 			readQueue(thisq, (void **)&in_pkt, &pktsize);
+			LATENCY_STAMP(in_pkt, LAT_SCHED);
 			writeQueue(pcore->workQ, in_pkt, pktsize);
 			pthread_mutex_lock(&(pcore->qlock));
 			pcore->packetcnt--;
@@ -0,0 +1,244 @@
+/*
+ * grstat.c (reader for the gRouter shared memory statistics page)
+ *
+ * Maps <config dir>/<router name>.stats read-only and prints it, including
+ * the drop counts by interface and reason. With -w the page is read every
+ * given number of milliseconds and the packet and queue drop rates since
+ * the previous read are printed instead of the totals.
+ *
+ * usage: grstat [-w ms] [-n count] statsfile
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "statspage.h"
+
+
+#define GRSTAT_SNAPSHOT_TRIES           1000
+
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [-w ms] [-n count] statsfile\n", prog);
+	exit(1);
+}
+
+
+static stats_page_t *mapPage(char *path)
+{
+	struct stat sb;
+	void *addr;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+	{
+		perror(path);
+		return NULL;
+	}
+	if ((fstat(fd, &sb) < 0) || (sb.st_size < (off_t)STATS_PAGE_BODY))
+	{
+		fprintf(stderr, "%s: not a gRouter statistics page\n", path);
+		close(fd);
+		return NULL;
+	}
+	addr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+	{
+		perror("mmap");
+		return NULL;
+	}
+	if (((stats_page_t *)addr)->magic != STATS_PAGE_MAGIC)
+	{
+		fprintf(stderr, "%s: bad magic, not a gRouter statistics page\n", path);
+		return NULL;
+	}
+	// pages written by an older router are shorter; this reader needs them all
+	if ((((stats_page_t *)addr)->version < STATS_PAGE_VERSION) ||
+	    (sb.st_size < (off_t)sizeof(stats_page_t)))
+	{
+		fprintf(stderr, "%s: page version %u is older than %d\n", path,
+			((stats_page_t *)addr)->version, STATS_PAGE_VERSION);
+		return NULL;
+	}
+	return (stats_page_t *)addr;
+}
+
+
+static char *ipString(char *buf, uint8_t *ip)
+{
+	sprintf(buf, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+	return buf;
+}
+
+
+static void printTotals(stats_page_t *s)
+{
+	char ipbuf[32];
+	stats_queue_t *q;
+	uint64_t *counts;
+	int i, r;
+
+	printf("router %s (pid %d), update %llu every %u ms\n", s->router_name, s->pid,
+	       (unsigned long long)s->updates, s->interval_ms);
+
+	printf("\n%-8s %-3s %-15s %12s %14s %12s %14s\n", "iface", "st", "address",
+	       "rx pkts", "rx bytes", "tx pkts", "tx bytes");
+	for (i = 0; i < s->num_ifaces; i++)
+		printf("%-8s %-3c %-15s %12llu %14llu %12llu %14llu\n", s->ifaces[i].name,
+		       s->ifaces[i].state, ipString(ipbuf, s->ifaces[i].ip_addr),
+		       (unsigned long long)s->ifaces[i].rx_pkts, (unsigned long long)s->ifaces[i].rx_bytes,
+		       (unsigned long long)s->ifaces[i].tx_pkts, (unsigned long long)s->ifaces[i].tx_bytes);
+
+	printf("\n%-24s %6s %6s %12s %12s %9s %9s %9s %9s\n", "queue", "depth", "max",
+	       "enq pkts", "deq pkts", "taildrop", "reddrop", "avg (us)", "max (us)");
+	for (i = 0; i < s->num_queues; i++)
+	{
+		q = &(s->queues[i]);
+		printf("%-24s %6d %6d %12llu %12llu %9llu %9llu %9.2f %9.2f\n", q->name, q->depth,
+		       q->maxdepth, (unsigned long long)q->enq_pkts, (unsigned long long)q->deq_pkts,
+		       (unsigned long long)q->taildrops, (unsigned long long)q->reddrops,
+		       q->sojourn_avg_ns / 1e3, q->sojourn_max_ns / 1e3);
+	}
+
+	printf("\nroutes %u/%u, arp %u/%u, arp cache %u/%u, classes %u, filter rules %u/%u\n",
+	       s->tables.routes, s->tables.max_routes, s->tables.arp_entries,
+	       s->tables.max_arp_entries, s->tables.arp_cache_entries, s->tables.arp_cache_size,
+	       s->tables.classes, s->tables.filter_rules, s->tables.max_filter_rules);
+	if (s->openflow.enabled)
+		printf("openflow flows %u/%u, lookups %llu, matched %llu\n", s->openflow.active_flows,
+		       s->openflow.max_flows, (unsigned long long)s->openflow.lookups,
+		       (unsigned long long)s->openflow.matched);
+
+	// only the reasons that dropped something, "-" for packets of the router itself
+	printf("\n%-8s %-24s %12s\n", "iface", "drop reason", "packets");
+	for (i = 0; i <= s->num_ifaces; i++)
+	{
+		counts = (i < s->num_ifaces) ? s->drops.ifaces[i] : s->drops.local;
+		for (r = 0; (r < s->drops.num_reasons) && (r < STATS_DROP_REASONS); r++)
+			if (counts[r] != 0)
+				printf("%-8s %-24s %12llu\n", (i < s->num_ifaces) ? s->ifaces[i].name : "-",
+				       s->drops.reasons[r], (unsigned long long)counts[r]);
+	}
+}
+
+
+// rates between two snapshots; interfaces and queues are matched by name
+static void printRates(stats_page_t *p, stats_page_t *s)
+{
+	double secs = (s->update_ns - p->update_ns) / 1e9;
+	stats_queue_t *q, *pq;
+	int i, j;
+
+	if (secs <= 0)
+		return;
+
+	printf("%-8s %10s %10s %10s %10s |", "iface", "rx kpps", "rx Mbps", "tx kpps", "tx Mbps");
+	printf(" %-24s %10s %10s %10s\n", "queue", "enq kpps", "deq kpps", "drops/s");
+	for (i = 0; (i < s->num_ifaces) || (i < s->num_queues); i++)
+	{
+		if (i < s->num_ifaces)
+		{
+			for (j = 0; j < p->num_ifaces; j++)
+				if (!strcmp(p->ifaces[j].name, s->ifaces[i].name))
+					break;
+			if (j < p->num_ifaces)
+				printf("%-8s %10.2f %10.2f %10.2f %10.2f |", s->ifaces[i].name,
+				       (s->ifaces[i].rx_pkts - p->ifaces[j].rx_pkts) / secs / 1e3,
+				       (s->ifaces[i].rx_bytes - p->ifaces[j].rx_bytes) * 8 / secs / 1e6,
+				       (s->ifaces[i].tx_pkts - p->ifaces[j].tx_pkts) / secs / 1e3,
+				       (s->ifaces[i].tx_bytes - p->ifaces[j].tx_bytes) * 8 / secs / 1e6);
+			else
+				printf("%-8s %10s %10s %10s %10s |", s->ifaces[i].name, "-", "-", "-", "-");
+		} else
+			printf("%-8s %10s %10s %10s %10s |", "", "", "", "", "");
+
+		if (i < s->num_queues)
+		{
+			q = &(s->queues[i]);
+			for (j = 0; j < p->num_queues; j++)
+				if (!strcmp(p->queues[j].name, q->name))
+					break;
+			pq = (j < p->num_queues) ? &(p->queues[j]) : q;
+			printf(" %-24s %10.2f %10.2f %10.2f", q->name,
+			       (q->enq_pkts - pq->enq_pkts) / secs / 1e3,
+			       (q->deq_pkts - pq->deq_pkts) / secs / 1e3,
+			       (q->taildrops + q->reddrops - pq->taildrops - pq->reddrops) / secs);
+		}
+		printf("\n");
+	}
+	printf("\n");
+}
+
+
+int main(int ac, char *av[])
+{
+	stats_page_t *page, *snap, *prev, *tmp;
+	struct timespec delay;
+	int opt, watch_ms = 0, count = 0, n;
+
+	while ((opt = getopt(ac, av, "w:n:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'w':
+			watch_ms = atoi(optarg);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		default:
+			usage(av[0]);
+		}
+	}
+	if (optind != ac - 1)
+		usage(av[0]);
+
+	if ((page = mapPage(av[optind])) == NULL)
+		return 1;
+	snap = malloc(sizeof(stats_page_t));
+	prev = malloc(sizeof(stats_page_t));
+	if ((snap == NULL) || (prev == NULL))
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	if (statsPageSnapshot(page, snap, GRSTAT_SNAPSHOT_TRIES) < 0)
+	{
+		fprintf(stderr, "%s: page is busy, is the router writing it in a loop?\n", av[optind]);
+		return 1;
+	}
+	if (watch_ms <= 0)
+	{
+		printTotals(snap);
+		return 0;
+	}
+
+	delay.tv_sec = watch_ms / 1000;
+	delay.tv_nsec = (watch_ms % 1000) * 1000000L;
+	for (n = 0; (count == 0) || (n < count); n++)
+	{
+		tmp = prev;
+		prev = snap;
+		snap = tmp;
+		nanosleep(&delay, NULL);
+		if (statsPageSnapshot(page, snap, GRSTAT_SNAPSHOT_TRIES) < 0)
+		{
+			snap = prev;            // keep the last good snapshot as the base
+			prev = tmp;
+			continue;
+		}
+		if (snap->updates == prev->updates)
+			fprintf(stderr, "no update from the router in the last %d ms\n", watch_ms);
+		printRates(prev, snap);
+	}
+	return 0;
+}
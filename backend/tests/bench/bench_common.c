@@ -0,0 +1,247 @@
+/*
+ * bench_common.c (helpers shared by the gRouter benchmarks)
+ */
+
+#include "bench_common.h"
+#include "packetcore.h"
+#include "classifier.h"
+#include "filter.h"
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Global objects defined in grouter.c, which is not linked into the benchmarks.
+router_config rconfig = {
+	.router_name="bench", .gini_home=NULL, .cli_flag=0, .config_file=NULL,
+	.config_dir=NULL, .openflow=0, .ghandler=0, .clihandler= 0, .scheduler=0,
+	.worker=0, .openflow_worker=0, .openflow_controller_iface=0,
+	.openflow_flowtable_timeout=0, .schedcycle=0
+};
+pktcore_t *pcore;
+classlist_t *classifier;
+filtertab_t *filter;
+
+
+#define BENCH_JSON_MAX_DEPTH            8
+
+static int json_depth;
+static int json_first[BENCH_JSON_MAX_DEPTH];
+static int perf_fd[2] = {-1, -1};
+
+
+uint64_t benchNow()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+int benchHaveTSC()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+
+/*
+ * Returns the time stamp counter where there is one; elsewhere the
+ * monotonic clock in ns, so that benchCyclesPerNs() is 1.
+ */
+uint64_t benchCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return benchNow();
+#endif
+}
+
+
+double benchCyclesPerNs()
+{
+	static double ratio = 0;
+	uint64_t t0, c0, t1, c1;
+
+	if (ratio > 0)
+		return ratio;
+	if (!benchHaveTSC())
+		return (ratio = 1.0);
+
+	t0 = benchNow();
+	c0 = benchCycles();
+	usleep(50000);
+	t1 = benchNow();
+	c1 = benchCycles();
+	ratio = (double)(c1 - c0) / (double)(t1 - t0);
+	return ratio;
+}
+
+
+static int benchPerfCounter(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/*
+ * Opens the cache miss counters for the calling thread. Returns 0 when
+ * perf_event_open is not permitted here (containers, perf_event_paranoid),
+ * in which case the benchmarks report the counts as null.
+ */
+int benchPerfOpen()
+{
+	perf_fd[0] = benchPerfCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	perf_fd[1] = benchPerfCounter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	return perf_fd[0] >= 0;
+}
+
+
+void benchPerfStart()
+{
+	int i;
+
+	for (i = 0; i < 2; i++)
+		if (perf_fd[i] >= 0)
+		{
+			ioctl(perf_fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(perf_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+}
+
+
+// stops the counters; returns 0 if there are no counters to read
+int benchPerfRead(uint64_t *cache_misses, uint64_t *l1d_misses)
+{
+	uint64_t *out[2] = {cache_misses, l1d_misses};
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		*out[i] = 0;
+		if (perf_fd[i] < 0)
+			continue;
+		ioctl(perf_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(perf_fd[i], out[i], sizeof(uint64_t)) != sizeof(uint64_t))
+			*out[i] = 0;
+	}
+	return perf_fd[0] >= 0;
+}
+
+
+static int benchCompareU64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+void benchSortU64(uint64_t *vals, long count)
+{
+	qsort(vals, count, sizeof(uint64_t), benchCompareU64);
+}
+
+
+// nearest-rank percentile of an already sorted array, pct in [0, 100]
+uint64_t benchPercentile(uint64_t *sorted, long count, double pct)
+{
+	long rank;
+
+	if (count <= 0)
+		return 0;
+	rank = (long)(pct / 100.0 * count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > count)
+		rank = count;
+	return sorted[rank - 1];
+}
+
+
+static void benchJSONKey(FILE *fp, char *key)
+{
+	fprintf(fp, "%s\n%*s\"%s\": ", json_first[json_depth] ? "" : ",", json_depth * 2, "", key);
+	json_first[json_depth] = 0;
+}
+
+
+void benchJSONBegin(FILE *fp)
+{
+	json_depth = 1;
+	json_first[json_depth] = 1;
+	fprintf(fp, "{");
+}
+
+
+void benchJSONSection(FILE *fp, char *name)
+{
+	benchJSONKey(fp, name);
+	fprintf(fp, "{");
+	if (json_depth < BENCH_JSON_MAX_DEPTH - 1)
+		json_depth++;
+	json_first[json_depth] = 1;
+}
+
+
+void benchJSONSectionEnd(FILE *fp)
+{
+	json_depth--;
+	fprintf(fp, "\n%*s}", json_depth * 2, "");
+}
+
+
+void benchJSONInt(FILE *fp, char *key, long long val)
+{
+	benchJSONKey(fp, key);
+	fprintf(fp, "%lld", val);
+}
+
+
+void benchJSONDouble(FILE *fp, char *key, double val)
+{
+	benchJSONKey(fp, key);
+	fprintf(fp, "%.3f", val);
+}
+
+
+void benchJSONString(FILE *fp, char *key, char *val)
+{
+	benchJSONKey(fp, key);
+	fprintf(fp, "\"%s\"", val);
+}
+
+
+void benchJSONNull(FILE *fp, char *key)
+{
+	benchJSONKey(fp, key);
+	fprintf(fp, "null");
+}
+
+
+void benchJSONEnd(FILE *fp)
+{
+	fprintf(fp, "\n}\n");
+	fflush(fp);
+}
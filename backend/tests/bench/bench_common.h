@@ -0,0 +1,41 @@
+/*
+ * bench_common.h (helpers shared by the gRouter benchmarks)
+ *
+ * The benchmarks link the same grouter objects as the unit tests, so the
+ * globals normally defined in grouter.c are provided by bench_common.c.
+ * Results are printed as JSON, one key per line, so that runs from two
+ * releases can be compared with diff.
+ */
+
+#ifndef __BENCH_COMMON_H__
+#define __BENCH_COMMON_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+
+#define BENCH_FORMAT_VERSION            1
+
+
+uint64_t benchNow();
+uint64_t benchCycles();
+double benchCyclesPerNs();
+int benchHaveTSC();
+
+int benchPerfOpen();
+void benchPerfStart();
+int benchPerfRead(uint64_t *cache_misses, uint64_t *l1d_misses);
+
+void benchSortU64(uint64_t *vals, long count);
+uint64_t benchPercentile(uint64_t *sorted, long count, double pct);
+
+void benchJSONBegin(FILE *fp);
+void benchJSONSection(FILE *fp, char *name);
+void benchJSONSectionEnd(FILE *fp);
+void benchJSONInt(FILE *fp, char *key, long long val);
+void benchJSONDouble(FILE *fp, char *key, double val);
+void benchJSONString(FILE *fp, char *key, char *val);
+void benchJSONNull(FILE *fp, char *key);
+void benchJSONEnd(FILE *fp);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * flowmod_bench.c (flow table install benchmark)
+ *
+ * Times openflow_flowtable_modify the way a controller drives it when it
+ * connects and pushes its flows: N flows are added one flow_mod at a
+ * time, with and without OFPFF_CHECK_OVERLAP, then modified, deleted and
+ * deleted strictly one at a time. Flow i matches IP packets to 10.x.y.1
+ * where x.y = i, so the flows never overlap and every flow_mod touches a
+ * single entry. Results give the total time and ns per flow_mod as JSON.
+ *
+ * usage: flowmod_bench [-flows N]
+ */
+
+#include "bench_common.h"
+#include "openflow_flowtable.h"
+#include "protocols.h"
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <slack/std.h>
+#include <slack/err.h>
+#include <slack/prog.h>
+
+#define BENCH_DEFAULT_FLOWS             100000
+
+typedef struct _flowmod_bench_t
+{
+	char *name;
+	uint16_t command;
+	uint16_t flags;
+} flowmod_bench_t;
+
+static flowmod_bench_t benches[] = {
+	{"add", OFPFC_ADD, 0},
+	{"modify_strict", OFPFC_MODIFY_STRICT, 0},
+	{"modify", OFPFC_MODIFY, 0},
+	{"delete_strict", OFPFC_DELETE_STRICT, 0},
+	{"add_check_overlap", OFPFC_ADD, OFPFF_CHECK_OVERLAP},
+	{"delete", OFPFC_DELETE, 0},
+	{NULL}
+};
+
+static struct
+{
+	ofp_flow_mod mod;
+	ofp_action_output output;
+} flow;
+
+
+static void benchFlow(long i, uint16_t command, uint16_t flags)
+{
+	memset(&flow, 0, sizeof(flow));
+	flow.mod.header.length = htons(sizeof(flow));
+	flow.mod.command = htons(command);
+	flow.mod.flags = htons(flags);
+	flow.mod.match.wildcards = htonl(OFPFW_ALL & ~OFPFW_DL_TYPE & ~OFPFW_NW_DST_MASK);
+	flow.mod.match.dl_type = htons(IP_PROTOCOL);
+	flow.mod.match.nw_dst = htonl(((10 + (i >> 16)) << 24) | ((i & 0xFFFF) << 8) | 1);
+	flow.mod.out_port = htons(OFPP_NONE);
+	flow.mod.buffer_id = htonl(-1);
+	flow.mod.priority = htons(OFP_DEFAULT_PRIORITY);
+	flow.output.type = htons(OFPAT_OUTPUT);
+	flow.output.len = htons(sizeof(ofp_action_output));
+	flow.output.port = htons(1 + (i & 3));
+}
+
+
+static void benchRun(flowmod_bench_t *fb, long flows)
+{
+	uint16_t error_type, error_code;
+	uint64_t start, elapsed;
+	long i, failed = 0;
+
+	start = benchNow();
+	for (i = 0; i < flows; i++)
+	{
+		benchFlow(i, fb->command, fb->flags);
+		if (openflow_flowtable_modify(&flow.mod, 0, &error_type, &error_code) != 0)
+			failed++;
+	}
+	elapsed = benchNow() - start;
+
+	benchJSONSection(stdout, fb->name);
+	benchJSONInt(stdout, "flows", flows);
+	benchJSONInt(stdout, "failed", failed);
+	benchJSONDouble(stdout, "total_ms", elapsed / 1e6);
+	benchJSONDouble(stdout, "ns_per_flow_mod", (double)elapsed / flows);
+	benchJSONSectionEnd(stdout);
+}
+
+
+int main(int ac, char *av[])
+{
+	long flows = BENCH_DEFAULT_FLOWS;
+	int i;
+
+	for (i = 1; i + 1 < ac; i += 2)
+	{
+		if (!strcmp(av[i], "-flows"))
+			flows = atol(av[i + 1]);
+	}
+	if ((i < ac) || (flows < 1) || (flows >= 65536L * 16))
+	{
+		fprintf(stderr, "usage: %s [-flows N]\n", av[0]);
+		exit(1);
+	}
+
+	prog_set_verbosity_level(0);
+	openflow_flowtable_init();
+	// room for the flows next to the default entry
+	if (openflow_flowtable_set_max_entries(0, flows + 1) < 0)
+	{
+		fprintf(stderr, "%s: cannot size the flow table for %ld flows\n", av[0], flows);
+		exit(1);
+	}
+
+	benchJSONBegin(stdout);
+	benchJSONString(stdout, "bench", "flowmod");
+	benchJSONInt(stdout, "format", BENCH_FORMAT_VERSION);
+	for (i = 0; benches[i].name != NULL; i++)
+		benchRun(&benches[i], flows);
+	benchJSONEnd(stdout);
+	openflow_flowtable_release();
+	exit(0);
+}
@@ -0,0 +1,629 @@
+/*
+ * grouter_bench.c (forwarding path benchmark)
+ *
+ * Builds a two interface router whose devices are socketpairs, then
+ * pushes UDP frames through the complete forwarding path:
+ *
+ *     socketpair -> fromdev -> enqueuePacket -> roundRobinScheduler
+ *                -> packetProcessor (IP) -> outputQ -> GNETHandler
+ *                -> todev -> socketpair
+ *
+ * Every frame carries its send time, so the sink measures the end to end
+ * latency. The CPU time of each router thread gives the per stage cost.
+ * The number of queues (classes), filter rules and routes and the queue
+ * size are configurable so the effect of each table on the fast path can
+ * be measured; results are printed as JSON.
+ *
+ * With -openflow N the router is an OpenFlow switch instead, with N workers
+ * and a flow per destination that outputs to eth1:
+ *
+ *     socketpair -> fromdev -> enqueuePacket -> openflowPacketProcessor x N
+ *                -> outputQ -> GNETHandler -> todev -> socketpair
+ *
+ * The worker stage is then the CPU time of all the workers together; use
+ * -flows to give the flow hash something to spread over the workers.
+ *
+ * usage: grouter_bench [-n packets] [-warmup packets] [-size bytes] [-window N]
+ *                      [-flows N] [-qsize slots] [-classes N] [-filters N]
+ *                      [-routes N] [-schedcycle us] [-openflow workers]
+ *                      [-label text]
+ */
+
+#include "bench_common.h"
+#include "packetcore.h"
+#include "classifier.h"
+#include "classspec.h"
+#include "filter.h"
+#include "protocols.h"
+#include "ethernet.h"
+#include "routetable.h"
+#include "mtu.h"
+#include "gnet.h"
+#include "arp.h"
+#include "ip.h"
+#include "udp.h"
+#include "clock.h"
+#include "openflow_config.h"
+#include "openflow_flowtable.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <slack/std.h>
+#include <slack/err.h>
+#include <slack/prog.h>
+
+#define BENCH_IN_IFACE                  0
+#define BENCH_OUT_IFACE                 1
+#define BENCH_STALL_NS                  1000000000ULL
+
+extern pktcore_t *pcore;
+extern classlist_t *classifier;
+extern filtertab_t *filter;
+extern router_config rconfig;
+
+typedef struct _bench_stamp_t
+{
+	uint64_t seq;
+	uint64_t sent;                      // benchNow() when written to the device
+} bench_stamp_t;
+
+typedef struct _bench_config_t
+{
+	long packets;
+	long warmup;
+	int size;
+	int window;
+	int flows;
+	int qsize;
+	int classes;
+	int filters;
+	int routes;
+	int schedcycle;
+	int openflow;                       // OpenFlow workers, 0 for the IP path
+	char *label;
+} bench_config_t;
+
+static bench_config_t cfg = {
+	.packets = 1000000, .warmup = 10000, .size = 64, .window = 64, .flows = 1,
+	.qsize = 0, .classes = 0, .filters = 0, .routes = 0, .schedcycle = 0,
+	.openflow = 0, .label = ""
+};
+
+// packet accounting: injected by main, dropped by fromdev, delivered by the sink
+static volatile uint64_t injected, dropped, delivered, lost;
+// frames that arrived after a later frame of the same flow
+static uint64_t reordered;
+static uint64_t *flow_last;
+static uint64_t *latency;
+static volatile long record_from = -1;
+
+static int peer_fd[2];                  // bench side of each interface socketpair
+static device_t bench_driver;
+
+
+static uint64_t inFlight()
+{
+	return __atomic_load_n(&injected, __ATOMIC_ACQUIRE) - __atomic_load_n(&dropped, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(&delivered, __ATOMIC_ACQUIRE) - lost;
+}
+
+
+void *toBenchDev(void *arg)
+{
+	gpacket_t *pkt = (gpacket_t *)arg;
+	interface_t *iface;
+
+	if ((iface = findInterface(pkt->frame.dst_interface)) != NULL)
+		send(iface->iface_fd, &(pkt->data), findPacketSize(&(pkt->data)), 0);
+	free(pkt);
+	return NULL;
+}
+
+
+void *fromBenchDev(void *arg)
+{
+	interface_t *iface = (interface_t *)arg;
+	gpacket_t *in_pkt;
+
+	while (1)
+	{
+		if ((in_pkt = (gpacket_t *)malloc(sizeof(gpacket_t))) == NULL)
+		{
+			fatal("[fromBenchDev]:: unable to allocate memory for packet.. ");
+			return NULL;
+		}
+		bzero(in_pkt, sizeof(gpacket_t));
+		if (recv(iface->iface_fd, &(in_pkt->data), sizeof(pkt_data_t), 0) <= 0)
+		{
+			free(in_pkt);
+			return NULL;
+		}
+		in_pkt->frame.src_interface = iface->interface_id;
+		COPY_MAC(in_pkt->frame.src_hw_addr, iface->mac_addr);
+		COPY_IP(in_pkt->frame.src_ip_addr, iface->ip_addr);
+		parsePacket(in_pkt);
+
+		if (enqueuePacket(pcore, in_pkt, sizeof(gpacket_t), cfg.openflow > 0) == EXIT_FAILURE)
+			__atomic_add_fetch(&dropped, 1, __ATOMIC_RELEASE);
+	}
+}
+
+
+static void *benchSink(void *arg)
+{
+	pkt_data_t frame;
+	bench_stamp_t stamp;
+	int offset = sizeof(frame.header) + sizeof(ip_packet_t) + sizeof(udp_packet_type);
+	uint64_t now, n;
+
+	while (recv(peer_fd[BENCH_OUT_IFACE], &frame, sizeof(frame), 0) > 0)
+	{
+		now = benchNow();
+		memcpy(&stamp, (uchar *)&frame + offset, sizeof(stamp));
+		n = __atomic_load_n(&delivered, __ATOMIC_RELAXED);
+		if ((record_from >= 0) && (stamp.seq >= record_from))
+			latency[stamp.seq - record_from] = now - stamp.sent;
+		if (stamp.seq + 1 < flow_last[stamp.seq % cfg.flows])
+			reordered++;
+		else
+			flow_last[stamp.seq % cfg.flows] = stamp.seq + 1;
+		__atomic_store_n(&delivered, n + 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+
+static interface_t *benchMakeInterface(int id, char *ip, char *mac)
+{
+	interface_t *iface;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+	{
+		fatal("[benchMakeInterface]:: unable to create socketpair %s ", strerror(errno));
+		exit(1);
+	}
+	iface = (interface_t *)malloc(sizeof(interface_t));
+	bzero(iface, sizeof(interface_t));
+	iface->interface_id = id;
+	iface->state = INTERFACE_UP;
+	iface->mode = IFACE_CLIENT_MODE;
+	sprintf(iface->device_name, "eth%d", id);
+	strcpy(iface->device_type, "bench");
+	Colon2MAC(mac, iface->mac_addr);
+	Dot2IP(ip, iface->ip_addr);
+	iface->device_mtu = DEFAULT_MTU;
+	iface->iface_fd = sv[0];
+	iface->devdriver = &bench_driver;
+	peer_fd[id] = sv[1];
+
+	GNETInsertInterface(iface);
+	addMTUEntry(MTU_tbl, id, iface->device_mtu, iface->ip_addr);
+	return iface;
+}
+
+
+/*
+ * Extra classes get a queue each and a source spec that never matches,
+ * so tagPacket and the scheduler walk all of them; filter rules deny
+ * traffic from other networks, so filteredPacket checks every rule.
+ */
+static void benchMakeTables()
+{
+	char name[MAX_DNAME_LEN], tmpbuf[MAX_TMPBUF_LEN];
+	uchar net[4], mask[4], nhop[4];
+	ip_spec_t *ips;
+	int i;
+
+	for (i = 0; i < cfg.classes + cfg.filters; i++)
+	{
+		sprintf(name, (i < cfg.classes) ? "bclass%d" : "bfilter%d", i);
+		addClassDef(classifier, name);
+		ips = (ip_spec_t *)malloc(sizeof(ip_spec_t));
+		sprintf(tmpbuf, "192.168.%d.0", i);
+		Dot2IP(tmpbuf, ips->ip_addr);
+		ips->preflen = 24;
+		insertIPSpec(classifier, name, 1, ips);
+		if (i < cfg.classes)
+			addPktCoreQueue(pcore, name, "taildrop", 1.0, 0.0, cfg.qsize);
+		else
+			addFilterRule(filter, 0, name);
+	}
+
+	// the bench traffic goes to 10.2.0.0/16 through 10.0.1.2 on eth1
+	Dot2IP("10.2.0.0", net);
+	Dot2IP("255.255.0.0", mask);
+	Dot2IP("10.0.1.2", nhop);
+	for (i = 0; i < cfg.routes; i++)
+	{
+		uchar fnet[4], fmask[4], fhop[4] = {0, 0, 0, 0};
+		sprintf(tmpbuf, "172.%d.%d.0", 16 + i / 256, i % 256);
+		Dot2IP(tmpbuf, fnet);
+		Dot2IP("255.255.255.0", fmask);
+		addRouteEntry(route_tbl, fnet, fmask, fhop, BENCH_IN_IFACE);
+	}
+	addRouteEntry(route_tbl, net, mask, nhop, BENCH_OUT_IFACE);
+}
+
+
+static int benchBuildFrame(pkt_data_t *frame, interface_t *in)
+{
+	ip_packet_t *ip_pkt = (ip_packet_t *)frame->data;
+	udp_packet_type *udp = (udp_packet_type *)((uchar *)ip_pkt + sizeof(ip_packet_t));
+	uchar bench_mac[6] = {0x02, 0xbe, 0x00, 0x00, 0x00, 0x01};
+	uchar addr[4];
+	int iplen = cfg.size - sizeof(frame->header);
+
+	bzero(frame, sizeof(pkt_data_t));
+	COPY_MAC(frame->header.dst, in->mac_addr);
+	COPY_MAC(frame->header.src, bench_mac);
+	frame->header.prot = htons(IP_PROTOCOL);
+
+	ip_pkt->ip_version = 4;
+	ip_pkt->ip_hdr_len = 5;
+	ip_pkt->ip_pkt_len = htons(iplen);
+	ip_pkt->ip_ttl = 64;
+	ip_pkt->ip_prot = UDP_PROTOCOL;
+	Dot2IP("10.1.0.1", addr);
+	COPY_IP(ip_pkt->ip_src, gHtonl(addr, addr));
+
+	udp->src_port = htons(1024);
+	udp->dst_port = htons(9);
+	udp->length = htons(iplen - sizeof(ip_packet_t));
+	return cfg.size;
+}
+
+
+/*
+ * Installs a flow for each bench destination that outputs to eth1, as a
+ * controller that learned the destinations would.
+ */
+static void benchMakeFlows()
+{
+	struct
+	{
+		ofp_flow_mod mod;
+		ofp_action_output output;
+	} flow;
+	uint16_t error_type, error_code;
+	int f;
+
+	if (openflow_flowtable_set_max_entries(0, cfg.flows + 1) < 0)
+	{
+		fatal("[benchMakeFlows]:: unable to size the flow table for %d flows ", cfg.flows);
+		exit(1);
+	}
+	for (f = 0; f < cfg.flows; f++)
+	{
+		bzero(&flow, sizeof(flow));
+		flow.mod.header.length = htons(sizeof(flow));
+		flow.mod.command = htons(OFPFC_ADD);
+		flow.mod.match.wildcards = htonl(OFPFW_ALL & ~OFPFW_DL_TYPE & ~OFPFW_NW_DST_MASK);
+		flow.mod.match.dl_type = htons(IP_PROTOCOL);
+		flow.mod.match.nw_dst = htonl((10 << 24) | (2 << 16) | (((f >> 8) & 0xFF) << 8) | ((f & 0xFF) + 1));
+		flow.mod.out_port = htons(OFPP_NONE);
+		flow.mod.buffer_id = htonl(-1);
+		flow.mod.priority = htons(OFP_DEFAULT_PRIORITY);
+		flow.output.type = htons(OFPAT_OUTPUT);
+		flow.output.len = htons(sizeof(ofp_action_output));
+		flow.output.port = htons(openflow_config_get_of_port_num(BENCH_OUT_IFACE));
+		openflow_flowtable_modify(&flow.mod, 0, &error_type, &error_code);
+	}
+}
+
+
+// sets the destination of flow f and refreshes the IP checksum
+static void benchSetFlow(pkt_data_t *frame, int f)
+{
+	ip_packet_t *ip_pkt = (ip_packet_t *)frame->data;
+	char tmpbuf[MAX_TMPBUF_LEN];
+	uchar addr[4];
+
+	sprintf(tmpbuf, "10.2.%d.%d", (f >> 8) & 0xFF, (f & 0xFF) + 1);
+	Dot2IP(tmpbuf, addr);
+	COPY_IP(ip_pkt->ip_dst, gHtonl(addr, addr));
+	ip_pkt->ip_cksum = 0;
+	ip_pkt->ip_cksum = htons(checksum((uchar *)ip_pkt, ip_pkt->ip_hdr_len * 2));
+}
+
+
+/*
+ * Sends count frames numbered from seq, keeping at most cfg.window of
+ * them inside the router, and waits until all are delivered or dropped.
+ * Frames that disappear without a trace are counted as lost after the
+ * router makes no progress for BENCH_STALL_NS.
+ */
+static void benchRun(pkt_data_t *frames, uint64_t seq, long count)
+{
+	int offset = sizeof(frames[0].header) + sizeof(ip_packet_t) + sizeof(udp_packet_type);
+	uint64_t last_progress = benchNow(), last_done = 0, done;
+	bench_stamp_t stamp;
+	pkt_data_t *frame;
+	long i = 0;
+
+	while (1)
+	{
+		if ((i < count) && (inFlight() < cfg.window))
+		{
+			frame = &frames[(seq + i) % cfg.flows];
+			stamp.seq = seq + i;
+			stamp.sent = benchNow();
+			memcpy((uchar *)frame + offset, &stamp, sizeof(stamp));
+			__atomic_add_fetch(&injected, 1, __ATOMIC_RELEASE);
+			send(peer_fd[BENCH_IN_IFACE], frame, cfg.size, 0);
+			i++;
+			continue;
+		}
+		if ((i == count) && (inFlight() == 0))
+			break;
+
+		done = delivered + dropped;
+		if (done != last_done)
+		{
+			last_done = done;
+			last_progress = benchNow();
+		} else if (benchNow() - last_progress > BENCH_STALL_NS)
+		{
+			lost += inFlight();
+			last_progress = benchNow();
+		}
+		sched_yield();
+	}
+}
+
+
+static uint64_t threadCPU(pthread_t tid)
+{
+	clockid_t cid;
+	struct timespec ts;
+
+	if ((tid == 0) || (pthread_getcpuclockid(tid, &cid) != 0) || (clock_gettime(cid, &ts) != 0))
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+// CPU time of a stage; the worker stage counts every OpenFlow worker
+static uint64_t stageCPU(pthread_t *tids, int stage)
+{
+	uint64_t cpu = 0;
+	int i;
+
+	if ((stage != 2) || (cfg.openflow == 0))
+		return threadCPU(tids[stage]);
+	for (i = 0; i < pcore->openflowworkers; i++)
+		cpu += threadCPU(pcore->openflowworker[i]);
+	return cpu;
+}
+
+
+static int benchParseArgs(int ac, char *av[])
+{
+	int i;
+
+	for (i = 1; i < ac; i++)
+	{
+		if ((i + 1 >= ac) || (av[i][0] != '-'))
+			return EXIT_FAILURE;
+		if (!strcmp(av[i], "-n"))
+			cfg.packets = atol(av[++i]);
+		else if (!strcmp(av[i], "-warmup"))
+			cfg.warmup = atol(av[++i]);
+		else if (!strcmp(av[i], "-size"))
+			cfg.size = atoi(av[++i]);
+		else if (!strcmp(av[i], "-window"))
+			cfg.window = atoi(av[++i]);
+		else if (!strcmp(av[i], "-flows"))
+			cfg.flows = atoi(av[++i]);
+		else if (!strcmp(av[i], "-qsize"))
+			cfg.qsize = atoi(av[++i]);
+		else if (!strcmp(av[i], "-classes"))
+			cfg.classes = atoi(av[++i]);
+		else if (!strcmp(av[i], "-filters"))
+			cfg.filters = atoi(av[++i]);
+		else if (!strcmp(av[i], "-routes"))
+			cfg.routes = atoi(av[++i]);
+		else if (!strcmp(av[i], "-schedcycle"))
+			cfg.schedcycle = atoi(av[++i]);
+		else if (!strcmp(av[i], "-openflow"))
+			cfg.openflow = atoi(av[++i]);
+		else if (!strcmp(av[i], "-label"))
+			cfg.label = av[++i];
+		else
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+// clamps a table size to the static limits of the router
+static int benchClamp(char *what, int val, int max)
+{
+	if (val > max)
+	{
+		fprintf(stderr, "grouter_bench: %s limited to %d by the router tables\n", what, max);
+		return max;
+	}
+	return (val < 0) ? 0 : val;
+}
+
+
+int main(int ac, char *av[])
+{
+	simplequeue_t *outputQ, *workQ, *openflowWorkQ = NULL;
+	pthread_t fromdev, sink;
+	interface_t *in;
+	pkt_data_t *frames;
+	uchar gw_ip[4], gw_mac[6];
+	char confdir[] = "/tmp/grouter_benchXXXXXX", tmpbuf[MAX_NAME_LEN];
+	uint64_t start, elapsed, cstart, cycles, cpu0[4], cpu1[4], total_cpu = 0;
+	char *stages[] = {"fromdev", "scheduler", "worker", "gnet"};
+	pthread_t tids[4];
+	double cpns;
+	int i;
+
+	if (benchParseArgs(ac, av) == EXIT_FAILURE)
+	{
+		fprintf(stderr, "usage: %s [-n packets] [-warmup packets] [-size bytes] [-window N] [-flows N]\n"
+			"       [-qsize slots] [-classes N] [-filters N] [-routes N] [-schedcycle us]\n"
+			"       [-openflow workers] [-label text]\n", av[0]);
+		exit(1);
+	}
+	cfg.size = benchClamp("frame size", cfg.size, sizeof(((pkt_data_t *)0)->header) + DEFAULT_MTU);
+	if (cfg.size < (int)(sizeof(((pkt_data_t *)0)->header) + sizeof(ip_packet_t) + sizeof(udp_packet_type) + sizeof(bench_stamp_t)))
+		cfg.size = sizeof(((pkt_data_t *)0)->header) + sizeof(ip_packet_t) + sizeof(udp_packet_type) + sizeof(bench_stamp_t);
+	cfg.qsize = benchClamp("queue size", cfg.qsize, MAX_QUEUE_SIZE);
+	cfg.classes = benchClamp("classes", cfg.classes, MAX_QUEUE_NUM - 1);
+	cfg.filters = benchClamp("filter rules", cfg.filters, MAX_FILTER_RULES);
+	cfg.routes = benchClamp("routes", cfg.routes, MAX_ROUTES - 1);
+	cfg.flows = (cfg.flows < 1) ? 1 : benchClamp("flows", cfg.flows, 65536);
+	cfg.openflow = benchClamp("OpenFlow workers", cfg.openflow, MAX_OPENFLOW_WORKERS);
+	rconfig.openflow = (cfg.openflow > 0);
+	if (cfg.window < 1)
+		cfg.window = 1;
+	rconfig.schedcycle = cfg.schedcycle;
+	prog_set_verbosity_level(1);
+
+	if (mkdtemp(confdir) == NULL)
+	{
+		fatal("[main]:: unable to create %s ", confdir);
+		exit(1);
+	}
+	rconfig.config_dir = confdir;
+
+	// the same start up sequence as grouter.c
+	clockInit(CLOCK_DEFAULT_RESOLUTION_US);
+	outputQ = createSimpleQueue("outputQueue", INFINITE_Q_SIZE, 0, 1);
+	workQ = createSimpleQueue("work Queue", INFINITE_Q_SIZE, 0, 1);
+	if (cfg.openflow)
+		openflowWorkQ = createSimpleQueue("Work queue for OpenFlow", INFINITE_Q_SIZE, 0, 1);
+	GNETInit(&(rconfig.ghandler), rconfig.config_dir, rconfig.router_name, outputQ);
+	ARPInit();
+	IPInit();
+	classifier = createClassifier();
+	filter = createFilter(classifier, 0);
+	pcore = createPacketCore(rconfig.router_name, outputQ, workQ, openflowWorkQ);
+	addPktCoreQueue(pcore, "default", "taildrop", 1.0, 0.0, cfg.qsize);
+
+	strcpy(bench_driver.devname, "bench");
+	strcpy(bench_driver.devdesc, "socketpair benchmark device");
+	bench_driver.fromdev = fromBenchDev;
+	bench_driver.todev = toBenchDev;
+	in = benchMakeInterface(BENCH_IN_IFACE, "10.1.0.254", "02:be:00:00:01:00");
+	benchMakeInterface(BENCH_OUT_IFACE, "10.0.1.1", "02:be:00:00:01:01");
+	benchMakeTables();
+	Dot2IP("10.0.1.2", gw_ip);
+	Colon2MAC("02:be:00:00:02:01", gw_mac);
+	putARPCache(gw_ip, gw_mac);
+
+	pthread_create(&(rconfig.scheduler), NULL, roundRobinScheduler, (void *)pcore);
+	pthread_create(&(rconfig.worker), NULL, packetProcessor, (void *)pcore);
+	if (cfg.openflow)
+	{
+		PktCoreOpenflowWorkerInit(pcore, cfg.openflow);
+		openflow_config_init_phy_ports();
+		benchMakeFlows();
+	}
+	pthread_create(&fromdev, NULL, fromBenchDev, (void *)in);
+	in->threadid = fromdev;
+	flow_last = (uint64_t *)calloc(cfg.flows, sizeof(uint64_t));
+	pthread_create(&sink, NULL, benchSink, NULL);
+
+	frames = (pkt_data_t *)malloc(cfg.flows * sizeof(pkt_data_t));
+	latency = (uint64_t *)calloc(cfg.packets > 0 ? cfg.packets : 1, sizeof(uint64_t));
+	for (i = 0; i < cfg.flows; i++)
+	{
+		benchBuildFrame(&frames[i], in);
+		benchSetFlow(&frames[i], i);
+	}
+	cpns = benchCyclesPerNs();
+
+	benchRun(frames, 0, cfg.warmup);
+	injected = dropped = delivered = lost = reordered = 0;
+
+	tids[0] = fromdev;
+	tids[1] = rconfig.scheduler;
+	tids[2] = rconfig.worker;
+	tids[3] = rconfig.ghandler;
+	for (i = 0; i < 4; i++)
+		cpu0[i] = stageCPU(tids, i);
+	record_from = cfg.warmup;
+	start = benchNow();
+	cstart = benchCycles();
+	benchRun(frames, cfg.warmup, cfg.packets);
+	cycles = benchCycles() - cstart;
+	elapsed = benchNow() - start;
+	for (i = 0; i < 4; i++)
+		cpu1[i] = stageCPU(tids, i);
+
+	// frames that were dropped or lost leave a zero hole at the front after sorting
+	benchSortU64(latency, cfg.packets);
+	long nlat = delivered, skip = cfg.packets - delivered;
+
+	benchJSONBegin(stdout);
+	benchJSONString(stdout, "bench", "grouter");
+	benchJSONInt(stdout, "format", BENCH_FORMAT_VERSION);
+	benchJSONString(stdout, "label", cfg.label);
+	benchJSONSection(stdout, "config");
+	benchJSONInt(stdout, "packets", cfg.packets);
+	benchJSONInt(stdout, "warmup", cfg.warmup);
+	benchJSONInt(stdout, "frame_size", cfg.size);
+	benchJSONInt(stdout, "window", cfg.window);
+	benchJSONInt(stdout, "flows", cfg.flows);
+	benchJSONInt(stdout, "queue_size", cfg.qsize ? cfg.qsize : MAX_QUEUE_SIZE);
+	benchJSONInt(stdout, "classes", cfg.classes);
+	benchJSONInt(stdout, "filter_rules", cfg.filters);
+	benchJSONInt(stdout, "routes", cfg.routes + 1);
+	benchJSONInt(stdout, "schedcycle_us", cfg.schedcycle);
+	benchJSONInt(stdout, "openflow_workers", cfg.openflow);
+	benchJSONString(stdout, "cycle_source", benchHaveTSC() ? "tsc" : "ns");
+	benchJSONSectionEnd(stdout);
+
+	benchJSONSection(stdout, "packets");
+	benchJSONInt(stdout, "injected", injected);
+	benchJSONInt(stdout, "delivered", delivered);
+	benchJSONInt(stdout, "dropped", dropped);
+	benchJSONInt(stdout, "lost", lost);
+	benchJSONInt(stdout, "reordered", reordered);
+	benchJSONSectionEnd(stdout);
+
+	benchJSONDouble(stdout, "elapsed_s", elapsed / 1e9);
+	benchJSONDouble(stdout, "mpps", elapsed ? delivered * 1e3 / elapsed : 0);
+	benchJSONDouble(stdout, "mbps", elapsed ? delivered * cfg.size * 8e3 / elapsed : 0);
+	benchJSONDouble(stdout, "wall_cycles_per_pkt", delivered ? (double)cycles / delivered : 0);
+
+	benchJSONSection(stdout, "stages");
+	for (i = 0; i < 4; i++)
+	{
+		uint64_t cpu = cpu1[i] - cpu0[i];
+		total_cpu += cpu;
+		benchJSONSection(stdout, stages[i]);
+		benchJSONDouble(stdout, "cpu_ns_per_pkt", delivered ? (double)cpu / delivered : 0);
+		benchJSONDouble(stdout, "cycles_per_pkt", delivered ? cpu * cpns / delivered : 0);
+		benchJSONDouble(stdout, "utilization", elapsed ? (double)cpu / elapsed : 0);
+		benchJSONSectionEnd(stdout);
+	}
+	benchJSONSectionEnd(stdout);
+	benchJSONDouble(stdout, "cycles_per_pkt", delivered ? total_cpu * cpns / delivered : 0);
+
+	benchJSONSection(stdout, "latency_ns");
+	benchJSONInt(stdout, "samples", nlat);
+	benchJSONInt(stdout, "min", nlat ? latency[skip] : 0);
+	benchJSONInt(stdout, "p50", benchPercentile(latency + skip, nlat, 50.0));
+	benchJSONInt(stdout, "p99", benchPercentile(latency + skip, nlat, 99.0));
+	benchJSONInt(stdout, "p999", benchPercentile(latency + skip, nlat, 99.9));
+	benchJSONInt(stdout, "max", nlat ? latency[cfg.packets - 1] : 0);
+	benchJSONSectionEnd(stdout);
+	benchJSONEnd(stdout);
+
+	sprintf(tmpbuf, "%s/%s.port", confdir, rconfig.router_name);
+	remove(tmpbuf);
+	rmdir(confdir);
+	exit(0);
+}
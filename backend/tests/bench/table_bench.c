@@ -0,0 +1,489 @@
+/*
+ * table_bench.c (lookup table microbenchmarks)
+ *
+ * Times the per packet lookups of the router one at a time, outside of
+ * the threads and queues of the forwarding path:
+ *
+ *     findRouteEntry, ARPFindEntry, lookupARPCache, tagPacket,
+ *     filteredPacket, openflow_flowtable_get_entry_for_packet,
+ *     checksum and a writeQueue/readQueue pair
+ *
+ * Each table is filled to 10, 100, ... 1M entries (capped at what the
+ * table can hold, the cap itself is also measured) and looked up with a
+ * uniform and a Zipf (s = 0.99) key distribution. The results give ns/op
+ * and, where perf_event_open is permitted, cache misses per op, as JSON.
+ *
+ * usage: table_bench [-time ms] [-only name]
+ */
+
+#include "bench_common.h"
+#include "packetcore.h"
+#include "classifier.h"
+#include "classspec.h"
+#include "filter.h"
+#include "protocols.h"
+#include "routetable.h"
+#include "simplequeue.h"
+#include "openflow_flowtable.h"
+#include "ethernet.h"
+#include "gnet.h"
+#include "arp.h"
+#include "ip.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <arpa/inet.h>
+#include <slack/std.h>
+#include <slack/err.h>
+#include <slack/prog.h>
+
+#define BENCH_KEYS                      65536           // power of 2
+#define BENCH_ZIPF_S                    0.99
+
+extern pktcore_t *pcore;
+extern classlist_t *classifier;
+extern filtertab_t *filter;
+
+typedef struct _table_bench_t
+{
+	char *name;
+	int (*fill)(int n);                 // fills n entries, returns how many fit
+	void (*lookup)(long key);
+	int keyed;                          // 0 when the key distribution is irrelevant
+	long sizes[8];                      // 0 terminated; default sizes when sizes[0] is 0
+} table_bench_t;
+
+static long keys[BENCH_KEYS];
+static long hits;
+static uint64_t min_time_ns = 200000000ULL;
+static gpacket_t scratch;
+static uchar scratch_buf[2048];
+static simplequeue_t *bench_queue;
+static double *zipf_cdf;
+
+
+/*
+ * Table entry i is 10.x.y.0/24 (routes, classes, flows) or 10.x.y.1
+ * (hosts) where x.y = i, so entries never overlap.
+ */
+static void benchEntryIP(long i, uchar *ip, int host)
+{
+	// host byte order, as Dot2IP leaves it
+	ip[3] = 10 + (i >> 16);
+	ip[2] = (i >> 8) & 0xFF;
+	ip[1] = i & 0xFF;
+	ip[0] = host;
+}
+
+
+static void benchScratchPacket(long key)
+{
+	ip_packet_t *ip_pkt = (ip_packet_t *)scratch.data.data;
+	uchar ip[4];
+
+	benchEntryIP(key, ip, 1);
+	COPY_IP(ip_pkt->ip_src, gHtonl(ip, ip));
+	COPY_IP(ip_pkt->ip_dst, ip_pkt->ip_src);
+}
+
+
+static int fillRoutes(int n)
+{
+	uchar net[4], mask[4], nhop[4] = {0, 0, 0, 0};
+	int i;
+
+	RouteTableInit(route_tbl);
+	Dot2IP("255.255.255.0", mask);
+	for (i = 0; i < n && i < MAX_ROUTES; i++)
+	{
+		benchEntryIP(i, net, 0);
+		addRouteEntry(route_tbl, net, mask, nhop, 0);
+	}
+	return i;
+}
+
+static void lookupRoute(long key)
+{
+	uchar ip[4], nhop[4];
+	int iface;
+
+	benchEntryIP(key, ip, 1);
+	if (findRouteEntry(route_tbl, ip, nhop, &iface) == EXIT_SUCCESS)
+		hits++;
+}
+
+
+static int fillARPTable(int n)
+{
+	uchar ip[4], mac[6] = {0x02, 0, 0, 0, 0, 0};
+	int i;
+
+	ARPInitTable();
+	for (i = 0; i < n && i < MAX_ARP; i++)
+	{
+		benchEntryIP(i, ip, 1);
+		mac[5] = i;
+		ARPAddEntry(ip, mac);
+	}
+	return i;
+}
+
+static void lookupARPTable(long key)
+{
+	uchar ip[4], mac[6];
+
+	benchEntryIP(key, ip, 1);
+	if (ARPFindEntry(ip, mac) == EXIT_SUCCESS)
+		hits++;
+}
+
+
+// the cache is hashed and overwrites on collision, so hits can be below 1
+static int fillARPCache(int n)
+{
+	uchar ip[4], mac[6] = {0x02, 0, 0, 0, 0, 0};
+	int i;
+
+	GNETInitARPCache();
+	for (i = 0; i < n && i < ARP_CACHE_SIZE; i++)
+	{
+		benchEntryIP(i, ip, 1);
+		mac[5] = i;
+		putARPCache(ip, mac);
+	}
+	return i;
+}
+
+static void lookupARPCacheKey(long key)
+{
+	uchar ip[4], mac[6];
+
+	benchEntryIP(key, ip, 1);
+	if (lookupARPCache(ip, mac) == TRUE)
+		hits++;
+}
+
+
+static void benchAddClass(char *cname, long i)
+{
+	ip_spec_t *ips = (ip_spec_t *)malloc(sizeof(ip_spec_t));
+
+	addClassDef(classifier, cname);
+	benchEntryIP(i, ips->ip_addr, 0);
+	ips->preflen = 24;
+	insertIPSpec(classifier, cname, 1, ips);
+}
+
+
+static int fillClasses(int n)
+{
+	char cname[MAX_DNAME_LEN];
+	int i;
+
+	classifier = createClassifier();
+	pcore = createPacketCore("bench", NULL, NULL, NULL);
+	addPktCoreQueue(pcore, "default", "taildrop", 1.0, 0.0, 0);
+	for (i = 0; i < n && i < MAX_QUEUE_NUM - 1; i++)
+	{
+		sprintf(cname, "class%d", i);
+		benchAddClass(cname, i);
+		addPktCoreQueue(pcore, cname, "taildrop", 1.0, 0.0, 0);
+	}
+	return i;
+}
+
+static void lookupClass(long key)
+{
+	benchScratchPacket(key);
+	if (strcmp(tagPacket(pcore, &scratch), "default"))
+		hits++;
+}
+
+
+static int fillFilter(int n)
+{
+	char cname[MAX_DNAME_LEN];
+	int i;
+
+	classifier = createClassifier();
+	filter = createFilter(classifier, 0);
+	for (i = 0; i < n && i < MAX_FILTER_RULES; i++)
+	{
+		sprintf(cname, "rule%d", i);
+		benchAddClass(cname, i);
+		addFilterRule(filter, 0, cname);
+	}
+	return i;
+}
+
+static void lookupFilter(long key)
+{
+	benchScratchPacket(key);
+	if (filteredPacket(filter, &scratch))
+		hits++;
+}
+
+
+static int fillFlowtable(int n)
+{
+	ofp_flow_mod mod;
+	uint16_t error_type, error_code;
+	uchar ip[4];
+	int i;
+
+	openflow_flowtable_release();
+	openflow_flowtable_init();
+	for (i = 0; i < n; i++)
+	{
+		memset(&mod, 0, sizeof(ofp_flow_mod));
+		mod.header.length = htons(sizeof(ofp_flow_mod));
+		mod.command = htons(OFPFC_ADD);
+		mod.match.wildcards = htonl(OFPFW_ALL & ~OFPFW_DL_TYPE & ~OFPFW_NW_DST_MASK);
+		mod.match.dl_type = htons(IP_PROTOCOL);
+		benchEntryIP(i, ip, 1);
+		memcpy(&mod.match.nw_dst, gHtonl(ip, ip), 4);
+		mod.out_port = htons(OFPP_NONE);
+		mod.buffer_id = htonl(-1);
+		mod.priority = htons(OFP_DEFAULT_PRIORITY);
+		if (openflow_flowtable_modify(&mod, 0, &error_type, &error_code) != 0)
+			break;
+	}
+	return i;
+}
+
+static void lookupFlow(long key)
+{
+	const openflow_flowtable_entry_type *entry;
+
+	benchScratchPacket(key);
+	if ((entry = openflow_flowtable_get_entry_for_packet(&scratch,
+						      findPacketSize(&(scratch.data)), 0)) != NULL)
+	{
+		hits++;
+		openflow_flowtable_release_entry(entry);
+	}
+}
+
+
+// for checksum the "entries" are the bytes summed
+static int fillChecksum(int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		scratch_buf[i] = i;
+	return n;
+}
+
+static long checksum_len;
+
+static void lookupChecksum(long key)
+{
+	if (checksum(scratch_buf, checksum_len / 2) != 0)
+		hits++;
+}
+
+
+// for the queue the "entries" are the packets already queued
+static int fillQueue(int n)
+{
+	int i;
+
+	bench_queue = createSimpleQueue("bench", INFINITE_Q_SIZE, 0, 0);
+	for (i = 0; i < n; i++)
+		writeQueue(bench_queue, &scratch, sizeof(gpacket_t));
+	return n;
+}
+
+static void lookupQueue(long key)
+{
+	void *data;
+	int size;
+
+	writeQueue(bench_queue, &scratch, sizeof(gpacket_t));
+	if (readQueue(bench_queue, &data, &size) == EXIT_SUCCESS)
+		hits++;
+}
+
+
+static table_bench_t benches[] = {
+	{"findRouteEntry", fillRoutes, lookupRoute, 1, {0}},
+	{"ARPFindEntry", fillARPTable, lookupARPTable, 1, {0}},
+	{"lookupARPCache", fillARPCache, lookupARPCacheKey, 1, {0}},
+	{"tagPacket", fillClasses, lookupClass, 1, {0}},
+	{"filteredPacket", fillFilter, lookupFilter, 1, {0}},
+	{"openflow_flowtable_get_entry_for_packet", fillFlowtable, lookupFlow, 1, {0}},
+	{"checksum", fillChecksum, lookupChecksum, 0, {20, 64, 576, 1500, 0}},
+	{"writeQueue_readQueue", fillQueue, lookupQueue, 0, {0}},
+	{NULL}
+};
+
+static long default_sizes[] = {10, 100, 1000, 10000, 100000, 1000000, 0};
+
+
+static void benchUniformKeys(long n)
+{
+	long i;
+
+	for (i = 0; i < BENCH_KEYS; i++)
+		keys[i] = random() % n;
+}
+
+
+/*
+ * Zipf keys: rank r is drawn with probability proportional to 1/r^s and
+ * mapped to a random entry, so the hot entries are spread over the table.
+ */
+static void benchZipfKeys(long n)
+{
+	long i, lo, hi, mid, *perm, tmp, j;
+	double sum = 0, u;
+
+	zipf_cdf = (double *)realloc(zipf_cdf, n * sizeof(double));
+	perm = (long *)malloc(n * sizeof(long));
+	for (i = 0; i < n; i++)
+	{
+		sum += 1.0 / pow(i + 1, BENCH_ZIPF_S);
+		zipf_cdf[i] = sum;
+		perm[i] = i;
+	}
+	for (i = n - 1; i > 0; i--)
+	{
+		j = random() % (i + 1);
+		tmp = perm[i];
+		perm[i] = perm[j];
+		perm[j] = tmp;
+	}
+	for (i = 0; i < BENCH_KEYS; i++)
+	{
+		u = (random() / (double)RAND_MAX) * sum;
+		lo = 0;
+		hi = n - 1;
+		while (lo < hi)
+		{
+			mid = (lo + hi) / 2;
+			if (zipf_cdf[mid] < u)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		keys[i] = perm[lo];
+	}
+	free(perm);
+}
+
+
+static void benchMeasure(table_bench_t *tb, char *dist, long entries)
+{
+	char name[MAX_NAME_LEN];
+	uint64_t start, elapsed, cache_misses, l1d_misses;
+	long ops = 0, i;
+	int perf;
+
+	hits = 0;
+	// one untimed pass to warm the caches and the branch predictors
+	for (i = 0; i < BENCH_KEYS / 16; i++)
+		tb->lookup(keys[i]);
+
+	hits = 0;
+	benchPerfStart();
+	start = benchNow();
+	do
+	{
+		for (i = 0; i < 4096; i++, ops++)
+			tb->lookup(keys[ops & (BENCH_KEYS - 1)]);
+		elapsed = benchNow() - start;
+	} while (elapsed < min_time_ns);
+	perf = benchPerfRead(&cache_misses, &l1d_misses);
+
+	sprintf(name, "%s/%s/%ld", tb->name, dist, entries);
+	benchJSONSection(stdout, name);
+	benchJSONInt(stdout, "entries", entries);
+	benchJSONInt(stdout, "ops", ops);
+	benchJSONDouble(stdout, "ns_per_op", (double)elapsed / ops);
+	benchJSONDouble(stdout, "hit_ratio", (double)hits / ops);
+	if (perf)
+	{
+		benchJSONDouble(stdout, "cache_misses_per_op", (double)cache_misses / ops);
+		benchJSONDouble(stdout, "l1d_misses_per_op", (double)l1d_misses / ops);
+	} else
+	{
+		benchJSONNull(stdout, "cache_misses_per_op");
+		benchJSONNull(stdout, "l1d_misses_per_op");
+	}
+	benchJSONSectionEnd(stdout);
+}
+
+
+static void benchRunTable(table_bench_t *tb)
+{
+	long *sizes = tb->sizes[0] ? tb->sizes : default_sizes;
+	long last = -1, n;
+	int i;
+
+	for (i = 0; sizes[i] != 0; i++)
+	{
+		// tables that are full stop growing; measure the full table once
+		n = tb->fill(sizes[i]);
+		if ((n == last) || (n == 0))
+			break;
+		last = n;
+		checksum_len = n;
+		if (tb->keyed)
+		{
+			benchUniformKeys(n);
+			benchMeasure(tb, "uniform", n);
+			benchZipfKeys(n);
+			benchMeasure(tb, "zipf", n);
+		} else
+		{
+			benchUniformKeys(1);
+			benchMeasure(tb, "fixed", n);
+		}
+		if (n < sizes[i])
+			break;
+	}
+}
+
+
+int main(int ac, char *av[])
+{
+	char *only = NULL;
+	int i;
+
+	for (i = 1; i + 1 < ac; i += 2)
+	{
+		if (!strcmp(av[i], "-time"))
+			min_time_ns = atol(av[i + 1]) * 1000000ULL;
+		else if (!strcmp(av[i], "-only"))
+			only = av[i + 1];
+	}
+	if ((i < ac) || (min_time_ns == 0))
+	{
+		fprintf(stderr, "usage: %s [-time ms] [-only name]\n", av[0]);
+		exit(1);
+	}
+
+	prog_set_verbosity_level(0);
+	srandom(1);
+	IPInit();
+	ARPInit();
+	GNETInitARPCache();
+	openflow_flowtable_init();
+	bzero(&scratch, sizeof(gpacket_t));
+	scratch.data.header.prot = htons(IP_PROTOCOL);
+	((ip_packet_t *)scratch.data.data)->ip_version = 4;
+	((ip_packet_t *)scratch.data.data)->ip_hdr_len = 5;
+	((ip_packet_t *)scratch.data.data)->ip_prot = UDP_PROTOCOL;
+
+	benchPerfOpen();
+	benchJSONBegin(stdout);
+	benchJSONString(stdout, "bench", "tables");
+	benchJSONInt(stdout, "format", BENCH_FORMAT_VERSION);
+	benchJSONInt(stdout, "min_time_ms", min_time_ns / 1000000);
+	for (i = 0; benches[i].name != NULL; i++)
+		if ((only == NULL) || strstr(benches[i].name, only))
+			benchRunTable(&benches[i]);
+	benchJSONEnd(stdout);
+	exit(0);
+}
@@ -1,5 +1,8 @@
 #include "openflow_config.h"
 #include "mut.h"
+#include "openflow.h"
+#include <arpa/inet.h>
+#include <stdlib.h>
 #include <stdint.h>
 
 
@@ -40,4 +43,23 @@ for(i=1; i<101; i++){
 }
 TEST_END
 
+TEST_BEGIN("Port flags follow the port config")
+openflow_config_init_phy_ports();
+// No GNET interfaces exist, so every port is down
+CHECK(openflow_config_port_can_send(1, 0) == 0)
+CHECK(openflow_config_port_can_send(0, 0) == 0)
+
+ofp_phy_port *port = openflow_config_get_phy_port(1);
+port->state = 0;
+port->config = htonl(OFPPC_NO_FLOOD);
+openflow_config_set_phy_port(1, port);
+CHECK(openflow_config_port_can_send(1, 0) == 1)
+CHECK(openflow_config_port_can_send(1, 1) == 0)
+
+port->config = htonl(OFPPC_PORT_DOWN);
+openflow_config_set_phy_port(1, port);
+CHECK(openflow_config_port_can_send(1, 0) == 0)
+free(port);
+TEST_END
+
 TESTSUITE_END
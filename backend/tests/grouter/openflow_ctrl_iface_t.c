@@ -0,0 +1,256 @@
+#include "openflow_ctrl_iface.h"
+#include "openflow_flowtable.h"
+#include "protocols.h"
+#include "mut.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+#include "common_def.h"
+
+// A controller on the loopback interface that the switch connects to
+static int32_t mock_listen_fd = -1;
+static int32_t mock_fd = -1;
+
+static int32_t mock_listen(uint16_t *port)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	int32_t one = 1;
+
+	int32_t fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = 0;
+	inet_aton("127.0.0.1", &addr.sin_addr);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+	        || listen(fd, 4) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	getsockname(fd, (struct sockaddr *) &addr, &addr_len);
+	*port = ntohs(addr.sin_port);
+	return fd;
+}
+
+static int32_t mock_accept(int32_t timeout_ms)
+{
+	struct pollfd pfd = { mock_listen_fd, POLLIN, 0 };
+	if (poll(&pfd, 1, timeout_ms) != 1) return -1;
+	return accept(mock_listen_fd, NULL, NULL);
+}
+
+// Reads exactly len bytes; returns 0 on close and -1 on timeout
+static int32_t mock_read(uint8_t *buf, uint32_t len, int32_t timeout_ms)
+{
+	uint32_t done = 0;
+	while (done < len)
+	{
+		struct pollfd pfd = { mock_fd, POLLIN, 0 };
+		if (poll(&pfd, 1, timeout_ms) != 1) return -1;
+		ssize_t ret = recv(mock_fd, buf + done, len - done, 0);
+		if (ret <= 0) return 0;
+		done += ret;
+	}
+	return len;
+}
+
+// Reads messages until one of the given type arrives, answering the echo
+// requests of the switch on the way unless those are what is expected
+static int32_t mock_expect(uint8_t type, uint8_t *buf)
+{
+	while (1)
+	{
+		if (mock_read(buf, sizeof(ofp_header), 2000) <= 0) return -1;
+		ofp_header *msg = (ofp_header *) buf;
+		uint16_t len = ntohs(msg->length);
+		if (len > sizeof(ofp_header)
+		        && mock_read(buf + sizeof(ofp_header),
+		                len - sizeof(ofp_header), 2000) <= 0) return -1;
+		if (msg->type == type) return len;
+		if (msg->type == OFPT_ECHO_REQUEST)
+		{
+			msg->type = OFPT_ECHO_REPLY;
+			send(mock_fd, buf, len, 0);
+		}
+	}
+}
+
+// Waits for the switch to close the connection without answering anything
+static uint8_t mock_wait_close(int32_t timeout_ms)
+{
+	uint8_t buf[256];
+	while (1)
+	{
+		struct pollfd pfd = { mock_fd, POLLIN, 0 };
+		if (poll(&pfd, 1, timeout_ms) != 1) return 0;
+		if (recv(mock_fd, buf, sizeof(buf), 0) <= 0) break;
+	}
+	close(mock_fd);
+	mock_fd = -1;
+	return 1;
+}
+
+static void mock_header(ofp_header *msg, uint8_t type, uint16_t len,
+        uint32_t xid)
+{
+	msg->version = OFP_VERSION;
+	msg->type = type;
+	msg->length = htons(len);
+	msg->xid = htonl(xid);
+}
+
+// Hello and features request written together, as controllers often do
+static int32_t mock_handshake(uint32_t xid, uint8_t *buf)
+{
+	ofp_header out[2];
+	mock_header(&out[0], OFPT_HELLO, sizeof(ofp_header), xid - 1);
+	mock_header(&out[1], OFPT_FEATURES_REQUEST, sizeof(ofp_header), xid);
+	send(mock_fd, out, sizeof(out), 0);
+	return mock_expect(OFPT_FEATURES_REPLY, buf);
+}
+
+static uint8_t buf[65536];
+
+// Adds flows that each match one IP destination and output to port 1
+static void mock_add_flows(uint32_t n)
+{
+	struct
+	{
+		ofp_flow_mod mod;
+		ofp_action_output output;
+	} flow;
+	uint16_t error_type, error_code;
+	uint32_t i;
+
+	for (i = 0; i < n; i++)
+	{
+		memset(&flow, 0, sizeof(flow));
+		flow.mod.header.length = htons(sizeof(flow));
+		flow.mod.command = htons(OFPFC_ADD);
+		flow.mod.match.wildcards = htonl(OFPFW_ALL & ~OFPFW_DL_TYPE
+		        & ~OFPFW_NW_DST_MASK);
+		flow.mod.match.dl_type = htons(IP_PROTOCOL);
+		flow.mod.match.nw_dst = htonl(0x0a000001 + (i << 8));
+		flow.mod.out_port = htons(OFPP_NONE);
+		flow.mod.buffer_id = htonl(-1);
+		flow.mod.priority = htons(OFP_DEFAULT_PRIORITY);
+		flow.output.type = htons(OFPAT_OUTPUT);
+		flow.output.len = htons(sizeof(ofp_action_output));
+		flow.output.port = htons(1);
+		openflow_flowtable_modify(&flow.mod, 0, &error_type, &error_code);
+	}
+}
+
+TESTSUITE_BEGIN
+
+TEST_BEGIN("Controller Handshake")
+	uint16_t port;
+	mock_listen_fd = mock_listen(&port);
+	CHECK(mock_listen_fd >= 0);
+	openflow_flowtable_init();
+	openflow_ctrl_iface_set_echo_interval(200);
+	openflow_ctrl_iface_init(port);
+
+	mock_fd = mock_accept(2000);
+	CHECK(mock_fd >= 0);
+	CHECK(mock_expect(OFPT_HELLO, buf) == sizeof(ofp_hello));
+	CHECK(mock_handshake(0x1234, buf) >= sizeof(ofp_switch_features));
+	CHECK(((ofp_header *) buf)->xid == htonl(0x1234));
+TEST_END
+
+TEST_BEGIN("Controller Message Split Across Reads")
+	uint8_t echo[sizeof(ofp_header) + 4];
+	mock_header((ofp_header *) echo, OFPT_ECHO_REQUEST, sizeof(echo), 77);
+	memcpy(echo + sizeof(ofp_header), "gini", 4);
+	send(mock_fd, echo, 5, 0);
+	usleep(50000);
+	send(mock_fd, echo + 5, sizeof(echo) - 5, 0);
+
+	CHECK(mock_expect(OFPT_ECHO_REPLY, buf) == sizeof(echo));
+	CHECK(((ofp_header *) buf)->xid == htonl(77));
+	CHECK(memcmp(buf + sizeof(ofp_header), "gini", 4) == 0);
+TEST_END
+
+TEST_BEGIN("Controller Echo Timeout")
+	// The switch asks after 200 ms of silence and gives up after 600 ms
+	CHECK(mock_expect(OFPT_ECHO_REQUEST, buf) == sizeof(ofp_header));
+	CHECK(mock_wait_close(2000));
+
+	mock_fd = mock_accept(2000);
+	CHECK(mock_fd >= 0);
+	CHECK(mock_expect(OFPT_HELLO, buf) == sizeof(ofp_hello));
+	CHECK(mock_handshake(0x4321, buf) >= sizeof(ofp_switch_features));
+TEST_END
+
+TEST_BEGIN("Controller Reconnect")
+	openflow_ctrl_iface_reconnect();
+	CHECK(mock_wait_close(1000));
+	mock_fd = mock_accept(1000);
+	CHECK(mock_fd >= 0);
+	CHECK(mock_expect(OFPT_HELLO, buf) == sizeof(ofp_hello));
+TEST_END
+
+TEST_BEGIN("Controller Stats Reply In Parts")
+	CHECK(mock_handshake(0x5678, buf) >= sizeof(ofp_switch_features));
+	CHECK(openflow_flowtable_set_max_entries(0, 2001) == 0);
+	mock_add_flows(2000);
+
+	// A barrier right behind the request is only answered after the reply
+	struct
+	{
+		ofp_stats_request req;
+		ofp_flow_stats_request body;
+		ofp_header barrier;
+	} out;
+	memset(&out, 0, sizeof(out));
+	mock_header(&out.req.header, OFPT_STATS_REQUEST,
+	        sizeof(out.req) + sizeof(out.body), 90);
+	out.req.type = htons(OFPST_FLOW);
+	out.body.match.wildcards = htonl(OFPFW_ALL);
+	out.body.table_id = 0xff;
+	out.body.out_port = htons(OFPP_NONE);
+	mock_header(&out.barrier, OFPT_BARRIER_REQUEST, sizeof(ofp_header), 91);
+	send(mock_fd, &out, sizeof(out), 0);
+
+	uint32_t flows = 0, parts = 0, more = 1;
+	while (more)
+	{
+		int32_t len = mock_expect(OFPT_STATS_REPLY, buf);
+		CHECK(len >= (int32_t) sizeof(ofp_stats_reply));
+		if (len < (int32_t) sizeof(ofp_stats_reply)) break;
+		ofp_stats_reply *reply = (ofp_stats_reply *) buf;
+		CHECK(reply->header.xid == htonl(90));
+		more = ntohs(reply->flags) & OFPSF_REPLY_MORE;
+		uint32_t offset = sizeof(ofp_stats_reply);
+		while (offset < len)
+		{
+			ofp_flow_stats *stats = (ofp_flow_stats *) (buf + offset);
+			CHECK(ntohs(stats->length)
+			        == sizeof(ofp_flow_stats) + sizeof(ofp_action_output));
+			offset += ntohs(stats->length);
+			flows++;
+		}
+		parts++;
+	}
+	// The default entry is in the reply as well
+	CHECK(flows == 2001);
+	CHECK(parts > 1);
+	CHECK(mock_expect(OFPT_BARRIER_REPLY, buf) == sizeof(ofp_header));
+	CHECK(((ofp_header *) buf)->xid == htonl(91));
+
+	// A table stats request has no body
+	mock_header(&out.req.header, OFPT_STATS_REQUEST, sizeof(out.req), 92);
+	out.req.type = htons(OFPST_TABLE);
+	send(mock_fd, &out.req, sizeof(out.req), 0);
+	CHECK(mock_expect(OFPT_STATS_REPLY, buf) == sizeof(ofp_stats_reply)
+	        + OPENFLOW_NUM_TABLES * sizeof(ofp_table_stats));
+TEST_END
+
+TESTSUITE_END
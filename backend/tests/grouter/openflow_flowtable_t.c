@@ -1,13 +1,99 @@
 #include "openflow_flowtable.h"
+#include "openflow_config.h"
+#include "clock.h"
+#include "protocols.h"
 #include "mut.h"
+#include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 
 
 #include "common_def.h"
 
 extern void openflow_flowtable_set_defaults(void);
-extern uint8_t openflow_flowtable_ip_compare(uint32_t ip_1, uint32_t ip_2,
-        uint8_t ip_len);
+
+// Fills in a flow mod without actions for a UDP match
+static void test_flow_mod(ofp_flow_mod *mod, uint16_t command,
+        uint32_t wildcards, uint16_t priority)
+{
+	memset(mod, 0, sizeof(ofp_flow_mod));
+	mod->header.length = htons(sizeof(ofp_flow_mod));
+	mod->command = htons(command);
+	mod->out_port = htons(OFPP_NONE);
+	mod->buffer_id = htonl(-1);
+	mod->priority = htons(priority);
+	mod->match.wildcards = htonl(wildcards);
+	mod->match.dl_type = htons(IP_PROTOCOL);
+	mod->match.nw_proto = UDP_PROTOCOL;
+}
+
+// Makes an untagged UDP packet from 10.0.0.1:1024 on the first port, with
+// its headers already parsed
+static void test_udp_packet(gpacket_t *packet, uint32_t nw_dst,
+        uint16_t tp_dst)
+{
+	memset(packet, 0, sizeof(gpacket_t));
+	packet->frame.meta.valid = 1;
+	packet->frame.meta.flags = PKT_META_IP | PKT_META_L4;
+	packet->frame.meta.vlan = PKT_META_VLAN_NONE;
+	packet->frame.meta.dl_type = IP_PROTOCOL;
+	packet->frame.meta.nw_proto = UDP_PROTOCOL;
+	packet->frame.meta.nw_src = 0x0a000001;
+	packet->frame.meta.nw_dst = nw_dst;
+	packet->frame.meta.tp_src = 1024;
+	packet->frame.meta.tp_dst = tp_dst;
+}
+
+// Looks up the packet and returns the priority of its entry, or -1 if
+// there is none
+static int32_t test_lookup(gpacket_t *packet, uint8_t table_id)
+{
+	const openflow_flowtable_entry_type *entry =
+	        openflow_flowtable_get_entry_for_packet(packet, 64, table_id);
+	int32_t priority = entry != NULL ? ntohs((uint16_t) entry->priority) : -1;
+	openflow_flowtable_release_entry(entry);
+	return priority;
+}
+
+// Lookup threads of the concurrency test, which count their lookups and
+// the entries they get that change before they give them back
+#define TEST_READERS 4
+
+static volatile uint8_t test_readers_stop;
+
+typedef struct
+{
+	uint64_t lookups;
+	uint64_t bad;
+} test_reader_type;
+
+static void *test_reader(void *arg)
+{
+	test_reader_type *reader = arg;
+	gpacket_t packet;
+
+	test_udp_packet(&packet, 0x0a000105, 53);
+	while (!__atomic_load_n(&test_readers_stop, __ATOMIC_ACQUIRE))
+	{
+		const openflow_flowtable_entry_type *entry =
+		        openflow_flowtable_get_entry_for_packet(&packet, 64, 1);
+		__atomic_store_n(&reader->lookups, reader->lookups + 1,
+		        __ATOMIC_RELAXED);
+		if (entry == NULL) continue;
+
+		// Writers have to wait until the entry is given back
+		uint32_t priority = entry->priority;
+		sched_yield();
+		if (!entry->active || entry->table_id != 1
+		        || entry->priority != priority
+		        || ntohs((uint16_t) priority) % 100 != 0)
+		{
+			reader->bad++;
+		}
+		openflow_flowtable_release_entry(entry);
+	}
+	return NULL;
+}
 
 TESTSUITE_BEGIN
 
@@ -23,7 +109,358 @@ TEST_BEGIN("Flowtable Modification")
   mod.header.length = htons(0);
   mod.priority = htons(19);
 
-	openflow_flowtable_modify(&mod, &error_type, &error_code);
+	openflow_flowtable_modify(&mod, 0, &error_type, &error_code);
+	openflow_flowtable_release();
+TEST_END
+
+TEST_BEGIN("Flowtable Size")
+	openflow_flowtable_init();
+	CHECK(openflow_flowtable_get_max_entries(0) == OPENFLOW_DEFAULT_FLOWTABLE_ENTRIES);
+	CHECK(openflow_flowtable_set_max_entries(0, 100000) == 0);
+	CHECK(openflow_flowtable_get_max_entries(0) == 100000);
+	CHECK(openflow_flowtable_set_max_entries(0, 0) < 0);
+	CHECK(openflow_flowtable_set_max_entries(0, OPENFLOW_MAX_FLOWTABLE_ENTRIES + 1) < 0);
+	CHECK(openflow_flowtable_set_max_entries(0, 16) == 0);
+	CHECK(openflow_flowtable_get_max_entries(0) == 16);
+	openflow_flowtable_release();
+TEST_END
+
+TEST_BEGIN("Flowtable Pipeline")
+	openflow_flowtable_init();
+	struct
+	{
+		ofp_flow_mod mod;
+		openflow_nx_action_resubmit_type resubmit;
+	} goto_mod;
+	uint16_t error_code, error_type;
+	memset(&goto_mod, 0, sizeof(goto_mod));
+	goto_mod.mod.header.length = htons(sizeof(goto_mod));
+	goto_mod.mod.command = htons(OFPFC_ADD);
+	goto_mod.mod.match.wildcards = htonl(OFPFW_ALL);
+	goto_mod.mod.out_port = htons(OFPP_NONE);
+	goto_mod.mod.buffer_id = htonl(-1);
+	goto_mod.mod.priority = htons(100);
+	goto_mod.resubmit.type = htons(OFPAT_VENDOR);
+	goto_mod.resubmit.len = htons(sizeof(openflow_nx_action_resubmit_type));
+	goto_mod.resubmit.vendor = htonl(OPENFLOW_NX_VENDOR_ID);
+	goto_mod.resubmit.subtype = htons(OPENFLOW_NXAST_RESUBMIT_TABLE);
+	goto_mod.resubmit.in_port = htons(OFPP_IN_PORT);
+	goto_mod.resubmit.table = 1;
+
+	// A table can only send packets on to a later one
+	CHECK(openflow_flowtable_modify(&goto_mod.mod, 1, &error_type, &error_code) < 0);
+	CHECK(ntohs(error_code) == OFPBAC_BAD_ARGUMENT);
+	CHECK(openflow_flowtable_modify(&goto_mod.mod, 0, &error_type, &error_code) == 0);
+
+	gpacket_t packet;
+	memset(&packet, 0, sizeof(packet));
+	const openflow_flowtable_entry_type *entry =
+	        openflow_flowtable_get_entry_for_packet(&packet, 64, 0);
+	CHECK(entry != NULL && entry->table_id == 0);
+	openflow_flowtable_release_entry(entry);
+	CHECK(openflow_flowtable_get_entry_for_packet(&packet, 64, 1) == NULL);
+	CHECK(openflow_flowtable_get_entry_for_packet(&packet, 64,
+	        OPENFLOW_NUM_TABLES) == NULL);
+
+	ofp_table_stats stats = openflow_flowtable_get_table_stats(1);
+	CHECK(stats.table_id == 1);
+	CHECK(ntohl(stats.active_count) == 0);
+	CHECK(ntohll(stats.lookup_count) == 1);
+
+	CHECK(openflow_flowtable_get_table_miss(1) == OPENFLOW_TABLE_MISS_CONTROLLER);
+	CHECK(openflow_flowtable_set_table_miss(1, OPENFLOW_TABLE_MISS_DROP) == 0);
+	CHECK(openflow_flowtable_get_table_miss(1) == OPENFLOW_TABLE_MISS_DROP);
+	CHECK(openflow_flowtable_set_table_miss(OPENFLOW_NUM_TABLES,
+	        OPENFLOW_TABLE_MISS_DROP) < 0);
+	openflow_flowtable_release();
+TEST_END
+
+TEST_BEGIN("Flowtable Overlap and Modify")
+	openflow_flowtable_init();
+	ofp_flow_mod mod;
+	uint16_t error_code, error_type;
+	memset(&mod, 0, sizeof(ofp_flow_mod));
+	mod.header.length = htons(sizeof(ofp_flow_mod));
+	mod.command = htons(OFPFC_ADD);
+	mod.flags = htons(OFPFF_CHECK_OVERLAP);
+	mod.out_port = htons(OFPP_NONE);
+	mod.buffer_id = htonl(-1);
+	mod.priority = htons(100);
+	mod.match.dl_type = htons(IP_PROTOCOL);
+
+	// 10.1.1.0/24, then 10.1.2.0/24 next to it
+	mod.match.wildcards = htonl(OFPFW_ALL & ~OFPFW_DL_TYPE & ~OFPFW_NW_DST_MASK)
+	        | htonl(8 << OFPFW_NW_DST_SHIFT);
+	mod.match.nw_dst = htonl(0x0a010100);
+	CHECK(openflow_flowtable_modify(&mod, 0, &error_type, &error_code) == 0);
+	mod.match.nw_dst = htonl(0x0a010200);
+	CHECK(openflow_flowtable_modify(&mod, 0, &error_type, &error_code) == 0);
+
+	// 10.1.0.0/16 overlaps both at the same priority only
+	mod.match.wildcards = htonl(OFPFW_ALL & ~OFPFW_DL_TYPE & ~OFPFW_NW_DST_MASK)
+	        | htonl(16 << OFPFW_NW_DST_SHIFT);
+	mod.match.nw_dst = htonl(0x0a010000);
+	CHECK(openflow_flowtable_modify(&mod, 0, &error_type, &error_code) < 0);
+	CHECK(ntohs(error_code) == OFPFMFC_OVERLAP);
+	mod.match.nw_dst = htonl(0x0a020000);
+	CHECK(openflow_flowtable_modify(&mod, 0, &error_type, &error_code) == 0);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(0).active_count) == 4);
+
+	// A modify of 10.0.0.0/8 changes the actions of the three entries, not
+	// their matches, which a strict delete still finds
+	mod.command = htons(OFPFC_MODIFY);
+	mod.flags = 0;
+	mod.match.wildcards = htonl(OFPFW_ALL & ~OFPFW_DL_TYPE & ~OFPFW_NW_DST_MASK)
+	        | htonl(24 << OFPFW_NW_DST_SHIFT);
+	mod.match.nw_dst = htonl(0x0a000000);
+	CHECK(openflow_flowtable_modify(&mod, 0, &error_type, &error_code) == 0);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(0).active_count) == 4);
+	mod.command = htons(OFPFC_DELETE_STRICT);
+	mod.match.wildcards = htonl(OFPFW_ALL & ~OFPFW_DL_TYPE & ~OFPFW_NW_DST_MASK)
+	        | htonl(8 << OFPFW_NW_DST_SHIFT);
+	mod.match.nw_dst = htonl(0x0a010200);
+	CHECK(openflow_flowtable_modify(&mod, 0, &error_type, &error_code) == 0);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(0).active_count) == 3);
+
+	// A delete of 10.1.0.0/16 takes the /24 left in it, not the /16 next to it
+	mod.command = htons(OFPFC_DELETE);
+	mod.match.wildcards = htonl(OFPFW_ALL & ~OFPFW_DL_TYPE & ~OFPFW_NW_DST_MASK)
+	        | htonl(16 << OFPFW_NW_DST_SHIFT);
+	mod.match.nw_dst = htonl(0x0a010000);
+	CHECK(openflow_flowtable_modify(&mod, 0, &error_type, &error_code) == 0);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(0).active_count) == 2);
+	openflow_flowtable_release();
+TEST_END
+
+TEST_BEGIN("Flowtable Lookup")
+	openflow_flowtable_init();
+	ofp_flow_mod mod;
+	gpacket_t packet;
+	uint16_t error_code, error_type;
+
+	// Table 1 starts empty
+	test_udp_packet(&packet, 0x0a000105, 53);
+	CHECK(test_lookup(&packet, 1) == -1);
+
+	// The UDP port tuple is searched first for its priority 900 entry, which
+	// does not match, and its priority 100 entry must not hide the priority
+	// 500 entry of the address tuple
+	test_flow_mod(&mod, OFPFC_ADD, OFPFW_ALL & ~OFPFW_DL_TYPE
+	        & ~OFPFW_NW_PROTO & ~OFPFW_TP_DST, 900);
+	mod.match.tp_dst = htons(80);
+	CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+	mod.priority = htons(100);
+	mod.match.tp_dst = htons(53);
+	CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+	test_flow_mod(&mod, OFPFC_ADD, (OFPFW_ALL & ~OFPFW_DL_TYPE
+	        & ~OFPFW_NW_DST_MASK) | (8 << OFPFW_NW_DST_SHIFT), 500);
+	mod.match.nw_dst = htonl(0x0a000100);
+	CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+
+	CHECK(test_lookup(&packet, 1) == 500);
+	test_udp_packet(&packet, 0x0a090005, 53);
+	CHECK(test_lookup(&packet, 1) == 100);
+	test_udp_packet(&packet, 0x0a090005, 80);
+	CHECK(test_lookup(&packet, 1) == 900);
+	test_udp_packet(&packet, 0x0a090005, 22);
+	CHECK(test_lookup(&packet, 1) == -1);
+
+	// An exact-match entry wins over any wildcard entry, whatever their
+	// priorities
+	test_flow_mod(&mod, OFPFC_ADD, OFPFW_ALL, 1000);
+	CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+	test_udp_packet(&packet, 0x0a000105, 53);
+	CHECK(test_lookup(&packet, 1) == 1000);
+	test_flow_mod(&mod, OFPFC_ADD, 0, 10);
+	mod.match.in_port = htons(openflow_config_get_of_port_num(0));
+	mod.match.dl_vlan = htons(OFP_VLAN_NONE);
+	mod.match.nw_src = htonl(0x0a000001);
+	mod.match.nw_dst = htonl(0x0a000105);
+	mod.match.tp_src = htons(1024);
+	mod.match.tp_dst = htons(53);
+	CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+	CHECK(test_lookup(&packet, 1) == 10);
+	test_udp_packet(&packet, 0x0a000105, 54);
+	CHECK(test_lookup(&packet, 1) == 1000);
+	openflow_flowtable_release();
+TEST_END
+
+TEST_BEGIN("Flowtable Lookup Cache")
+	openflow_flowtable_init();
+	ofp_flow_mod mod;
+	gpacket_t packet;
+	uint16_t error_code, error_type;
+	uint32_t wildcards = (OFPFW_ALL & ~OFPFW_DL_TYPE & ~OFPFW_NW_DST_MASK)
+	        | (8 << OFPFW_NW_DST_SHIFT);
+
+	test_flow_mod(&mod, OFPFC_ADD, wildcards, 100);
+	mod.match.nw_dst = htonl(0x0a000100);
+	CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+	test_udp_packet(&packet, 0x0a000105, 53);
+	CHECK(test_lookup(&packet, 1) == 100);
+	CHECK(test_lookup(&packet, 1) == 100);
+
+	// Every change of the table must be seen by the lookup that follows it,
+	// whatever the cache of this thread holds
+	test_flow_mod(&mod, OFPFC_ADD, OFPFW_ALL & ~OFPFW_DL_TYPE
+	        & ~OFPFW_NW_PROTO & ~OFPFW_TP_DST, 200);
+	mod.match.tp_dst = htons(53);
+	CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+	CHECK(test_lookup(&packet, 1) == 200);
+
+	mod.command = htons(OFPFC_DELETE_STRICT);
+	CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+	CHECK(test_lookup(&packet, 1) == 100);
+
+	// A resize moves the entries, so the result must come from the new ones
+	CHECK(openflow_flowtable_set_max_entries(1,
+	        openflow_flowtable_get_max_entries(1) * 4) == 0);
+	const openflow_flowtable_entry_type *entry =
+	        openflow_flowtable_get_entry_for_packet(&packet, 64, 1);
+	CHECK(entry != NULL && entry->active && entry->table_id == 1
+	        && ntohs((uint16_t) entry->priority) == 100);
+	openflow_flowtable_release_entry(entry);
+
+	test_flow_mod(&mod, OFPFC_DELETE_STRICT, wildcards, 100);
+	mod.match.nw_dst = htonl(0x0a000100);
+	CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+	CHECK(test_lookup(&packet, 1) == -1);
+	openflow_flowtable_release();
+TEST_END
+
+TEST_BEGIN("Flowtable Concurrent Lookups")
+	openflow_flowtable_init();
+	ofp_flow_mod mod;
+	uint16_t error_code, error_type;
+	pthread_t threads[TEST_READERS];
+	test_reader_type readers[TEST_READERS];
+	uint64_t lookups = 0;
+	uint32_t i;
+
+	test_flow_mod(&mod, OFPFC_ADD, OFPFW_ALL, 100);
+	CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+
+	memset(readers, 0, sizeof(readers));
+	test_readers_stop = 0;
+	for (i = 0; i < TEST_READERS; i++)
+	{
+		CHECK(pthread_create(&threads[i], NULL, test_reader, &readers[i]) == 0);
+	}
+
+	for (i = 0; i < TEST_READERS; i++)
+	{
+		while (__atomic_load_n(&readers[i].lookups, __ATOMIC_RELAXED) == 0)
+		{
+			sched_yield();
+		}
+	}
+
+	// Flows the packet matches come and go under the readers, through adds
+	// and both kinds of delete
+	for (i = 0; i < 20000; i++)
+	{
+		test_flow_mod(&mod, OFPFC_ADD, OFPFW_ALL & ~OFPFW_DL_TYPE
+		        & ~OFPFW_NW_PROTO & ~OFPFW_TP_DST, 200);
+		mod.match.tp_dst = htons(53);
+		CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+		test_flow_mod(&mod, OFPFC_ADD, (OFPFW_ALL & ~OFPFW_DL_TYPE
+		        & ~OFPFW_NW_DST_MASK) | (8 << OFPFW_NW_DST_SHIFT),
+		        300 + i % 2 * 100);
+		mod.match.nw_dst = htonl(0x0a000100);
+		CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+
+		test_flow_mod(&mod, OFPFC_DELETE_STRICT, OFPFW_ALL & ~OFPFW_DL_TYPE
+		        & ~OFPFW_NW_PROTO & ~OFPFW_TP_DST, 200);
+		mod.match.tp_dst = htons(53);
+		CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+		test_flow_mod(&mod, OFPFC_DELETE, (OFPFW_ALL & ~OFPFW_DL_TYPE
+		        & ~OFPFW_NW_DST_MASK) | (16 << OFPFW_NW_DST_SHIFT), 0);
+		mod.match.nw_dst = htonl(0x0a000000);
+		CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+		if (i % 64 == 0) sched_yield();
+	}
+
+	__atomic_store_n(&test_readers_stop, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < TEST_READERS; i++)
+	{
+		CHECK(pthread_join(threads[i], NULL) == 0);
+		CHECK(readers[i].lookups > 0);
+		CHECK(readers[i].bad == 0);
+		lookups += readers[i].lookups;
+	}
+
+	ofp_table_stats stats = openflow_flowtable_get_table_stats(1);
+	CHECK(ntohl(stats.active_count) == 1);
+	CHECK(ntohll(stats.lookup_count) == lookups);
+	CHECK(ntohll(stats.matched_count) == lookups);
+	openflow_flowtable_release();
+TEST_END
+
+TEST_BEGIN("Flowtable Timeouts")
+	openflow_flowtable_init();
+	ofp_flow_mod mod;
+	gpacket_t packet;
+	uint16_t error_code, error_type;
+	// Entries are stamped with the clock when they are added, which may be
+	// a second past this
+	time_t start = clockSeconds();
+	struct
+	{
+		uint16_t idle_timeout;
+		uint16_t hard_timeout;
+	} timeouts[] = {
+		{ 10, 0 }, { 0, 20 }, { 0, 300 }, { 400, 0 }, { 30, 500 }, { 0, 0 }
+	};
+	uint32_t i;
+
+	// The longer timeouts are further than one turn of the first level of
+	// the timer wheel, so they go off from the second level
+	for (i = 0; i < sizeof(timeouts) / sizeof(timeouts[0]); i++)
+	{
+		test_flow_mod(&mod, OFPFC_ADD, OFPFW_ALL & ~OFPFW_DL_TYPE
+		        & ~OFPFW_NW_PROTO & ~OFPFW_TP_DST, 100);
+		mod.match.tp_dst = htons(i + 1);
+		mod.idle_timeout = htons(timeouts[i].idle_timeout);
+		mod.hard_timeout = htons(timeouts[i].hard_timeout);
+		CHECK(openflow_flowtable_modify(&mod, 1, &error_type, &error_code) == 0);
+	}
+	CHECK(ntohl(openflow_flowtable_get_table_stats(1).active_count) == 6);
+
+	openflow_flowtable_expire(start + 9);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(1).active_count) == 6);
+	openflow_flowtable_expire(start + 11);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(1).active_count) == 5);
+	test_udp_packet(&packet, 0x0a000105, 1);
+	CHECK(test_lookup(&packet, 1) == -1);
+
+	openflow_flowtable_expire(start + 19);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(1).active_count) == 5);
+	openflow_flowtable_expire(start + 21);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(1).active_count) == 4);
+
+	// An idle timeout goes off before the hard timeout of the same entry
+	openflow_flowtable_expire(start + 29);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(1).active_count) == 4);
+	openflow_flowtable_expire(start + 31);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(1).active_count) == 3);
+
+	openflow_flowtable_expire(start + 299);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(1).active_count) == 3);
+	openflow_flowtable_expire(start + 301);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(1).active_count) == 2);
+
+	// Nothing expires while a stats reply is being read
+	openflow_flowtable_stats_begin();
+	openflow_flowtable_expire(start + 401);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(1).active_count) == 2);
+	openflow_flowtable_stats_end();
+	openflow_flowtable_expire(start + 401);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(1).active_count) == 1);
+
+	openflow_flowtable_expire(start + 100000);
+	CHECK(ntohl(openflow_flowtable_get_table_stats(1).active_count) == 1);
+	test_udp_packet(&packet, 0x0a000105, 6);
+	CHECK(test_lookup(&packet, 1) == 100);
 	openflow_flowtable_release();
 TEST_END
 
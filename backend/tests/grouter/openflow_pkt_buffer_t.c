@@ -0,0 +1,54 @@
+#include "openflow_pkt_buffer.h"
+#include "mut.h"
+#include <stdint.h>
+
+
+#include "common_def.h"
+
+static gpacket_t packet, out;
+
+TESTSUITE_BEGIN
+
+TEST_BEGIN("Packet Buffer Store and Retrieve")
+	openflow_pkt_buffer_init();
+	memset(&packet, 0, sizeof(packet));
+	packet.frame.src_interface = 3;
+	memcpy(packet.data.data, "gini", 4);
+
+	uint32_t id = openflow_pkt_buffer_store(&packet, 64);
+	CHECK(id != OPENFLOW_PKT_BUFFER_NONE);
+	CHECK(openflow_pkt_buffer_retrieve(id, &out) == 0);
+	CHECK(out.frame.src_interface == 3);
+	CHECK(memcmp(out.data.data, "gini", 4) == 0);
+	CHECK(openflow_pkt_buffer_retrieve(id, &out) == OPENFLOW_PKT_BUFFER_ERR_EMPTY);
+TEST_END
+
+TEST_BEGIN("Packet Buffer Pool Full")
+	openflow_pkt_buffer_init();
+	uint32_t i, first = openflow_pkt_buffer_store(&packet, 64);
+	for (i = 1; i < OPENFLOW_PKT_BUFFERS; i++)
+		CHECK(openflow_pkt_buffer_store(&packet, 64) != OPENFLOW_PKT_BUFFER_NONE);
+	CHECK(openflow_pkt_buffer_store(&packet, 64) == OPENFLOW_PKT_BUFFER_NONE);
+
+	// A freed buffer is only reused in turn, and then under a new ID
+	CHECK(openflow_pkt_buffer_retrieve(first, &out) == 0);
+	uint32_t id = openflow_pkt_buffer_store(&packet, 64);
+	CHECK(id != OPENFLOW_PKT_BUFFER_NONE && id != first);
+	CHECK(openflow_pkt_buffer_retrieve(first, &out) == OPENFLOW_PKT_BUFFER_ERR_UNKNOWN);
+TEST_END
+
+TEST_BEGIN("Packet In Rate Limit")
+	openflow_pkt_buffer_init();
+	openflow_pkt_buffer_set_rate(1, 5);
+	uint32_t i, admitted = 0;
+	for (i = 0; i < 20; i++)
+		admitted += openflow_pkt_buffer_admit(2);
+	CHECK(admitted == 5);
+	CHECK(openflow_pkt_buffer_admit(1) == 1);
+
+	openflow_pkt_buffer_set_rate(0, 5);
+	for (i = 0; i < 20; i++)
+		CHECK(openflow_pkt_buffer_admit(2) == 1);
+TEST_END
+
+TESTSUITE_END
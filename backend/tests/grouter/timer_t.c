@@ -0,0 +1,55 @@
+#include "timer.h"
+#include "mut.h"
+#include <stdint.h>
+#include <time.h>
+
+
+#include "common_def.h"
+
+static router_timer_t once, periodic, self;
+static volatile int once_count, periodic_count, self_count;
+
+static void countOnce(void *arg) { once_count++; }
+static void countPeriodic(void *arg) { periodic_count++; }
+
+static void stopSelf(void *arg)
+{
+	if (++self_count == 3)
+		timerStop(&self);
+}
+
+static void sleepMs(int ms)
+{
+	struct timespec delay = {ms / 1000, (ms % 1000) * 1000000L};
+	nanosleep(&delay, NULL);
+}
+
+TESTSUITE_BEGIN
+
+TEST_BEGIN("One Shot Timer")
+	CHECK(timerInit() == EXIT_SUCCESS);
+	timerStart(&once, 20, 0, countOnce, NULL);
+	CHECK(once_count == 0);
+	sleepMs(100);
+	CHECK(once_count == 1);
+	CHECK(once.armed == 0);
+TEST_END
+
+TEST_BEGIN("Periodic Timer Stop")
+	timerStart(&periodic, 10, 10, countPeriodic, NULL);
+	sleepMs(100);
+	timerStop(&periodic);
+	int count = periodic_count;
+	CHECK(count >= 3);
+	sleepMs(50);
+	CHECK(periodic_count == count);
+TEST_END
+
+TEST_BEGIN("Handler Stops Its Own Timer")
+	timerStart(&self, 5, 5, stopSelf, NULL);
+	sleepMs(100);
+	CHECK(self_count == 3);
+	CHECK(self.armed == 0);
+TEST_END
+
+TESTSUITE_END